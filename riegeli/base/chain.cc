@@ -44,14 +44,185 @@ void WritePadding(std::ostream& out, size_t pad) {
   }
 }
 
+// Returns the number of times from must be doubled to reach at least to.
+constexpr size_t NumDoublings(size_t from, size_t to) {
+  return from >= to ? 0 : 1 + NumDoublings(from * 2, to);
+}
+
+// If true, the thread is exiting and its Chain::Block::Cache is destroyed.
+// This is trivially destructible, so unlike the cache itself it remains valid
+// while destructors of other thread-local objects run.
+thread_local bool block_cache_destroyed = false;
+
 }  // namespace
 
+// Memory of internal blocks recently freed by a thread, reused by blocks
+// allocated by the same thread. Chains are created and destroyed at high rates
+// (records, buffers of readers and writers, compressed and decoded chunks), and
+// this avoids the global allocator for most of their blocks.
+//
+// Capacities between kMinBufferSize() and kMaxBufferSize() are rounded up to
+// size classes, kClassesPerPowerOf2 per power of 2, so that memory of a block
+// can be reused by a block of a similar capacity. Other capacities are not
+// cached.
+class Chain::Block::Cache {
+ public:
+  static constexpr size_t kClassesPerPowerOf2 = 4;
+  // The number of size classes. A capacity is cached if its size class is
+  // smaller.
+  static constexpr size_t kNumClasses =
+      NumDoublings(kMinBufferSize(), kMaxBufferSize()) * kClassesPerPowerOf2 +
+      1;
+
+  Cache() noexcept {}
+
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+
+  ~Cache();
+
+  // Returns the cache of the current thread, or nullptr if the thread is
+  // exiting and memory is no longer cached.
+  static Cache* ThreadLocal();
+
+  // Returns the size class of a block with at least the given capacity, and
+  // rounds *capacity up to the capacity of the size class. Returns kNumClasses
+  // and leaves *capacity unchanged if it is not cached.
+  static size_t SizeClass(size_t* capacity);
+
+  // Returns cached memory of the size class, or nullptr if there is none.
+  void* Get(size_t size_class);
+
+  // Caches memory of the size class. Returns false if there is no room for it.
+  bool Put(size_t size_class, void* memory);
+
+ private:
+  // The maximum total capacity of cached blocks of a size class, except that
+  // kMinBlocksPerClass blocks can always be cached.
+  static constexpr size_t kMaxBytesPerClass = size_t{64} << 10;
+  static constexpr size_t kMinBlocksPerClass = 4;
+
+  static size_t ClassCapacity(size_t size_class);
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct FreeList {
+    FreeBlock* head = nullptr;
+    size_t size = 0;
+  };
+
+  FreeList free_lists_[kNumClasses];
+};
+
+constexpr size_t Chain::Block::Cache::kClassesPerPowerOf2;
+constexpr size_t Chain::Block::Cache::kNumClasses;
+constexpr size_t Chain::Block::Cache::kMaxBytesPerClass;
+constexpr size_t Chain::Block::Cache::kMinBlocksPerClass;
+
+Chain::Block::Cache::~Cache() {
+  for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+    FreeBlock* free_block = free_lists_[size_class].head;
+    while (free_block != nullptr) {
+      FreeBlock* const next = free_block->next;
+      FreeAlignedBytes<Block>(
+          reinterpret_cast<Block*>(free_block),
+          kInternalAllocatedOffset() + ClassCapacity(size_class));
+      free_block = next;
+    }
+    free_lists_[size_class] = FreeList();
+  }
+  // Blocks can still be allocated and freed by destructors of other
+  // thread-local objects.
+  block_cache_destroyed = true;
+}
+
+inline Chain::Block::Cache* Chain::Block::Cache::ThreadLocal() {
+  if (RIEGELI_UNLIKELY(block_cache_destroyed)) return nullptr;
+  static thread_local Cache cache;
+  return &cache;
+}
+
+inline size_t Chain::Block::Cache::SizeClass(size_t* capacity) {
+  if (*capacity < kMinBufferSize() || *capacity > kMaxBufferSize()) {
+    return kNumClasses;
+  }
+  size_t power = kMinBufferSize();
+  size_t size_class = 0;
+  while (*capacity > power * 2) {
+    power *= 2;
+    size_class += kClassesPerPowerOf2;
+  }
+  const size_t step = power / kClassesPerPowerOf2;
+  const size_t num_steps = (*capacity - power + step - 1) / step;
+  *capacity = power + num_steps * step;
+  return size_class + num_steps;
+}
+
+inline size_t Chain::Block::Cache::ClassCapacity(size_t size_class) {
+  const size_t power = kMinBufferSize() << (size_class / kClassesPerPowerOf2);
+  return power + size_class % kClassesPerPowerOf2 *
+                     (power / kClassesPerPowerOf2);
+}
+
+inline void* Chain::Block::Cache::Get(size_t size_class) {
+  RIEGELI_ASSERT_LT(size_class, kNumClasses)
+      << "Failed precondition of Chain::Block::Cache::Get(): "
+         "size class out of range";
+  FreeList& free_list = free_lists_[size_class];
+  FreeBlock* const free_block = free_list.head;
+  if (free_block == nullptr) return nullptr;
+  free_list.head = free_block->next;
+  --free_list.size;
+  return free_block;
+}
+
+inline bool Chain::Block::Cache::Put(size_t size_class, void* memory) {
+  RIEGELI_ASSERT_LT(size_class, kNumClasses)
+      << "Failed precondition of Chain::Block::Cache::Put(): "
+         "size class out of range";
+  FreeList& free_list = free_lists_[size_class];
+  if (free_list.size >=
+      UnsignedMax(kMaxBytesPerClass / ClassCapacity(size_class),
+                  kMinBlocksPerClass)) {
+    return false;
+  }
+  FreeBlock* const free_block = new (memory) FreeBlock();
+  free_block->next = free_list.head;
+  free_list.head = free_block;
+  ++free_list.size;
+  return true;
+}
+
+inline Chain::Block* Chain::Block::AllocateInternal(size_t* capacity) {
+  const size_t size_class = Cache::SizeClass(capacity);
+  if (size_class < Cache::kNumClasses) {
+    Cache* const cache = Cache::ThreadLocal();
+    if (RIEGELI_LIKELY(cache != nullptr)) {
+      void* const memory = cache->Get(size_class);
+      if (memory != nullptr) return static_cast<Block*>(memory);
+    }
+  }
+  return AllocateAlignedBytes<Block>(kInternalAllocatedOffset() + *capacity);
+}
+
+inline void Chain::Block::FreeInternal(Block* block, size_t capacity) {
+  const size_t size_class = Cache::SizeClass(&capacity);
+  if (size_class < Cache::kNumClasses) {
+    Cache* const cache = Cache::ThreadLocal();
+    if (RIEGELI_LIKELY(cache != nullptr) && cache->Put(size_class, block)) {
+      return;
+    }
+  }
+  FreeAlignedBytes<Block>(block, kInternalAllocatedOffset() + capacity);
+}
+
 inline Chain::Block* Chain::Block::NewInternal(size_t capacity) {
   RIEGELI_ASSERT_GT(capacity, 0u)
       << "Failed precondition of Chain::Block::NewInternal(): zero capacity";
   RIEGELI_CHECK_LE(capacity, Block::kMaxCapacity()) << "Out of memory";
-  Block* const block =
-      AllocateAlignedBytes<Block>(kInternalAllocatedOffset() + capacity);
+  Block* const block = AllocateInternal(&capacity);
   new (block) Block(capacity, 0);
   return block;
 }
@@ -61,8 +232,7 @@ inline Chain::Block* Chain::Block::NewInternalForPrepend(size_t capacity) {
       << "Failed precondition of Chain::Block::NewInternalForPrepend(): zero "
          "capacity";
   RIEGELI_CHECK_LE(capacity, Block::kMaxCapacity()) << "Out of memory";
-  Block* const block =
-      AllocateAlignedBytes<Block>(kInternalAllocatedOffset() + capacity);
+  Block* const block = AllocateInternal(&capacity);
   new (block) Block(capacity, capacity);
   return block;
 }
@@ -81,9 +251,9 @@ inline void Chain::Block::Unref() {
   if (has_unique_owner() ||
       ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     if (is_internal()) {
-      const size_t num_bytes = kInternalAllocatedOffset() + capacity();
+      const size_t capacity = this->capacity();
       this->~Block();
-      FreeAlignedBytes<Block>(this, num_bytes);
+      FreeInternal(this, capacity);
     } else {
       external_.methods->delete_block(this);
     }
@@ -495,10 +495,21 @@ class Chain::Block {
     char object_lower_bound[1];
   };
 
+  class Cache;
+
   static constexpr size_t kInternalAllocatedOffset();
   template <typename T>
   static constexpr size_t kExternalObjectOffset();
 
+  // Allocates memory of an internal block with at least the given capacity,
+  // reusing memory cached by the current thread if possible. Sets *capacity to
+  // the actual capacity.
+  static Block* AllocateInternal(size_t* capacity);
+
+  // Frees memory of an internal block with the given capacity, caching it in
+  // the current thread if possible.
+  static void FreeInternal(Block* block, size_t capacity);
+
   // Constructs an internal block.
   Block(size_t capacity, size_t space_before);
 
@@ -0,0 +1,194 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef RIEGELI_BASE_FLAT_HASH_MAP_H_
+#define RIEGELI_BASE_FLAT_HASH_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+namespace internal {
+
+// A hash map with open addressing, intended for small keys and values which
+// are looked up frequently. Entries are stored contiguously in insertion order,
+// and a separate table of entry indices is probed linearly.
+//
+// Differences from std::unordered_map:
+//  * Iteration follows insertion order, which makes it reproducible.
+//  * Inserting invalidates iterators, pointers, and references to entries.
+//  * Erasing individual entries is not supported.
+//  * clear() keeps allocated capacity, so that filling the map again with
+//    similar contents does not allocate.
+//
+// Hash must distribute keys well in low bits, e.g. by finalizing them with
+// Murmur3_64().
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap {
+ public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = std::pair<Key, Value>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  FlatHashMap() noexcept {}
+
+  FlatHashMap(FlatHashMap&& src) = default;
+  FlatHashMap& operator=(FlatHashMap&& src) = default;
+
+  iterator begin() { return entries_.begin(); }
+  const_iterator begin() const { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator end() const { return entries_.end(); }
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  // Removes all entries, keeping allocated capacity.
+  void clear();
+
+  // Ensures that inserting up to size entries in total does not reallocate.
+  void reserve(size_t size);
+
+  // If key is not present, inserts it with Value constructed from args, and
+  // returns an iterator to the new entry and true. Otherwise returns an
+  // iterator to the existing entry and false.
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+
+  // Returns a reference to the value for key, inserting a value-initialized
+  // value if key is not present.
+  Value& operator[](const Key& key) { return try_emplace(key).first->second; }
+
+  // Returns an iterator to the entry for key, or end() if key is not present.
+  iterator find(const Key& key);
+  const_iterator find(const Key& key) const;
+
+ private:
+  static constexpr size_t kMinNumSlots = 16;
+
+  // Returns the index in slots_ where key is present or should be inserted.
+  //
+  // Precondition: !slots_.empty()
+  size_t FindSlot(const Key& key) const;
+
+  // Resizes slots_ to num_slots and reinserts indices of all entries.
+  void Rehash(size_t num_slots);
+
+  std::vector<value_type> entries_;
+  // 0 for an empty slot, otherwise the index of an entry in entries_ plus 1.
+  //
+  // Invariant: slots_.size() is 0 or a power of 2 and at least
+  //            2 * entries_.size()
+  std::vector<uint32_t> slots_;
+  Hash hash_;
+  KeyEqual key_equal_;
+};
+
+// Implementation details follow.
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+constexpr size_t FlatHashMap<Key, Value, Hash, KeyEqual>::kMinNumSlots;
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+void FlatHashMap<Key, Value, Hash, KeyEqual>::clear() {
+  entries_.clear();
+  std::fill(slots_.begin(), slots_.end(), uint32_t{0});
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+void FlatHashMap<Key, Value, Hash, KeyEqual>::reserve(size_t size) {
+  entries_.reserve(size);
+  if (slots_.size() / 2 < size) {
+    size_t num_slots = kMinNumSlots;
+    while (num_slots / 2 < size) num_slots *= 2;
+    Rehash(num_slots);
+  }
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+template <typename... Args>
+std::pair<typename FlatHashMap<Key, Value, Hash, KeyEqual>::iterator, bool>
+FlatHashMap<Key, Value, Hash, KeyEqual>::try_emplace(const Key& key,
+                                                    Args&&... args) {
+  if (RIEGELI_UNLIKELY(slots_.size() / 2 <= entries_.size())) {
+    Rehash(slots_.empty() ? kMinNumSlots : slots_.size() * 2);
+  }
+  const size_t slot = FindSlot(key);
+  if (slots_[slot] != 0) {
+    return std::make_pair(entries_.begin() + (slots_[slot] - 1), false);
+  }
+  entries_.emplace_back(std::piecewise_construct, std::forward_as_tuple(key),
+                        std::forward_as_tuple(std::forward<Args>(args)...));
+  slots_[slot] = IntCast<uint32_t>(entries_.size());
+  return std::make_pair(entries_.end() - 1, true);
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+typename FlatHashMap<Key, Value, Hash, KeyEqual>::iterator
+FlatHashMap<Key, Value, Hash, KeyEqual>::find(const Key& key) {
+  if (slots_.empty()) return entries_.end();
+  const size_t slot = FindSlot(key);
+  if (slots_[slot] == 0) return entries_.end();
+  return entries_.begin() + (slots_[slot] - 1);
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+typename FlatHashMap<Key, Value, Hash, KeyEqual>::const_iterator
+FlatHashMap<Key, Value, Hash, KeyEqual>::find(const Key& key) const {
+  if (slots_.empty()) return entries_.end();
+  const size_t slot = FindSlot(key);
+  if (slots_[slot] == 0) return entries_.end();
+  return entries_.begin() + (slots_[slot] - 1);
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+inline size_t FlatHashMap<Key, Value, Hash, KeyEqual>::FindSlot(
+    const Key& key) const {
+  RIEGELI_ASSERT(!slots_.empty())
+      << "Failed precondition of FlatHashMap::FindSlot(): no slots";
+  const size_t mask = slots_.size() - 1;
+  size_t slot = static_cast<size_t>(hash_(key)) & mask;
+  while (slots_[slot] != 0 &&
+         !key_equal_(entries_[slots_[slot] - 1].first, key)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+void FlatHashMap<Key, Value, Hash, KeyEqual>::Rehash(size_t num_slots) {
+  RIEGELI_ASSERT_GE(num_slots / 2, entries_.size())
+      << "Failed precondition of FlatHashMap::Rehash(): too few slots";
+  slots_.assign(num_slots, 0);
+  const size_t mask = num_slots - 1;
+  for (size_t index = 0; index < entries_.size(); ++index) {
+    size_t slot = static_cast<size_t>(hash_(entries_[index].first)) & mask;
+    while (slots_[slot] != 0) slot = (slot + 1) & mask;
+    slots_[slot] = IntCast<uint32_t>(index + 1);
+  }
+}
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_FLAT_HASH_MAP_H_
@@ -0,0 +1,190 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make MAP_ANONYMOUS and madvise() available.
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "riegeli/base/huge_pages.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/str_error.h"
+
+#if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+#define RIEGELI_INTERNAL_HAVE_HUGE_PAGES 1
+#else
+#define RIEGELI_INTERNAL_HAVE_HUGE_PAGES 0
+#endif
+
+// MAP_HUGE_2MB is defined only in <linux/mman.h>, but MAP_HUGE_SHIFT is
+// available from <sys/mman.h>.
+#if defined(MAP_HUGE_SHIFT) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+namespace riegeli {
+
+#if RIEGELI_INTERNAL_HAVE_HUGE_PAGES
+
+namespace {
+
+// Recently freed memory is kept for reuse, because mapping fresh huge pages
+// costs page faults and zeroing which would outweigh the savings of a buffer
+// used once per chunk.
+class HugePagesCache {
+ public:
+  // Returns cached memory of at least size bytes but not much larger, or
+  // nullptr if there is none.
+  void* Get(size_t size, size_t* allocated_size);
+
+  // Caches memory. Returns false if there is no room for it.
+  bool Put(void* ptr, size_t allocated_size);
+
+ private:
+  static constexpr size_t kMaxRegions = 4;
+  static constexpr size_t kMaxBytes = size_t{64} << 20;
+
+  struct Region {
+    void* ptr;
+    size_t size;
+  };
+
+  std::mutex mutex_;
+  std::vector<Region> regions_;
+  size_t total_size_ = 0;
+};
+
+constexpr size_t HugePagesCache::kMaxRegions;
+constexpr size_t HugePagesCache::kMaxBytes;
+
+void* HugePagesCache::Get(size_t size, size_t* allocated_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto iter = regions_.begin(); iter != regions_.end(); ++iter) {
+    if (iter->size >= size && iter->size / 2 <= size) {
+      void* const ptr = iter->ptr;
+      *allocated_size = iter->size;
+      total_size_ -= iter->size;
+      regions_.erase(iter);
+      return ptr;
+    }
+  }
+  return nullptr;
+}
+
+bool HugePagesCache::Put(void* ptr, size_t allocated_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (regions_.size() >= kMaxRegions ||
+      allocated_size > kMaxBytes - total_size_) {
+    return false;
+  }
+  regions_.push_back(Region{ptr, allocated_size});
+  total_size_ += allocated_size;
+  return true;
+}
+
+HugePagesCache& GlobalHugePagesCache() {
+  // Never destroyed: memory can be freed during destruction of static objects.
+  static HugePagesCache* const kCache = new HugePagesCache();
+  return *kCache;
+}
+
+}  // namespace
+
+#endif  // RIEGELI_INTERNAL_HAVE_HUGE_PAGES
+
+void* AllocateHugePages(size_t size, size_t* allocated_size) {
+#if RIEGELI_INTERNAL_HAVE_HUGE_PAGES
+  if (RIEGELI_UNLIKELY(size == 0 ||
+                       size > std::numeric_limits<size_t>::max() -
+                                  2 * kHugePageSize)) {
+    return nullptr;
+  }
+  const size_t rounded_size = RoundUp<kHugePageSize>(size);
+  {
+    void* const data =
+        GlobalHugePagesCache().Get(rounded_size, allocated_size);
+    if (data != nullptr) return data;
+  }
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+  static_assert(kHugePageSize == size_t{1} << 21,
+                "MAP_HUGE_2MB does not match kHugePageSize");
+  {
+    // The page size is explicit because the default hugetlb page size can be
+    // larger, e.g. 1G, and then munmap() of rounded_size would fail.
+    void* const data =
+        mmap(nullptr, rounded_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (data != MAP_FAILED) {
+      *allocated_size = rounded_size;
+      return data;
+    }
+  }
+#endif
+  // Explicit huge pages are not reserved. Map an aligned region for
+  // transparent huge pages: overallocate and unmap the unaligned margins.
+  const size_t mapped_size = rounded_size + kHugePageSize;
+  void* const mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (RIEGELI_UNLIKELY(mapped == MAP_FAILED)) return nullptr;
+  char* const mapped_begin = static_cast<char*>(mapped);
+  const uintptr_t mapped_address = reinterpret_cast<uintptr_t>(mapped);
+  char* const data =
+      mapped_begin + (RoundUp<kHugePageSize>(mapped_address) - mapped_address);
+  if (data != mapped_begin) {
+    const int result = munmap(mapped_begin, PtrDistance(mapped_begin, data));
+    RIEGELI_CHECK_EQ(result, 0) << "munmap() failed: " << StrError(errno);
+  }
+  char* const data_end = data + rounded_size;
+  if (data_end != mapped_begin + mapped_size) {
+    const int result =
+        munmap(data_end, PtrDistance(data_end, mapped_begin + mapped_size));
+    RIEGELI_CHECK_EQ(result, 0) << "munmap() failed: " << StrError(errno);
+  }
+  AdviseHugePages(data, rounded_size);
+  *allocated_size = rounded_size;
+  return data;
+#else
+  return nullptr;
+#endif
+}
+
+void FreeHugePages(void* ptr, size_t allocated_size) {
+#if RIEGELI_INTERNAL_HAVE_HUGE_PAGES
+  if (GlobalHugePagesCache().Put(ptr, allocated_size)) return;
+  const int result = munmap(ptr, allocated_size);
+  RIEGELI_CHECK_EQ(result, 0) << "munmap() failed: " << StrError(errno);
+#else
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Failed precondition of FreeHugePages(): "
+         "huge pages are not supported";
+#endif
+}
+
+void AdviseHugePages(void* ptr, size_t size) {
+#if RIEGELI_INTERNAL_HAVE_HUGE_PAGES
+  // Failure is ignored because this is only a hint.
+  madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+}
+
+}  // namespace riegeli
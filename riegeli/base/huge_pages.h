@@ -0,0 +1,50 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_HUGE_PAGES_H_
+#define RIEGELI_BASE_HUGE_PAGES_H_
+
+#include <stddef.h>
+
+namespace riegeli {
+
+// The size of a huge page assumed for alignment. Memory smaller than this does
+// not benefit from huge pages.
+constexpr size_t kHugePageSize = size_t{2} << 20;
+
+// Allocates at least size bytes of memory backed by huge pages where possible,
+// which reduces TLB misses when large buffers are accessed.
+//
+// Explicit 2M huge pages (MAP_HUGETLB) are used if the system has them
+// reserved, otherwise the memory is aligned to kHugePageSize and advised with
+// MADV_HUGEPAGE for transparent huge pages. A few recently freed regions are
+// reused, so that a buffer allocated once per chunk does not fault in fresh
+// pages each time. Sets *allocated_size to the size to pass to
+// FreeHugePages().
+//
+// Returns nullptr if memory cannot be mapped, or if huge pages are not
+// supported by the system; the caller should then allocate ordinary memory.
+void* AllocateHugePages(size_t size, size_t* allocated_size);
+
+// Frees memory allocated by AllocateHugePages().
+void FreeHugePages(void* ptr, size_t allocated_size);
+
+// Advises the kernel to back an existing mapping with transparent huge pages,
+// e.g. a file mapped with mmap(). Failure is ignored because this is only a
+// hint.
+void AdviseHugePages(void* ptr, size_t size);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_HUGE_PAGES_H_
@@ -0,0 +1,61 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/memory_budget.h"
+
+#include <stddef.h>
+#include <limits>
+#include <mutex>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+size_t MemoryBudget::used_memory() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_memory_;
+}
+
+bool MemoryBudget::TryReserve(size_t memory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (used_memory_ != 0 && (used_memory_ > max_memory_ ||
+                            memory > max_memory_ - used_memory_)) {
+    return false;
+  }
+  used_memory_ += memory;
+  return true;
+}
+
+void MemoryBudget::ReserveUnconditionally(size_t memory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RIEGELI_CHECK_LE(memory, std::numeric_limits<size_t>::max() - used_memory_)
+      << "Failed precondition of MemoryBudget::ReserveUnconditionally(): "
+         "memory overflow";
+  used_memory_ += memory;
+}
+
+void MemoryBudget::Release(size_t memory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RIEGELI_ASSERT_LE(memory, used_memory_)
+      << "Failed precondition of MemoryBudget::Release(): "
+         "releasing more memory than reserved";
+  used_memory_ -= memory;
+}
+
+bool MemoryBudget::Exhausted() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_memory_ != 0 && used_memory_ >= max_memory_;
+}
+
+}  // namespace riegeli
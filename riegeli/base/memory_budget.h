@@ -0,0 +1,76 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_MEMORY_BUDGET_H_
+#define RIEGELI_BASE_MEMORY_BUDGET_H_
+
+#include <stddef.h>
+#include <mutex>
+
+namespace riegeli {
+
+// A limit of memory shared by multiple RecordWriters and RecordReaders, which
+// reserve memory of chunks being built, encoded, and decoded from it. When the
+// budget is exhausted, they shed work, e.g. close chunks early or read ahead
+// fewer chunks, and wait only for their own background work, instead of growing
+// memory usage without bound.
+//
+// Nobody waits for memory reserved by others, because objects sharing a budget
+// may be used by the same thread, and waiting for each other would deadlock.
+// Hence the budget can be exceeded a little: by memory which is already
+// allocated, and by a minimal amount of work needed to make progress.
+//
+// Amounts of memory are approximate: memory of chunks is estimated with
+// MemoryEstimator.
+//
+// MemoryBudget is thread-safe.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t max_memory) : max_memory_(max_memory) {}
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  size_t max_memory() const { return max_memory_; }
+
+  // Returns the amount of memory currently reserved.
+  size_t used_memory() const;
+
+  // Reserves memory if it fits in the budget, or if no memory is reserved.
+  //
+  // Return values:
+  //  * true  - memory is reserved
+  //  * false - memory does not fit
+  bool TryReserve(size_t memory);
+
+  // Reserves memory even if the budget is exceeded. This is meant for memory
+  // which is already allocated, or which is needed to make progress.
+  void ReserveUnconditionally(size_t memory);
+
+  // Releases memory reserved before.
+  void Release(size_t memory);
+
+  // Returns true if no memory is available. The result may be stale as soon
+  // as this returns.
+  bool Exhausted() const;
+
+ private:
+  const size_t max_memory_;
+  mutable std::mutex mutex_;
+  size_t used_memory_ = 0;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_MEMORY_BUDGET_H_
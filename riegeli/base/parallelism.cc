@@ -14,9 +14,12 @@
 
 #include "riegeli/base/parallelism.h"
 
-#include <functional>
-#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <utility>
@@ -25,52 +28,125 @@
 #include "riegeli/base/memory.h"
 
 namespace riegeli {
-namespace internal {
+
+struct ThreadPool::Worker {
+  ThreadPool* thread_pool = nullptr;
+  std::thread thread;
+  std::mutex mutex;
+  // Guarded by mutex.
+  std::deque<std::function<void()>> tasks;
+};
+
+thread_local ThreadPool::Worker* ThreadPool::current_worker_ = nullptr;
+
+ThreadPool::ThreadPool(Options options)
+    : max_threads_(options.max_threads_ > 0
+                       ? IntCast<size_t>(options.max_threads_)
+                       : std::thread::hardware_concurrency() > 0
+                             ? size_t{std::thread::hardware_concurrency()}
+                             : size_t{1}),
+      workers_(new Worker[max_threads_]) {
+  for (size_t i = 0; i < max_threads_; ++i) workers_[i].thread_pool = this;
+}
 
 ThreadPool::~ThreadPool() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  exiting_ = true;
-  has_work_.notify_all();
-  while (num_threads_ > 0) workers_exited_.wait(lock);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exiting_ = true;
+    has_work_.notify_all();
+  }
+  const size_t num_threads = num_threads_.load(std::memory_order_acquire);
+  for (size_t i = 0; i < num_threads; ++i) workers_[i].thread.join();
 }
 
 void ThreadPool::Schedule(std::function<void()> task) {
+  Worker* worker = current_worker_;
+  if (worker == nullptr || worker->thread_pool != this) {
+    size_t index = max_threads_;
+    if (num_idle_threads_.load() == 0) index = StartWorker();
+    if (index == max_threads_) {
+      index = next_worker_.fetch_add(1, std::memory_order_relaxed) %
+              num_threads_.load(std::memory_order_acquire);
+    }
+    worker = &workers_[index];
+  }
   {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    // num_pending_tasks_ is incremented before the task can be taken, so that
+    // TakeTask() never decrements it below 0.
+    num_pending_tasks_.fetch_add(1);
+    worker->tasks.push_back(std::move(task));
+  }
+  // The order of modifying num_pending_tasks_ before reading num_idle_threads_
+  // here, and modifying num_idle_threads_ before reading num_pending_tasks_ in
+  // Work(), ensures that some worker thread notices the task.
+  if (num_idle_threads_.load() > 0) {
     std::lock_guard<std::mutex> lock(mutex_);
-    RIEGELI_ASSERT(!exiting_)
-        << "Failed precondition of ThreadPool::Schedule(): no new threads may "
-           "be scheduled while the thread pool is exiting";
-    tasks_.push_back(std::move(task));
-    if (num_idle_threads_ >= tasks_.size()) {
-      has_work_.notify_one();
+    has_work_.notify_one();
+  }
+}
+
+inline size_t ThreadPool::StartWorker() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RIEGELI_ASSERT(!exiting_)
+      << "Failed precondition of ThreadPool::Schedule(): no new tasks may be "
+         "scheduled while the thread pool is exiting";
+  const size_t index = num_threads_.load(std::memory_order_relaxed);
+  if (index == max_threads_) return max_threads_;
+  workers_[index].thread = std::thread([this, index] { Work(index); });
+  num_threads_.store(index + 1, std::memory_order_release);
+  return index;
+}
+
+void ThreadPool::Work(size_t index) {
+  current_worker_ = &workers_[index];
+  std::function<void()> task;
+  for (;;) {
+    if (TakeTask(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_idle_threads_.fetch_add(1);
+    while (num_pending_tasks_.load() == 0 && !exiting_) has_work_.wait(lock);
+    num_idle_threads_.fetch_sub(1);
+    if (num_pending_tasks_.load() == 0) {
+      RIEGELI_ASSERT(exiting_) << "Worker thread woken up without work";
+      current_worker_ = nullptr;
       return;
     }
-    ++num_threads_;
   }
-  std::thread([this] {
-    for (;;) {
-      std::unique_lock<std::mutex> lock(mutex_);
-      ++num_idle_threads_;
-      while (tasks_.empty() && !exiting_) {
-        if (has_work_.wait_for(lock, std::chrono::seconds(60)) ==
-            std::cv_status::timeout) {
-          break;
-        }
-      }
-      --num_idle_threads_;
-      if (tasks_.empty() || exiting_) {
-        if (--num_threads_ == 0) workers_exited_.notify_all();
-        return;
-      }
-      const std::function<void()> task = std::move(tasks_.front());
-      tasks_.pop_front();
-      lock.unlock();
-      task();
+}
+
+inline bool ThreadPool::TakeTask(size_t index, std::function<void()>* task) {
+  {
+    Worker& worker = workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      *task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+      num_pending_tasks_.fetch_sub(1);
+      return true;
+    }
+  }
+  const size_t num_threads = num_threads_.load(std::memory_order_acquire);
+  for (size_t i = 1; i < num_threads; ++i) {
+    Worker& victim = workers_[(index + i) % num_threads];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      num_pending_tasks_.fetch_sub(1);
+      num_steals_.fetch_add(1, std::memory_order_relaxed);
+      return true;
     }
-  })
-      .detach();
+  }
+  return false;
 }
 
+namespace internal {
+
 ThreadPool& DefaultThreadPool() {
   static NoDestructor<ThreadPool> kStaticThreadPool;
   return *kStaticThreadPool;
@@ -16,41 +16,192 @@
 #define RIEGELI_BASE_PARALLELISM_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <atomic>
 #include <condition_variable>
-#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <utility>
+
+#include "riegeli/base/base.h"
 
 namespace riegeli {
-namespace internal {
 
-// A thread pool with lazily created worker threads, without a thread count
-// limit. Worker threads exit after being idle for one minute.
+// A thread pool with a bounded number of lazily created worker threads.
+//
+// Each worker thread has its own queue of tasks. A task scheduled from a worker
+// thread of this pool goes to the queue of that worker thread, otherwise queues
+// are chosen round-robin. A worker thread takes tasks from the front of its own
+// queue, and when it is empty, steals tasks from the back of queues of other
+// worker threads.
+//
+// ThreadPool is thread-safe.
 class ThreadPool {
  public:
-  ThreadPool() = default;
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    constexpr Options() noexcept {}
+
+    // Sets the maximum number of worker threads. Worker threads are created
+    // when tasks are scheduled and no worker thread is idle, until this number
+    // is reached, and they exit when the ThreadPool is destroyed.
+    //
+    // Default: std::thread::hardware_concurrency(), or 1 if it is not known.
+    Options& set_max_threads(int max_threads) & {
+      RIEGELI_ASSERT_GT(max_threads, 0)
+          << "Failed precondition of "
+             "ThreadPool::Options::set_max_threads(): "
+             "non-positive number of threads";
+      max_threads_ = max_threads;
+      return *this;
+    }
+    Options&& set_max_threads(int max_threads) && {
+      return std::move(set_max_threads(max_threads));
+    }
+
+   private:
+    friend class ThreadPool;
+
+    // 0 means std::thread::hardware_concurrency().
+    int max_threads_ = 0;
+  };
+
+  explicit ThreadPool(Options options = Options());
 
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
 
+  // Waits for all scheduled tasks to finish.
   ~ThreadPool();
 
+  // Schedules a task to be run by some worker thread.
   void Schedule(std::function<void()> task);
 
+  // Returns the maximum number of worker threads.
+  size_t max_threads() const { return max_threads_; }
+
+  // Returns the number of worker threads created so far.
+  size_t num_threads() const;
+
+  // Returns the number of tasks which were scheduled but were not taken by a
+  // worker thread yet.
+  size_t queue_depth() const;
+
+  // Returns the number of tasks which were taken by a worker thread from the
+  // queue of another worker thread.
+  uint64_t num_steals() const;
+
  private:
+  struct Worker;
+
+  // Creates a worker thread if the thread count limit allows it. Returns the
+  // index of the new worker, or max_threads_ if no worker was created.
+  size_t StartWorker();
+
+  // Body of a worker thread.
+  void Work(size_t index);
+
+  // Takes a task from the queue of the given worker, or steals it from another
+  // worker.
+  //
+  // Return values:
+  //  * true  - success (*task is set)
+  //  * false - all queues are empty
+  bool TakeTask(size_t index, std::function<void()>* task);
+
+  // The worker running on the current thread, or nullptr if the current thread
+  // is not a worker thread of any ThreadPool.
+  static thread_local Worker* current_worker_;
+
+  size_t max_threads_;
+  // max_threads_ elements, the first num_threads_ of them have worker threads.
+  std::unique_ptr<Worker[]> workers_;
+  std::atomic<size_t> num_threads_{0};
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<size_t> num_pending_tasks_{0};
+  std::atomic<size_t> num_idle_threads_{0};
+  std::atomic<uint64_t> num_steals_{0};
+  // Guards creating worker threads, exiting_, and waiting for work.
   std::mutex mutex_;
-  // All variables below are guarded by mutex_.
   bool exiting_ = false;
-  size_t num_threads_ = 0;
-  size_t num_idle_threads_ = 0;
-  std::deque<std::function<void()>> tasks_;
   std::condition_variable has_work_;
-  std::condition_variable workers_exited_;
 };
 
+namespace internal {
+
+// EventCount lets threads wait until a condition on atomic variables becomes
+// true, without locking on the fast paths: Wait() first evaluates the condition
+// without a lock, and NotifyAll() takes a lock only if some thread is waiting.
+//
+// Variables read by the condition must be modified with sequentially
+// consistent atomic operations before calling NotifyAll().
+//
+// EventCount is thread-safe.
+class EventCount {
+ public:
+  EventCount() noexcept {}
+
+  EventCount(const EventCount&) = delete;
+  EventCount& operator=(const EventCount&) = delete;
+
+  // Waits until condition() returns true.
+  template <typename Condition>
+  void Wait(Condition condition);
+
+  // Wakes up threads waiting in Wait() to reevaluate their conditions.
+  void NotifyAll();
+
+ private:
+  std::atomic<size_t> num_waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_changed_;
+};
+
+// The thread pool used by RecordWriter and RecordReader unless another thread
+// pool is specified in their options.
 ThreadPool& DefaultThreadPool();
 
 }  // namespace internal
+
+// Implementation details follow.
+
+inline size_t ThreadPool::num_threads() const {
+  return num_threads_.load(std::memory_order_acquire);
+}
+
+inline size_t ThreadPool::queue_depth() const {
+  return num_pending_tasks_.load(std::memory_order_relaxed);
+}
+
+inline uint64_t ThreadPool::num_steals() const {
+  return num_steals_.load(std::memory_order_relaxed);
+}
+
+namespace internal {
+
+template <typename Condition>
+void EventCount::Wait(Condition condition) {
+  if (condition()) return;
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_waiters_.fetch_add(1);
+  // The order of modifying num_waiters_ before evaluating the condition here,
+  // and modifying variables read by the condition before reading num_waiters_
+  // in NotifyAll(), ensures that the notification is not missed.
+  while (!condition()) condition_changed_.wait(lock);
+  num_waiters_.fetch_sub(1);
+}
+
+inline void EventCount::NotifyAll() {
+  if (num_waiters_.load() == 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  condition_changed_.notify_all();
+}
+
+}  // namespace internal
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BASE_PARALLELISM_H_
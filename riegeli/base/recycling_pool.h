@@ -0,0 +1,139 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_RECYCLING_POOL_H_
+#define RIEGELI_BASE_RECYCLING_POOL_H_
+
+#include <stddef.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+// RecyclingPool keeps objects which are expensive to create, e.g. compression
+// contexts, so that they can be reused instead of being created again.
+//
+// Objects are keyed by parameters which their allocated state depends on, e.g.
+// a compression level, and an object is reused only for the same key. The
+// caller resets the state of a reused object.
+//
+// RecyclingPool is thread-safe.
+template <typename T, typename Deleter = std::default_delete<T>,
+          typename Key = int>
+class RecyclingPool {
+ public:
+  // Deleter of Handle, which returns the object to the pool.
+  class Recycler {
+   public:
+    Recycler() noexcept {}
+
+    Recycler(RecyclingPool* pool, Key key) noexcept
+        : pool_(pool), key_(std::move(key)) {}
+
+    void operator()(T* ptr) const;
+
+   private:
+    RecyclingPool* pool_ = nullptr;
+    Key key_{};
+  };
+
+  // Owns an object taken from the pool, and returns it to the pool when
+  // destroyed.
+  using Handle = std::unique_ptr<T, Recycler>;
+
+  // Keeps up to max_size unused objects. The least recently used objects are
+  // deleted first.
+  explicit RecyclingPool(size_t max_size = 16) : max_size_(max_size) {}
+
+  RecyclingPool(const RecyclingPool&) = delete;
+  RecyclingPool& operator=(const RecyclingPool&) = delete;
+
+  // Returns the pool shared by the process. It is never destroyed, so that
+  // objects can be returned to it during destruction of static objects.
+  static RecyclingPool& global();
+
+  // Takes an unused object with the given key from the pool, or creates it with
+  // factory() if there is none. factory() returns std::unique_ptr<T, Deleter>,
+  // possibly nullptr.
+  //
+  // The caller must reset the state of the object if it was used before.
+  template <typename Factory>
+  Handle Get(Key key, Factory factory);
+
+ private:
+  void Put(const Key& key, T* ptr);
+
+  const size_t max_size_;
+  std::mutex mutex_;
+  // Unused objects, the most recently used at the end.
+  std::vector<std::pair<Key, std::unique_ptr<T, Deleter>>> entries_;
+};
+
+// Implementation details follow.
+
+template <typename T, typename Deleter, typename Key>
+void RecyclingPool<T, Deleter, Key>::Recycler::operator()(T* ptr) const {
+  RIEGELI_ASSERT(pool_ != nullptr)
+      << "Failed precondition of RecyclingPool::Recycler: "
+         "default-constructed recycler used with an object";
+  pool_->Put(key_, ptr);
+}
+
+template <typename T, typename Deleter, typename Key>
+RecyclingPool<T, Deleter, Key>& RecyclingPool<T, Deleter, Key>::global() {
+  static NoDestructor<RecyclingPool> kStaticPool;
+  return *kStaticPool;
+}
+
+template <typename T, typename Deleter, typename Key>
+template <typename Factory>
+typename RecyclingPool<T, Deleter, Key>::Handle
+RecyclingPool<T, Deleter, Key>::Get(Key key, Factory factory) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto iter = entries_.rbegin(); iter != entries_.rend(); ++iter) {
+      if (iter->first == key) {
+        T* const ptr = iter->second.release();
+        entries_.erase(std::next(iter).base());
+        return Handle(ptr, Recycler(this, std::move(key)));
+      }
+    }
+  }
+  std::unique_ptr<T, Deleter> created = factory();
+  return Handle(created.release(), Recycler(this, std::move(key)));
+}
+
+template <typename T, typename Deleter, typename Key>
+void RecyclingPool<T, Deleter, Key>::Put(const Key& key, T* ptr) {
+  std::unique_ptr<T, Deleter> object(ptr);
+  if (RIEGELI_UNLIKELY(max_size_ == 0)) return;
+  // The evicted object is deleted after unlocking.
+  std::unique_ptr<T, Deleter> evicted;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.size() == max_size_) {
+    evicted = std::move(entries_.front().second);
+    entries_.erase(entries_.begin());
+  }
+  entries_.emplace_back(key, std::move(object));
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_RECYCLING_POOL_H_
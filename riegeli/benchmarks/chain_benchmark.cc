@@ -0,0 +1,117 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kTotalSize = size_t{1} << 20;
+
+// Appends fragments of state.range(0) bytes until kTotalSize bytes are
+// accumulated.
+void BM_ChainAppend(benchmark::State& state) {
+  const std::string text = SyntheticText(kTotalSize);
+  const size_t fragment_size = IntCast<size_t>(state.range(0));
+  for (auto _ : state) {
+    Chain chain;
+    for (size_t pos = 0; pos < kTotalSize; pos += fragment_size) {
+      chain.Append(string_view(text.data() + pos,
+                               UnsignedMin(fragment_size, kTotalSize - pos)));
+    }
+    benchmark::DoNotOptimize(chain);
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * kTotalSize));
+}
+BENCHMARK(BM_ChainAppend)->RangeMultiplier(16)->Range(1, 1 << 16);
+
+void BM_ChainPrepend(benchmark::State& state) {
+  const std::string text = SyntheticText(kTotalSize);
+  const size_t fragment_size = IntCast<size_t>(state.range(0));
+  for (auto _ : state) {
+    Chain chain;
+    for (size_t pos = 0; pos < kTotalSize; pos += fragment_size) {
+      chain.Prepend(string_view(text.data() + pos,
+                                UnsignedMin(fragment_size, kTotalSize - pos)));
+    }
+    benchmark::DoNotOptimize(chain);
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * kTotalSize));
+}
+BENCHMARK(BM_ChainPrepend)->RangeMultiplier(16)->Range(1, 1 << 16);
+
+// Appends a Chain consisting of blocks of state.range(0) bytes to another
+// Chain, sharing or copying the blocks depending on their size.
+void BM_ChainAppendChain(benchmark::State& state) {
+  const std::string text = SyntheticText(kTotalSize);
+  const size_t block_size = IntCast<size_t>(state.range(0));
+  Chain src;
+  for (size_t pos = 0; pos < kTotalSize; pos += block_size) {
+    Chain block;
+    block.Append(string_view(text.data() + pos,
+                             UnsignedMin(block_size, kTotalSize - pos)));
+    src.Append(std::move(block));
+  }
+  for (auto _ : state) {
+    Chain chain;
+    chain.Append(src);
+    benchmark::DoNotOptimize(chain);
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * kTotalSize));
+}
+BENCHMARK(BM_ChainAppendChain)->RangeMultiplier(16)->Range(16, 1 << 16);
+
+void BM_ChainCopy(benchmark::State& state) {
+  const std::string text = SyntheticText(kTotalSize);
+  const size_t fragment_size = IntCast<size_t>(state.range(0));
+  Chain src;
+  for (size_t pos = 0; pos < kTotalSize; pos += fragment_size) {
+    src.Append(string_view(text.data() + pos,
+                           UnsignedMin(fragment_size, kTotalSize - pos)));
+  }
+  for (auto _ : state) {
+    Chain chain(src);
+    benchmark::DoNotOptimize(chain);
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * kTotalSize));
+}
+BENCHMARK(BM_ChainCopy)->RangeMultiplier(16)->Range(1, 1 << 16);
+
+void BM_ChainAppendToString(benchmark::State& state) {
+  const std::string text = SyntheticText(kTotalSize);
+  const size_t fragment_size = IntCast<size_t>(state.range(0));
+  Chain src;
+  for (size_t pos = 0; pos < kTotalSize; pos += fragment_size) {
+    src.Append(string_view(text.data() + pos,
+                           UnsignedMin(fragment_size, kTotalSize - pos)));
+  }
+  for (auto _ : state) {
+    std::string dest;
+    src.AppendTo(&dest);
+    benchmark::DoNotOptimize(dest);
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * kTotalSize));
+}
+BENCHMARK(BM_ChainAppendToString)->RangeMultiplier(16)->Range(1, 1 << 16);
+
+}  // namespace
+}  // namespace riegeli
@@ -0,0 +1,98 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kNumRecords = 10000;
+
+// state.range(0) is the compression type, state.range(1) is the compression
+// level.
+void ApplyCompressions(benchmark::internal::Benchmark* b) {
+  b->Args({static_cast<int64_t>(internal::CompressionType::kNone), 0});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kBrotli), 6});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kBrotli), 9});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kZstd), 3});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kZstd), 9});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kLz4), 0});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kLz4), 9});
+  b->Args({static_cast<int64_t>(internal::CompressionType::kSnappy), 0});
+}
+
+void BM_SimpleChunkEncoderEncode(benchmark::State& state) {
+  const std::vector<std::string> records = SyntheticProtoCorpus(kNumRecords);
+  SimpleChunkEncoder encoder(
+      static_cast<internal::CompressionType>(state.range(0)),
+      IntCast<int>(state.range(1)));
+  size_t encoded_size = 0;
+  for (auto _ : state) {
+    encoder.Reset();
+    for (const std::string& record : records) {
+      encoder.AddRecord(string_view(record));
+    }
+    Chunk chunk;
+    if (!encoder.Encode(&chunk)) {
+      state.SkipWithError("Encode() failed");
+      break;
+    }
+    encoded_size = chunk.data.size();
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumRecords));
+  state.SetBytesProcessed(
+      IntCast<int64_t>(state.iterations() * TotalSize(records)));
+  state.counters["encoded_bytes"] = static_cast<double>(encoded_size);
+}
+BENCHMARK(BM_SimpleChunkEncoderEncode)->Apply(ApplyCompressions);
+
+void BM_SimpleChunkDecode(benchmark::State& state) {
+  const std::vector<std::string> records = SyntheticProtoCorpus(kNumRecords);
+  SimpleChunkEncoder encoder(
+      static_cast<internal::CompressionType>(state.range(0)),
+      IntCast<int>(state.range(1)));
+  for (const std::string& record : records) {
+    encoder.AddRecord(string_view(record));
+  }
+  Chunk chunk;
+  if (!encoder.Encode(&chunk)) RIEGELI_ASSERT_UNREACHABLE();
+  ChunkDecoder decoder;
+  for (auto _ : state) {
+    if (!decoder.Reset(chunk)) {
+      state.SkipWithError(decoder.Message().c_str());
+      break;
+    }
+    string_view record;
+    while (decoder.ReadRecord(&record)) benchmark::DoNotOptimize(record);
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumRecords));
+  state.SetBytesProcessed(
+      IntCast<int64_t>(state.iterations() * TotalSize(records)));
+}
+BENCHMARK(BM_SimpleChunkDecode)->Apply(ApplyCompressions);
+
+}  // namespace
+}  // namespace riegeli
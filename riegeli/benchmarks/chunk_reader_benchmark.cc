@@ -0,0 +1,118 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+#include "riegeli/bytes/string_reader.h"
+#include "riegeli/bytes/string_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kNumRecords = 100000;
+
+// Returns a Riegeli/records file with uncompressed chunks of about 64 KiB.
+std::string RecordsFile() {
+  const std::vector<std::string> records = SyntheticProtoCorpus(kNumRecords);
+  std::string file;
+  RecordWriter writer(riegeli::make_unique<StringWriter>(&file),
+                      RecordWriter::Options()
+                          .DisableCompression()
+                          .set_desired_chunk_size(size_t{64} << 10));
+  for (const std::string& record : records) {
+    if (!writer.WriteRecord(string_view(record))) {
+      RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+    }
+  }
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  return file;
+}
+
+void BM_ChunkReaderReadChunks(benchmark::State& state) {
+  const std::string file = RecordsFile();
+  for (auto _ : state) {
+    ChunkReader reader(riegeli::make_unique<StringReader>(&file));
+    Chunk chunk;
+    while (reader.ReadChunk(&chunk)) benchmark::DoNotOptimize(chunk);
+    if (!reader.Close()) {
+      state.SkipWithError(reader.Message().c_str());
+      break;
+    }
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * file.size()));
+}
+BENCHMARK(BM_ChunkReaderReadChunks);
+
+// Overwrites state.range(0) evenly spaced regions of 16 bytes with garbage,
+// then reads the file with skip_corruption, which scans block headers to
+// resynchronize after each damaged region.
+void BM_ChunkReaderRecover(benchmark::State& state) {
+  std::string file = RecordsFile();
+  const size_t num_corruptions = IntCast<size_t>(state.range(0));
+  for (size_t i = 0; i < num_corruptions; ++i) {
+    const size_t pos = file.size() / (num_corruptions + 1) * (i + 1);
+    for (size_t j = pos; j < UnsignedMin(pos + 16, file.size()); ++j) {
+      file[j] = static_cast<char>(file[j] ^ 0x5a);
+    }
+  }
+  size_t num_chunks = 0;
+  for (auto _ : state) {
+    ChunkReader reader(riegeli::make_unique<StringReader>(&file),
+                       ChunkReader::Options().set_skip_corruption(true));
+    Chunk chunk;
+    num_chunks = 0;
+    while (reader.ReadChunk(&chunk)) ++num_chunks;
+    if (!reader.Close()) {
+      state.SkipWithError(reader.Message().c_str());
+      break;
+    }
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * file.size()));
+  state.counters["chunks_recovered"] = static_cast<double>(num_chunks);
+}
+BENCHMARK(BM_ChunkReaderRecover)->Arg(1)->Arg(16)->Arg(256);
+
+// Seeks to state.range(0) evenly spaced positions and reads the chunk
+// containing each, which locates chunk boundaries through block headers.
+void BM_ChunkReaderSeekToChunkContaining(benchmark::State& state) {
+  const std::string file = RecordsFile();
+  const size_t num_seeks = IntCast<size_t>(state.range(0));
+  for (auto _ : state) {
+    ChunkReader reader(riegeli::make_unique<StringReader>(&file));
+    Chunk chunk;
+    for (size_t i = 0; i < num_seeks; ++i) {
+      if (!reader.SeekToChunkContaining(file.size() / num_seeks * i) ||
+          !reader.ReadChunk(&chunk)) {
+        state.SkipWithError(reader.Message().c_str());
+        break;
+      }
+      benchmark::DoNotOptimize(chunk);
+    }
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * num_seeks));
+}
+BENCHMARK(BM_ChunkReaderSeekToChunkContaining)->Arg(64);
+
+}  // namespace
+}  // namespace riegeli
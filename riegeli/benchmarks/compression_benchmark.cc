@@ -0,0 +1,146 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+#include "riegeli/bytes/brotli_reader.h"
+#include "riegeli/bytes/brotli_writer.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_reader.h"
+#include "riegeli/bytes/lz4_writer.h"
+#include "riegeli/bytes/snappy_reader.h"
+#include "riegeli/bytes/snappy_writer.h"
+#include "riegeli/bytes/zstd_reader.h"
+#include "riegeli/bytes/zstd_writer.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kTotalSize = size_t{1} << 20;
+
+// state.range(0) is the compression level, state.range(1) selects the input:
+// text (0) or serialized protos (1).
+std::string Input(int64_t kind) {
+  if (kind == 0) return SyntheticText(kTotalSize);
+  std::string input =
+      std::string(ConcatenateRecords(SyntheticProtoCorpus(20000)));
+  input.resize(UnsignedMin(input.size(), kTotalSize));
+  return input;
+}
+
+template <typename CompressingWriter>
+typename CompressingWriter::Options WriterOptions(int level, size_t size) {
+  return typename CompressingWriter::Options()
+      .set_compression_level(level)
+      .set_size_hint(size);
+}
+
+template <>
+Lz4Writer::Options WriterOptions<Lz4Writer>(int level, size_t size) {
+  return Lz4Writer::Options().set_compression_level(level);
+}
+
+template <>
+SnappyWriter::Options WriterOptions<SnappyWriter>(int level, size_t size) {
+  return SnappyWriter::Options().set_size_hint(size);
+}
+
+template <typename CompressingWriter>
+Chain Compress(const std::string& input, int level) {
+  Chain compressed;
+  CompressingWriter writer(
+      riegeli::make_unique<ChainWriter>(&compressed),
+      WriterOptions<CompressingWriter>(level, input.size()));
+  if (!writer.Write(input)) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  return compressed;
+}
+
+template <typename CompressingWriter>
+void BM_Compress(benchmark::State& state) {
+  const int level = IntCast<int>(state.range(0));
+  const std::string input = Input(state.range(1));
+  size_t compressed_size = 0;
+  for (auto _ : state) {
+    compressed_size = Compress<CompressingWriter>(input, level).size();
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * input.size()));
+  state.counters["ratio"] =
+      static_cast<double>(input.size()) / static_cast<double>(compressed_size);
+}
+
+template <typename CompressingWriter, typename DecompressingReader>
+void BM_Decompress(benchmark::State& state) {
+  const int level = IntCast<int>(state.range(0));
+  const std::string input = Input(state.range(1));
+  const Chain compressed = Compress<CompressingWriter>(input, level);
+  std::string output;
+  for (auto _ : state) {
+    DecompressingReader reader(riegeli::make_unique<ChainReader>(&compressed));
+    output.clear();
+    if (!reader.Read(&output, input.size())) {
+      state.SkipWithError(reader.Message().c_str());
+      break;
+    }
+    if (!reader.VerifyEndAndClose()) {
+      state.SkipWithError(reader.Message().c_str());
+      break;
+    }
+  }
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * input.size()));
+}
+
+void BrotliLevels(benchmark::internal::Benchmark* b) {
+  for (int64_t level = 0; level <= 11; ++level) {
+    for (int64_t kind = 0; kind <= 1; ++kind) b->Args({level, kind});
+  }
+}
+
+void ZstdLevels(benchmark::internal::Benchmark* b) {
+  for (int64_t level = 1; level <= 22; ++level) {
+    for (int64_t kind = 0; kind <= 1; ++kind) b->Args({level, kind});
+  }
+}
+
+void Lz4Levels(benchmark::internal::Benchmark* b) {
+  for (int64_t level = 0; level <= 12; ++level) {
+    for (int64_t kind = 0; kind <= 1; ++kind) b->Args({level, kind});
+  }
+}
+
+// Snappy has no compression levels.
+void SnappyLevels(benchmark::internal::Benchmark* b) {
+  for (int64_t kind = 0; kind <= 1; ++kind) b->Args({0, kind});
+}
+
+BENCHMARK_TEMPLATE(BM_Compress, BrotliWriter)->Apply(BrotliLevels);
+BENCHMARK_TEMPLATE(BM_Decompress, BrotliWriter, BrotliReader)
+    ->Apply(BrotliLevels);
+BENCHMARK_TEMPLATE(BM_Compress, ZstdWriter)->Apply(ZstdLevels);
+BENCHMARK_TEMPLATE(BM_Decompress, ZstdWriter, ZstdReader)->Apply(ZstdLevels);
+BENCHMARK_TEMPLATE(BM_Compress, Lz4Writer)->Apply(Lz4Levels);
+BENCHMARK_TEMPLATE(BM_Decompress, Lz4Writer, Lz4Reader)->Apply(Lz4Levels);
+BENCHMARK_TEMPLATE(BM_Compress, SnappyWriter)->Apply(SnappyLevels);
+BENCHMARK_TEMPLATE(BM_Decompress, SnappyWriter, SnappyReader)
+    ->Apply(SnappyLevels);
+
+}  // namespace
+}  // namespace riegeli
@@ -0,0 +1,218 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/benchmarks/synthetic_corpus.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/string_writer.h"
+#include "riegeli/bytes/writer_utils.h"
+
+namespace riegeli {
+
+namespace {
+
+// SplitMix64. Unlike std::uniform_int_distribution, its output is specified
+// exactly, so corpora are reproducible across standard libraries.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (state_ += uint64_t{0x9e3779b97f4a7c15});
+    z = (z ^ (z >> 30)) * uint64_t{0xbf58476d1ce4e5b9};
+    z = (z ^ (z >> 27)) * uint64_t{0x94d049bb133111eb};
+    return z ^ (z >> 31);
+  }
+
+  // Returns a value in [0, bound).
+  uint64_t Uniform(uint64_t bound) { return Next() % bound; }
+
+  // Returns a value in [0, bound) biased towards small values.
+  uint64_t Skewed(uint64_t bound) {
+    return Uniform(Uniform(bound) + 1);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+const char* const kWords[] = {
+    "the",     "of",      "and",       "to",       "in",       "record",
+    "chunk",   "block",   "writer",    "reader",   "message",  "field",
+    "value",   "index",   "position",  "buffer",   "stream",   "file",
+    "data",    "size",    "compress",  "decode",   "encode",   "bucket",
+    "state",   "machine", "transpose", "varint",   "string",   "nested",
+    "proto",   "repeated"};
+constexpr size_t kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+
+enum class WireType : uint32_t {
+  kVarint = 0,
+  kFixed64 = 1,
+  kLengthDelimited = 2,
+  kFixed32 = 5,
+};
+
+void WriteTag(Writer* dest, uint32_t field, WireType wire_type) {
+  WriteVarint32(dest, (field << 3) | static_cast<uint32_t>(wire_type));
+}
+
+void WriteLengthDelimited(Writer* dest, uint32_t field, string_view value) {
+  WriteTag(dest, field, WireType::kLengthDelimited);
+  WriteVarint64(dest, value.size());
+  dest->Write(value);
+}
+
+void WriteFixed32(Writer* dest, uint32_t field, uint32_t value) {
+  WriteTag(dest, field, WireType::kFixed32);
+  const uint32_t word = WriteLittleEndian32(value);
+  dest->Write(string_view(reinterpret_cast<const char*>(&word), sizeof(word)));
+}
+
+void WriteFixed64(Writer* dest, uint32_t field, uint64_t value) {
+  WriteTag(dest, field, WireType::kFixed64);
+  const uint64_t word = WriteLittleEndian64(value);
+  dest->Write(string_view(reinterpret_cast<const char*>(&word), sizeof(word)));
+}
+
+std::string Words(Random* random, size_t num_words) {
+  std::string result;
+  for (size_t i = 0; i < num_words; ++i) {
+    if (i > 0) result += ' ';
+    result += kWords[random->Skewed(kNumWords)];
+  }
+  return result;
+}
+
+std::string NestedMessage(Random* random) {
+  std::string message;
+  StringWriter writer(&message);
+  WriteLengthDelimited(&writer, 1,
+                       "key_" + std::to_string(random->Uniform(64)));
+  // A double in [0, 1) with 53 random bits.
+  const double score =
+      static_cast<double>(random->Next() >> 11) * (1.0 / 9007199254740992.0);
+  uint64_t score_bits;
+  memcpy(&score_bits, &score, sizeof(score_bits));
+  WriteFixed64(&writer, 2, score_bits);
+  if (random->Uniform(4) != 0) {
+    WriteTag(&writer, 3, WireType::kVarint);
+    WriteVarint32(&writer, IntCast<uint32_t>(random->Uniform(2)));
+  }
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  return message;
+}
+
+}  // namespace
+
+std::vector<std::string> SyntheticProtoCorpus(size_t num_records,
+                                              uint64_t seed) {
+  Random random(seed);
+  std::vector<std::string> records;
+  records.reserve(num_records);
+  uint64_t id = random.Uniform(uint64_t{1} << 40);
+  for (size_t i = 0; i < num_records; ++i) {
+    std::string record;
+    StringWriter writer(&record);
+    id += 1 + random.Skewed(1000);
+    WriteTag(&writer, 1, WireType::kVarint);
+    WriteVarint64(&writer, id);
+    WriteLengthDelimited(&writer, 2, Words(&random, 1 + random.Uniform(8)));
+    const size_t num_values = IntCast<size_t>(random.Skewed(16));
+    for (size_t j = 0; j < num_values; ++j) {
+      WriteTag(&writer, 3, WireType::kVarint);
+      WriteVarint32(&writer, IntCast<uint32_t>(random.Skewed(1 << 20)));
+    }
+    if (random.Uniform(8) != 0) {
+      WriteLengthDelimited(&writer, 4, NestedMessage(&random));
+    }
+    WriteFixed32(&writer, 5, static_cast<uint32_t>(random.Next()));
+    const size_t num_deltas = IntCast<size_t>(random.Skewed(32));
+    if (num_deltas > 0) {
+      std::string deltas;
+      StringWriter deltas_writer(&deltas);
+      for (size_t j = 0; j < num_deltas; ++j) {
+        const int64_t delta = static_cast<int64_t>(random.Skewed(1 << 16)) -
+                              int64_t{1 << 15};
+        // ZigZag encoding of sint64.
+        WriteVarint64(&deltas_writer, (static_cast<uint64_t>(delta) << 1) ^
+                                          static_cast<uint64_t>(delta >> 63));
+      }
+      if (!deltas_writer.Close()) {
+        RIEGELI_ASSERT_UNREACHABLE() << deltas_writer.Message();
+      }
+      WriteLengthDelimited(&writer, 6, deltas);
+    }
+    if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+std::string SyntheticText(size_t size, uint64_t seed) {
+  Random random(seed);
+  std::string text;
+  text.reserve(size + 16);
+  while (text.size() < size) {
+    text += Words(&random, 4 + random.Uniform(12));
+    text += random.Uniform(8) == 0 ? ".\n" : ". ";
+  }
+  text.resize(size);
+  return text;
+}
+
+std::vector<uint64_t> SyntheticVarints(size_t num_values,
+                                       size_t max_varint_length,
+                                       uint64_t seed) {
+  RIEGELI_ASSERT_GT(max_varint_length, 0u)
+      << "Failed precondition of SyntheticVarints(): zero varint length";
+  RIEGELI_ASSERT_LE(max_varint_length, 10u)
+      << "Failed precondition of SyntheticVarints(): varint length too large";
+  Random random(seed);
+  std::vector<uint64_t> values;
+  values.reserve(num_values);
+  for (size_t i = 0; i < num_values; ++i) {
+    const size_t length =
+        1 + IntCast<size_t>(random.Uniform(max_varint_length));
+    // A varint of length bytes holds a value with between 7 * (length - 1) + 1
+    // and 7 * length significant bits.
+    const size_t bits = length == 10 ? 64 : 7 * length;
+    uint64_t value = random.Next() >> (64 - bits);
+    if (length > 1) value |= uint64_t{1} << (7 * (length - 1));
+    values.push_back(value);
+  }
+  return values;
+}
+
+Chain ConcatenateRecords(const std::vector<std::string>& records) {
+  Chain result;
+  for (const std::string& record : records) result.Append(record);
+  return result;
+}
+
+size_t TotalSize(const std::vector<std::string>& records) {
+  size_t total_size = 0;
+  for (const std::string& record : records) total_size += record.size();
+  return total_size;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,70 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BENCHMARKS_SYNTHETIC_CORPUS_H_
+#define RIEGELI_BENCHMARKS_SYNTHETIC_CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// Synthetic inputs for microbenchmarks. They are generated from a seed with a
+// fixed algorithm, so that the same seed always gives the same bytes, on every
+// platform and with every standard library.
+
+// Returns num_records serialized proto messages of the following type:
+//
+//   message Record {
+//     optional uint64 id = 1;                // increasing, small deltas
+//     optional string name = 2;              // words from a small vocabulary
+//     repeated uint32 values = 3;            // 0 to 15 values, not packed
+//     optional Nested nested = 4;
+//     optional fixed32 checksum = 5;         // random
+//     repeated sint64 deltas = 6 [packed = true];
+//   }
+//
+//   message Nested {
+//     optional string key = 1;               // one of 64 distinct keys
+//     optional double score = 2;
+//     optional bool flag = 3;
+//   }
+//
+// The message is not compiled; the wire format is generated directly.
+std::vector<std::string> SyntheticProtoCorpus(size_t num_records,
+                                              uint64_t seed = 1);
+
+// Returns size bytes of text-like data with compressibility similar to natural
+// language.
+std::string SyntheticText(size_t size, uint64_t seed = 1);
+
+// Returns num_values varints whose encoded length is uniformly distributed
+// between 1 and max_varint_length bytes (at most 10).
+std::vector<uint64_t> SyntheticVarints(size_t num_values,
+                                       size_t max_varint_length,
+                                       uint64_t seed = 1);
+
+// Returns the concatenation of records.
+Chain ConcatenateRecords(const std::vector<std::string>& records);
+
+// Returns the total size of records.
+size_t TotalSize(const std::vector<std::string>& records);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BENCHMARKS_SYNTHETIC_CORPUS_H_
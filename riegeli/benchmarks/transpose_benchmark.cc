@@ -0,0 +1,163 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+#include "riegeli/bytes/chain_backward_writer.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/chunk_encoding/transpose_decoder.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kNumRecords = 10000;
+
+// Values of state.range(0) selecting the compression of buckets.
+enum Compression : int64_t {
+  kNone = 0,
+  kBrotli = 1,
+  kZstd = 2,
+  kLz4 = 3,
+  kSnappy = 4
+};
+
+void SetUpEncoder(int64_t compression, TransposeEncoder* encoder) {
+  switch (compression) {
+    case kNone:
+      return;
+    case kBrotli:
+      encoder->EnableBrotliCompression(6);
+      return;
+    case kZstd:
+      encoder->EnableZstdCompression(3);
+      return;
+    case kLz4:
+      encoder->EnableLz4Compression(0);
+      return;
+    case kSnappy:
+      encoder->EnableSnappyCompression();
+      return;
+  }
+  RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression: " << compression;
+}
+
+Chain Encode(const std::vector<std::string>& records, int64_t compression,
+             size_t bucket_size) {
+  TransposeEncoder encoder;
+  SetUpEncoder(compression, &encoder);
+  encoder.SetDesiredBucketSize(bucket_size);
+  for (const std::string& record : records) encoder.AddMessage(record);
+  Chain encoded;
+  ChainWriter writer(&encoded);
+  if (!encoder.Encode(&writer)) RIEGELI_ASSERT_UNREACHABLE();
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  return encoded;
+}
+
+void BM_TransposeEncode(benchmark::State& state) {
+  const std::vector<std::string> records = SyntheticProtoCorpus(kNumRecords);
+  TransposeEncoder encoder;
+  SetUpEncoder(state.range(0), &encoder);
+  size_t encoded_size = 0;
+  for (auto _ : state) {
+    encoder.Reset();
+    for (const std::string& record : records) encoder.AddMessage(record);
+    Chain encoded;
+    ChainWriter writer(&encoded);
+    if (!encoder.Encode(&writer)) {
+      state.SkipWithError("Encode() failed");
+      break;
+    }
+    if (!writer.Close()) {
+      state.SkipWithError(writer.Message().c_str());
+      break;
+    }
+    encoded_size = encoded.size();
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumRecords));
+  state.SetBytesProcessed(
+      IntCast<int64_t>(state.iterations() * TotalSize(records)));
+  state.counters["encoded_bytes"] = static_cast<double>(encoded_size);
+}
+BENCHMARK(BM_TransposeEncode)
+    ->Arg(kNone)
+    ->Arg(kBrotli)
+    ->Arg(kZstd)
+    ->Arg(kLz4)
+    ->Arg(kSnappy);
+
+// state.range(1) selects the field filter:
+//  * 0 - all fields
+//  * 1 - Record.id only
+//  * 2 - Record.nested.key only
+void BM_TransposeDecode(benchmark::State& state) {
+  const std::vector<std::string> records = SyntheticProtoCorpus(kNumRecords);
+  const Chain encoded = Encode(records, state.range(0), size_t{64} << 10);
+  FieldFilter field_filter = FieldFilter::All();
+  switch (state.range(1)) {
+    case 0:
+      break;
+    case 1:
+      field_filter = FieldFilter({{1}});
+      break;
+    case 2:
+      field_filter = FieldFilter({{4, 1}});
+      break;
+  }
+  size_t decoded_size = 0;
+  for (auto _ : state) {
+    ChainReader reader(&encoded);
+    TransposeDecoder decoder;
+    if (!decoder.Initialize(&reader, field_filter)) {
+      state.SkipWithError("Initialize() failed");
+      break;
+    }
+    Chain decoded;
+    ChainBackwardWriter writer(&decoded);
+    std::vector<size_t> boundaries;
+    if (!decoder.Decode(&writer, &boundaries)) {
+      state.SkipWithError("Decode() failed");
+      break;
+    }
+    if (!writer.Close()) {
+      state.SkipWithError(writer.Message().c_str());
+      break;
+    }
+    decoded_size = decoded.size();
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumRecords));
+  state.SetBytesProcessed(
+      IntCast<int64_t>(state.iterations() * TotalSize(records)));
+  state.counters["decoded_bytes"] = static_cast<double>(decoded_size);
+}
+BENCHMARK(BM_TransposeDecode)->Apply([](benchmark::internal::Benchmark* b) {
+  for (const int64_t compression : {kNone, kBrotli, kZstd, kLz4, kSnappy}) {
+    for (const int64_t field_filter : {0, 1, 2}) {
+      b->Args({compression, field_filter});
+    }
+  }
+});
+
+}  // namespace
+}  // namespace riegeli
@@ -0,0 +1,94 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "riegeli/base/base.h"
+#include "riegeli/benchmarks/synthetic_corpus.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/string_reader.h"
+#include "riegeli/bytes/string_writer.h"
+#include "riegeli/bytes/writer_utils.h"
+
+namespace riegeli {
+namespace {
+
+constexpr size_t kNumValues = size_t{1} << 16;
+
+// state.range(0) is the maximum encoded length of a varint.
+void BM_WriteVarint64(benchmark::State& state) {
+  const std::vector<uint64_t> values =
+      SyntheticVarints(kNumValues, IntCast<size_t>(state.range(0)));
+  std::string dest;
+  for (auto _ : state) {
+    dest.clear();
+    StringWriter writer(&dest);
+    for (const uint64_t value : values) WriteVarint64(&writer, value);
+    if (!writer.Close()) {
+      state.SkipWithError(writer.Message().c_str());
+      break;
+    }
+    benchmark::DoNotOptimize(dest);
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumValues));
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * dest.size()));
+}
+BENCHMARK(BM_WriteVarint64)->DenseRange(1, 10, 3);
+
+void BM_ReadVarint64(benchmark::State& state) {
+  const std::vector<uint64_t> values =
+      SyntheticVarints(kNumValues, IntCast<size_t>(state.range(0)));
+  std::string src;
+  StringWriter writer(&src);
+  for (const uint64_t value : values) WriteVarint64(&writer, value);
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  for (auto _ : state) {
+    StringReader reader(&src);
+    uint64_t sum = 0;
+    uint64_t value;
+    while (ReadVarint64(&reader, &value)) sum += value;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumValues));
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * src.size()));
+}
+BENCHMARK(BM_ReadVarint64)->DenseRange(1, 10, 3);
+
+void BM_ReadVarint32(benchmark::State& state) {
+  const std::vector<uint64_t> values =
+      SyntheticVarints(kNumValues, IntCast<size_t>(state.range(0)));
+  std::string src;
+  StringWriter writer(&src);
+  for (const uint64_t value : values) {
+    WriteVarint32(&writer, static_cast<uint32_t>(value));
+  }
+  if (!writer.Close()) RIEGELI_ASSERT_UNREACHABLE() << writer.Message();
+  for (auto _ : state) {
+    StringReader reader(&src);
+    uint32_t sum = 0;
+    uint32_t value;
+    while (ReadVarint32(&reader, &value)) sum += value;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(IntCast<int64_t>(state.iterations() * kNumValues));
+  state.SetBytesProcessed(IntCast<int64_t>(state.iterations() * src.size()));
+}
+BENCHMARK(BM_ReadVarint32)->DenseRange(1, 5, 2);
+
+}  // namespace
+}  // namespace riegeli
@@ -37,6 +37,7 @@
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/huge_pages.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/str_error.h"
 #include "riegeli/base/string_view.h"
@@ -394,18 +395,24 @@ FdMMapReader::FdMMapReader(FdMMapReader&& src) noexcept
     : Reader(std::move(src)),
       filename_(riegeli::exchange(src.filename_, std::string())),
       error_code_(riegeli::exchange(src.error_code_, 0)),
-      contents_(riegeli::exchange(src.contents_, Chain())) {}
+      contents_(riegeli::exchange(src.contents_, Chain())),
+      advised_begin_(riegeli::exchange(src.advised_begin_, 0)),
+      advised_end_(riegeli::exchange(src.advised_end_, 0)) {}
 
 FdMMapReader& FdMMapReader::operator=(FdMMapReader&& src) noexcept {
   Reader::operator=(std::move(src)),
   filename_ = riegeli::exchange(src.filename_, std::string());
   error_code_ = riegeli::exchange(src.error_code_, 0);
   contents_ = riegeli::exchange(src.contents_, Chain());
+  advised_begin_ = riegeli::exchange(src.advised_begin_, 0);
+  advised_end_ = riegeli::exchange(src.advised_end_, 0);
   return *this;
 }
 
 void FdMMapReader::Done() {
   contents_ = Chain();
+  advised_begin_ = 0;
+  advised_end_ = 0;
   // filename_ and error_code_ are not cleared.
   Reader::Done();
 }
@@ -431,6 +438,13 @@ inline void FdMMapReader::Initialize(int fd, Options options) {
       FailOperation("mmap()", error_code);
       return;
     }
+    if (options.sequential_) {
+      // Failure is ignored because this is only a hint.
+      madvise(data, IntCast<size_t>(stat_info.st_size), MADV_SEQUENTIAL);
+    }
+    if (options.huge_pages_) {
+      AdviseHugePages(data, IntCast<size_t>(stat_info.st_size));
+    }
     contents_.AppendExternal(MMapRef(data, IntCast<size_t>(stat_info.st_size)));
     start_ = iter()->data();
     cursor_ = iter()->data();
@@ -521,6 +535,29 @@ bool FdMMapReader::Size(Position* size) const {
   return true;
 }
 
+void FdMMapReader::ReadHint(Position length) {
+  if (RIEGELI_UNLIKELY(!healthy()) || contents_.blocks().empty()) return;
+  static const Position kPageSize = IntCast<Position>(sysconf(_SC_PAGESIZE));
+  const Position begin = pos();
+  const Position end = begin + UnsignedMin(length, contents_.size() - begin);
+  Position advise_begin;
+  if (begin >= advised_begin_ && begin <= advised_end_) {
+    // Extend the range advised before.
+    if (end <= advised_end_) return;
+    advise_begin = advised_end_;
+  } else {
+    advise_begin = begin - begin % kPageSize;
+    advised_begin_ = advise_begin;
+  }
+  const Position advise_end =
+      end + (kPageSize - end % kPageSize) % kPageSize;
+  if (advise_end <= advise_begin) return;
+  // Failure is ignored because this is only a hint.
+  madvise(const_cast<char*>(start_) + advise_begin,
+          IntCast<size_t>(advise_end - advise_begin), MADV_WILLNEED);
+  advised_end_ = advise_end;
+}
+
 bool FdMMapReader::HopeForMoreSlow() const {
   RIEGELI_ASSERT_EQ(available(), 0u)
       << "Failed precondition of Reader::HopeForMoreSlow(): "
@@ -272,10 +272,39 @@ class FdMMapReader final : public Reader {
       return std::move(set_owns_fd(owns_fd));
     }
 
+    // If true, the mapping is advised with MADV_SEQUENTIAL: the kernel reads
+    // ahead aggressively and may free pages soon after they are accessed. This
+    // suits reading the file once from the beginning to the end.
+    //
+    // Default: false.
+    Options& set_sequential(bool sequential) & {
+      sequential_ = sequential;
+      return *this;
+    }
+    Options&& set_sequential(bool sequential) && {
+      return std::move(set_sequential(sequential));
+    }
+
+    // If true, the mapping is advised with MADV_HUGEPAGE, so that the kernel
+    // may back it with transparent huge pages, which reduces TLB misses when a
+    // large file is read. This takes effect only if the filesystem supports
+    // huge pages for the page cache; otherwise it is ignored.
+    //
+    // Default: false.
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
    private:
     friend class FdMMapReader;
 
     bool owns_fd_ = true;
+    bool sequential_ = false;
+    bool huge_pages_ = false;
   };
 
   // Creates a closed FdMMapReader.
@@ -301,6 +330,10 @@ class FdMMapReader final : public Reader {
   bool SupportsRandomAccess() const override { return true; }
   bool Size(Position* size) const override;
 
+  // Advises the kernel with MADV_WILLNEED to start reading the pages of the
+  // given range which are not resident yet.
+  void ReadHint(Position length) override;
+
  protected:
   void Done() override;
   bool PullSlow() override;
@@ -327,6 +360,10 @@ class FdMMapReader final : public Reader {
   // Invariant: if healthy() then error_code_ == 0
   int error_code_ = 0;
   Chain contents_;
+  // The range of positions which have already been advised by ReadHint(),
+  // aligned to page boundaries.
+  Position advised_begin_ = 0;
+  Position advised_end_ = 0;
 
   // Invariants:
   //   start_ == (contents_.blocks().empty() ? nullptr : iter()->data())
@@ -0,0 +1,315 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make pread() available, and O_DIRECT on Linux.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/fd_uring_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/str_error.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/fd_holder.h"
+#include "riegeli/bytes/io_uring.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+FdUringReader::FdUringReader() noexcept : Reader(State::kClosed) {}
+
+FdUringReader::FdUringReader(int fd, Options options)
+    : Reader(State::kOpen),
+      owned_fd_(options.owns_fd_ ? fd : -1),
+      fd_(fd),
+      filename_(fd == 0 ? "/dev/stdin"
+                        : "/proc/self/fd/" + std::to_string(fd)) {
+  RIEGELI_ASSERT_GE(fd, 0)
+      << "Failed precondition of FdUringReader::FdUringReader(int): "
+         "negative file descriptor";
+  Initialize(options.buffer_size_, options.queue_depth_);
+}
+
+FdUringReader::FdUringReader(std::string filename, int flags, Options options)
+    : Reader(State::kOpen), filename_(std::move(filename)) {
+  RIEGELI_ASSERT(options.owns_fd_)
+      << "Failed precondition of FdUringReader::FdUringReader(string): "
+         "file must be owned if FdUringReader opens it";
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of FdUringReader::FdUringReader(string): "
+         "flags must include O_RDONLY or O_RDWR";
+#ifdef O_DIRECT
+  if (options.direct_io_) flags |= O_DIRECT;
+#endif
+again:
+  fd_ = open(filename_.c_str(), flags, 0666);
+  if (RIEGELI_UNLIKELY(fd_ < 0)) {
+    const int error_code = errno;
+    if (error_code == EINTR) goto again;
+    FailOperation("open()", error_code);
+    return;
+  }
+  owned_fd_ = internal::FdHolder(fd_);
+  Initialize(options.buffer_size_, options.queue_depth_);
+}
+
+FdUringReader::FdUringReader(FdUringReader&& src) noexcept
+    : Reader(std::move(src)),
+      owned_fd_(std::move(src.owned_fd_)),
+      fd_(riegeli::exchange(src.fd_, -1)),
+      filename_(riegeli::exchange(src.filename_, std::string())),
+      error_code_(riegeli::exchange(src.error_code_, 0)),
+      window_size_(riegeli::exchange(src.window_size_, 0)),
+      windows_(riegeli::exchange(src.windows_, std::vector<Window>())),
+      ring_(std::move(src.ring_)) {}
+
+FdUringReader& FdUringReader::operator=(FdUringReader&& src) noexcept {
+  // Destroy the ring first, waiting for reads in flight to windows_.
+  ring_ = std::move(src.ring_);
+  Reader::operator=(std::move(src));
+  owned_fd_ = std::move(src.owned_fd_);
+  fd_ = riegeli::exchange(src.fd_, -1);
+  filename_ = riegeli::exchange(src.filename_, std::string());
+  error_code_ = riegeli::exchange(src.error_code_, 0);
+  window_size_ = riegeli::exchange(src.window_size_, 0);
+  windows_ = riegeli::exchange(src.windows_, std::vector<Window>());
+  return *this;
+}
+
+FdUringReader::~FdUringReader() = default;
+
+inline void FdUringReader::Initialize(size_t buffer_size, int queue_depth) {
+  window_size_ = RoundUp<internal::kDirectIoAlignment>(UnsignedMin(
+      buffer_size, size_t{std::numeric_limits<uint32_t>::max()} -
+                       internal::kDirectIoAlignment));
+  windows_.resize(IntCast<size_t>(queue_depth) + 1);
+  if (queue_depth > 0) {
+    ring_ = internal::IoUring::Create(IntCast<unsigned>(queue_depth) + 1);
+  }
+}
+
+void FdUringReader::Done() {
+  // Wait for reads in flight before freeing their buffers.
+  ring_.reset();
+  windows_ = std::vector<Window>();
+  const int error_code = owned_fd_.Close();
+  if (RIEGELI_UNLIKELY(error_code != 0) && RIEGELI_LIKELY(healthy())) {
+    FailOperation(internal::FdHolder::CloseFunctionName(), error_code);
+  }
+  // filename_ and error_code_ are not cleared.
+  window_size_ = 0;
+  Reader::Done();
+}
+
+bool FdUringReader::FailOperation(string_view operation, int error_code) {
+  error_code_ = error_code;
+  return Fail(std::string(operation) + " failed: " + StrError(error_code) +
+              ", reading " + filename_);
+}
+
+bool FdUringReader::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  // If the current window is full, this loads the next window. Otherwise this
+  // reads the current window again, in case the file has grown.
+  const Position index = limit_pos_ / window_size_;
+  const size_t offset = IntCast<size_t>(limit_pos_ % window_size_);
+  if (RIEGELI_UNLIKELY(!LoadWindow(index))) return false;
+  cursor_ = start_ + UnsignedMin(offset, buffer_size());
+  return available() > 0;
+}
+
+bool FdUringReader::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos_)
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  bool seek_ok = true;
+  if (new_pos > limit_pos_) {
+    // Seeking forwards.
+    struct stat stat_info;
+    if (RIEGELI_UNLIKELY(fstat(fd_, &stat_info) < 0)) {
+      return FailOperation("fstat()", errno);
+    }
+    if (RIEGELI_UNLIKELY(new_pos > IntCast<Position>(stat_info.st_size))) {
+      // File ends.
+      new_pos = IntCast<Position>(stat_info.st_size);
+      seek_ok = false;
+    }
+  }
+  if (RIEGELI_UNLIKELY(!LoadWindow(new_pos / window_size_))) return false;
+  const size_t offset = IntCast<size_t>(new_pos % window_size_);
+  if (RIEGELI_UNLIKELY(offset > buffer_size())) {
+    // File has been truncated.
+    cursor_ = limit_;
+    return false;
+  }
+  cursor_ = start_ + offset;
+  return seek_ok;
+}
+
+bool FdUringReader::Size(Position* size) const {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  struct stat stat_info;
+  const int result = fstat(fd_, &stat_info);
+  if (RIEGELI_UNLIKELY(result < 0)) return false;
+  *size = IntCast<Position>(stat_info.st_size);
+  return true;
+}
+
+inline bool FdUringReader::LoadWindow(Position index) {
+  if (RIEGELI_UNLIKELY(index >= Position{std::numeric_limits<off_t>::max()} /
+                                    window_size_)) {
+    return FailOverflow();
+  }
+  Window* const window = &windows_[IntCast<size_t>(index % windows_.size())];
+  // A window which ended before window_size_ was at the end of file, which
+  // might have grown since then, so it is read again.
+  if (window->index != index ||
+      (!window->in_flight && window->length < window_size_)) {
+    if (RIEGELI_UNLIKELY(!WaitForWindow(window))) return false;
+    StartRead(index, window);
+  }
+  if (RIEGELI_UNLIKELY(!WaitForWindow(window))) return false;
+  if (RIEGELI_UNLIKELY(window->error_code != 0)) {
+    const int error_code = window->error_code;
+    window->index = kNoWindow();
+    return FailOperation(ring_ != nullptr ? "io_uring read" : "pread()",
+                         error_code);
+  }
+  if (window->length == window_size_) {
+    if (RIEGELI_UNLIKELY(!ReadAhead(index))) return false;
+  }
+  start_ = window->buffer.GetData(window_size_);
+  cursor_ = start_;
+  limit_ = start_ + window->length;
+  limit_pos_ = index * window_size_ + window->length;
+  return true;
+}
+
+inline void FdUringReader::StartRead(Position index, Window* window) {
+  RIEGELI_ASSERT(!window->in_flight)
+      << "Failed precondition of FdUringReader::StartRead(): "
+         "read already in flight";
+  window->index = index;
+  window->length = 0;
+  window->error_code = 0;
+  char* const dest = window->buffer.GetData(window_size_);
+  const off_t offset = IntCast<off_t>(index * window_size_);
+  if (ring_ != nullptr) {
+    ring_->PrepareRead(fd_, dest, window_size_, offset,
+                       IntCast<uint64_t>(window - windows_.data()));
+    window->in_flight = true;
+    return;
+  }
+  do {
+  again:
+    const ssize_t result =
+        pread(fd_, dest + window->length, window_size_ - window->length,
+              offset + IntCast<off_t>(window->length));
+    if (RIEGELI_UNLIKELY(result < 0)) {
+      const int error_code = errno;
+      if (error_code == EINTR) goto again;
+      window->error_code = error_code;
+      return;
+    }
+    if (result == 0) return;
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result), window_size_ - window->length)
+        << "pread() read more than requested";
+    window->length += IntCast<size_t>(result);
+  } while (window->length < window_size_);
+}
+
+inline bool FdUringReader::ReadAhead(Position index) {
+  if (ring_ == nullptr) return true;
+  for (size_t i = 1; i < windows_.size(); ++i) {
+    const Position next_index = index + i;
+    if (RIEGELI_UNLIKELY(next_index >=
+                         Position{std::numeric_limits<off_t>::max()} /
+                             window_size_)) {
+      break;
+    }
+    Window* const window =
+        &windows_[IntCast<size_t>(next_index % windows_.size())];
+    // A window still in flight for a different index is left alone rather
+    // than waited for; LoadWindow() handles it if it is needed.
+    if (window->index == next_index || window->in_flight) continue;
+    StartRead(next_index, window);
+  }
+  const int error_code = ring_->Submit(false);
+  if (RIEGELI_UNLIKELY(error_code != 0)) {
+    return FailOperation("io_uring_enter()", error_code);
+  }
+  return true;
+}
+
+inline bool FdUringReader::WaitForWindow(Window* window) {
+  while (window->in_flight) {
+    if (RIEGELI_UNLIKELY(!ProcessCompletions(true))) return false;
+  }
+  return true;
+}
+
+bool FdUringReader::ProcessCompletions(bool wait) {
+  const int error_code = ring_->Submit(wait);
+  if (RIEGELI_UNLIKELY(error_code != 0)) {
+    return FailOperation("io_uring_enter()", error_code);
+  }
+  uint64_t user_data;
+  int32_t result;
+  while (ring_->PopCompletion(&user_data, &result)) {
+    Window* const window = &windows_[IntCast<size_t>(user_data)];
+    RIEGELI_ASSERT(window->in_flight)
+        << "Completion of a read which is not in flight";
+    if (RIEGELI_UNLIKELY(result == -EAGAIN || result == -EINTR)) {
+      ring_->PrepareRead(fd_, window->buffer.GetData(window_size_),
+                         window_size_,
+                         IntCast<off_t>(window->index * window_size_),
+                         user_data);
+      continue;
+    }
+    window->in_flight = false;
+    if (RIEGELI_UNLIKELY(result < 0)) {
+      window->error_code = -result;
+    } else {
+      RIEGELI_ASSERT_LE(IntCast<size_t>(result), window_size_)
+          << "io_uring read more than requested";
+      window->length = IntCast<size_t>(result);
+    }
+  }
+  return true;
+}
+
+}  // namespace riegeli
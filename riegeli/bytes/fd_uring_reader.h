@@ -0,0 +1,209 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_FD_URING_READER_H_
+#define RIEGELI_BYTES_FD_URING_READER_H_
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/fd_holder.h"
+#include "riegeli/bytes/io_uring.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// A Reader which reads from a file descriptor, keeping several reads of the
+// following parts of the file in flight through Linux io_uring while the
+// current part is being consumed. It supports random access; the file
+// descriptor must support pread() and fstat().
+//
+// The file is read in windows of buffer_size bytes aligned to multiples of
+// buffer_size, so the file descriptor may be opened with O_DIRECT.
+//
+// If io_uring is not available, FdUringReader falls back to reading each window
+// with pread() when it is needed.
+//
+// Multiple FdUringReaders can read concurrently from the same fd. Reads occur
+// at the position managed by the FdUringReader.
+class FdUringReader final : public Reader {
+ public:
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    constexpr Options() noexcept {}
+
+    // If true, the fd will be owned by the FdUringReader and will be closed
+    // when the FdUringReader is closed.
+    //
+    // If false, the fd must be alive until closing the FdUringReader.
+    //
+    // Default: true.
+    Options& set_owns_fd(bool owns_fd) & {
+      owns_fd_ = owns_fd;
+      return *this;
+    }
+    Options&& set_owns_fd(bool owns_fd) && {
+      return std::move(set_owns_fd(owns_fd));
+    }
+
+    // Size of a window. It is rounded up to a multiple of 4096.
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "FdUringReader::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Number of windows following the current one which are being read in the
+    // background.
+    //
+    // 0 disables read-ahead.
+    //
+    // Default: 4.
+    Options& set_queue_depth(int queue_depth) & {
+      RIEGELI_ASSERT_GE(queue_depth, 0)
+          << "Failed precondition of "
+             "FdUringReader::Options::set_queue_depth(): "
+             "negative queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(int queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+
+    // If true, FdUringReader opens the file with O_DIRECT, bypassing the page
+    // cache. This is relevant only when FdUringReader opens the file; a given
+    // fd may already be opened with O_DIRECT.
+    //
+    // Default: false.
+    Options& set_direct_io(bool direct_io) & {
+      direct_io_ = direct_io;
+      return *this;
+    }
+    Options&& set_direct_io(bool direct_io) && {
+      return std::move(set_direct_io(direct_io));
+    }
+
+   private:
+    friend class FdUringReader;
+
+    bool owns_fd_ = true;
+    size_t buffer_size_ = kDefaultBufferSize();
+    int queue_depth_ = 4;
+    bool direct_io_ = false;
+  };
+
+  // Creates a closed FdUringReader.
+  //
+  // Not defaulted because string::string() is not noexcept before C++17.
+  FdUringReader() noexcept;
+
+  // Will read from fd, starting at its beginning.
+  explicit FdUringReader(int fd, Options options = Options());
+
+  // Opens a file for reading.
+  //
+  // flags is the second argument of open, typically O_RDONLY.
+  //
+  // flags must include O_RDONLY or O_RDWR.
+  // options.set_owns_fd(false) must not be used.
+  FdUringReader(std::string filename, int flags, Options options = Options());
+
+  FdUringReader(FdUringReader&& src) noexcept;
+  FdUringReader& operator=(FdUringReader&& src) noexcept;
+
+  ~FdUringReader();
+
+  const std::string& filename() const { return filename_; }
+  int error_code() const { return error_code_; }
+
+  // Returns true if reads are performed through io_uring, false if they fall
+  // back to pread().
+  bool uses_io_uring() const { return ring_ != nullptr; }
+
+  bool SupportsRandomAccess() const override { return true; }
+  bool Size(Position* size) const override;
+
+ protected:
+  void Done() override;
+  bool PullSlow() override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  static constexpr Position kNoWindow() {
+    return std::numeric_limits<Position>::max();
+  }
+
+  struct Window {
+    internal::DirectIoBuffer buffer;
+    // Index of the window in the file, i.e. its position divided by
+    // window_size_, or kNoWindow() if none.
+    Position index = kNoWindow();
+    bool in_flight = false;
+    // Number of bytes read, valid if !in_flight.
+    size_t length = 0;
+    // errno value from a failed read, valid if !in_flight.
+    int error_code = 0;
+  };
+
+  void Initialize(size_t buffer_size, int queue_depth);
+  RIEGELI_ATTRIBUTE_COLD bool FailOperation(string_view operation,
+                                            int error_code);
+  // Makes the window with the given index current, reading it if needed.
+  bool LoadWindow(Position index);
+  // Starts reading the window with the given index into window.
+  void StartRead(Position index, Window* window);
+  // Starts reading windows following the window with the given index.
+  bool ReadAhead(Position index);
+  bool WaitForWindow(Window* window);
+  // Submits prepared reads and processes available completions. If wait is
+  // true, waits for at least one completion.
+  bool ProcessCompletions(bool wait);
+
+  internal::FdHolder owned_fd_;
+  int fd_ = -1;
+  std::string filename_;
+  // errno value from a failed operation, or 0 if none.
+  //
+  // Invariant: if healthy() then error_code_ == 0
+  int error_code_ = 0;
+  size_t window_size_ = 0;
+  // The window with index i is held in windows_[i % windows_.size()].
+  std::vector<Window> windows_;
+  // Declared after windows_ so that it is destroyed first, waiting for reads
+  // in flight to windows_.
+  std::unique_ptr<internal::IoUring> ring_;
+
+  // Invariants:
+  //   limit_pos_ <= numeric_limits<off_t>::max()
+  //   if start_ != nullptr then start_pos() is a multiple of window_size_
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_FD_URING_READER_H_
@@ -0,0 +1,373 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make pwrite() available, and O_DIRECT on Linux.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/fd_uring_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/str_error.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/fd_holder.h"
+#include "riegeli/bytes/io_uring.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+FdUringWriter::FdUringWriter() noexcept : Writer(State::kClosed) {}
+
+FdUringWriter::FdUringWriter(int fd, Options options)
+    : Writer(State::kOpen),
+      owned_fd_(options.owns_fd_ ? fd : -1),
+      fd_(fd),
+      filename_(fd == 1 ? "/dev/stdout"
+                        : fd == 2 ? "/dev/stderr"
+                                  : "/proc/self/fd/" + std::to_string(fd)) {
+  RIEGELI_ASSERT_GE(fd, 0)
+      << "Failed precondition of FdUringWriter::FdUringWriter(int): "
+         "negative file descriptor";
+  Initialize(options.owns_fd_, options.buffer_size_, options.queue_depth_);
+}
+
+FdUringWriter::FdUringWriter(std::string filename, int flags, Options options)
+    : Writer(State::kOpen), filename_(std::move(filename)) {
+  RIEGELI_ASSERT(options.owns_fd_)
+      << "Failed precondition of FdUringWriter::FdUringWriter(string): "
+         "file must be owned if FdUringWriter opens it";
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of FdUringWriter::FdUringWriter(string): "
+         "flags must include O_WRONLY or O_RDWR";
+  if (RIEGELI_UNLIKELY((flags & O_APPEND) != 0)) {
+    Fail("FdUringWriter does not support O_APPEND, writing " + filename_);
+    return;
+  }
+#ifdef O_DIRECT
+  if (options.direct_io_) flags |= O_DIRECT;
+#endif
+again:
+  fd_ = open(filename_.c_str(), flags, options.permissions_);
+  if (RIEGELI_UNLIKELY(fd_ < 0)) {
+    const int error_code = errno;
+    if (error_code == EINTR) goto again;
+    FailOperation("open()", error_code);
+    return;
+  }
+  owned_fd_ = internal::FdHolder(fd_);
+  Initialize(true, options.buffer_size_, options.queue_depth_);
+}
+
+FdUringWriter::FdUringWriter(FdUringWriter&& src) noexcept
+    : Writer(std::move(src)),
+      owned_fd_(std::move(src.owned_fd_)),
+      fd_(riegeli::exchange(src.fd_, -1)),
+      filename_(riegeli::exchange(src.filename_, std::string())),
+      error_code_(riegeli::exchange(src.error_code_, 0)),
+      direct_io_(riegeli::exchange(src.direct_io_, false)),
+      buffer_size_(riegeli::exchange(src.buffer_size_, 0)),
+      buffers_(riegeli::exchange(src.buffers_, std::vector<Buffer>())),
+      current_(riegeli::exchange(src.current_, 0)),
+      ring_(std::move(src.ring_)) {}
+
+FdUringWriter& FdUringWriter::operator=(FdUringWriter&& src) noexcept {
+  // Destroy the ring first, waiting for writes in flight from buffers_.
+  ring_ = std::move(src.ring_);
+  Writer::operator=(std::move(src));
+  owned_fd_ = std::move(src.owned_fd_);
+  fd_ = riegeli::exchange(src.fd_, -1);
+  filename_ = riegeli::exchange(src.filename_, std::string());
+  error_code_ = riegeli::exchange(src.error_code_, 0);
+  direct_io_ = riegeli::exchange(src.direct_io_, false);
+  buffer_size_ = riegeli::exchange(src.buffer_size_, 0);
+  buffers_ = riegeli::exchange(src.buffers_, std::vector<Buffer>());
+  current_ = riegeli::exchange(src.current_, 0);
+  return *this;
+}
+
+FdUringWriter::~FdUringWriter() = default;
+
+inline void FdUringWriter::Initialize(bool owns_fd, size_t buffer_size,
+                                      int queue_depth) {
+  buffer_size_ = RoundUp<internal::kDirectIoAlignment>(UnsignedMin(
+      buffer_size, size_t{std::numeric_limits<uint32_t>::max()} -
+                       internal::kDirectIoAlignment));
+  const int flags = fcntl(fd_, F_GETFL);
+  if (RIEGELI_UNLIKELY(flags < 0)) {
+    FailOperation("fcntl()", errno);
+    return;
+  }
+  if (RIEGELI_UNLIKELY((flags & O_APPEND) != 0)) {
+    Fail("FdUringWriter does not support O_APPEND, writing " + filename_);
+    return;
+  }
+  const off_t pos = lseek(fd_, 0, SEEK_CUR);
+  if (RIEGELI_UNLIKELY(pos < 0)) {
+    FailOperation("lseek()", errno);
+    return;
+  }
+  start_pos_ = IntCast<Position>(pos);
+#ifdef O_DIRECT
+  if ((flags & O_DIRECT) != 0) {
+    // Flags of an fd are shared with its duplicates, so they are changed only
+    // if the fd is owned.
+    if (RIEGELI_UNLIKELY(!owns_fd)) {
+      Fail("FdUringWriter requires an owned fd for O_DIRECT, writing " +
+           filename_);
+      return;
+    }
+    if (start_pos_ % internal::kDirectIoAlignment == 0) {
+      direct_io_ = true;
+    } else if (RIEGELI_UNLIKELY(fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0)) {
+      FailOperation("fcntl()", errno);
+      return;
+    }
+  }
+#endif
+  buffers_.resize(IntCast<size_t>(queue_depth) + 1);
+  if (queue_depth > 0) {
+    ring_ = internal::IoUring::Create(IntCast<unsigned>(queue_depth) + 1);
+  }
+}
+
+void FdUringWriter::Done() {
+  if (RIEGELI_LIKELY(healthy())) WriteBuffered();
+  // Wait for writes in flight before freeing their buffers.
+  ring_.reset();
+  buffers_ = std::vector<Buffer>();
+  const int error_code = owned_fd_.Close();
+  if (RIEGELI_UNLIKELY(error_code != 0) && RIEGELI_LIKELY(healthy())) {
+    FailOperation(internal::FdHolder::CloseFunctionName(), error_code);
+  }
+  // filename_ and error_code_ are not cleared.
+  direct_io_ = false;
+  buffer_size_ = 0;
+  current_ = 0;
+  Writer::Done();
+}
+
+bool FdUringWriter::FailOperation(string_view operation, int error_code) {
+  error_code_ = error_code;
+  return Fail(std::string(operation) + " failed: " + StrError(error_code) +
+              ", writing " + filename_);
+}
+
+bool FdUringWriter::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  const size_t length = written_to_buffer();
+  if (length > 0) {
+    if (RIEGELI_UNLIKELY(!StartWrite(length))) return false;
+    start_pos_ += length;
+    cursor_ = start_;
+    limit_ = start_;
+    current_ = (current_ + 1) % buffers_.size();
+  }
+  if (RIEGELI_UNLIKELY(buffer_size_ >
+                       Position{std::numeric_limits<off_t>::max()} -
+                           start_pos_)) {
+    return FailOverflow();
+  }
+  Buffer* const buffer = &buffers_[current_];
+  if (RIEGELI_UNLIKELY(!WaitForBuffer(buffer))) return false;
+  start_ = buffer->buffer.GetData(buffer_size_);
+  cursor_ = start_;
+  limit_ = start_ + buffer_size_;
+  return true;
+}
+
+bool FdUringWriter::Flush(FlushType flush_type) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (RIEGELI_UNLIKELY(!WriteBuffered())) return false;
+  switch (flush_type) {
+    case FlushType::kFromObject:
+    case FlushType::kFromProcess:
+      return true;
+    case FlushType::kFromMachine: {
+      const int result = fsync(fd_);
+      if (RIEGELI_UNLIKELY(result < 0)) return FailOperation("fsync()", errno);
+      return true;
+    }
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown flush type: " << static_cast<int>(flush_type);
+}
+
+bool FdUringWriter::Size(Position* size) const {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  struct stat stat_info;
+  const int result = fstat(fd_, &stat_info);
+  if (RIEGELI_UNLIKELY(result < 0)) return false;
+  *size = UnsignedMax(IntCast<Position>(stat_info.st_size), pos());
+  return true;
+}
+
+inline bool FdUringWriter::StartWrite(size_t length) {
+  Buffer* const buffer = &buffers_[current_];
+  RIEGELI_ASSERT(!buffer->in_flight)
+      << "Failed precondition of FdUringWriter::StartWrite(): "
+         "write already in flight";
+  if (ring_ == nullptr) return WriteSync(start_, length, start_pos_);
+  buffer->in_flight = true;
+  buffer->pos = start_pos_;
+  buffer->written = 0;
+  buffer->length = length;
+  PrepareWrite(buffer);
+  return ProcessCompletions(false);
+}
+
+bool FdUringWriter::WriteSync(const char* src, size_t length, Position pos) {
+  while (length > 0) {
+  again:
+    const ssize_t result = pwrite(
+        fd_, src,
+        UnsignedMin(length, size_t{std::numeric_limits<ssize_t>::max()}),
+        IntCast<off_t>(pos));
+    if (RIEGELI_UNLIKELY(result < 0)) {
+      const int error_code = errno;
+      if (error_code == EINTR) goto again;
+      return FailOperation("pwrite()", error_code);
+    }
+    if (RIEGELI_UNLIKELY(result == 0)) {
+      // No progress is possible, retrying would loop forever.
+      return FailOperation("pwrite()", EIO);
+    }
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result), length)
+        << "pwrite() wrote more than requested";
+    src += IntCast<size_t>(result);
+    length -= IntCast<size_t>(result);
+    pos += IntCast<size_t>(result);
+  }
+  return true;
+}
+
+bool FdUringWriter::WriteBuffered() {
+  const size_t length = written_to_buffer();
+  const size_t aligned_length =
+      direct_io_ ? RoundDown<internal::kDirectIoAlignment>(length) : length;
+  if (aligned_length > 0) {
+    if (RIEGELI_UNLIKELY(!StartWrite(aligned_length))) return false;
+  }
+  if (RIEGELI_UNLIKELY(!WaitForAll())) return false;
+#ifdef O_DIRECT
+  if (length > aligned_length) {
+    // The tail does not satisfy O_DIRECT requirements. Write it with O_DIRECT
+    // cleared, and keep it at the beginning of the buffer so that its block is
+    // written again with O_DIRECT when the following data fill it.
+    const size_t tail_length = length - aligned_length;
+    const int flags = fcntl(fd_, F_GETFL);
+    if (RIEGELI_UNLIKELY(flags < 0)) return FailOperation("fcntl()", errno);
+    if (RIEGELI_UNLIKELY(fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0)) {
+      return FailOperation("fcntl()", errno);
+    }
+    const bool write_ok = WriteSync(start_ + aligned_length, tail_length,
+                                    start_pos_ + aligned_length);
+    if (RIEGELI_UNLIKELY(fcntl(fd_, F_SETFL, flags) < 0) &&
+        RIEGELI_LIKELY(write_ok)) {
+      return FailOperation("fcntl()", errno);
+    }
+    if (RIEGELI_UNLIKELY(!write_ok)) return false;
+    memmove(start_, start_ + aligned_length, tail_length);
+  }
+#endif
+  start_pos_ += aligned_length;
+  cursor_ = start_ + (length - aligned_length);
+  return true;
+}
+
+inline bool FdUringWriter::WaitForBuffer(Buffer* buffer) {
+  while (buffer->in_flight) {
+    if (RIEGELI_UNLIKELY(!ProcessCompletions(true))) return false;
+  }
+  if (RIEGELI_UNLIKELY(buffer->error_code != 0)) {
+    return FailOperation("io_uring write",
+                         riegeli::exchange(buffer->error_code, 0));
+  }
+  return true;
+}
+
+bool FdUringWriter::WaitForAll() {
+  for (Buffer& buffer : buffers_) {
+    if (RIEGELI_UNLIKELY(!WaitForBuffer(&buffer))) return false;
+  }
+  return true;
+}
+
+bool FdUringWriter::ProcessCompletions(bool wait) {
+  const int error_code = ring_->Submit(wait);
+  if (RIEGELI_UNLIKELY(error_code != 0)) {
+    return FailOperation("io_uring_enter()", error_code);
+  }
+  uint64_t user_data;
+  int32_t result;
+  while (ring_->PopCompletion(&user_data, &result)) {
+    Buffer* const buffer = &buffers_[IntCast<size_t>(user_data)];
+    RIEGELI_ASSERT(buffer->in_flight)
+        << "Completion of a write which is not in flight";
+    if (RIEGELI_UNLIKELY(result == -EAGAIN || result == -EINTR)) {
+      PrepareWrite(buffer);
+      continue;
+    }
+    if (RIEGELI_UNLIKELY(result <= 0)) {
+      buffer->in_flight = false;
+      // A write of 0 bytes makes no progress, resubmitting it would loop
+      // forever.
+      buffer->error_code = result < 0 ? -result : EIO;
+      continue;
+    }
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result),
+                      buffer->length - buffer->written)
+        << "io_uring wrote more than requested";
+    buffer->written += IntCast<size_t>(result);
+    if (buffer->written < buffer->length) {
+      // Short write, write the rest.
+      PrepareWrite(buffer);
+      continue;
+    }
+    buffer->in_flight = false;
+  }
+  return true;
+}
+
+inline void FdUringWriter::PrepareWrite(Buffer* buffer) {
+  ring_->PrepareWrite(fd_, buffer->buffer.GetData(buffer_size_) +
+                               buffer->written,
+                      buffer->length - buffer->written,
+                      IntCast<off_t>(buffer->pos + buffer->written),
+                      IntCast<uint64_t>(buffer - buffers_.data()));
+}
+
+}  // namespace riegeli
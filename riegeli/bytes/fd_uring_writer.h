@@ -0,0 +1,235 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_FD_URING_WRITER_H_
+#define RIEGELI_BYTES_FD_URING_WRITER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/fd_holder.h"
+#include "riegeli/bytes/io_uring.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// A Writer which writes to a file descriptor, keeping writes of several full
+// buffers in flight through Linux io_uring while the next buffer is being
+// filled. The file descriptor must support pwrite() and fstat(), and must not
+// be opened with O_APPEND: writes in flight may complete in any order, so they
+// use explicit positions.
+//
+// Writing starts at the current fd position, like FdWriter with
+// set_sync_pos(true), but the fd position is not changed by writing. For a
+// file just opened without O_APPEND this is the beginning of the file.
+//
+// If the fd is opened with O_DIRECT, all writes except for the tail written by
+// Flush() and Close() are aligned. The tail is written with O_DIRECT
+// temporarily cleared, and is written again when the following data fill its
+// block. Since this changes the flags of the fd, an fd opened with O_DIRECT
+// must be owned by the FdUringWriter.
+//
+// If io_uring is not available, FdUringWriter falls back to writing each
+// buffer with pwrite() when it is full.
+//
+// FdUringWriter does not support random access.
+class FdUringWriter final : public Writer {
+ public:
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    constexpr Options() noexcept {}
+
+    // If true, the fd will be owned by the FdUringWriter and will be closed
+    // when the FdUringWriter is closed.
+    //
+    // If false, the fd must be alive until closing the FdUringWriter.
+    //
+    // Default: true.
+    Options& set_owns_fd(bool owns_fd) & {
+      owns_fd_ = owns_fd;
+      return *this;
+    }
+    Options&& set_owns_fd(bool owns_fd) && {
+      return std::move(set_owns_fd(owns_fd));
+    }
+
+    // Permissions to use in case a new file is created (9 bits). The effective
+    // permissions are modified by the process's umask.
+    Options& set_permissions(mode_t permissions) & {
+      permissions_ = permissions;
+      return *this;
+    }
+    Options&& set_permissions(mode_t permissions) && {
+      return std::move(set_permissions(permissions));
+    }
+
+    // Size of a buffer. It is rounded up to a multiple of 4096.
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "FdUringWriter::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Number of full buffers which are being written in the background while
+    // the next buffer is being filled.
+    //
+    // 0 disables background writing.
+    //
+    // Default: 4.
+    Options& set_queue_depth(int queue_depth) & {
+      RIEGELI_ASSERT_GE(queue_depth, 0)
+          << "Failed precondition of "
+             "FdUringWriter::Options::set_queue_depth(): "
+             "negative queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(int queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+
+    // If true, FdUringWriter opens the file with O_DIRECT, bypassing the page
+    // cache. This is relevant only when FdUringWriter opens the file; a given
+    // fd may already be opened with O_DIRECT.
+    //
+    // O_DIRECT is not used if writing would start at a position which is not a
+    // multiple of 4096.
+    //
+    // Default: false.
+    Options& set_direct_io(bool direct_io) & {
+      direct_io_ = direct_io;
+      return *this;
+    }
+    Options&& set_direct_io(bool direct_io) && {
+      return std::move(set_direct_io(direct_io));
+    }
+
+   private:
+    friend class FdUringWriter;
+
+    bool owns_fd_ = true;
+    mode_t permissions_ = 0666;
+    size_t buffer_size_ = kDefaultBufferSize();
+    int queue_depth_ = 4;
+    bool direct_io_ = false;
+  };
+
+  // Creates a closed FdUringWriter.
+  //
+  // Not defaulted because string::string() is not noexcept before C++17.
+  FdUringWriter() noexcept;
+
+  // Will write to fd, starting at its current position.
+  //
+  // fd must not be opened with O_APPEND. If fd is opened with O_DIRECT,
+  // options.set_owns_fd(false) must not be used.
+  explicit FdUringWriter(int fd, Options options = Options());
+
+  // Opens a file for writing.
+  //
+  // flags is the second argument of open, typically
+  // O_WRONLY | O_CREAT | O_TRUNC.
+  //
+  // flags must include O_WRONLY or O_RDWR, and must not include O_APPEND.
+  // options.set_owns_fd(false) must not be used.
+  FdUringWriter(std::string filename, int flags, Options options = Options());
+
+  FdUringWriter(FdUringWriter&& src) noexcept;
+  FdUringWriter& operator=(FdUringWriter&& src) noexcept;
+
+  ~FdUringWriter();
+
+  const std::string& filename() const { return filename_; }
+  int error_code() const { return error_code_; }
+
+  // Returns true if writes are performed through io_uring, false if they fall
+  // back to pwrite().
+  bool uses_io_uring() const { return ring_ != nullptr; }
+
+  bool Flush(FlushType flush_type) override;
+  bool Size(Position* size) const override;
+
+ protected:
+  void Done() override;
+  bool PushSlow() override;
+
+ private:
+  struct Buffer {
+    internal::DirectIoBuffer buffer;
+    bool in_flight = false;
+    // Position in the file, and the range of the buffer being written, valid
+    // if in_flight.
+    Position pos = 0;
+    size_t written = 0;
+    size_t length = 0;
+    // errno value from a failed write, valid if !in_flight.
+    int error_code = 0;
+  };
+
+  void Initialize(bool owns_fd, size_t buffer_size, int queue_depth);
+  RIEGELI_ATTRIBUTE_COLD bool FailOperation(string_view operation,
+                                            int error_code);
+  // Starts writing length bytes from the beginning of the current buffer at
+  // start_pos_.
+  bool StartWrite(size_t length);
+  // Writes length bytes from src at pos synchronously.
+  bool WriteSync(const char* src, size_t length, Position pos);
+  // Writes buffered data except for an unaligned tail in O_DIRECT mode, and
+  // waits until all writes complete.
+  bool WriteBuffered();
+  bool WaitForBuffer(Buffer* buffer);
+  bool WaitForAll();
+  // Submits prepared writes and processes available completions. If wait is
+  // true, waits for at least one completion.
+  bool ProcessCompletions(bool wait);
+  void PrepareWrite(Buffer* buffer);
+
+  internal::FdHolder owned_fd_;
+  int fd_ = -1;
+  std::string filename_;
+  // errno value from a failed operation, or 0 if none.
+  //
+  // Invariant: if healthy() then error_code_ == 0
+  int error_code_ = 0;
+  bool direct_io_ = false;
+  size_t buffer_size_ = 0;
+  std::vector<Buffer> buffers_;
+  // Index in buffers_ of the buffer between start_ and limit_.
+  size_t current_ = 0;
+  // Declared after buffers_ so that it is destroyed first, waiting for writes
+  // in flight from buffers_.
+  std::unique_ptr<internal::IoUring> ring_;
+
+  // Invariants:
+  //   start_pos_ <= numeric_limits<off_t>::max()
+  //   if direct_io_ then start_pos_ is a multiple of 4096
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_FD_URING_WRITER_H_
@@ -0,0 +1,235 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/io_uring.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <memory>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
+#include "riegeli/base/base.h"
+
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup) && \
+    defined(__NR_io_uring_enter)
+#define RIEGELI_INTERNAL_HAVE_IO_URING 1
+#else
+#define RIEGELI_INTERNAL_HAVE_IO_URING 0
+#endif
+
+namespace riegeli {
+namespace internal {
+
+#if RIEGELI_INTERNAL_HAVE_IO_URING
+
+namespace {
+
+template <typename T>
+T* RingField(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+std::unique_ptr<IoUring> IoUring::Create(unsigned entries) {
+  RIEGELI_ASSERT_GT(entries, 0u)
+      << "Failed precondition of IoUring::Create(): no entries";
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const long ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd < 0) return nullptr;
+  std::unique_ptr<IoUring> ring(new IoUring());
+  ring->ring_fd_ = IntCast<int>(ring_fd);
+  // IORING_OP_READ and IORING_OP_WRITE appeared in the same kernel release as
+  // IORING_FEAT_RW_CUR_POS.
+  if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) return nullptr;
+
+  ring->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_ring_size_ = ring->cq_ring_size_ =
+        UnsignedMax(ring->sq_ring_size_, ring->cq_ring_size_);
+  }
+  void* const sq_ring =
+      mmap(nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) return nullptr;
+  ring->sq_ring_ = sq_ring;
+  if (single_mmap) {
+    ring->cq_ring_ = sq_ring;
+  } else {
+    void* const cq_ring =
+        mmap(nullptr, ring->cq_ring_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) return nullptr;
+    ring->cq_ring_ = cq_ring;
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* const sqes =
+      mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return nullptr;
+  ring->sqes_ = sqes;
+
+  ring->sq_tail_ = RingField<unsigned>(ring->sq_ring_, params.sq_off.tail);
+  ring->sq_ring_mask_ =
+      *RingField<unsigned>(ring->sq_ring_, params.sq_off.ring_mask);
+  ring->sq_array_ = RingField<unsigned>(ring->sq_ring_, params.sq_off.array);
+  ring->cq_head_ = RingField<unsigned>(ring->cq_ring_, params.cq_off.head);
+  ring->cq_tail_ = RingField<unsigned>(ring->cq_ring_, params.cq_off.tail);
+  ring->cq_ring_mask_ =
+      *RingField<unsigned>(ring->cq_ring_, params.cq_off.ring_mask);
+  ring->cqes_ = RingField<void>(ring->cq_ring_, params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (num_in_flight_ > 0) {
+    uint64_t user_data;
+    int32_t result;
+    while (num_in_flight_ > 0) {
+      if (RIEGELI_UNLIKELY(Submit(true) != 0)) break;
+      while (PopCompletion(&user_data, &result)) {
+      }
+    }
+  }
+  if (sqes_ != nullptr) munmap(sqes_, sqes_size_);
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+}
+
+namespace {
+
+inline void PrepareReadWrite(uint8_t opcode, int fd, const char* data,
+                             size_t length, off_t offset, uint64_t user_data,
+                             struct io_uring_sqe* sqe) {
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = IntCast<uint64_t>(offset);
+  sqe->addr = reinterpret_cast<uintptr_t>(data);
+  sqe->len = IntCast<uint32_t>(length);
+  sqe->user_data = user_data;
+}
+
+}  // namespace
+
+void IoUring::PrepareRead(int fd, char* dest, size_t length, off_t offset,
+                          uint64_t user_data) {
+  RIEGELI_ASSERT_LE(num_in_flight_, sq_ring_mask_)
+      << "Failed precondition of IoUring::PrepareRead(): too many requests";
+  // This thread is the only producer, so sq_tail_ can be read without
+  // synchronization.
+  const unsigned tail = *sq_tail_;
+  const unsigned index = tail & sq_ring_mask_;
+  PrepareReadWrite(IORING_OP_READ, fd, dest, length, offset, user_data,
+                   static_cast<struct io_uring_sqe*>(sqes_) + index);
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++num_to_submit_;
+  ++num_in_flight_;
+}
+
+void IoUring::PrepareWrite(int fd, const char* src, size_t length,
+                           off_t offset, uint64_t user_data) {
+  RIEGELI_ASSERT_LE(num_in_flight_, sq_ring_mask_)
+      << "Failed precondition of IoUring::PrepareWrite(): too many requests";
+  const unsigned tail = *sq_tail_;
+  const unsigned index = tail & sq_ring_mask_;
+  PrepareReadWrite(IORING_OP_WRITE, fd, src, length, offset, user_data,
+                   static_cast<struct io_uring_sqe*>(sqes_) + index);
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++num_to_submit_;
+  ++num_in_flight_;
+}
+
+int IoUring::Submit(bool wait) {
+  if (num_to_submit_ == 0 && !wait) return 0;
+again:
+  const long result = syscall(__NR_io_uring_enter, ring_fd_, num_to_submit_,
+                              wait ? 1u : 0u,
+                              wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+  if (RIEGELI_UNLIKELY(result < 0)) {
+    const int error_code = errno;
+    if (error_code == EINTR) goto again;
+    return error_code;
+  }
+  num_to_submit_ -= IntCast<unsigned>(result);
+  return 0;
+}
+
+bool IoUring::PopCompletion(uint64_t* user_data, int32_t* result) {
+  // This thread is the only consumer, so cq_head_ can be read without
+  // synchronization.
+  const unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+  const struct io_uring_cqe& cqe =
+      static_cast<const struct io_uring_cqe*>(cqes_)[head & cq_ring_mask_];
+  *user_data = cqe.user_data;
+  *result = cqe.res;
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  --num_in_flight_;
+  return true;
+}
+
+#else  // !RIEGELI_INTERNAL_HAVE_IO_URING
+
+std::unique_ptr<IoUring> IoUring::Create(unsigned entries) { return nullptr; }
+
+IoUring::~IoUring() {}
+
+void IoUring::PrepareRead(int fd, char* dest, size_t length, off_t offset,
+                          uint64_t user_data) {
+  RIEGELI_ASSERT_UNREACHABLE() << "io_uring not available";
+}
+
+void IoUring::PrepareWrite(int fd, const char* src, size_t length,
+                           off_t offset, uint64_t user_data) {
+  RIEGELI_ASSERT_UNREACHABLE() << "io_uring not available";
+}
+
+int IoUring::Submit(bool wait) { return ENOSYS; }
+
+bool IoUring::PopCompletion(uint64_t* user_data, int32_t* result) {
+  return false;
+}
+
+#endif  // !RIEGELI_INTERNAL_HAVE_IO_URING
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,175 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_IO_URING_H_
+#define RIEGELI_BYTES_IO_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <memory>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+namespace internal {
+
+// Alignment of buffers, file offsets, and lengths required by O_DIRECT.
+//
+// The actual requirement is the logical block size of the underlying device,
+// which is at most the page size on all common configurations.
+constexpr size_t kDirectIoAlignment = 4096;
+
+// Owns a buffer aligned to kDirectIoAlignment, allocated on first use.
+class DirectIoBuffer {
+ public:
+  DirectIoBuffer() noexcept {}
+
+  DirectIoBuffer(DirectIoBuffer&& src) noexcept;
+  DirectIoBuffer& operator=(DirectIoBuffer&& src) noexcept;
+
+  ~DirectIoBuffer();
+
+  // Returns the buffer, allocating it if needed.
+  //
+  // Precondition: size is the same in all calls and is a multiple of
+  // kDirectIoAlignment
+  char* GetData(size_t size);
+
+ private:
+  void DeleteBuffer();
+
+  char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A minimal Linux io_uring submission and completion queue, driven directly by
+// the io_uring_setup() and io_uring_enter() system calls.
+//
+// IoUring is not thread-safe: a single thread must prepare, submit, and reap
+// requests.
+class IoUring {
+ public:
+  // Returns an IoUring which can hold up to entries requests in flight, or
+  // nullptr if io_uring is not available (e.g. the kernel is older than 5.6,
+  // or io_uring is disabled by seccomp or sysctl). In the latter case the
+  // caller should fall back to pread() and pwrite().
+  static std::unique_ptr<IoUring> Create(unsigned entries);
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // Waits until all requests in flight complete, because their buffers must
+  // not be freed before that, and then tears down the queues.
+  ~IoUring();
+
+  // Queues a read of length bytes from fd at offset into dest. The request is
+  // started by the next Submit().
+  //
+  // Precondition: num_in_flight() < entries passed to Create()
+  void PrepareRead(int fd, char* dest, size_t length, off_t offset,
+                   uint64_t user_data);
+
+  // Queues a write of length bytes from src to fd at offset. The request is
+  // started by the next Submit().
+  //
+  // Precondition: num_in_flight() < entries passed to Create()
+  void PrepareWrite(int fd, const char* src, size_t length, off_t offset,
+                    uint64_t user_data);
+
+  // Starts all prepared requests, and if wait is true, waits until at least one
+  // completion is available.
+  //
+  // Return values:
+  //  * 0     - success
+  //  * errno - failure
+  int Submit(bool wait);
+
+  // If a completion is available, removes it, stores its user_data in
+  // *user_data and its result (number of bytes transferred, or -errno) in
+  // *result, and returns true. Otherwise returns false.
+  bool PopCompletion(uint64_t* user_data, int32_t* result);
+
+  // Returns the number of requests prepared but not yet completed.
+  size_t num_in_flight() const { return num_in_flight_; }
+
+ private:
+  IoUring() noexcept {}
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  void* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_ring_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_ring_mask_ = 0;
+  void* cqes_ = nullptr;
+
+  // Number of requests prepared but not yet passed to io_uring_enter().
+  unsigned num_to_submit_ = 0;
+  size_t num_in_flight_ = 0;
+};
+
+// Implementation details follow.
+
+inline DirectIoBuffer::DirectIoBuffer(DirectIoBuffer&& src) noexcept
+    : data_(riegeli::exchange(src.data_, nullptr)),
+      size_(riegeli::exchange(src.size_, 0)) {}
+
+inline DirectIoBuffer& DirectIoBuffer::operator=(
+    DirectIoBuffer&& src) noexcept {
+  // Exchange src.data_ early to support self-assignment.
+  char* const data = riegeli::exchange(src.data_, nullptr);
+  const size_t size = riegeli::exchange(src.size_, 0);
+  DeleteBuffer();
+  data_ = data;
+  size_ = size;
+  return *this;
+}
+
+inline DirectIoBuffer::~DirectIoBuffer() { DeleteBuffer(); }
+
+inline char* DirectIoBuffer::GetData(size_t size) {
+  if (data_ == nullptr) {
+    RIEGELI_ASSERT_EQ(size % kDirectIoAlignment, 0u)
+        << "Failed precondition of DirectIoBuffer::GetData(): "
+           "size not aligned";
+    data_ = AllocateAlignedBytes<char, kDirectIoAlignment>(size);
+    size_ = size;
+  } else {
+    RIEGELI_ASSERT_EQ(size, size_)
+        << "Failed precondition of DirectIoBuffer::GetData(): "
+           "size changed";
+  }
+  return data_;
+}
+
+inline void DirectIoBuffer::DeleteBuffer() {
+  if (data_ != nullptr) {
+    FreeAlignedBytes<char, kDirectIoAlignment>(data_, size_);
+  }
+}
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_IO_URING_H_
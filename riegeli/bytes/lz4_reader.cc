@@ -0,0 +1,155 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/lz4_reader.h"
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "lz4frame.h"
+
+namespace riegeli {
+
+inline void Lz4Reader::LZ4F_dctxDeleter::operator()(LZ4F_dctx* ptr) const {
+  LZ4F_freeDecompressionContext(ptr);
+}
+
+Lz4Reader::Lz4Reader() noexcept = default;
+
+Lz4Reader::Lz4Reader(std::unique_ptr<Reader> src, Options options)
+    : Lz4Reader(src.get(), options) {
+  owned_src_ = std::move(src);
+}
+
+Lz4Reader::Lz4Reader(Reader* src, Options options)
+    : BufferedReader(options.buffer_size_), src_(RIEGELI_ASSERT_NOTNULL(src)) {
+  LZ4F_dctx* decompressor;
+  const size_t result =
+      LZ4F_createDecompressionContext(&decompressor, LZ4F_VERSION);
+  if (RIEGELI_UNLIKELY(LZ4F_isError(result))) {
+    Fail(std::string("LZ4F_createDecompressionContext() failed: ") +
+         LZ4F_getErrorName(result));
+    return;
+  }
+  decompressor_.reset(decompressor);
+}
+
+Lz4Reader::Lz4Reader(Lz4Reader&& src) noexcept
+    : BufferedReader(std::move(src)),
+      owned_src_(std::move(src.owned_src_)),
+      src_(riegeli::exchange(src.src_, nullptr)),
+      decompressor_(std::move(src.decompressor_)) {}
+
+Lz4Reader& Lz4Reader::operator=(Lz4Reader&& src) noexcept {
+  BufferedReader::operator=(std::move(src));
+  owned_src_ = std::move(src.owned_src_);
+  src_ = riegeli::exchange(src.src_, nullptr);
+  decompressor_ = std::move(src.decompressor_);
+  return *this;
+}
+
+Lz4Reader::~Lz4Reader() = default;
+
+void Lz4Reader::Done() {
+  if (!Pull() && RIEGELI_UNLIKELY(decompressor_ != nullptr)) {
+    Fail("Truncated LZ4-compressed stream");
+  }
+  if (owned_src_ != nullptr) {
+    if (RIEGELI_LIKELY(healthy())) {
+      if (RIEGELI_UNLIKELY(!owned_src_->Close())) Fail(*owned_src_);
+    }
+    owned_src_.reset();
+  }
+  src_ = nullptr;
+  decompressor_.reset();
+  BufferedReader::Done();
+}
+
+bool Lz4Reader::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  // After all data have been decompressed, skip BufferedReader::PullSlow()
+  // to avoid allocating the buffer in case it was not allocated yet.
+  if (RIEGELI_UNLIKELY(decompressor_ == nullptr)) return false;
+  return BufferedReader::PullSlow();
+}
+
+bool Lz4Reader::ReadInternal(char* dest, size_t min_length,
+                             size_t max_length) {
+  RIEGELI_ASSERT_GT(min_length, 0u)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "nothing to read";
+  RIEGELI_ASSERT_GE(max_length, min_length)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "max_length < min_length";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "Object unhealthy";
+  if (RIEGELI_UNLIKELY(max_length >
+                       std::numeric_limits<Position>::max() - limit_pos_)) {
+    return FailOverflow();
+  }
+  if (RIEGELI_UNLIKELY(decompressor_ == nullptr)) return false;
+  size_t length_read = 0;
+  for (;;) {
+    size_t src_length = src_->available();
+    size_t dest_length = max_length - length_read;
+    const size_t result =
+        LZ4F_decompress(decompressor_.get(), dest + length_read, &dest_length,
+                        src_->cursor(), &src_length, nullptr);
+    src_->set_cursor(src_->cursor() + src_length);
+    length_read += dest_length;
+    if (RIEGELI_UNLIKELY(result == 0)) {
+      decompressor_.reset();
+      limit_pos_ += length_read;
+      return length_read >= min_length;
+    }
+    if (RIEGELI_UNLIKELY(LZ4F_isError(result))) {
+      Fail(std::string("LZ4F_decompress() failed: ") +
+           LZ4F_getErrorName(result));
+      limit_pos_ += length_read;
+      return length_read >= min_length;
+    }
+    if (length_read >= min_length) {
+      limit_pos_ += length_read;
+      return true;
+    }
+    // LZ4F_decompress() does not necessarily consume all input even if there
+    // is output space, so pull more data only if the input is exhausted.
+    if (src_->available() > 0) continue;
+    if (RIEGELI_UNLIKELY(!src_->Pull())) {
+      limit_pos_ += length_read;
+      if (RIEGELI_LIKELY(src_->HopeForMore())) return false;
+      if (src_->healthy()) return Fail("Truncated LZ4-compressed stream");
+      return Fail(*src_);
+    }
+  }
+}
+
+bool Lz4Reader::HopeForMoreSlow() const {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::HopeForMoreSlow(): "
+         "data available, use HopeForMore() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  return decompressor_ != nullptr;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,202 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/lz4_writer.h"
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "lz4frame.h"
+
+namespace riegeli {
+
+inline void Lz4Writer::LZ4F_cctxDeleter::operator()(LZ4F_cctx* ptr) const {
+  LZ4F_freeCompressionContext(ptr);
+}
+
+Lz4Writer::Lz4Writer() noexcept = default;
+
+Lz4Writer::Lz4Writer(std::unique_ptr<Writer> dest, Options options)
+    : Lz4Writer(dest.get(), options) {
+  owned_dest_ = std::move(dest);
+}
+
+Lz4Writer::Lz4Writer(Writer* dest, Options options)
+    : BufferedWriter(options.buffer_size_),
+      dest_(RIEGELI_ASSERT_NOTNULL(dest)) {
+  LZ4F_cctx* compressor;
+  const size_t create_result =
+      LZ4F_createCompressionContext(&compressor, LZ4F_VERSION);
+  if (RIEGELI_UNLIKELY(LZ4F_isError(create_result))) {
+    Fail(std::string("LZ4F_createCompressionContext() failed: ") +
+         LZ4F_getErrorName(create_result));
+    return;
+  }
+  compressor_.reset(compressor);
+  preferences_.compressionLevel = options.compression_level_;
+  // Emit each block as soon as it is complete instead of keeping it in
+  // LZ4F_cctx, which saves a copy of the data.
+  preferences_.autoFlush = 1;
+  // Chunks are protected by their own hashes, and the decompressed size is
+  // not known in advance.
+  preferences_.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+  WriteCompressed(
+      LZ4F_HEADER_SIZE_MAX,
+      [this](char* dest, size_t capacity) {
+        return LZ4F_compressBegin(compressor_.get(), dest, capacity,
+                                  &preferences_);
+      },
+      "LZ4F_compressBegin()");
+}
+
+Lz4Writer::Lz4Writer(Lz4Writer&& src) noexcept
+    : BufferedWriter(std::move(src)),
+      owned_dest_(std::move(src.owned_dest_)),
+      dest_(riegeli::exchange(src.dest_, nullptr)),
+      preferences_(src.preferences_),
+      compressor_(std::move(src.compressor_)),
+      compressed_buffer_(std::move(src.compressed_buffer_)) {}
+
+Lz4Writer& Lz4Writer::operator=(Lz4Writer&& src) noexcept {
+  BufferedWriter::operator=(std::move(src));
+  owned_dest_ = std::move(src.owned_dest_);
+  dest_ = riegeli::exchange(src.dest_, nullptr);
+  preferences_ = src.preferences_;
+  compressor_ = std::move(src.compressor_);
+  compressed_buffer_ = std::move(src.compressed_buffer_);
+  return *this;
+}
+
+Lz4Writer::~Lz4Writer() = default;
+
+void Lz4Writer::Done() {
+  PushInternal();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (RIEGELI_LIKELY(healthy())) {
+    WriteCompressed(
+        LZ4F_compressBound(0, &preferences_),
+        [this](char* dest, size_t capacity) {
+          return LZ4F_compressEnd(compressor_.get(), dest, capacity, nullptr);
+        },
+        "LZ4F_compressEnd()");
+  }
+  if (owned_dest_ != nullptr) {
+    if (RIEGELI_LIKELY(healthy())) {
+      if (RIEGELI_UNLIKELY(!owned_dest_->Close())) Fail(*owned_dest_);
+    }
+    owned_dest_.reset();
+  }
+  dest_ = nullptr;
+  compressor_.reset();
+  compressed_buffer_ = std::string();
+  BufferedWriter::Done();
+}
+
+bool Lz4Writer::Flush(FlushType flush_type) {
+  if (RIEGELI_UNLIKELY(!PushInternal())) return false;
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (RIEGELI_UNLIKELY(!WriteCompressed(
+          LZ4F_compressBound(0, &preferences_),
+          [this](char* dest, size_t capacity) {
+            return LZ4F_flush(compressor_.get(), dest, capacity, nullptr);
+          },
+          "LZ4F_flush()"))) {
+    return false;
+  }
+  if (RIEGELI_UNLIKELY(!dest_->Flush(flush_type))) {
+    if (dest_->healthy()) return false;
+    limit_ = start_;
+    return Fail(*dest_);
+  }
+  return true;
+}
+
+bool Lz4Writer::WriteInternal(string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "Object unhealthy";
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not cleared";
+  if (RIEGELI_UNLIKELY(src.size() >
+                       std::numeric_limits<Position>::max() - limit_pos())) {
+    limit_ = start_;
+    return FailOverflow();
+  }
+  // Compress at most buffer_size_ at a time to bound the size of
+  // compressed_buffer_ if src is large.
+  do {
+    const size_t length = UnsignedMin(src.size(), buffer_size_);
+    if (RIEGELI_UNLIKELY(!WriteCompressed(
+            LZ4F_compressBound(length, &preferences_),
+            [this, src, length](char* dest, size_t capacity) {
+              return LZ4F_compressUpdate(compressor_.get(), dest, capacity,
+                                         src.data(), length, nullptr);
+            },
+            "LZ4F_compressUpdate()"))) {
+      return false;
+    }
+    start_pos_ += length;
+    src.remove_prefix(length);
+  } while (!src.empty());
+  return true;
+}
+
+template <typename Function>
+bool Lz4Writer::WriteCompressed(size_t max_length, Function function,
+                                string_view function_name) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of Lz4Writer::WriteCompressed(): "
+         "Object unhealthy";
+  if (dest_->available() >= max_length) {
+    const size_t result = function(dest_->cursor(), dest_->available());
+    if (RIEGELI_UNLIKELY(LZ4F_isError(result))) {
+      limit_ = start_;
+      return Fail(std::string(function_name) +
+                  " failed: " + LZ4F_getErrorName(result));
+    }
+    dest_->set_cursor(dest_->cursor() + result);
+    return true;
+  }
+  if (compressed_buffer_.size() < max_length) {
+    compressed_buffer_.resize(max_length);
+  }
+  const size_t result =
+      function(&compressed_buffer_[0], compressed_buffer_.size());
+  if (RIEGELI_UNLIKELY(LZ4F_isError(result))) {
+    limit_ = start_;
+    return Fail(std::string(function_name) +
+                " failed: " + LZ4F_getErrorName(result));
+  }
+  if (RIEGELI_UNLIKELY(
+          !dest_->Write(string_view(compressed_buffer_.data(), result)))) {
+    limit_ = start_;
+    return Fail(*dest_);
+  }
+  return true;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,130 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_LZ4_WRITER_H_
+#define RIEGELI_BYTES_LZ4_WRITER_H_
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "lz4frame.h"
+
+namespace riegeli {
+
+// A Writer which compresses data with LZ4 (in the LZ4 frame format) before
+// passing it to another Writer.
+class Lz4Writer final : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    Options() noexcept {}
+
+    // Tune compression level vs. compression speed tradeoff.
+    //
+    // Levels 0 to 2 select fast LZ4 compression, levels 3 to 12 select LZ4-HC
+    // which is slower but compresses better. Decompression speed is similar.
+    //
+    // Level must be between 0 and 12. Default: 0.
+    Options& set_compression_level(int level) & {
+      RIEGELI_ASSERT_GE(level, 0)
+          << "Failed precondition of "
+             "Lz4Writer::Options::set_compression_level(): "
+             "compression level out of range";
+      RIEGELI_ASSERT_LE(level, 12)
+          << "Failed precondition of "
+             "Lz4Writer::Options::set_compression_level(): "
+             "compression level out of range";
+      compression_level_ = level;
+      return *this;
+    }
+    Options&& set_compression_level(int level) && {
+      return std::move(set_compression_level(level));
+    }
+
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of Lz4Writer::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    friend class Lz4Writer;
+
+    int compression_level_ = 0;
+    size_t buffer_size_ = kDefaultBufferSize();
+  };
+
+  // Creates a closed Lz4Writer.
+  Lz4Writer() noexcept;
+
+  // Will write LZ4-compressed stream to the byte Writer which is owned by this
+  // Lz4Writer and will be closed and deleted when the Lz4Writer is closed.
+  explicit Lz4Writer(std::unique_ptr<Writer> dest, Options options = Options());
+
+  // Will write LZ4-compressed stream to the byte Writer which is not owned by
+  // this Lz4Writer and must be kept alive but not accessed until closing the
+  // Lz4Writer, except that it is allowed to read its destination directly
+  // after Flush().
+  explicit Lz4Writer(Writer* dest, Options options = Options());
+
+  Lz4Writer(Lz4Writer&& src) noexcept;
+  Lz4Writer& operator=(Lz4Writer&& src) noexcept;
+
+  ~Lz4Writer();
+
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  void Done() override;
+  bool WriteInternal(string_view src) override;
+
+ private:
+  struct LZ4F_cctxDeleter {
+    void operator()(LZ4F_cctx* ptr) const;
+  };
+
+  // Calls function(dest, capacity), which writes up to max_length compressed
+  // bytes and returns their length or an LZ4F error code, with a destination
+  // of capacity >= max_length. This is dest_ if it has enough space available,
+  // or compressed_buffer_ which is then written to dest_.
+  template <typename Function>
+  bool WriteCompressed(size_t max_length, Function function,
+                       string_view function_name);
+
+  std::unique_ptr<Writer> owned_dest_;
+  // Invariant: if healthy() then dest_ != nullptr
+  Writer* dest_ = nullptr;
+  LZ4F_preferences_t preferences_{};
+  std::unique_ptr<LZ4F_cctx, LZ4F_cctxDeleter> compressor_;
+  // Compressed data which did not fit in the space available in dest_.
+  // LZ4F functions require the output capacity to be known in advance.
+  std::string compressed_buffer_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_LZ4_WRITER_H_
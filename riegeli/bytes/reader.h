@@ -185,6 +185,13 @@ class Reader : public Object {
   //  * false - failure (healthy() is unchanged)
   virtual bool Size(Position* size) const { return false; }
 
+  // Hints that length bytes following the current position will be read soon,
+  // so that the source may start fetching them in the background. This does
+  // not change the results of any other operation.
+  //
+  // The default implementation does nothing.
+  virtual void ReadHint(Position length) {}
+
  protected:
   // Creates a Reader with the given initial state.
   explicit Reader(State state) noexcept : Object(state) {}
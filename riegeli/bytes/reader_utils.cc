@@ -16,16 +16,25 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <utility>
 
+#include "highwayhash/arch_specific.h"
+#include "highwayhash/instruction_sets.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/varint.h"
 #include "riegeli/bytes/writer.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RIEGELI_INTERNAL_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace riegeli {
 
 namespace internal {
@@ -166,6 +175,273 @@ char* CopyVarint64Slow(Reader* src, char* dest) {
 
 }  // namespace internal
 
+namespace {
+
+// A kernel decodes up to num varints from the range [*src, limit) to dest[],
+// stopping early at an invalid varint or when the remaining data might not
+// contain a whole varint, and returns the number of varints decoded, with *src
+// pointing after them.
+
+template <typename T>
+struct VarintTraits;
+
+template <>
+struct VarintTraits<uint32_t> {
+  static constexpr size_t kMaxLength = kMaxLengthVarint32();
+  static bool Read(const char** src, uint32_t* data) {
+    return ReadVarint32(src, data);
+  }
+  static bool Read(Reader* src, uint32_t* data) {
+    return ReadVarint32(src, data);
+  }
+};
+
+template <>
+struct VarintTraits<uint64_t> {
+  static constexpr size_t kMaxLength = kMaxLengthVarint64();
+  static bool Read(const char** src, uint64_t* data) {
+    return ReadVarint64(src, data);
+  }
+  static bool Read(Reader* src, uint64_t* data) {
+    return ReadVarint64(src, data);
+  }
+};
+
+template <typename T>
+size_t DecodeVarintsPortable(const char** src, const char* limit, T* dest,
+                             size_t num) {
+  const char* cursor = *src;
+  size_t i = 0;
+  while (i < num &&
+         PtrDistance(cursor, limit) >= VarintTraits<T>::kMaxLength) {
+    const char* next = cursor;
+    if (RIEGELI_UNLIKELY(!VarintTraits<T>::Read(&next, &dest[i]))) break;
+    cursor = next;
+    ++i;
+  }
+  *src = cursor;
+  return i;
+}
+
+#if RIEGELI_INTERNAL_X86_SIMD
+
+// Converts 16 single-byte varints to T.
+template <typename T>
+void Widen16(__m128i bytes, T* dest);
+
+template <>
+__attribute__((target("sse4.1"))) inline void Widen16(__m128i bytes,
+                                                      uint32_t* dest) {
+  __m128i* const out = reinterpret_cast<__m128i*>(dest);
+  _mm_storeu_si128(out + 0, _mm_cvtepu8_epi32(bytes));
+  _mm_storeu_si128(out + 1, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)));
+  _mm_storeu_si128(out + 2, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+  _mm_storeu_si128(out + 3, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12)));
+}
+
+template <>
+__attribute__((target("sse4.1"))) inline void Widen16(__m128i bytes,
+                                                      uint64_t* dest) {
+  __m128i* const out = reinterpret_cast<__m128i*>(dest);
+  _mm_storeu_si128(out + 0, _mm_cvtepu8_epi64(bytes));
+  _mm_storeu_si128(out + 1, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 2)));
+  _mm_storeu_si128(out + 2, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 4)));
+  _mm_storeu_si128(out + 3, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 6)));
+  _mm_storeu_si128(out + 4, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 8)));
+  _mm_storeu_si128(out + 5, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 10)));
+  _mm_storeu_si128(out + 6, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 12)));
+  _mm_storeu_si128(out + 7, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 14)));
+}
+
+// Decodes 16 bytes at a time if they are all single-byte varints, which is
+// common for small values, otherwise decodes the varints ending in these bytes
+// one by one.
+template <typename T>
+__attribute__((target("sse4.1"))) size_t DecodeVarintsSSE41(
+    const char** src, const char* limit, T* dest, size_t num) {
+  const char* cursor = *src;
+  size_t i = 0;
+  while (num - i >= 16 && PtrDistance(cursor, limit) >=
+                              16 + VarintTraits<T>::kMaxLength) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor));
+    if (_mm_movemask_epi8(bytes) == 0) {
+      Widen16(bytes, dest + i);
+      cursor += 16;
+      i += 16;
+      continue;
+    }
+    const char* const block_limit = cursor + 16;
+    do {
+      const char* next = cursor;
+      if (RIEGELI_UNLIKELY(!VarintTraits<T>::Read(&next, &dest[i]))) {
+        *src = cursor;
+        return i;
+      }
+      cursor = next;
+      ++i;
+    } while (cursor < block_limit && i < num);
+  }
+  *src = cursor;
+  return i + DecodeVarintsPortable(src, limit, dest + i, num - i);
+}
+
+// Converts 32 single-byte varints to T.
+template <typename T>
+void Widen32(__m256i bytes, T* dest);
+
+template <>
+__attribute__((target("avx2"))) inline void Widen32(__m256i bytes,
+                                                    uint32_t* dest) {
+  __m256i* const out = reinterpret_cast<__m256i*>(dest);
+  const __m128i low = _mm256_castsi256_si128(bytes);
+  const __m128i high = _mm256_extracti128_si256(bytes, 1);
+  _mm256_storeu_si256(out + 0, _mm256_cvtepu8_epi32(low));
+  _mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)));
+  _mm256_storeu_si256(out + 2, _mm256_cvtepu8_epi32(high));
+  _mm256_storeu_si256(out + 3, _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)));
+}
+
+template <>
+__attribute__((target("avx2"))) inline void Widen32(__m256i bytes,
+                                                    uint64_t* dest) {
+  __m256i* const out = reinterpret_cast<__m256i*>(dest);
+  const __m128i low = _mm256_castsi256_si128(bytes);
+  const __m128i high = _mm256_extracti128_si256(bytes, 1);
+  _mm256_storeu_si256(out + 0, _mm256_cvtepu8_epi64(low));
+  _mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi64(_mm_srli_si128(low, 4)));
+  _mm256_storeu_si256(out + 2, _mm256_cvtepu8_epi64(_mm_srli_si128(low, 8)));
+  _mm256_storeu_si256(out + 3, _mm256_cvtepu8_epi64(_mm_srli_si128(low, 12)));
+  _mm256_storeu_si256(out + 4, _mm256_cvtepu8_epi64(high));
+  _mm256_storeu_si256(out + 5, _mm256_cvtepu8_epi64(_mm_srli_si128(high, 4)));
+  _mm256_storeu_si256(out + 6, _mm256_cvtepu8_epi64(_mm_srli_si128(high, 8)));
+  _mm256_storeu_si256(out + 7,
+                      _mm256_cvtepu8_epi64(_mm_srli_si128(high, 12)));
+}
+
+// For each length of a varint up to 8 bytes, the mask of its value bits.
+constexpr uint64_t kValueBits[9] = {
+    0,
+    0x000000000000007f,
+    0x0000000000007f7f,
+    0x00000000007f7f7f,
+    0x000000007f7f7f7f,
+    0x0000007f7f7f7f7f,
+    0x00007f7f7f7f7f7f,
+    0x007f7f7f7f7f7f7f,
+    0x7f7f7f7f7f7f7f7f,
+};
+
+// Classifies 32 bytes at a time by their continuation bits. If they are all
+// single-byte varints, they are widened together. Otherwise the ends of
+// varints are found from the continuation bits, and each varint of up to 8
+// bytes is decoded with a single PEXT instruction. Longer varints, which are
+// rare, are decoded one byte at a time.
+template <typename T>
+__attribute__((target("avx2,bmi,bmi2"))) size_t DecodeVarintsAVX2(
+    const char** src, const char* limit, T* dest, size_t num) {
+  // 8 bytes are loaded from the beginning of each varint, which begins at most
+  // 31 bytes after cursor.
+  constexpr size_t kMinAvailable = 32 + 8;
+  constexpr size_t kMaxFastLength =
+      VarintTraits<T>::kMaxLength < 8 ? VarintTraits<T>::kMaxLength : 8;
+  const char* cursor = *src;
+  size_t i = 0;
+  while (i < num && PtrDistance(cursor, limit) >= kMinAvailable) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor));
+    const uint32_t continuation =
+        static_cast<uint32_t>(_mm256_movemask_epi8(bytes));
+    if (continuation == 0 && num - i >= 32) {
+      Widen32(bytes, dest + i);
+      cursor += 32;
+      i += 32;
+      continue;
+    }
+    uint32_t ends = ~continuation;
+    size_t begin = 0;
+    while (ends != 0 && i < num) {
+      const size_t end = IntCast<size_t>(_tzcnt_u32(ends));
+      const size_t length = end + 1 - begin;
+      if (length > kMaxFastLength) break;
+      const uint8_t last_byte = static_cast<uint8_t>(cursor[end]);
+      if (RIEGELI_UNLIKELY(length > 1 && last_byte == 0)) break;
+      if (length == VarintTraits<T>::kMaxLength &&
+          RIEGELI_UNLIKELY(last_byte >= (uint32_t{1} << (sizeof(T) * 8 -
+                                                          (length - 1) * 7)))) {
+        break;
+      }
+      uint64_t word;
+      std::memcpy(&word, cursor + begin, sizeof(word));
+      dest[i++] = static_cast<T>(_pext_u64(word, kValueBits[length]));
+      begin = end + 1;
+      ends = _blsr_u32(ends);
+    }
+    if (begin == 0) {
+      // The varint is long or invalid.
+      if (i == num) break;
+      const char* next = cursor;
+      if (RIEGELI_UNLIKELY(!VarintTraits<T>::Read(&next, &dest[i]))) break;
+      cursor = next;
+      ++i;
+      continue;
+    }
+    cursor += begin;
+  }
+  *src = cursor;
+  return i + DecodeVarintsPortable(src, limit, dest + i, num - i);
+}
+
+#endif  // RIEGELI_INTERNAL_X86_SIMD
+
+template <typename T>
+using DecodeVarintsFunction = size_t (*)(const char** src, const char* limit,
+                                         T* dest, size_t num);
+
+template <typename T>
+DecodeVarintsFunction<T> ChooseDecodeVarints() {
+#if RIEGELI_INTERNAL_X86_SIMD
+  const highwayhash::TargetBits supported =
+      highwayhash::InstructionSets::Supported();
+  // HighwayHash includes BMI2 in its AVX2 target.
+  if (supported & HH_TARGET_AVX2) return DecodeVarintsAVX2<T>;
+  if (supported & HH_TARGET_SSE41) return DecodeVarintsSSE41<T>;
+#endif
+  return DecodeVarintsPortable<T>;
+}
+
+template <typename T>
+bool ReadVarints(Reader* src, T* dest, size_t num) {
+  static const DecodeVarintsFunction<T> decode_varints =
+      ChooseDecodeVarints<T>();
+  while (num > 0) {
+    if (src->available() >= VarintTraits<T>::kMaxLength) {
+      const char* cursor = src->cursor();
+      const size_t num_decoded =
+          decode_varints(&cursor, src->limit(), dest, num);
+      src->set_cursor(cursor);
+      dest += num_decoded;
+      num -= num_decoded;
+      if (num == 0) break;
+    }
+    // Near the end of the buffer, or the varint is invalid.
+    if (RIEGELI_UNLIKELY(!VarintTraits<T>::Read(src, dest))) return false;
+    ++dest;
+    --num;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ReadVarints32(Reader* src, uint32_t* dest, size_t num) {
+  return ReadVarints(src, dest, num);
+}
+
+bool ReadVarints64(Reader* src, uint64_t* dest, size_t num) {
+  return ReadVarints(src, dest, num);
+}
+
 bool ReadAll(Reader* src, string_view* dest, std::string* scratch) {
   Position size;
   if (src->Size(&size)) {
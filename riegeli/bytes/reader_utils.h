@@ -15,6 +15,7 @@
 #ifndef RIEGELI_BYTES_READER_UTILS_H_
 #define RIEGELI_BYTES_READER_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -46,6 +47,18 @@ bool ReadVarint64(const char** src, uint64_t* data);
 bool ReadVarint32(Reader* src, uint32_t* data);
 bool ReadVarint64(Reader* src, uint64_t* data);
 
+// Reads num varints to dest[0..num). This is equivalent to calling
+// ReadVarint32() or ReadVarint64() num times, but faster when num is large:
+// on x86-64 it uses SSE4.1 or AVX2 instructions, selected at runtime
+// depending on the CPU.
+//
+// Return values:
+//  * true  - success (num values read)
+//  * false - failure (source ends or some varint is invalid; the position
+//            and the contents of dest[] are unspecified)
+bool ReadVarints32(Reader* src, uint32_t* dest, size_t num);
+bool ReadVarints64(Reader* src, uint64_t* dest, size_t num);
+
 // Returns the updated dest after the copied value, or nullptr on failure.
 // At least kMaxLengthVarint32() bytes of space at dest[] must be available.
 char* CopyVarint32(Reader* src, char* dest);
@@ -0,0 +1,126 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_reader.h"
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "snappy.h"
+
+namespace riegeli {
+
+namespace {
+
+// Snappy encodes at most 64 bytes of uncompressed data in a 3-byte copy
+// element, so the uncompressed length read from the header is trusted only up
+// to this multiple of the compressed size.
+constexpr size_t kMaxSnappyCompressionRatio = 22;
+
+}  // namespace
+
+SnappyReader::SnappyReader() noexcept : Reader(State::kClosed) {}
+
+SnappyReader::SnappyReader(std::unique_ptr<Reader> src)
+    : SnappyReader(src.get()) {
+  owned_src_ = std::move(src);
+}
+
+SnappyReader::SnappyReader(Reader* src)
+    : Reader(State::kOpen), src_(RIEGELI_ASSERT_NOTNULL(src)) {}
+
+SnappyReader::SnappyReader(SnappyReader&& src) noexcept
+    : Reader(std::move(src)),
+      owned_src_(std::move(src.owned_src_)),
+      src_(riegeli::exchange(src.src_, nullptr)),
+      decompressed_(riegeli::exchange(src.decompressed_, false)),
+      uncompressed_(std::move(src.uncompressed_)) {}
+
+SnappyReader& SnappyReader::operator=(SnappyReader&& src) noexcept {
+  Reader::operator=(std::move(src));
+  owned_src_ = std::move(src.owned_src_);
+  src_ = riegeli::exchange(src.src_, nullptr);
+  decompressed_ = riegeli::exchange(src.decompressed_, false);
+  uncompressed_ = std::move(src.uncompressed_);
+  return *this;
+}
+
+SnappyReader::~SnappyReader() = default;
+
+void SnappyReader::Done() {
+  if (owned_src_ != nullptr) {
+    if (RIEGELI_LIKELY(healthy())) {
+      if (RIEGELI_UNLIKELY(!owned_src_->Close())) Fail(*owned_src_);
+    }
+    owned_src_.reset();
+  }
+  src_ = nullptr;
+  decompressed_ = false;
+  uncompressed_.reset();
+  Reader::Done();
+}
+
+bool SnappyReader::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (decompressed_) return false;
+  decompressed_ = true;
+  string_view compressed;
+  std::string scratch;
+  if (RIEGELI_UNLIKELY(!ReadAll(src_, &compressed, &scratch))) {
+    if (src_->healthy()) return Fail("Truncated Snappy-compressed stream");
+    return Fail(*src_);
+  }
+  size_t length;
+  if (RIEGELI_UNLIKELY(!snappy::GetUncompressedLength(
+          compressed.data(), compressed.size(), &length))) {
+    return Fail("Invalid Snappy-compressed stream");
+  }
+  if (length == 0) return false;
+  if (RIEGELI_UNLIKELY(length / kMaxSnappyCompressionRatio >=
+                       compressed.size())) {
+    // The length is corrupted. Fail without allocating it.
+    return Fail("Invalid Snappy-compressed stream");
+  }
+  uncompressed_.reset(new char[length]);
+  if (RIEGELI_UNLIKELY(!snappy::RawUncompress(
+          compressed.data(), compressed.size(), uncompressed_.get()))) {
+    uncompressed_.reset();
+    return Fail("Invalid Snappy-compressed stream");
+  }
+  start_ = uncompressed_.get();
+  cursor_ = start_;
+  limit_ = start_ + length;
+  limit_pos_ += length;
+  return true;
+}
+
+bool SnappyReader::HopeForMoreSlow() const {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::HopeForMoreSlow(): "
+         "data available, use HopeForMore() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  return !decompressed_;
+}
+
+}  // namespace riegeli
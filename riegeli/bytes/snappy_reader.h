@@ -0,0 +1,69 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_READER_H_
+#define RIEGELI_BYTES_SNAPPY_READER_H_
+
+#include <memory>
+
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// A Reader which decompresses data with Snappy after getting it from another
+// Reader.
+//
+// The Snappy format is not streamable: the whole compressed stream is read and
+// decompressed on the first Pull() into a flat buffer, which is then exposed
+// directly without further copying.
+class SnappyReader final : public Reader {
+ public:
+  // Creates a closed SnappyReader.
+  SnappyReader() noexcept;
+
+  // Will read Snappy-compressed stream from the byte Reader which is owned by
+  // this SnappyReader and will be closed and deleted when the SnappyReader is
+  // closed.
+  explicit SnappyReader(std::unique_ptr<Reader> src);
+
+  // Will read Snappy-compressed stream from the byte Reader which is not owned
+  // by this SnappyReader and must be kept alive but not accessed until closing
+  // the SnappyReader.
+  explicit SnappyReader(Reader* src);
+
+  SnappyReader(SnappyReader&& src) noexcept;
+  SnappyReader& operator=(SnappyReader&& src) noexcept;
+
+  ~SnappyReader();
+
+ protected:
+  void Done() override;
+  bool PullSlow() override;
+  bool HopeForMoreSlow() const override;
+
+ private:
+  std::unique_ptr<Reader> owned_src_;
+  // Invariant: if healthy() and !decompressed_ then src_ != nullptr
+  Reader* src_ = nullptr;
+  // If true, all data have been decompressed to uncompressed_ and src_ is no
+  // longer used.
+  bool decompressed_ = false;
+  // Decompressed data. start_ points here after decompression.
+  std::unique_ptr<char[]> uncompressed_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_READER_H_
@@ -0,0 +1,116 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_writer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "snappy.h"
+
+namespace riegeli {
+
+SnappyWriter::SnappyWriter() noexcept = default;
+
+SnappyWriter::SnappyWriter(std::unique_ptr<Writer> dest, Options options)
+    : SnappyWriter(dest.get(), options) {
+  owned_dest_ = std::move(dest);
+}
+
+SnappyWriter::SnappyWriter(Writer* dest, Options options)
+    : BufferedWriter(options.buffer_size_),
+      dest_(RIEGELI_ASSERT_NOTNULL(dest)) {
+  if (options.size_hint_ > 0) {
+    uncompressed_.reserve(UnsignedMin(options.size_hint_,
+                                      std::numeric_limits<uint32_t>::max()));
+  }
+}
+
+SnappyWriter::SnappyWriter(SnappyWriter&& src) noexcept
+    : BufferedWriter(std::move(src)),
+      owned_dest_(std::move(src.owned_dest_)),
+      dest_(riegeli::exchange(src.dest_, nullptr)),
+      uncompressed_(std::move(src.uncompressed_)) {}
+
+SnappyWriter& SnappyWriter::operator=(SnappyWriter&& src) noexcept {
+  BufferedWriter::operator=(std::move(src));
+  owned_dest_ = std::move(src.owned_dest_);
+  dest_ = riegeli::exchange(src.dest_, nullptr);
+  uncompressed_ = std::move(src.uncompressed_);
+  return *this;
+}
+
+SnappyWriter::~SnappyWriter() = default;
+
+void SnappyWriter::Done() {
+  PushInternal();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (RIEGELI_LIKELY(healthy())) {
+    const size_t max_length = snappy::MaxCompressedLength(uncompressed_.size());
+    if (dest_->available() >= max_length) {
+      size_t length;
+      snappy::RawCompress(uncompressed_.data(), uncompressed_.size(),
+                          dest_->cursor(), &length);
+      dest_->set_cursor(dest_->cursor() + length);
+    } else {
+      std::string compressed;
+      snappy::Compress(uncompressed_.data(), uncompressed_.size(),
+                       &compressed);
+      if (RIEGELI_UNLIKELY(!dest_->Write(std::move(compressed)))) {
+        Fail(*dest_);
+      }
+    }
+  }
+  if (owned_dest_ != nullptr) {
+    if (RIEGELI_LIKELY(healthy())) {
+      if (RIEGELI_UNLIKELY(!owned_dest_->Close())) Fail(*owned_dest_);
+    }
+    owned_dest_.reset();
+  }
+  dest_ = nullptr;
+  uncompressed_ = std::string();
+  BufferedWriter::Done();
+}
+
+bool SnappyWriter::WriteInternal(string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "Object unhealthy";
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not cleared";
+  // The Snappy format stores the uncompressed size as a 32-bit value.
+  if (RIEGELI_UNLIKELY(src.size() > std::numeric_limits<uint32_t>::max() -
+                                        uncompressed_.size())) {
+    limit_ = start_;
+    return FailOverflow();
+  }
+  uncompressed_.append(src.data(), src.size());
+  start_pos_ += src.size();
+  return true;
+}
+
+}  // namespace riegeli
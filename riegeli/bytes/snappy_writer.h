@@ -0,0 +1,107 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_WRITER_H_
+#define RIEGELI_BYTES_SNAPPY_WRITER_H_
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// A Writer which compresses data with Snappy before passing it to another
+// Writer.
+//
+// The Snappy format is not streamable: all data are accumulated in memory and
+// compressed when the SnappyWriter is closed. Flush() is not supported. The
+// total size is limited to 4GB - 1.
+class SnappyWriter final : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    Options() noexcept {}
+
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of SnappyWriter::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Announce in advance the destination size. This avoids reallocating the
+    // uncompressed data.
+    //
+    // If the size hint turns out to not match reality, nothing breaks.
+    Options& set_size_hint(Position size_hint) & {
+      size_hint_ = size_hint;
+      return *this;
+    }
+    Options&& set_size_hint(Position size_hint) && {
+      return std::move(set_size_hint(size_hint));
+    }
+
+   private:
+    friend class SnappyWriter;
+
+    size_t buffer_size_ = kDefaultBufferSize();
+    Position size_hint_ = 0;
+  };
+
+  // Creates a closed SnappyWriter.
+  SnappyWriter() noexcept;
+
+  // Will write Snappy-compressed stream to the byte Writer which is owned by
+  // this SnappyWriter and will be closed and deleted when the SnappyWriter is
+  // closed.
+  explicit SnappyWriter(std::unique_ptr<Writer> dest,
+                        Options options = Options());
+
+  // Will write Snappy-compressed stream to the byte Writer which is not owned
+  // by this SnappyWriter and must be kept alive but not accessed until closing
+  // the SnappyWriter.
+  explicit SnappyWriter(Writer* dest, Options options = Options());
+
+  SnappyWriter(SnappyWriter&& src) noexcept;
+  SnappyWriter& operator=(SnappyWriter&& src) noexcept;
+
+  ~SnappyWriter();
+
+ protected:
+  void Done() override;
+  bool WriteInternal(string_view src) override;
+
+ private:
+  std::unique_ptr<Writer> owned_dest_;
+  // Invariant: if healthy() then dest_ != nullptr
+  Writer* dest_ = nullptr;
+  // Data to be compressed when the SnappyWriter is closed.
+  std::string uncompressed_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_WRITER_H_
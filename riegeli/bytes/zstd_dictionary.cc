@@ -0,0 +1,95 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/zstd_dictionary.h"
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/string_view.h"
+#include "zdict.h"
+#include "zstd.h"
+
+namespace riegeli {
+
+inline void ZstdDictionary::ZSTD_CDictDeleter::operator()(
+    ZSTD_CDict* ptr) const {
+  ZSTD_freeCDict(ptr);
+}
+
+inline void ZstdDictionary::ZSTD_DDictDeleter::operator()(
+    ZSTD_DDict* ptr) const {
+  ZSTD_freeDDict(ptr);
+}
+
+ZstdDictionary::ZstdDictionary(std::string data) : data_(std::move(data)) {}
+
+ZstdDictionary::~ZstdDictionary() = default;
+
+std::shared_ptr<const ZstdDictionary> ZstdDictionary::Train(
+    const std::vector<Chain>& samples, size_t max_size) {
+  RIEGELI_ASSERT_GT(max_size, 0u)
+      << "Failed precondition of ZstdDictionary::Train(): "
+         "zero dictionary size";
+  // ZDICT_trainFromBuffer() expects samples concatenated in one buffer.
+  size_t total_size = 0;
+  for (const Chain& sample : samples) total_size += sample.size();
+  std::string samples_buffer;
+  samples_buffer.reserve(total_size);
+  std::vector<size_t> sample_sizes;
+  sample_sizes.reserve(samples.size());
+  for (const Chain& sample : samples) {
+    sample.AppendTo(&samples_buffer);
+    sample_sizes.push_back(sample.size());
+  }
+  std::string data(max_size, '\0');
+  const size_t result = ZDICT_trainFromBuffer(
+      &data[0], data.size(), samples_buffer.data(), sample_sizes.data(),
+      IntCast<unsigned>(sample_sizes.size()));
+  if (RIEGELI_UNLIKELY(ZDICT_isError(result))) return nullptr;
+  data.resize(result);
+  return std::make_shared<const ZstdDictionary>(std::move(data));
+}
+
+const ZSTD_CDict* ZstdDictionary::PrepareCompressionDictionary(
+    int compression_level) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : compression_dictionaries_) {
+    if (entry.first == compression_level) return entry.second.get();
+  }
+  std::unique_ptr<ZSTD_CDict, ZSTD_CDictDeleter> dictionary(
+      ZSTD_createCDict(data_.data(), data_.size(), compression_level));
+  if (RIEGELI_UNLIKELY(dictionary == nullptr)) return nullptr;
+  const ZSTD_CDict* const result = dictionary.get();
+  compression_dictionaries_.emplace_back(compression_level,
+                                         std::move(dictionary));
+  return result;
+}
+
+const ZSTD_DDict* ZstdDictionary::PrepareDecompressionDictionary() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (decompression_dictionary_ == nullptr) {
+    decompression_dictionary_.reset(
+        ZSTD_createDDict(data_.data(), data_.size()));
+  }
+  return decompression_dictionary_.get();
+}
+
+}  // namespace riegeli
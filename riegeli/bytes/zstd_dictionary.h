@@ -0,0 +1,102 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_ZSTD_DICTIONARY_H_
+#define RIEGELI_BYTES_ZSTD_DICTIONARY_H_
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/string_view.h"
+#include "zstd.h"
+
+namespace riegeli {
+
+// A Zstd dictionary, shared by ZstdWriter and ZstdReader instances which
+// compress or decompress many small streams with similar contents.
+//
+// A dictionary must be digested before Zstd can use it, which is costly
+// compared to compressing a small stream. ZstdDictionary digests its data
+// lazily and caches the results: one digested dictionary per compression level
+// for compression, and one for decompression.
+//
+// ZstdDictionary is thread-safe. It is meant to be shared as
+// std::shared_ptr<const ZstdDictionary>.
+class ZstdDictionary {
+ public:
+  // Creates a dictionary from its serialized form, as returned by data().
+  //
+  // This is either a dictionary produced by Train() or by the zstd command line
+  // tool, or raw content which is likely to occur in the data.
+  explicit ZstdDictionary(std::string data);
+
+  ZstdDictionary(const ZstdDictionary&) = delete;
+  ZstdDictionary& operator=(const ZstdDictionary&) = delete;
+
+  ~ZstdDictionary();
+
+  // Trains a dictionary of at most max_size bytes from samples.
+  //
+  // Returns nullptr if training failed, e.g. if there are too few samples.
+  static std::shared_ptr<const ZstdDictionary> Train(
+      const std::vector<Chain>& samples, size_t max_size);
+
+  // Returns the serialized dictionary.
+  string_view data() const { return data_; }
+
+  // Returns the dictionary digested for compression at compression_level,
+  // digesting it on the first call for that level.
+  //
+  // Returns nullptr on failure. The result is valid as long as the
+  // ZstdDictionary is alive.
+  const ZSTD_CDict* PrepareCompressionDictionary(int compression_level) const;
+
+  // Returns the dictionary digested for decompression, digesting it on the
+  // first call.
+  //
+  // Returns nullptr on failure. The result is valid as long as the
+  // ZstdDictionary is alive.
+  const ZSTD_DDict* PrepareDecompressionDictionary() const;
+
+ private:
+  struct ZSTD_CDictDeleter {
+    void operator()(ZSTD_CDict* ptr) const;
+  };
+  struct ZSTD_DDictDeleter {
+    void operator()(ZSTD_DDict* ptr) const;
+  };
+
+  std::string data_;
+  mutable std::mutex mutex_;
+  // Digested dictionaries for compression, keyed by compression level. There
+  // are few distinct levels in practice, so linear search suffices.
+  //
+  // Guarded by mutex_.
+  mutable std::vector<
+      std::pair<int, std::unique_ptr<ZSTD_CDict, ZSTD_CDictDeleter>>>
+      compression_dictionaries_;
+  // Guarded by mutex_.
+  mutable std::unique_ptr<ZSTD_DDict, ZSTD_DDictDeleter>
+      decompression_dictionary_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_ZSTD_DICTIONARY_H_
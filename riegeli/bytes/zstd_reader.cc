@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Make ZSTD_initDStream_usingDDict() available.
+#define ZSTD_STATIC_LINKING_ONLY
+
 #include "riegeli/bytes/zstd_reader.h"
 
 #include <stddef.h>
@@ -21,8 +24,10 @@
 #include <utility>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -35,18 +40,38 @@ inline void ZstdReader::ZSTD_DStreamDeleter::operator()(
 ZstdReader::ZstdReader() noexcept = default;
 
 ZstdReader::ZstdReader(std::unique_ptr<Reader> src, Options options)
-    : ZstdReader(src.get(), options) {
+    : ZstdReader(src.get(), std::move(options)) {
   owned_src_ = std::move(src);
 }
 
 ZstdReader::ZstdReader(Reader* src, Options options)
     : BufferedReader(options.buffer_size_),
       src_(RIEGELI_ASSERT_NOTNULL(src)),
-      decompressor_(ZSTD_createDStream()) {
+      dictionary_(std::move(options.dictionary_)),
+      decompressor_(DecompressorPool::global().Get(0, [] {
+        return std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter>(
+            ZSTD_createDStream());
+      })) {
   if (RIEGELI_UNLIKELY(decompressor_ == nullptr)) {
     Fail("ZSTD_createDStream() failed");
     return;
   }
+  // Initialization resets the decompression context if it is reused.
+  if (dictionary_ != nullptr) {
+    const ZSTD_DDict* const decompression_dictionary =
+        dictionary_->PrepareDecompressionDictionary();
+    if (RIEGELI_UNLIKELY(decompression_dictionary == nullptr)) {
+      Fail("ZSTD_createDDict() failed");
+      return;
+    }
+    const size_t result = ZSTD_initDStream_usingDDict(
+        decompressor_.get(), decompression_dictionary);
+    if (RIEGELI_UNLIKELY(ZSTD_isError(result))) {
+      Fail(std::string("ZSTD_initDStream_usingDDict() failed: ") +
+           ZSTD_getErrorName(result));
+    }
+    return;
+  }
   const size_t result = ZSTD_initDStream(decompressor_.get());
   if (RIEGELI_UNLIKELY(ZSTD_isError(result))) {
     Fail(std::string("ZSTD_initDStream() failed: ") + ZSTD_getErrorName(result));
@@ -57,12 +82,14 @@ ZstdReader::ZstdReader(ZstdReader&& src) noexcept
     : BufferedReader(std::move(src)),
       owned_src_(std::move(src.owned_src_)),
       src_(riegeli::exchange(src.src_, nullptr)),
+      dictionary_(std::move(src.dictionary_)),
       decompressor_(std::move(src.decompressor_)) {}
 
 ZstdReader& ZstdReader::operator=(ZstdReader&& src) noexcept {
   BufferedReader::operator=(std::move(src));
   owned_src_ = std::move(src.owned_src_);
   src_ = riegeli::exchange(src.src_, nullptr);
+  dictionary_ = std::move(src.dictionary_);
   decompressor_ = std::move(src.decompressor_);
   return *this;
 }
@@ -81,6 +108,7 @@ void ZstdReader::Done() {
   }
   src_ = nullptr;
   decompressor_.reset();
+  dictionary_.reset();
   BufferedReader::Done();
 }
 
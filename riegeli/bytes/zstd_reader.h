@@ -20,8 +20,10 @@
 #include <utility>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -47,10 +49,27 @@ class ZstdReader final : public BufferedReader {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // Decompress with a dictionary. This must be the dictionary which was
+    // given to ZstdWriter::Options::set_dictionary() for compression.
+    //
+    // nullptr means no dictionary.
+    //
+    // Default: nullptr.
+    Options& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
    private:
     friend class ZstdReader;
 
     size_t buffer_size_ = ZSTD_DStreamOutSize();
+    std::shared_ptr<const ZstdDictionary> dictionary_;
   };
 
   // Creates a closed ZstdReader.
@@ -82,13 +101,19 @@ class ZstdReader final : public BufferedReader {
     void operator()(ZSTD_DStream* ptr) const;
   };
 
+  // Decompression contexts are reused by later ZstdReaders. They do not depend
+  // on parameters, so they are all kept with the key 0.
+  using DecompressorPool = RecyclingPool<ZSTD_DStream, ZSTD_DStreamDeleter>;
+
   std::unique_ptr<Reader> owned_src_;
   // Invariant: if healthy() then src_ != nullptr
   Reader* src_ = nullptr;
+  // Keeps the digested dictionary used by decompressor_ alive.
+  std::shared_ptr<const ZstdDictionary> dictionary_;
   // If healthy() but decompressor_ == nullptr then all data have been
   // decompressed. In this case ZSTD_decompressStream() must not be called
   // again.
-  std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter> decompressor_;
+  DecompressorPool::Handle decompressor_;
 };
 
 }  // namespace riegeli
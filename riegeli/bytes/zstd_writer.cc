@@ -12,8 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make ZSTD_initCStream_advanced() available, which allows specifying a size
-// hint.
+// Make ZSTD_initCStream_advanced() and ZSTD_initCStream_usingCDict_advanced()
+// available, which allow specifying a size hint.
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include "riegeli/bytes/zstd_writer.h"
@@ -25,9 +25,11 @@
 #include <utility>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -40,23 +42,49 @@ inline void ZstdWriter::ZSTD_CStreamDeleter::operator()(
 ZstdWriter::ZstdWriter() noexcept = default;
 
 ZstdWriter::ZstdWriter(std::unique_ptr<Writer> dest, Options options)
-    : ZstdWriter(dest.get(), options) {
+    : ZstdWriter(dest.get(), std::move(options)) {
   owned_dest_ = std::move(dest);
 }
 
 ZstdWriter::ZstdWriter(Writer* dest, Options options)
     : BufferedWriter(options.buffer_size_),
       dest_(RIEGELI_ASSERT_NOTNULL(dest)),
-      compressor_(ZSTD_createCStream()) {
+      dictionary_(std::move(options.dictionary_)),
+      compressor_(CompressorPool::global().Get(
+          std::make_pair(options.compression_level_, dictionary_ != nullptr),
+          [] {
+            return std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter>(
+                ZSTD_createCStream());
+          })) {
   if (RIEGELI_UNLIKELY(compressor_ == nullptr)) {
     Fail("ZSTD_createCStream() failed");
     return;
   }
   const unsigned long long size_hint = UnsignedMin(
       options.size_hint_, std::numeric_limits<unsigned long long>::max());
+  // Initialization resets the compression context if it is reused.
   ZSTD_parameters params =
-      ZSTD_getParams(options.compression_level_, size_hint, 0);
+      ZSTD_getParams(options.compression_level_, size_hint,
+                     dictionary_ == nullptr ? 0 : dictionary_->data().size());
   params.fParams.contentSizeFlag = options.size_hint_ > 0 ? 1 : 0;
+  if (dictionary_ != nullptr) {
+    const ZSTD_CDict* const compression_dictionary =
+        dictionary_->PrepareCompressionDictionary(options.compression_level_);
+    if (RIEGELI_UNLIKELY(compression_dictionary == nullptr)) {
+      Fail("ZSTD_createCDict() failed");
+      return;
+    }
+    // Unlike ZSTD_initCStream_advanced(), 0 means an empty source here rather
+    // than an unknown size.
+    const size_t result = ZSTD_initCStream_usingCDict_advanced(
+        compressor_.get(), compression_dictionary, params.fParams,
+        options.size_hint_ > 0 ? size_hint : ZSTD_CONTENTSIZE_UNKNOWN);
+    if (RIEGELI_UNLIKELY(ZSTD_isError(result))) {
+      Fail(std::string("ZSTD_initCStream_usingCDict_advanced() failed: ") +
+           ZSTD_getErrorName(result));
+    }
+    return;
+  }
   const size_t result = ZSTD_initCStream_advanced(compressor_.get(), nullptr, 0,
                                                   params, size_hint);
   if (RIEGELI_UNLIKELY(ZSTD_isError(result))) {
@@ -69,12 +97,14 @@ ZstdWriter::ZstdWriter(ZstdWriter&& src) noexcept
     : BufferedWriter(std::move(src)),
       owned_dest_(std::move(src.owned_dest_)),
       dest_(riegeli::exchange(src.dest_, nullptr)),
+      dictionary_(std::move(src.dictionary_)),
       compressor_(std::move(src.compressor_)) {}
 
 ZstdWriter& ZstdWriter::operator=(ZstdWriter&& src) noexcept {
   BufferedWriter::operator=(std::move(src));
   owned_dest_ = std::move(src.owned_dest_);
   dest_ = riegeli::exchange(src.dest_, nullptr);
+  dictionary_ = std::move(src.dictionary_);
   compressor_ = std::move(src.compressor_);
   return *this;
 }
@@ -96,6 +126,7 @@ void ZstdWriter::Done() {
   }
   dest_ = nullptr;
   compressor_.reset();
+  dictionary_.reset();
   BufferedWriter::Done();
 }
 
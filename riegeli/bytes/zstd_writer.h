@@ -20,9 +20,11 @@
 #include <utility>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -81,12 +83,29 @@ class ZstdWriter final : public BufferedWriter {
       return std::move(set_size_hint(size_hint));
     }
 
+    // Compress with a dictionary. The same dictionary must be given to
+    // ZstdReader::Options::set_dictionary() for decompression.
+    //
+    // nullptr means no dictionary.
+    //
+    // Default: nullptr.
+    Options& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
    private:
     friend class ZstdWriter;
 
     int compression_level_ = 9;
     size_t buffer_size_ = ZSTD_CStreamInSize();
     Position size_hint_ = 0;
+    std::shared_ptr<const ZstdDictionary> dictionary_;
   };
 
   // Creates a closed ZstdWriter.
@@ -119,13 +138,24 @@ class ZstdWriter final : public BufferedWriter {
     void operator()(ZSTD_CStream* ptr) const;
   };
 
+  // Compression contexts are reused by later ZstdWriters, which avoids
+  // allocating their large state again. They are keyed by the compression
+  // level and by whether a dictionary is used: initializing a context with a
+  // dictionary keeps compression parameters from its previous initialization
+  // in some Zstd versions, so contexts used without a dictionary are not
+  // reused with one.
+  using CompressorPool = RecyclingPool<ZSTD_CStream, ZSTD_CStreamDeleter,
+                                       std::pair<int, bool>>;
+
   template <typename Function>
   bool FlushInternal(Function function, string_view function_name);
 
   std::unique_ptr<Writer> owned_dest_;
   // Invariant: if healthy() then dest_ != nullptr
   Writer* dest_ = nullptr;
-  std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter> compressor_;
+  // Keeps the digested dictionary used by compressor_ alive.
+  std::shared_ptr<const ZstdDictionary> dictionary_;
+  CompressorPool::Handle compressor_;
 };
 
 }  // namespace riegeli
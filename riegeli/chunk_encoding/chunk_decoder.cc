@@ -16,34 +16,49 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits>
 #include <memory>
+#include <ostream>
 #include <string>
 #include <utility>
 
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/huge_pages.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/brotli_reader.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/lz4_reader.h"
 #include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/bytes/zstd_reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/flat_decompression.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
 
 namespace riegeli {
 
 namespace {
 
+// zstd_dictionary is used if compression_type is
+// internal::CompressionType::kZstdWithDictionary.
 class Decompressor {
  public:
   bool Initialize(ChainReader* src, internal::CompressionType compression_type,
+                  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
                   std::string* message);
 
   Reader* reader() const { return reader_; }
@@ -56,9 +71,10 @@ class Decompressor {
   Reader* reader_;
 };
 
-bool Decompressor::Initialize(ChainReader* src,
-                              internal::CompressionType compression_type,
-                              std::string* message) {
+bool Decompressor::Initialize(
+    ChainReader* src, internal::CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    std::string* message) {
   src_ = src;
   switch (compression_type) {
     case internal::CompressionType::kNone:
@@ -72,6 +88,23 @@ bool Decompressor::Initialize(ChainReader* src,
       owned_reader_ = riegeli::make_unique<ZstdReader>(src);
       reader_ = owned_reader_.get();
       return true;
+    case internal::CompressionType::kZstdWithDictionary:
+      if (RIEGELI_UNLIKELY(zstd_dictionary == nullptr)) {
+        *message = "Missing Zstd dictionary";
+        return false;
+      }
+      owned_reader_ = riegeli::make_unique<ZstdReader>(
+          src, ZstdReader::Options().set_dictionary(zstd_dictionary));
+      reader_ = owned_reader_.get();
+      return true;
+    case internal::CompressionType::kLz4:
+      owned_reader_ = riegeli::make_unique<Lz4Reader>(src);
+      reader_ = owned_reader_.get();
+      return true;
+    case internal::CompressionType::kSnappy:
+      owned_reader_ = riegeli::make_unique<SnappyReader>(src);
+      reader_ = owned_reader_.get();
+      return true;
   }
   *message = "Unknown compression type: " +
              std::to_string(static_cast<int>(compression_type));
@@ -83,12 +116,123 @@ bool Decompressor::VerifyEndAndClose() {
   return src_ == reader_ || src_->VerifyEndAndClose();
 }
 
+// Owns a buffer of decoded values, to be attached to a Chain as a single block.
+class FlatBuffer {
+ public:
+  // If huge_pages is true and the buffer is large enough, it is backed by huge
+  // pages if possible.
+  FlatBuffer(size_t size, bool huge_pages);
+
+  FlatBuffer(FlatBuffer&& src) noexcept;
+  FlatBuffer& operator=(FlatBuffer&& src) noexcept;
+
+  ~FlatBuffer();
+
+  char* data() const { return data_; }
+  void AddUniqueTo(string_view data, MemoryEstimator* memory_estimator) const;
+  void DumpStructure(string_view data, std::ostream& out) const;
+
+ private:
+  void Free();
+
+  char* data_;
+  size_t allocated_size_;
+  // If true, data_ was allocated by AllocateHugePages().
+  bool huge_pages_;
+};
+
+FlatBuffer::FlatBuffer(size_t size, bool huge_pages) {
+  if (huge_pages && size >= kHugePageSize) {
+    data_ = static_cast<char*>(AllocateHugePages(size, &allocated_size_));
+    if (data_ != nullptr) {
+      huge_pages_ = true;
+      return;
+    }
+  }
+  data_ = new char[size];
+  allocated_size_ = size;
+  huge_pages_ = false;
+}
+
+inline FlatBuffer::FlatBuffer(FlatBuffer&& src) noexcept
+    : data_(riegeli::exchange(src.data_, nullptr)),
+      allocated_size_(riegeli::exchange(src.allocated_size_, 0)),
+      huge_pages_(riegeli::exchange(src.huge_pages_, false)) {}
+
+inline FlatBuffer& FlatBuffer::operator=(FlatBuffer&& src) noexcept {
+  // Exchange data_ early to support self-assignment.
+  char* const data = riegeli::exchange(src.data_, nullptr);
+  Free();
+  data_ = data;
+  allocated_size_ = riegeli::exchange(src.allocated_size_, 0);
+  huge_pages_ = riegeli::exchange(src.huge_pages_, false);
+  return *this;
+}
+
+inline FlatBuffer::~FlatBuffer() { Free(); }
+
+inline void FlatBuffer::Free() {
+  if (data_ == nullptr) return;
+  if (huge_pages_) {
+    FreeHugePages(data_, allocated_size_);
+  } else {
+    delete[] data_;
+  }
+}
+
+void FlatBuffer::AddUniqueTo(string_view data,
+                             MemoryEstimator* memory_estimator) const {
+  memory_estimator->AddMemory(sizeof(*this) + allocated_size_);
+}
+
+void FlatBuffer::DumpStructure(string_view data, std::ostream& out) const {
+  out << (huge_pages_ ? "flat (huge pages)" : "flat");
+}
+
+// Writes backwards to an array of a fixed size, failing if it would overflow.
+class FlatBackwardWriter final : public BackwardWriter {
+ public:
+  FlatBackwardWriter(char* dest, size_t size);
+
+  // Returns the data written so far.
+  //
+  // Precondition: !closed()
+  string_view written() const {
+    return string_view(cursor_, written_to_buffer());
+  }
+
+ protected:
+  void Done() override { BackwardWriter::Done(); }
+  bool PushSlow() override;
+};
+
+inline FlatBackwardWriter::FlatBackwardWriter(char* dest, size_t size)
+    : BackwardWriter(State::kOpen) {
+  start_ = dest + size;
+  cursor_ = start_;
+  limit_ = dest;
+}
+
+bool FlatBackwardWriter::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of BackwardWriter::PushSlow(): "
+         "space available, use Push() instead";
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  return Fail("Decoded data exceed the size declared in chunk header");
+}
+
 }  // namespace
 
 ChunkDecoder::ChunkDecoder(Options options)
     : Object(State::kOpen),
       skip_corruption_(options.skip_corruption_),
-      field_filter_(std::move(options.field_filter_)) {
+      field_filter_(std::move(options.field_filter_)),
+      stats_(options.stats_),
+      thread_pool_(options.thread_pool_),
+      zstd_dictionary_(std::move(options.zstd_dictionary_)),
+      max_flat_chunk_size_(options.max_flat_chunk_size_),
+      huge_pages_(options.huge_pages_),
+      memory_budget_(options.memory_budget_) {
   Clear();
 }
 
@@ -96,6 +240,13 @@ ChunkDecoder::ChunkDecoder(ChunkDecoder&& src) noexcept
     : Object(std::move(src)),
       skip_corruption_(src.skip_corruption_),
       field_filter_(std::move(src.field_filter_)),
+      stats_(src.stats_),
+      thread_pool_(src.thread_pool_),
+      zstd_dictionary_(std::move(src.zstd_dictionary_)),
+      max_flat_chunk_size_(src.max_flat_chunk_size_),
+      huge_pages_(src.huge_pages_),
+      memory_budget_(src.memory_budget_),
+      decoded_memory_(riegeli::exchange(src.decoded_memory_, 0)),
       boundaries_(riegeli::exchange(src.boundaries_, std::vector<size_t>{0})),
       values_reader_(
           riegeli::exchange(src.values_reader_, ChainReader(Chain()))),
@@ -106,6 +257,14 @@ ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& src) noexcept {
   Object::operator=(std::move(src));
   skip_corruption_ = src.skip_corruption_;
   field_filter_ = std::move(src.field_filter_);
+  stats_ = src.stats_;
+  thread_pool_ = src.thread_pool_;
+  zstd_dictionary_ = std::move(src.zstd_dictionary_);
+  max_flat_chunk_size_ = src.max_flat_chunk_size_;
+  huge_pages_ = src.huge_pages_;
+  if (memory_budget_ != nullptr) memory_budget_->Release(decoded_memory_);
+  memory_budget_ = src.memory_budget_;
+  decoded_memory_ = riegeli::exchange(src.decoded_memory_, 0);
   boundaries_ = riegeli::exchange(src.boundaries_, std::vector<size_t>{0});
   values_reader_ = riegeli::exchange(src.values_reader_, ChainReader(Chain()));
   num_records_ = riegeli::exchange(src.num_records_, 0);
@@ -113,10 +272,15 @@ ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& src) noexcept {
   return *this;
 }
 
-ChunkDecoder::~ChunkDecoder() = default;
+ChunkDecoder::~ChunkDecoder() {
+  if (memory_budget_ != nullptr) memory_budget_->Release(decoded_memory_);
+}
 
 void ChunkDecoder::Clear() {
   MarkHealthy();
+  if (memory_budget_ != nullptr) {
+    memory_budget_->Release(riegeli::exchange(decoded_memory_, 0));
+  }
   boundaries_.clear();
   boundaries_.push_back(0);
   values_reader_ = ChainReader(Chain());
@@ -147,11 +311,48 @@ bool ChunkDecoder::Reset(const Chunk& chunk) {
   RIEGELI_ASSERT(!boundaries_.empty());
   RIEGELI_ASSERT_EQ(boundaries_.front(), 0u);
   RIEGELI_ASSERT_EQ(boundaries_.back(), values.size());
+  if (memory_budget_ != nullptr) {
+    decoded_memory_ =
+        values.EstimateMemory() + boundaries_.capacity() * sizeof(size_t);
+    memory_budget_->ReserveUnconditionally(decoded_memory_);
+  }
   values_reader_ = ChainReader(std::move(values));
   num_records_ = boundaries_.size() - 1;
+  if (stats_ != nullptr) stats_->AddDecodedChunk(num_records_);
   return true;
 }
 
+size_t ChunkDecoder::ReadRecords(std::vector<string_view>* records,
+                                 size_t max_num_records) {
+  RIEGELI_ASSERT_GT(max_num_records, 0u)
+      << "Failed precondition of ChunkDecoder::ReadRecords(): "
+         "no records requested";
+  const size_t num_records =
+      IntCast<size_t>(UnsignedMin(max_num_records, num_records_ - index_));
+  records->clear();
+  records->reserve(num_records);
+  records_scratch_.clear();
+  const size_t* boundary = &boundaries_[IntCast<size_t>(index_)];
+  for (size_t i = 0; i < num_records; ++i) {
+    RIEGELI_ASSERT_GE(boundary[1], boundary[0]);
+    const size_t length = boundary[1] - boundary[0];
+    ++boundary;
+    if (values_reader_.available() == 0) values_reader_.Pull();
+    if (RIEGELI_LIKELY(values_reader_.available() >= length)) {
+      records->emplace_back(values_reader_.cursor(), length);
+      values_reader_.set_cursor(values_reader_.cursor() + length);
+    } else {
+      records_scratch_.emplace_back(new char[length]);
+      if (!values_reader_.Read(records_scratch_.back().get(), length)) {
+        RIEGELI_ASSERT_UNREACHABLE();
+      }
+      records->emplace_back(records_scratch_.back().get(), length);
+    }
+  }
+  index_ += num_records;
+  return num_records;
+}
+
 bool ChunkDecoder::Initialize(uint8_t chunk_type, const ChunkHeader& header,
                               ChainReader* data_reader, Chain* values) {
   switch (static_cast<internal::ChunkType>(chunk_type)) {
@@ -161,6 +362,8 @@ bool ChunkDecoder::Initialize(uint8_t chunk_type, const ChunkHeader& header,
       return InitializeSimple(header, data_reader, values);
     case internal::ChunkType::kTransposed:
       return InitializeTransposed(header, data_reader, values);
+    case internal::ChunkType::kZstdDictionary:
+      return InitializeZstdDictionary(data_reader);
   }
   return Fail("Unknown chunk type: " + std::to_string(chunk_type));
 }
@@ -189,71 +392,171 @@ inline bool ChunkDecoder::InitializeSimple(const ChunkHeader& header,
   Decompressor sizes_decompressor;
   std::string message;
   if (RIEGELI_UNLIKELY(!sizes_decompressor.Initialize(
-          &compressed_sizes_reader, compression_type, &message))) {
+          &compressed_sizes_reader, compression_type, zstd_dictionary_,
+          &message))) {
     return Fail(message);
   }
 
+  const uint64_t decoded_data_size = header.decoded_data_size();
+  // If the compression library can decompress values in one call, they are
+  // decompressed directly to a flat buffer, without a Reader.
+  const bool decompress_flat =
+      internal::SupportsFlatDecompression(compression_type) &&
+      DecodeFlat(header);
   Decompressor values_decompressor;
-  if (RIEGELI_UNLIKELY(!values_decompressor.Initialize(
-          data_reader, compression_type, &message))) {
+  if (!decompress_flat &&
+      RIEGELI_UNLIKELY(!values_decompressor.Initialize(
+          data_reader, compression_type, zstd_dictionary_, &message))) {
     return Fail(message);
   }
 
-  const uint64_t decoded_data_size = header.decoded_data_size();
-  if (RIEGELI_UNLIKELY(
-          !values_decompressor.reader()->Read(values, decoded_data_size))) {
-    return Fail("Invalid simple chunk (values)");
-  }
-  if (RIEGELI_UNLIKELY(!values_decompressor.VerifyEndAndClose())) {
-    return Fail("Invalid simple chunk (closing values)");
+  {
+    PipelineStats::Timer timer(stats_, PipelineStats::Stage::kDecompress);
+    // Values extend until the end of the chunk. Their size is needed only for
+    // statistics.
+    Position compressed_size = 0;
+    if (stats_ != nullptr) {
+      Position data_size;
+      if (!data_reader->Size(&data_size)) RIEGELI_ASSERT_UNREACHABLE();
+      compressed_size = data_size - data_reader->pos();
+    }
+    if (decompress_flat) {
+      FlatBuffer flat_buffer(IntCast<size_t>(decoded_data_size), huge_pages_);
+      char* const flat_data = flat_buffer.data();
+      if (RIEGELI_UNLIKELY(!internal::DecompressFlat(
+              data_reader, compression_type, zstd_dictionary_, flat_data,
+              IntCast<size_t>(decoded_data_size)))) {
+        return Fail("Invalid simple chunk (values)");
+      }
+      values->AppendExternal(
+          std::move(flat_buffer),
+          string_view(flat_data, IntCast<size_t>(decoded_data_size)));
+    } else if (compression_type != internal::CompressionType::kNone &&
+               DecodeFlat(header)) {
+      FlatBuffer flat_buffer(IntCast<size_t>(decoded_data_size), huge_pages_);
+      char* const flat_data = flat_buffer.data();
+      if (RIEGELI_UNLIKELY(!values_decompressor.reader()->Read(
+              flat_data, IntCast<size_t>(decoded_data_size)))) {
+        return Fail("Invalid simple chunk (values)");
+      }
+      values->AppendExternal(
+          std::move(flat_buffer),
+          string_view(flat_data, IntCast<size_t>(decoded_data_size)));
+    } else if (RIEGELI_UNLIKELY(!values_decompressor.reader()->Read(
+                   values, decoded_data_size))) {
+      return Fail("Invalid simple chunk (values)");
+    }
+    if (!decompress_flat &&
+        RIEGELI_UNLIKELY(!values_decompressor.VerifyEndAndClose())) {
+      return Fail("Invalid simple chunk (closing values)");
+    }
+    timer.set_bytes(compressed_size, decoded_data_size);
   }
 
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kDecompress);
   const size_t num_boundaries = header.num_records() + 1;
   uint64_t boundary = 0;
   RIEGELI_ASSERT_EQ(boundaries_.size(), 1u);
   boundaries_[0] = boundary;
+  // Sizes are read in batches, which lets ReadVarints64() vectorize, while
+  // memory is not allocated for more records than are actually present.
+  uint64_t sizes[256];
   while (boundaries_.size() < num_boundaries) {
-    uint64_t size;
-    if (RIEGELI_UNLIKELY(!ReadVarint64(sizes_decompressor.reader(), &size))) {
+    const size_t batch_size = UnsignedMin(
+        num_boundaries - boundaries_.size(), sizeof(sizes) / sizeof(sizes[0]));
+    if (RIEGELI_UNLIKELY(
+            !ReadVarints64(sizes_decompressor.reader(), sizes, batch_size))) {
       return Fail("Invalid simple chunk (record size)");
     }
-    if (RIEGELI_UNLIKELY(size > decoded_data_size - boundary)) {
-      return Fail("Invalid simple chunk (overflow)");
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (RIEGELI_UNLIKELY(sizes[i] > decoded_data_size - boundary)) {
+        return Fail("Invalid simple chunk (overflow)");
+      }
+      boundary += sizes[i];
+      boundaries_.push_back(boundary);
     }
-    boundary += size;
-    boundaries_.push_back(boundary);
   }
+  const Position sizes_decoded_size = sizes_decompressor.reader()->pos();
   if (RIEGELI_UNLIKELY(!sizes_decompressor.VerifyEndAndClose())) {
     return Fail("Invalid simple chunk (closing sizes)");
   }
+  timer.set_bytes(compressed_sizes.size(), sizes_decoded_size);
   return true;
 }
 
 inline bool ChunkDecoder::InitializeTransposed(const ChunkHeader& header,
                                                ChainReader* data_reader,
                                                Chain* values) {
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTransposeDecode);
+  const Position pos_before = data_reader->pos();
   TransposeDecoder transpose_decoder;
+  transpose_decoder.set_stats(stats_);
+  transpose_decoder.set_thread_pool(thread_pool_);
+  transpose_decoder.set_zstd_dictionary(zstd_dictionary_);
+  transpose_decoder.set_max_flat_size(max_flat_chunk_size_);
   if (RIEGELI_UNLIKELY(
           !transpose_decoder.Initialize(data_reader, field_filter_))) {
     return Fail("Invalid transposed chunk");
   }
 
-  ChainBackwardWriter values_writer(
-      values,
-      ChainBackwardWriter::Options().set_size_hint(header.decoded_data_size()));
-  if (RIEGELI_UNLIKELY(
-          !transpose_decoder.Decode(&values_writer, &boundaries_))) {
-    return Fail("Invalid transposed chunk");
+  if (field_filter_.include_all() && DecodeFlat(header)) {
+    // Values are written backwards, so they end at the end of the buffer.
+    FlatBuffer flat_buffer(IntCast<size_t>(header.decoded_data_size()),
+                           huge_pages_);
+    FlatBackwardWriter values_writer(
+        flat_buffer.data(), IntCast<size_t>(header.decoded_data_size()));
+    if (RIEGELI_UNLIKELY(
+            !transpose_decoder.Decode(&values_writer, &boundaries_))) {
+      return Fail("Invalid transposed chunk");
+    }
+    const string_view written = values_writer.written();
+    if (!values_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+    values->AppendExternal(std::move(flat_buffer), written);
+  } else {
+    ChainBackwardWriter values_writer(
+        values, ChainBackwardWriter::Options().set_size_hint(
+                    header.decoded_data_size()));
+    if (RIEGELI_UNLIKELY(
+            !transpose_decoder.Decode(&values_writer, &boundaries_))) {
+      return Fail("Invalid transposed chunk");
+    }
+    if (!values_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
   }
-  if (!values_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+  timer.set_bytes(data_reader->pos() - pos_before, values->size());
   return data_reader->VerifyEndAndClose();
 }
 
+inline bool ChunkDecoder::DecodeFlat(const ChunkHeader& header) const {
+  return max_flat_chunk_size_ > 0 &&
+         header.decoded_data_size() <=
+             UnsignedMin(max_flat_chunk_size_,
+                         std::numeric_limits<size_t>::max());
+}
+
+inline bool ChunkDecoder::InitializeZstdDictionary(ChainReader* data_reader) {
+  // The dictionary extends until the end of the chunk.
+  Position data_size;
+  if (!data_reader->Size(&data_size)) RIEGELI_ASSERT_UNREACHABLE();
+  std::string dictionary;
+  if (!data_reader->Read(&dictionary, data_size - data_reader->pos())) {
+    RIEGELI_ASSERT_UNREACHABLE();
+  }
+  // Keep the current dictionary if it is the same, together with its digested
+  // forms.
+  if (zstd_dictionary_ == nullptr || zstd_dictionary_->data() != dictionary) {
+    zstd_dictionary_ =
+        std::make_shared<const ZstdDictionary>(std::move(dictionary));
+  }
+  return true;
+}
+
 bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite* record, uint64_t* key) {
 again:
   if (RIEGELI_UNLIKELY(index_ == num_records())) return false;
   if (key != nullptr) *key = index_;
   ++index_;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kParse);
+  timer.set_bytes(boundaries_[index_] - boundaries_[index_ - 1], 0);
   LimitingReader message_reader(&values_reader_, boundaries_[index_]);
   if (RIEGELI_UNLIKELY(!ParsePartialFromReader(record, &message_reader))) {
     if (!values_reader_.Seek(boundaries_[index_])) {
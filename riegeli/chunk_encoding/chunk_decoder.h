@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -42,6 +43,10 @@ namespace riegeli {
 // record_reader.h.
 class Chunk;
 class ChunkHeader;
+class MemoryBudget;
+class PipelineStats;
+class ThreadPool;
+class ZstdDictionary;
 
 class ChunkDecoder : public Object {
  public:
@@ -74,11 +79,118 @@ class ChunkDecoder : public Object {
       return std::move(set_field_filter(std::move(field_filter)));
     }
 
+    // Sets the PipelineStats which collect statistics of decoding chunks and
+    // parsing records. It must be kept alive while the ChunkDecoder is used.
+    //
+    // nullptr disables collecting statistics.
+    //
+    // Default: nullptr
+    Options& set_stats(PipelineStats* stats) & {
+      stats_ = stats;
+      return *this;
+    }
+    Options&& set_stats(PipelineStats* stats) && {
+      return std::move(set_stats(stats));
+    }
+
+    // Sets the thread pool which decompresses buckets of a transposed chunk
+    // concurrently if the field filter includes all fields. It must be kept
+    // alive while the ChunkDecoder is used.
+    //
+    // nullptr decompresses buckets sequentially.
+    //
+    // Default: nullptr
+    Options& set_thread_pool(ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+
+    // Sets the dictionary for chunks compressed with a Zstd dictionary, if it
+    // is known before reading the internal::ChunkType::kZstdDictionary chunk.
+    //
+    // nullptr means that the dictionary is not known yet.
+    //
+    // Default: nullptr
+    Options& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) & {
+      zstd_dictionary_ = std::move(zstd_dictionary);
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+
+    // Sets the maximum decoded size of a chunk which is decompressed into a
+    // single buffer, allocated once with the size stored in the chunk header.
+    // Records of such a chunk are never split between blocks, so
+    // ReadRecord(string_view*) and ReadRecords() never copy them.
+    //
+    // Larger chunks, chunks decoded with a field filter which excludes some
+    // fields, and simple chunks without compression (whose records can point
+    // into the chunk data instead) are decoded into blocks of bounded size.
+    //
+    // This also bounds the decompressed size of a bucket of a transposed chunk
+    // which is decompressed at once (see
+    // TransposeDecoder::set_max_flat_size()).
+    //
+    // 0 disables decoding into a single buffer.
+    //
+    // Default: 16M
+    Options& set_max_flat_chunk_size(uint64_t max_flat_chunk_size) & {
+      max_flat_chunk_size_ = max_flat_chunk_size;
+      return *this;
+    }
+    Options&& set_max_flat_chunk_size(uint64_t max_flat_chunk_size) && {
+      return std::move(set_max_flat_chunk_size(max_flat_chunk_size));
+    }
+
+    // If true, a single buffer for a chunk of at least kHugePageSize decoded
+    // bytes is backed by huge pages if the system supports them, which reduces
+    // TLB misses when records are read. Otherwise ordinary memory is used.
+    //
+    // Default: false
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
+    // Sets the MemoryBudget which memory of the decoded chunk is reserved from,
+    // until the next Reset() or Clear(). It must be kept alive while the
+    // ChunkDecoder is used.
+    //
+    // The chunk is already decoded when its memory is reserved, so Reset()
+    // does not limit memory by itself. Callers limit decoding by checking
+    // MemoryBudget::Exhausted() before decoding more chunks.
+    //
+    // nullptr means no accounting.
+    //
+    // Default: nullptr
+    Options& set_memory_budget(MemoryBudget* memory_budget) & {
+      memory_budget_ = memory_budget;
+      return *this;
+    }
+    Options&& set_memory_budget(MemoryBudget* memory_budget) && {
+      return std::move(set_memory_budget(memory_budget));
+    }
+
    private:
     friend class ChunkDecoder;
 
     bool skip_corruption_ = false;
     FieldFilter field_filter_ = FieldFilter::All();
+    PipelineStats* stats_ = nullptr;
+    ThreadPool* thread_pool_ = nullptr;
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+    uint64_t max_flat_chunk_size_ = uint64_t{16} << 20;
+    bool huge_pages_ = false;
+    MemoryBudget* memory_budget_ = nullptr;
   };
 
   explicit ChunkDecoder(Options options = Options());
@@ -90,6 +202,11 @@ class ChunkDecoder : public Object {
   ~ChunkDecoder();
 
   void Clear();
+
+  // Decodes records of chunk.
+  //
+  // An internal::ChunkType::kZstdDictionary chunk has no records; instead its
+  // dictionary replaces zstd_dictionary(), to be used for subsequent chunks.
   bool Reset(const Chunk& chunk);
 
   // Reads the next record.
@@ -97,7 +214,12 @@ class ChunkDecoder : public Object {
   // ReadRecord(MessageLite*) parses raw bytes to a proto message after reading.
   // The remaining overloads read raw bytes (they never generate a new failure).
   // For ReadRecord(string_view*) the string_view is valid until the next
-  // non-const operation on this ChunkDecoder.
+  // non-const operation on this ChunkDecoder. If the chunk is simple and
+  // uncompressed, the string_view points into the chunk data without copying
+  // (e.g. into the memory mapped by FdMMapReader), except for records split by
+  // a block header which are copied to contiguous memory. If the chunk was
+  // decoded into a single buffer (see Options::set_max_flat_chunk_size()), the
+  // string_view always points into it without copying.
   //
   // If key != nullptr, *key is set to the record index on success.
   //
@@ -110,10 +232,38 @@ class ChunkDecoder : public Object {
   bool ReadRecord(std::string* record, uint64_t* key = nullptr);
   bool ReadRecord(Chain* record, uint64_t* key = nullptr);
 
+  // Reads up to max_num_records next records, replacing *records with them.
+  // Their indices are consecutive, starting from index() before the call.
+  //
+  // The string_views are valid until the next non-const operation on this
+  // ChunkDecoder. They point into decoded values without copying, except for
+  // records split between blocks of values, which are copied to memory
+  // belonging to the batch. Records are not split if the chunk was decoded into
+  // a single buffer.
+  //
+  // Returns the number of records read, 0 if the chunk ends.
+  //
+  // Precondition: max_num_records > 0
+  size_t ReadRecords(std::vector<string_view>* records, size_t max_num_records);
+
   uint64_t index() const { return index_; }
   void SetIndex(uint64_t index);
   uint64_t num_records() const { return num_records_; }
 
+  // Returns the dictionary for chunks compressed with a Zstd dictionary, or
+  // nullptr if it is not known yet.
+  //
+  // It comes from Options::set_zstd_dictionary(), from set_zstd_dictionary(),
+  // or from the last internal::ChunkType::kZstdDictionary chunk given to
+  // Reset().
+  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary() const {
+    return zstd_dictionary_;
+  }
+  void set_zstd_dictionary(
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary) {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+  }
+
  protected:
   void Done() override { Clear(); }
 
@@ -124,9 +274,21 @@ class ChunkDecoder : public Object {
                         Chain* values);
   bool InitializeTransposed(const ChunkHeader& header, ChainReader* data_reader,
                             Chain* values);
+  bool InitializeZstdDictionary(ChainReader* data_reader);
+  // Returns true if the values of a chunk with this header should be decoded
+  // into a single buffer.
+  bool DecodeFlat(const ChunkHeader& header) const;
 
   bool skip_corruption_;
   FieldFilter field_filter_;
+  PipelineStats* stats_;
+  ThreadPool* thread_pool_;
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+  uint64_t max_flat_chunk_size_;
+  bool huge_pages_;
+  MemoryBudget* memory_budget_;
+  // Memory of the decoded chunk reserved from memory_budget_.
+  size_t decoded_memory_ = 0;
   // Invariants:
   //   if healthy() then boundaries_[0] == 0
   //   for each i, boundaries_[i + 1] >= boundaries_[i]
@@ -138,6 +300,9 @@ class ChunkDecoder : public Object {
   //                         else index_ == num_records()
   uint64_t index_;
   std::string record_scratch_;
+  // Copies of records returned by the last ReadRecords() which are split
+  // between blocks of values.
+  std::vector<std::unique_ptr<char[]>> records_scratch_;
 };
 
 inline bool ChunkDecoder::ReadRecord(string_view* record, uint64_t* key) {
@@ -27,22 +27,43 @@
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/message_serialize.h"
+#include "riegeli/bytes/snappy_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/writer_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 
 namespace riegeli {
 
+namespace {
+
+// Computes the header of chunk->data and counts the chunk in stats.
+void SetChunkHeader(uint64_t num_records, uint64_t decoded_data_size,
+                    PipelineStats* stats, Chunk* chunk) {
+  {
+    PipelineStats::Timer timer(stats, PipelineStats::Stage::kHash);
+    timer.set_bytes(chunk->data.size(), 0);
+    chunk->header = ChunkHeader(chunk->data, num_records, decoded_data_size);
+  }
+  if (stats != nullptr) stats->AddEncodedChunk(num_records);
+}
+
+}  // namespace
+
 SimpleChunkEncoder::Compressor::Compressor(
-    internal::CompressionType compression_type, int compression_level) {
-  Reset(compression_type, compression_level);
+    internal::CompressionType compression_type, int compression_level,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary) {
+  Reset(compression_type, compression_level, zstd_dictionary);
 }
 
 inline void SimpleChunkEncoder::Compressor::Reset(
-    internal::CompressionType compression_type, int compression_level) {
+    internal::CompressionType compression_type, int compression_level,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary) {
   data_.Clear();
   std::unique_ptr<Writer> data_writer =
       riegeli::make_unique<ChainWriter>(&data_);
@@ -60,6 +81,23 @@ inline void SimpleChunkEncoder::Compressor::Reset(
           std::move(data_writer),
           ZstdWriter::Options().set_compression_level(compression_level));
       return;
+    case internal::CompressionType::kZstdWithDictionary:
+      RIEGELI_ASSERT(zstd_dictionary != nullptr)
+          << "Zstd compression with a dictionary requested "
+             "but no dictionary given";
+      writer_ = riegeli::make_unique<ZstdWriter>(
+          std::move(data_writer), ZstdWriter::Options()
+                                      .set_compression_level(compression_level)
+                                      .set_dictionary(zstd_dictionary));
+      return;
+    case internal::CompressionType::kLz4:
+      writer_ = riegeli::make_unique<Lz4Writer>(
+          std::move(data_writer),
+          Lz4Writer::Options().set_compression_level(compression_level));
+      return;
+    case internal::CompressionType::kSnappy:
+      writer_ = riegeli::make_unique<SnappyWriter>(std::move(data_writer));
+      return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown compression type: " << static_cast<int>(compression_type);
@@ -72,17 +110,52 @@ Chain* SimpleChunkEncoder::Compressor::Encode() {
 
 ChunkEncoder::~ChunkEncoder() = default;
 
+void ChunkEncoder::AddRecords(const string_view* records, size_t num_records) {
+  for (size_t i = 0; i < num_records; ++i) AddRecord(records[i]);
+}
+
+void ChunkEncoder::AddRecords(const Chain* records, size_t num_records) {
+  for (size_t i = 0; i < num_records; ++i) AddRecord(records[i]);
+}
+
 SimpleChunkEncoder::SimpleChunkEncoder(
-    internal::CompressionType compression_type, int compression_level)
+    internal::CompressionType compression_type, int compression_level,
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary)
     : compression_type_(compression_type),
       compression_level_(compression_level),
-      sizes_compressor_(compression_type, compression_level),
-      values_compressor_(compression_type, compression_level) {}
+      zstd_dictionary_(std::move(zstd_dictionary)),
+      sizes_compressor_(compression_type, compression_level, zstd_dictionary_),
+      values_compressor_(compression_type, compression_level,
+                         zstd_dictionary_) {}
 
 void SimpleChunkEncoder::Reset() {
   num_records_ = 0;
-  sizes_compressor_.Reset(compression_type_, compression_level_);
-  values_compressor_.Reset(compression_type_, compression_level_);
+  sizes_compressor_.Reset(compression_type_, compression_level_,
+                          zstd_dictionary_);
+  values_compressor_.Reset(compression_type_, compression_level_,
+                           zstd_dictionary_);
+}
+
+void SimpleChunkEncoder::SetCompression(
+    internal::CompressionType compression_type, int compression_level) {
+  RIEGELI_ASSERT_EQ(num_records_, 0u)
+      << "Failed precondition of SimpleChunkEncoder::SetCompression(): "
+         "records already added";
+  RIEGELI_ASSERT(compression_type !=
+                     internal::CompressionType::kZstdWithDictionary ||
+                 zstd_dictionary_ != nullptr)
+      << "Failed precondition of SimpleChunkEncoder::SetCompression(): "
+         "no dictionary";
+  if (compression_type == compression_type_ &&
+      compression_level == compression_level_) {
+    return;
+  }
+  compression_type_ = compression_type;
+  compression_level_ = compression_level;
+  sizes_compressor_.Reset(compression_type_, compression_level_,
+                          zstd_dictionary_);
+  values_compressor_.Reset(compression_type_, compression_level_,
+                           zstd_dictionary_);
 }
 
 void SimpleChunkEncoder::AddRecord(const google::protobuf::MessageLite& record) {
@@ -94,66 +167,108 @@ void SimpleChunkEncoder::AddRecord(const google::protobuf::MessageLite& record)
   //             record.InitializationErrorString());
   RIEGELI_CHECK(record.IsInitialized());
   ++num_records_;
-  WriteVarint64(sizes_compressor_.writer(), record.ByteSizeLong());
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kSerialize);
+  const size_t size = record.ByteSizeLong();
+  timer.set_bytes(0, size);
+  WriteVarint64(sizes_compressor_.writer(), size);
   SerializePartialToWriter(record, values_compressor_.writer());
 }
 
 void SimpleChunkEncoder::AddRecord(string_view record) {
   ++num_records_;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
   WriteVarint64(sizes_compressor_.writer(), record.size());
   values_compressor_.writer()->Write(record);
 }
 
 void SimpleChunkEncoder::AddRecord(std::string&& record) {
   ++num_records_;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
   WriteVarint64(sizes_compressor_.writer(), record.size());
   values_compressor_.writer()->Write(std::move(record));
 }
 
 void SimpleChunkEncoder::AddRecord(const Chain& record) {
   ++num_records_;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
   WriteVarint64(sizes_compressor_.writer(), record.size());
   values_compressor_.writer()->Write(record);
 }
 
 void SimpleChunkEncoder::AddRecord(Chain&& record) {
   ++num_records_;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
   WriteVarint64(sizes_compressor_.writer(), record.size());
   values_compressor_.writer()->Write(std::move(record));
 }
 
+void SimpleChunkEncoder::AddRecords(const string_view* records,
+                                    size_t num_records) {
+  AddRecordsImpl(records, num_records);
+}
+
+void SimpleChunkEncoder::AddRecords(const Chain* records, size_t num_records) {
+  AddRecordsImpl(records, num_records);
+}
+
+template <typename Record>
+inline void SimpleChunkEncoder::AddRecordsImpl(const Record* records,
+                                               size_t num_records) {
+  num_records_ += num_records;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
+  Writer* const sizes_writer = sizes_compressor_.writer();
+  Writer* const values_writer = values_compressor_.writer();
+  for (size_t i = 0; i < num_records; ++i) {
+    WriteVarint64(sizes_writer, records[i].size());
+    values_writer->Write(records[i]);
+  }
+}
+
 bool SimpleChunkEncoder::Encode(Chunk* chunk) {
   chunk->data.Clear();
   ChainWriter data_writer(&chunk->data);
   WriteByte(&data_writer, static_cast<uint8_t>(internal::ChunkType::kSimple));
   WriteByte(&data_writer, static_cast<uint8_t>(compression_type_));
 
-  Chain* compressed_sizes = sizes_compressor_.Encode();
-  if (RIEGELI_UNLIKELY(compressed_sizes == nullptr)) return false;
-  WriteVarint64(&data_writer, compressed_sizes->size());
-  data_writer.Write(std::move(*compressed_sizes));
-
   const Position decoded_data_size = values_compressor_.writer()->pos();
-  Chain* compressed_values = values_compressor_.Encode();
-  if (RIEGELI_UNLIKELY(compressed_values == nullptr)) return false;
-  data_writer.Write(std::move(*compressed_values));
+  {
+    PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
+    const Position uncompressed_size =
+        sizes_compressor_.writer()->pos() + decoded_data_size;
+    Chain* compressed_sizes = sizes_compressor_.Encode();
+    if (RIEGELI_UNLIKELY(compressed_sizes == nullptr)) return false;
+    Chain* compressed_values = values_compressor_.Encode();
+    if (RIEGELI_UNLIKELY(compressed_values == nullptr)) return false;
+    timer.set_bytes(uncompressed_size,
+                    compressed_sizes->size() + compressed_values->size());
+    WriteVarint64(&data_writer, compressed_sizes->size());
+    data_writer.Write(std::move(*compressed_sizes));
+    data_writer.Write(std::move(*compressed_values));
+  }
   if (RIEGELI_UNLIKELY(!data_writer.Close())) return false;
-  chunk->header = ChunkHeader(chunk->data, num_records_,
-                              IntCast<uint64_t>(decoded_data_size));
+  SetChunkHeader(num_records_, IntCast<uint64_t>(decoded_data_size), stats_,
+                 chunk);
   return true;
 }
 
 EagerTransposedChunkEncoder::EagerTransposedChunkEncoder(
     internal::CompressionType compression_type, int compression_level,
-    size_t desired_bucket_size) {
+    size_t desired_bucket_size,
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary)
+    : zstd_dictionary_(std::move(zstd_dictionary)) {
   SetCompression(compression_type, compression_level);
   transpose_encoder_.SetDesiredBucketSize(desired_bucket_size);
 }
 
-inline void EagerTransposedChunkEncoder::SetCompression(
+void EagerTransposedChunkEncoder::SetCompression(
     internal::CompressionType compression_type, int compression_level) {
+  RIEGELI_ASSERT_EQ(num_records_, 0u)
+      << "Failed precondition of "
+         "EagerTransposedChunkEncoder::SetCompression(): "
+         "records already added";
   switch (compression_type) {
     case internal::CompressionType::kNone:
+      transpose_encoder_.DisableCompression();
       return;
     case internal::CompressionType::kBrotli:
       transpose_encoder_.EnableBrotliCompression(compression_level);
@@ -161,11 +276,26 @@ inline void EagerTransposedChunkEncoder::SetCompression(
     case internal::CompressionType::kZstd:
       transpose_encoder_.EnableZstdCompression(compression_level);
       return;
+    case internal::CompressionType::kZstdWithDictionary:
+      transpose_encoder_.EnableZstdCompression(compression_level,
+                                               zstd_dictionary_);
+      return;
+    case internal::CompressionType::kLz4:
+      transpose_encoder_.EnableLz4Compression(compression_level);
+      return;
+    case internal::CompressionType::kSnappy:
+      transpose_encoder_.EnableSnappyCompression();
+      return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown compression type: " << static_cast<int>(compression_type);
 }
 
+void EagerTransposedChunkEncoder::set_stats(PipelineStats* stats) {
+  ChunkEncoder::set_stats(stats);
+  transpose_encoder_.set_stats(stats);
+}
+
 void EagerTransposedChunkEncoder::Reset() {
   num_records_ = 0;
   decoded_data_size_ = 0;
@@ -181,56 +311,109 @@ void EagerTransposedChunkEncoder::AddRecord(const google::protobuf::MessageLite&
   //             record.InitializationErrorString());
   RIEGELI_CHECK(record.IsInitialized());
   ++num_records_;
-  decoded_data_size_ += record.ByteSizeLong();
-  transpose_encoder_.AddMessage(SerializePartialAsChain(record));
+  Chain serialized;
+  {
+    PipelineStats::Timer timer(stats_, PipelineStats::Stage::kSerialize);
+    serialized = SerializePartialAsChain(record);
+    timer.set_bytes(0, serialized.size());
+  }
+  decoded_data_size_ += serialized.size();
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  timer.set_bytes(serialized.size(), 0);
+  transpose_encoder_.AddMessage(serialized);
 }
 
 void EagerTransposedChunkEncoder::AddRecord(string_view record) {
   ++num_records_;
   decoded_data_size_ += record.size();
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  timer.set_bytes(record.size(), 0);
   transpose_encoder_.AddMessage(record);
 }
 
 void EagerTransposedChunkEncoder::AddRecord(std::string&& record) {
   ++num_records_;
   decoded_data_size_ += record.size();
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  timer.set_bytes(record.size(), 0);
   transpose_encoder_.AddMessage(std::move(record));
 }
 
 void EagerTransposedChunkEncoder::AddRecord(const Chain& record) {
   ++num_records_;
   decoded_data_size_ += record.size();
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  timer.set_bytes(record.size(), 0);
   transpose_encoder_.AddMessage(record);
 }
 
 void EagerTransposedChunkEncoder::AddRecord(Chain&& record) {
   ++num_records_;
   decoded_data_size_ += record.size();
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  timer.set_bytes(record.size(), 0);
   // Not std::move(record): TransposeEncoder::AddMessage() does not have a
   // Chain&& overload.
   transpose_encoder_.AddMessage(record);
 }
 
+void EagerTransposedChunkEncoder::AddRecords(const string_view* records,
+                                             size_t num_records) {
+  AddRecordsImpl(records, num_records);
+}
+
+void EagerTransposedChunkEncoder::AddRecords(const Chain* records,
+                                             size_t num_records) {
+  AddRecordsImpl(records, num_records);
+}
+
+template <typename Record>
+inline void EagerTransposedChunkEncoder::AddRecordsImpl(const Record* records,
+                                                        size_t num_records) {
+  num_records_ += num_records;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+  size_t size = 0;
+  for (size_t i = 0; i < num_records; ++i) {
+    size += records[i].size();
+    transpose_encoder_.AddMessage(records[i]);
+  }
+  decoded_data_size_ += size;
+  timer.set_bytes(size, 0);
+}
+
 bool EagerTransposedChunkEncoder::Encode(Chunk* chunk) {
   chunk->data.Clear();
   ChainWriter data_writer(&chunk->data);
   WriteByte(&data_writer,
             static_cast<uint8_t>(internal::ChunkType::kTransposed));
-  if (!transpose_encoder_.Encode(&data_writer)) return false;
+  {
+    PipelineStats::Timer timer(stats_, PipelineStats::Stage::kTranspose);
+    if (!transpose_encoder_.Encode(&data_writer)) return false;
+    timer.set_bytes(0, data_writer.pos());
+  }
   if (!data_writer.Close()) return false;
-  chunk->header = ChunkHeader(chunk->data, num_records_, decoded_data_size_);
+  SetChunkHeader(num_records_, decoded_data_size_, stats_, chunk);
   return true;
 }
 
 DeferredTransposedChunkEncoder::DeferredTransposedChunkEncoder(
     internal::CompressionType compression_type, int compression_level,
-    size_t desired_bucket_size)
-    : compression_type_(compression_type),
-      compression_level_(compression_level),
-      desired_bucket_size_(desired_bucket_size) {}
+    size_t desired_bucket_size,
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary)
+    : eager_chunk_encoder_(compression_type, compression_level,
+                           desired_bucket_size, std::move(zstd_dictionary)) {}
 
 void DeferredTransposedChunkEncoder::Reset() { records_.clear(); }
 
+void DeferredTransposedChunkEncoder::SetCompression(
+    internal::CompressionType compression_type, int compression_level) {
+  RIEGELI_ASSERT(records_.empty())
+      << "Failed precondition of "
+         "DeferredTransposedChunkEncoder::SetCompression(): "
+         "records already added";
+  eager_chunk_encoder_.SetCompression(compression_type, compression_level);
+}
+
 void DeferredTransposedChunkEncoder::AddRecord(
     const google::protobuf::MessageLite& record) {
   // TODO: Propagate the failure from record.IsInitialized() when
@@ -240,8 +423,10 @@ void DeferredTransposedChunkEncoder::AddRecord(
   //             " because it is missing required fields: " +
   //             record.InitializationErrorString());
   RIEGELI_CHECK(record.IsInitialized());
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kSerialize);
   records_.emplace_back();
   AppendPartialToChain(record, &records_.back());
+  timer.set_bytes(0, records_.back().size());
 }
 
 void DeferredTransposedChunkEncoder::AddRecord(string_view record) {
@@ -260,13 +445,25 @@ void DeferredTransposedChunkEncoder::AddRecord(Chain&& record) {
   records_.push_back(std::move(record));
 }
 
+void DeferredTransposedChunkEncoder::AddRecords(const string_view* records,
+                                                size_t num_records) {
+  records_.reserve(records_.size() + num_records);
+  for (size_t i = 0; i < num_records; ++i) records_.emplace_back(records[i]);
+}
+
+void DeferredTransposedChunkEncoder::AddRecords(const Chain* records,
+                                                size_t num_records) {
+  records_.insert(records_.end(), records, records + num_records);
+}
+
 bool DeferredTransposedChunkEncoder::Encode(Chunk* chunk) {
-  EagerTransposedChunkEncoder eager_chunk_encoder(
-      compression_type_, compression_level_, desired_bucket_size_);
+  eager_chunk_encoder_.set_stats(stats_);
   for (const auto& record : records_) {
-    eager_chunk_encoder.AddRecord(record);
+    eager_chunk_encoder_.AddRecord(record);
   }
-  return eager_chunk_encoder.Encode(chunk);
+  const bool ok = eager_chunk_encoder_.Encode(chunk);
+  eager_chunk_encoder_.Reset();
+  return ok;
 }
 
 }  // namespace riegeli
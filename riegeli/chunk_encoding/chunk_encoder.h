@@ -24,8 +24,10 @@
 #include "riegeli/base/chain.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_encoder.h"
 
 namespace riegeli {
@@ -39,14 +41,39 @@ class ChunkEncoder {
 
   virtual ~ChunkEncoder();
 
+  // Sets the PipelineStats which collect statistics of encoding, or nullptr to
+  // disable collecting statistics. It must be kept alive while this
+  // ChunkEncoder is used.
+  virtual void set_stats(PipelineStats* stats) { stats_ = stats; }
+
   virtual void Reset() = 0;
+
+  // Changes the compression of the chunk being encoded and of later chunks.
+  // This does not change the format, so it can vary from chunk to chunk.
+  //
+  // A compression type with a dictionary reuses the dictionary passed to the
+  // constructor, which is then required.
+  //
+  // Precondition: no records were added since construction or Reset().
+  virtual void SetCompression(internal::CompressionType compression_type,
+                              int compression_level) = 0;
+
   virtual void AddRecord(const google::protobuf::MessageLite& record) = 0;
   virtual void AddRecord(string_view record) = 0;
   virtual void AddRecord(std::string&& record) = 0;
   void AddRecord(const char* record) { AddRecord(string_view(record)); }
   virtual void AddRecord(const Chain& record) = 0;
   virtual void AddRecord(Chain&& record) = 0;
+
+  // Adds num_records records, like AddRecord() called for each of them, with
+  // less overhead per record.
+  virtual void AddRecords(const string_view* records, size_t num_records);
+  virtual void AddRecords(const Chain* records, size_t num_records);
+
   virtual bool Encode(Chunk* chunk) = 0;
+
+ protected:
+  PipelineStats* stats_ = nullptr;
 };
 
 // Format:
@@ -61,25 +88,37 @@ class ChunkEncoder {
 // uncompressed size.
 class SimpleChunkEncoder final : public ChunkEncoder {
  public:
-  SimpleChunkEncoder(internal::CompressionType compression_type,
-                     int compression_level);
+  // zstd_dictionary is required if compression_type is
+  // internal::CompressionType::kZstdWithDictionary, and ignored otherwise.
+  SimpleChunkEncoder(
+      internal::CompressionType compression_type, int compression_level,
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary = nullptr);
 
   void Reset() override;
+  void SetCompression(internal::CompressionType compression_type,
+                      int compression_level) override;
   void AddRecord(const google::protobuf::MessageLite& record) override;
   void AddRecord(string_view record) override;
   void AddRecord(std::string&& record) override;
   void AddRecord(const Chain& record) override;
   void AddRecord(Chain&& record) override;
+  void AddRecords(const string_view* records, size_t num_records) override;
+  void AddRecords(const Chain* records, size_t num_records) override;
   bool Encode(Chunk* data) override;
 
  private:
+  template <typename Record>
+  void AddRecordsImpl(const Record* records, size_t num_records);
+
   class Compressor {
    public:
     Compressor(internal::CompressionType compression_type,
-               int compression_level);
+               int compression_level,
+               const std::shared_ptr<const ZstdDictionary>& zstd_dictionary);
 
     void Reset(internal::CompressionType compression_type,
-               int compression_level);
+               int compression_level,
+               const std::shared_ptr<const ZstdDictionary>& zstd_dictionary);
     Writer* writer() const { return writer_.get(); }
     Chain* Encode();
 
@@ -90,6 +129,7 @@ class SimpleChunkEncoder final : public ChunkEncoder {
 
   internal::CompressionType compression_type_;
   int compression_level_;
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
   size_t num_records_ = 0;
   Compressor sizes_compressor_;
   Compressor values_compressor_;
@@ -100,22 +140,39 @@ class SimpleChunkEncoder final : public ChunkEncoder {
 // copying than DeferredTransposedChunkEncoder.
 class EagerTransposedChunkEncoder final : public ChunkEncoder {
  public:
-  EagerTransposedChunkEncoder(internal::CompressionType compression_type,
-                              int compression_level,
-                              size_t desired_bucket_size);
+  // zstd_dictionary is required if compression_type is
+  // internal::CompressionType::kZstdWithDictionary, and ignored otherwise.
+  EagerTransposedChunkEncoder(
+      internal::CompressionType compression_type, int compression_level,
+      size_t desired_bucket_size,
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary = nullptr);
+
+  void set_stats(PipelineStats* stats) override;
+
+  // Sets the thread pool which compresses buckets of a chunk concurrently, or
+  // nullptr to compress them sequentially. It must be kept alive while this
+  // ChunkEncoder is used.
+  void set_thread_pool(ThreadPool* thread_pool) {
+    transpose_encoder_.set_thread_pool(thread_pool);
+  }
 
   void Reset() override;
+  void SetCompression(internal::CompressionType compression_type,
+                      int compression_level) override;
   void AddRecord(const google::protobuf::MessageLite& record) override;
   void AddRecord(string_view record) override;
   void AddRecord(std::string&& record) override;
   void AddRecord(const Chain& record) override;
   void AddRecord(Chain&& record) override;
+  void AddRecords(const string_view* records, size_t num_records) override;
+  void AddRecords(const Chain* records, size_t num_records) override;
   bool Encode(Chunk* data) override;
 
  private:
-  void SetCompression(internal::CompressionType compression_type,
-                      int compression_level);
+  template <typename Record>
+  void AddRecordsImpl(const Record* records, size_t num_records);
 
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
   size_t num_records_ = 0;
   size_t decoded_data_size_ = 0;
   TransposeEncoder transpose_encoder_;
@@ -126,23 +183,36 @@ class EagerTransposedChunkEncoder final : public ChunkEncoder {
 // Encode(). It does more memory copying than EagerTransposedChunkEncoder.
 class DeferredTransposedChunkEncoder final : public ChunkEncoder {
  public:
-  DeferredTransposedChunkEncoder(internal::CompressionType compression_type,
-                                 int compression_level,
-                                 size_t desired_bucket_size);
+  // zstd_dictionary is required if compression_type is
+  // internal::CompressionType::kZstdWithDictionary, and ignored otherwise.
+  DeferredTransposedChunkEncoder(
+      internal::CompressionType compression_type, int compression_level,
+      size_t desired_bucket_size,
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary = nullptr);
+
+  // Sets the thread pool which compresses buckets of a chunk concurrently, or
+  // nullptr to compress them sequentially. It must be kept alive while this
+  // ChunkEncoder is used.
+  void set_thread_pool(ThreadPool* thread_pool) {
+    eager_chunk_encoder_.set_thread_pool(thread_pool);
+  }
 
   void Reset() override;
+  void SetCompression(internal::CompressionType compression_type,
+                      int compression_level) override;
   void AddRecord(const google::protobuf::MessageLite& record) override;
   void AddRecord(string_view record) override;
   void AddRecord(std::string&& record) override;
   void AddRecord(const Chain& record) override;
   void AddRecord(Chain&& record) override;
+  void AddRecords(const string_view* records, size_t num_records) override;
+  void AddRecords(const Chain* records, size_t num_records) override;
   bool Encode(Chunk* data) override;
 
  private:
-  internal::CompressionType compression_type_;
-  int compression_level_;
-  size_t desired_bucket_size_;
   std::vector<Chain> records_;
+  // Kept between chunks so that capacity of its internal tables is reused.
+  EagerTransposedChunkEncoder eager_chunk_encoder_;
 };
 
 }  // namespace riegeli
@@ -0,0 +1,99 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_COLUMN_H_
+#define RIEGELI_CHUNK_ENCODING_COLUMN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+
+namespace riegeli {
+
+// Values of a single field in consecutive records, decoded without
+// reconstructing the records.
+//
+// Values of record i have indices from record_offsets[i] inclusive to
+// record_offsets[i + 1] exclusive, in the order in which they occur in the
+// record. A record in which the field is absent, or which is not a proto
+// message, has no values. For a non-repeated field the last value is the
+// effective one, as in proto parsing.
+struct Column {
+  // The representation of values, which must agree with the declared type of
+  // the field.
+  enum class Type {
+    // int32, int64, uint32, uint64, bool, enum, and sint32 and sint64 (which
+    // remain ZigZag-encoded). Values are in ints.
+    kVarint,
+    // fixed32 and sfixed32, zero-extended. Values are in ints.
+    kFixed32,
+    // fixed64 and sfixed64. Values are in ints.
+    kFixed64,
+    // float, converted to double. Values are in doubles.
+    kFloat,
+    // double. Values are in doubles.
+    kDouble,
+    // string and bytes. Values are in strings, delimited by string_offsets.
+    kString,
+  };
+
+  void Clear();
+
+  size_t num_records() const { return record_offsets.size() - 1; }
+  size_t num_values() const { return record_offsets.back(); }
+
+  // Returns the string value with the given index.
+  //
+  // Precondition: index < string_offsets.size() - 1
+  string_view string_value(size_t index) const;
+
+  // Invariants:
+  //   record_offsets.front() == 0
+  //   for each i, record_offsets[i + 1] >= record_offsets[i]
+  std::vector<size_t> record_offsets = {0};
+  std::vector<int64_t> ints;
+  std::vector<double> doubles;
+  // Concatenated string values. Value i is
+  // strings[string_offsets[i], string_offsets[i + 1]).
+  std::string strings;
+  std::vector<size_t> string_offsets = {0};
+};
+
+// Implementation details follow.
+
+inline void Column::Clear() {
+  record_offsets.clear();
+  record_offsets.push_back(0);
+  ints.clear();
+  doubles.clear();
+  strings.clear();
+  string_offsets.clear();
+  string_offsets.push_back(0);
+}
+
+inline string_view Column::string_value(size_t index) const {
+  RIEGELI_ASSERT_LT(index, string_offsets.size() - 1)
+      << "Failed precondition of Column::string_value(): "
+         "index out of range";
+  return string_view(strings.data() + string_offsets[index],
+                     string_offsets[index + 1] - string_offsets[index]);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_COLUMN_H_
@@ -0,0 +1,306 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/column_decoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/string_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/column.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/transpose_decoder.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
+
+namespace riegeli {
+
+namespace {
+
+// Sizes of the parts of a Column, remembered to discard values appended
+// afterwards.
+class ColumnSizes {
+ public:
+  explicit ColumnSizes(const Column& column)
+      : num_ints_(column.ints.size()),
+        num_doubles_(column.doubles.size()),
+        strings_size_(column.strings.size()),
+        num_strings_(column.string_offsets.size()) {}
+
+  void Truncate(Column* column) const {
+    column->ints.resize(num_ints_);
+    column->doubles.resize(num_doubles_);
+    column->strings.resize(strings_size_);
+    column->string_offsets.resize(num_strings_);
+  }
+
+ private:
+  size_t num_ints_;
+  size_t num_doubles_;
+  size_t strings_size_;
+  size_t num_strings_;
+};
+
+}  // namespace
+
+ColumnDecoder::ColumnDecoder(FieldFilter::Field field, Column::Type type)
+    : Object(State::kOpen),
+      field_(std::move(field)),
+      type_(type),
+      chunk_decoder_(ChunkDecoder::Options().set_field_filter(
+          FieldFilter().AddField(field_))) {
+  RIEGELI_ASSERT(!field_.empty())
+      << "Failed precondition of ColumnDecoder::ColumnDecoder(): "
+         "empty field";
+}
+
+ColumnDecoder::ColumnDecoder(ColumnDecoder&& src) noexcept
+    : Object(std::move(src)),
+      field_(std::move(src.field_)),
+      type_(src.type_),
+      chunk_decoder_(std::move(src.chunk_decoder_)),
+      type_mismatch_(riegeli::exchange(src.type_mismatch_, false)) {}
+
+ColumnDecoder& ColumnDecoder::operator=(ColumnDecoder&& src) noexcept {
+  Object::operator=(std::move(src));
+  field_ = std::move(src.field_);
+  type_ = src.type_;
+  chunk_decoder_ = std::move(src.chunk_decoder_);
+  type_mismatch_ = riegeli::exchange(src.type_mismatch_, false);
+  return *this;
+}
+
+ColumnDecoder::~ColumnDecoder() = default;
+
+bool ColumnDecoder::Decode(const Chunk& chunk, Column* column) {
+  MarkHealthy();
+  column->Clear();
+  ChainReader data_reader(&chunk.data);
+  uint8_t chunk_type;
+  if (!ReadByte(&data_reader, &chunk_type)) {
+    chunk_type = static_cast<uint8_t>(internal::ChunkType::kPadding);
+  }
+  if (static_cast<internal::ChunkType>(chunk_type) ==
+      internal::ChunkType::kTransposed) {
+    TransposeDecoder transpose_decoder;
+    transpose_decoder.set_zstd_dictionary(chunk_decoder_.zstd_dictionary());
+    if (transpose_decoder.Initialize(&data_reader,
+                                     FieldFilter().AddField(field_)) &&
+        transpose_decoder.DecodeColumn(field_, type_, column) &&
+        column->num_records() == chunk.header.num_records() &&
+        data_reader.VerifyEndAndClose()) {
+      return true;
+    }
+    // Either the chunk is invalid, which DecodeRecords() will report, or the
+    // field is stored in a way which DecodeColumn() does not support.
+    column->Clear();
+  }
+  return DecodeRecords(chunk, column);
+}
+
+bool ColumnDecoder::DecodeRecords(const Chunk& chunk, Column* column) {
+  if (RIEGELI_UNLIKELY(!chunk_decoder_.Reset(chunk))) {
+    Fail(chunk_decoder_);
+    chunk_decoder_.Clear();
+    return false;
+  }
+  column->record_offsets.reserve(
+      IntCast<size_t>(chunk_decoder_.num_records()) + 1);
+  string_view record;
+  while (chunk_decoder_.ReadRecord(&record)) {
+    const ColumnSizes column_sizes(*column);
+    StringReader record_reader(record.data(), record.size());
+    if (RIEGELI_UNLIKELY(!ParseMessage(&record_reader, 0, 0, column))) {
+      if (type_mismatch_) {
+        type_mismatch_ = false;
+        chunk_decoder_.Clear();
+        return Fail("Wire type of the field does not match the column type");
+      }
+      // The record is not a proto message, so it has no values.
+      column_sizes.Truncate(column);
+    }
+    column->record_offsets.push_back(column->ints.size() +
+                                     column->doubles.size() +
+                                     column->string_offsets.size() - 1);
+  }
+  chunk_decoder_.Clear();
+  return true;
+}
+
+bool ColumnDecoder::ParseMessage(Reader* src, size_t depth,
+                                 uint32_t end_group_field, Column* column) {
+  while (src->Pull()) {
+    uint32_t tag;
+    if (RIEGELI_UNLIKELY(!ReadVarint32(src, &tag))) return false;
+    const uint32_t field_number = tag >> 3;
+    if (RIEGELI_UNLIKELY(field_number == 0)) return false;
+    const internal::WireType wire_type =
+        static_cast<internal::WireType>(tag & 7);
+    if (wire_type == internal::WireType::kEndGroup) {
+      return field_number == end_group_field;
+    }
+    const bool matches = depth < field_.size() && field_number == field_[depth];
+    const bool is_column_field = matches && depth + 1 == field_.size();
+    if (is_column_field && wire_type != internal::ColumnWireType(type_) &&
+        (wire_type != internal::WireType::kLengthDelimited ||
+         type_ == Column::Type::kString)) {
+      type_mismatch_ = true;
+      return false;
+    }
+    switch (wire_type) {
+      case internal::WireType::kVarint:
+        if (is_column_field) {
+          if (RIEGELI_UNLIKELY(!ParseValue(src, column))) return false;
+        } else {
+          uint64_t value;
+          if (RIEGELI_UNLIKELY(!ReadVarint64(src, &value))) return false;
+        }
+        break;
+      case internal::WireType::kFixed32:
+        if (is_column_field) {
+          if (RIEGELI_UNLIKELY(!ParseValue(src, column))) return false;
+        } else {
+          if (RIEGELI_UNLIKELY(!src->Skip(sizeof(uint32_t)))) return false;
+        }
+        break;
+      case internal::WireType::kFixed64:
+        if (is_column_field) {
+          if (RIEGELI_UNLIKELY(!ParseValue(src, column))) return false;
+        } else {
+          if (RIEGELI_UNLIKELY(!src->Skip(sizeof(uint64_t)))) return false;
+        }
+        break;
+      case internal::WireType::kLengthDelimited: {
+        uint32_t length;
+        if (RIEGELI_UNLIKELY(!ReadVarint32(src, &length))) return false;
+        const Position end_pos = src->pos() + length;
+        if (is_column_field && type_ == Column::Type::kString) {
+          if (RIEGELI_UNLIKELY(!src->Read(&column->strings, length))) {
+            return false;
+          }
+          column->string_offsets.push_back(column->strings.size());
+        } else if (is_column_field) {
+          // Packed repeated field.
+          LimitingReader values_reader(src, end_pos);
+          while (values_reader.Pull()) {
+            if (RIEGELI_UNLIKELY(!ParseValue(&values_reader, column))) {
+              type_mismatch_ = values_reader.healthy();
+              return false;
+            }
+          }
+          if (RIEGELI_UNLIKELY(!values_reader.Close()) ||
+              RIEGELI_UNLIKELY(src->pos() != end_pos)) {
+            return false;
+          }
+        } else if (matches) {
+          const ColumnSizes column_sizes(*column);
+          LimitingReader submessage_reader(src, end_pos);
+          if (RIEGELI_UNLIKELY(
+                  !ParseMessage(&submessage_reader, depth + 1, 0, column))) {
+            if (type_mismatch_) return false;
+            // A string which is not a proto message. Like DecodeColumn(),
+            // which sees such a string as a string rather than a submessage,
+            // skip it and keep values from the rest of the record.
+            column_sizes.Truncate(column);
+            if (RIEGELI_UNLIKELY(!submessage_reader.Close()) ||
+                RIEGELI_UNLIKELY(!src->Seek(end_pos))) {
+              return false;
+            }
+            break;
+          }
+          if (RIEGELI_UNLIKELY(!submessage_reader.Close()) ||
+              RIEGELI_UNLIKELY(src->pos() != end_pos)) {
+            return false;
+          }
+        } else {
+          if (RIEGELI_UNLIKELY(!src->Skip(length))) return false;
+        }
+      } break;
+      case internal::WireType::kStartGroup:
+        if (RIEGELI_UNLIKELY(!ParseMessage(
+                src, matches ? depth + 1 : field_.size(), field_number,
+                column))) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return src->healthy() && end_group_field == 0;
+}
+
+bool ColumnDecoder::ParseValue(Reader* src, Column* column) {
+  switch (type_) {
+    case Column::Type::kVarint: {
+      uint64_t value;
+      if (RIEGELI_UNLIKELY(!ReadVarint64(src, &value))) return false;
+      column->ints.push_back(static_cast<int64_t>(value));
+      return true;
+    }
+    case Column::Type::kFixed32:
+    case Column::Type::kFloat: {
+      uint32_t word;
+      if (RIEGELI_UNLIKELY(!src->Read(reinterpret_cast<char*>(&word),
+                                      sizeof(word)))) {
+        return false;
+      }
+      const uint32_t value = ReadLittleEndian32(word);
+      if (type_ == Column::Type::kFloat) {
+        float float_value;
+        std::memcpy(&float_value, &value, sizeof(float_value));
+        column->doubles.push_back(float_value);
+      } else {
+        column->ints.push_back(int64_t{value});
+      }
+      return true;
+    }
+    case Column::Type::kFixed64:
+    case Column::Type::kDouble: {
+      uint64_t word;
+      if (RIEGELI_UNLIKELY(!src->Read(reinterpret_cast<char*>(&word),
+                                      sizeof(word)))) {
+        return false;
+      }
+      const uint64_t value = ReadLittleEndian64(word);
+      if (type_ == Column::Type::kDouble) {
+        double double_value;
+        std::memcpy(&double_value, &value, sizeof(double_value));
+        column->doubles.push_back(double_value);
+      } else {
+        column->ints.push_back(static_cast<int64_t>(value));
+      }
+      return true;
+    }
+    case Column::Type::kString:
+      break;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unexpected column type: " << static_cast<int>(type_);
+}
+
+}  // namespace riegeli
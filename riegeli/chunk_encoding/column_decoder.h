@@ -0,0 +1,108 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_COLUMN_DECODER_H_
+#define RIEGELI_CHUNK_ENCODING_COLUMN_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/column.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+
+namespace riegeli {
+
+// Decodes values of a single field from records of chunks into a Column.
+class ColumnDecoder : public Object {
+ public:
+  // Will decode values of field, which is a path of field numbers like in
+  // FieldFilter, represented as specified by type.
+  //
+  // Precondition: !field.empty()
+  ColumnDecoder(FieldFilter::Field field, Column::Type type);
+
+  ColumnDecoder(ColumnDecoder&& src) noexcept;
+  ColumnDecoder& operator=(ColumnDecoder&& src) noexcept;
+
+  ~ColumnDecoder();
+
+  const FieldFilter::Field& field() const { return field_; }
+  Column::Type type() const { return type_; }
+
+  // Returns the dictionary for chunks compressed with a Zstd dictionary, or
+  // nullptr if it is not known yet. Like in ChunkDecoder, it is replaced by
+  // decoding an internal::ChunkType::kZstdDictionary chunk.
+  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary() const {
+    return chunk_decoder_.zstd_dictionary();
+  }
+  void set_zstd_dictionary(
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary) {
+    chunk_decoder_.set_zstd_dictionary(std::move(zstd_dictionary));
+  }
+
+  // Decodes values of the field from records of chunk into *column, replacing
+  // its contents.
+  //
+  // A transposed chunk is decoded without reconstructing the records if
+  // possible, decompressing only buckets with values of the field. Otherwise
+  // (e.g. for a simple chunk, or a packed repeated field) the records are
+  // decoded, excluding other fields if the chunk is transposed, and values are
+  // parsed from them.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy()), e.g. the chunk is invalid, or the field
+  //            has a wire type not matching the column type
+  bool Decode(const Chunk& chunk, Column* column);
+
+ protected:
+  void Done() override { chunk_decoder_.Clear(); }
+
+ private:
+  // Decodes the records of chunk and parses values from them.
+  bool DecodeRecords(const Chunk& chunk, Column* column);
+
+  // Appends values of the field to *column from a message read from src,
+  // which begins inside submessages or groups with field numbers
+  // field_[0..depth). The message ends at the end of src, or at the end of the
+  // group with end_group_field if it is not 0.
+  //
+  // If depth == field_.size(), the message is only validated.
+  //
+  // Returns false if the message is invalid, and additionally sets
+  // type_mismatch_ to true if the field has an incompatible wire type.
+  bool ParseMessage(Reader* src, size_t depth, uint32_t end_group_field,
+                    Column* column);
+
+  // Appends a value of the field to *column, read from src in the wire format
+  // of the column type.
+  bool ParseValue(Reader* src, Column* column);
+
+  FieldFilter::Field field_;
+  Column::Type type_;
+  // Invariant: chunk_decoder_ includes only field_
+  ChunkDecoder chunk_decoder_;
+  bool type_mismatch_ = false;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_COLUMN_DECODER_H_
@@ -0,0 +1,146 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/flat_decompression.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#include "brotli/decode.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "zstd.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+struct ZSTD_DCtxDeleter {
+  void operator()(ZSTD_DCtx* ptr) const { ZSTD_freeDCtx(ptr); }
+};
+
+struct BrotliDecoderStateDeleter {
+  void operator()(BrotliDecoderState* ptr) const {
+    BrotliDecoderDestroyInstance(ptr);
+  }
+};
+
+// Decompression contexts are reused by later calls. They do not depend on
+// parameters, so they are all kept with the key 0.
+using ZstdDecompressorPool = RecyclingPool<ZSTD_DCtx, ZSTD_DCtxDeleter>;
+
+bool ZstdDecompressFlat(
+    string_view src,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary, char* dest,
+    size_t size) {
+  const ZstdDecompressorPool::Handle decompressor =
+      ZstdDecompressorPool::global().Get(0, [] {
+        return std::unique_ptr<ZSTD_DCtx, ZSTD_DCtxDeleter>(ZSTD_createDCtx());
+      });
+  if (RIEGELI_UNLIKELY(decompressor == nullptr)) return false;
+  // Decompression resets the decompression context if it is reused.
+  size_t result;
+  if (zstd_dictionary != nullptr) {
+    const ZSTD_DDict* const decompression_dictionary =
+        zstd_dictionary->PrepareDecompressionDictionary();
+    if (RIEGELI_UNLIKELY(decompression_dictionary == nullptr)) return false;
+    result = ZSTD_decompress_usingDDict(decompressor.get(), dest, size,
+                                        src.data(), src.size(),
+                                        decompression_dictionary);
+  } else {
+    result = ZSTD_decompressDCtx(decompressor.get(), dest, size, src.data(),
+                                 src.size());
+  }
+  // An error is reported also if there are data after the last frame, or if
+  // the decompressed data do not fit in size.
+  return !ZSTD_isError(result) && result == size;
+}
+
+bool BrotliDecompressFlat(string_view src, char* dest, size_t size) {
+  // BrotliDecoderDecompress() does not report data after the compressed
+  // stream, so a decoder is driven directly, with all input and output
+  // available in a single call.
+  const std::unique_ptr<BrotliDecoderState, BrotliDecoderStateDeleter>
+      decompressor(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+  if (RIEGELI_UNLIKELY(decompressor == nullptr)) return false;
+  size_t available_in = src.size();
+  const uint8_t* next_in = reinterpret_cast<const uint8_t*>(src.data());
+  size_t available_out = size;
+  uint8_t* next_out = reinterpret_cast<uint8_t*>(dest);
+  const BrotliDecoderResult result = BrotliDecoderDecompressStream(
+      decompressor.get(), &available_in, &next_in, &available_out, &next_out,
+      nullptr);
+  return result == BROTLI_DECODER_RESULT_SUCCESS && available_in == 0 &&
+         available_out == 0;
+}
+
+}  // namespace
+
+bool SupportsFlatDecompression(CompressionType compression_type) {
+  switch (compression_type) {
+    case CompressionType::kBrotli:
+    case CompressionType::kZstd:
+    case CompressionType::kZstdWithDictionary:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool DecompressFlat(
+    ChainReader* src, CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary, char* dest,
+    size_t size) {
+  RIEGELI_ASSERT(SupportsFlatDecompression(compression_type))
+      << "Failed precondition of DecompressFlat(): "
+         "unsupported compression type: "
+      << static_cast<int>(compression_type);
+  Position src_size;
+  if (!src->Size(&src_size)) RIEGELI_ASSERT_UNREACHABLE();
+  const size_t compressed_size = IntCast<size_t>(src_size - src->pos());
+  string_view compressed;
+  std::unique_ptr<char[]> flattened;
+  if (src->available() >= compressed_size) {
+    compressed = string_view(src->cursor(), compressed_size);
+    if (!src->Skip(compressed_size)) RIEGELI_ASSERT_UNREACHABLE();
+  } else {
+    flattened.reset(new char[compressed_size]);
+    if (!src->Read(flattened.get(), compressed_size)) {
+      RIEGELI_ASSERT_UNREACHABLE();
+    }
+    compressed = string_view(flattened.get(), compressed_size);
+  }
+  switch (compression_type) {
+    case CompressionType::kBrotli:
+      return BrotliDecompressFlat(compressed, dest, size);
+    case CompressionType::kZstd:
+      return ZstdDecompressFlat(compressed, nullptr, dest, size);
+    case CompressionType::kZstdWithDictionary:
+      if (RIEGELI_UNLIKELY(zstd_dictionary == nullptr)) return false;
+      return ZstdDecompressFlat(compressed, zstd_dictionary, dest, size);
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Unsupported compression type: "
+          << static_cast<int>(compression_type);
+  }
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,57 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_FLAT_DECOMPRESSION_H_
+#define RIEGELI_CHUNK_ENCODING_FLAT_DECOMPRESSION_H_
+
+#include <stddef.h>
+#include <memory>
+
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+
+namespace riegeli {
+namespace internal {
+
+// Returns true if DecompressFlat() supports compression_type. Data compressed
+// otherwise are decompressed with a Reader.
+bool SupportsFlatDecompression(CompressionType compression_type);
+
+// Decompresses the remaining data of src, whose decompressed size is known to
+// be size, to the array dest, with a single call to the compression library.
+// This avoids copying through the buffer of a decompressing Reader.
+//
+// Compressed data are copied to a flat array first only if they are
+// fragmented in src.
+//
+// zstd_dictionary is used if compression_type is
+// CompressionType::kZstdWithDictionary.
+//
+// Precondition: SupportsFlatDecompression(compression_type)
+//
+// Return values:
+//  * true  - success (the remaining data of src are consumed and decompress
+//            to exactly size bytes)
+//  * false - failure (compressed data are invalid or have a different
+//            decompressed size, or a dictionary is missing)
+bool DecompressFlat(
+    ChainReader* src, CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary, char* dest,
+    size_t size);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_FLAT_DECOMPRESSION_H_
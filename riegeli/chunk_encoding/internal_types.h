@@ -25,6 +25,9 @@ enum class ChunkType : uint8_t {
   kPadding = 0,
   kSimple = 's',
   kTransposed = 't',
+  // Stores the Zstd dictionary used by chunks compressed with
+  // CompressionType::kZstdWithDictionary. It contains no records.
+  kZstdDictionary = 'd',
 };
 
 // These values are frozen in the file format.
@@ -32,6 +35,11 @@ enum class CompressionType : uint8_t {
   kNone = 0,
   kBrotli = 'b',
   kZstd = 'z',
+  // Zstd with the dictionary stored in the ChunkType::kZstdDictionary chunk of
+  // the same file.
+  kZstdWithDictionary = 'Z',
+  kLz4 = '4',
+  kSnappy = 's',
 };
 
 }  // namespace internal
@@ -0,0 +1,152 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/pipeline_stats.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+namespace {
+
+// The innermost running Timer with stats in this thread, or nullptr.
+thread_local PipelineStats::Timer* current_timer = nullptr;
+
+}  // namespace
+
+constexpr int PipelineStats::kNumStages;
+constexpr int PipelineStats::kNumBufferTypes;
+
+const char* PipelineStats::StageName(Stage stage) {
+  switch (stage) {
+    case Stage::kSerialize:
+      return "serialize";
+    case Stage::kTranspose:
+      return "transpose";
+    case Stage::kCompress:
+      return "compress";
+    case Stage::kHash:
+      return "hash";
+    case Stage::kWriteChunk:
+      return "write_chunk";
+    case Stage::kReadChunk:
+      return "read_chunk";
+    case Stage::kDecompress:
+      return "decompress";
+    case Stage::kTransposeDecode:
+      return "transpose_decode";
+    case Stage::kParse:
+      return "parse";
+    case Stage::kNumStages:
+      break;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown stage: " << static_cast<int>(stage);
+}
+
+const char* PipelineStats::BufferTypeName(BufferType buffer_type) {
+  switch (buffer_type) {
+    case BufferType::kVarint:
+      return "varint";
+    case BufferType::kFixed32:
+      return "fixed32";
+    case BufferType::kFixed64:
+      return "fixed64";
+    case BufferType::kString:
+      return "string";
+    case BufferType::kNonProto:
+      return "nonproto";
+    case BufferType::kNumBufferTypes:
+      break;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown buffer type: " << static_cast<int>(buffer_type);
+}
+
+double PipelineStats::StageStats::ratio() const {
+  if (bytes_in == 0) return 0.0;
+  return static_cast<double>(bytes_out) / static_cast<double>(bytes_in);
+}
+
+PipelineStats::Snapshot PipelineStats::snapshot() const {
+  Snapshot snapshot;
+  for (int i = 0; i < kNumStages; ++i) {
+    snapshot.stages[i].nanos =
+        stages_[i].nanos.load(std::memory_order_relaxed);
+    snapshot.stages[i].calls =
+        stages_[i].calls.load(std::memory_order_relaxed);
+    snapshot.stages[i].bytes_in =
+        stages_[i].bytes_in.load(std::memory_order_relaxed);
+    snapshot.stages[i].bytes_out =
+        stages_[i].bytes_out.load(std::memory_order_relaxed);
+  }
+  for (int i = 0; i < kNumBufferTypes; ++i) {
+    snapshot.buffer_types[i].buckets =
+        buffer_types_[i].buckets.load(std::memory_order_relaxed);
+    snapshot.buffer_types[i].buffers =
+        buffer_types_[i].buffers.load(std::memory_order_relaxed);
+    snapshot.buffer_types[i].bytes =
+        buffer_types_[i].bytes.load(std::memory_order_relaxed);
+  }
+  snapshot.chunks_encoded = chunks_encoded_.load(std::memory_order_relaxed);
+  snapshot.records_encoded = records_encoded_.load(std::memory_order_relaxed);
+  snapshot.chunks_decoded = chunks_decoded_.load(std::memory_order_relaxed);
+  snapshot.records_decoded = records_decoded_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+void PipelineStats::Reset() {
+  for (AtomicStageStats& stats : stages_) {
+    stats.nanos.store(0, std::memory_order_relaxed);
+    stats.calls.store(0, std::memory_order_relaxed);
+    stats.bytes_in.store(0, std::memory_order_relaxed);
+    stats.bytes_out.store(0, std::memory_order_relaxed);
+  }
+  for (AtomicBufferTypeStats& stats : buffer_types_) {
+    stats.buckets.store(0, std::memory_order_relaxed);
+    stats.buffers.store(0, std::memory_order_relaxed);
+    stats.bytes.store(0, std::memory_order_relaxed);
+  }
+  chunks_encoded_.store(0, std::memory_order_relaxed);
+  records_encoded_.store(0, std::memory_order_relaxed);
+  chunks_decoded_.store(0, std::memory_order_relaxed);
+  records_decoded_.store(0, std::memory_order_relaxed);
+}
+
+void PipelineStats::Timer::Start() {
+  parent_ = current_timer;
+  current_timer = this;
+  nested_nanos_ = 0;
+  start_ = std::chrono::steady_clock::now();
+}
+
+void PipelineStats::Timer::Stop() {
+  const uint64_t nanos = IntCast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_)
+          .count());
+  RIEGELI_ASSERT(current_timer == this)
+      << "Failed precondition of PipelineStats::Timer::~Timer(): "
+         "Timers not destroyed in reverse order of construction";
+  current_timer = parent_;
+  if (parent_ != nullptr) parent_->nested_nanos_ += nanos;
+  stats_->AddStage(stage_, nanos - UnsignedMin(nested_nanos_, nanos), bytes_in_,
+                   bytes_out_);
+}
+
+}  // namespace riegeli
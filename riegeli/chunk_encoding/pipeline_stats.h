@@ -0,0 +1,270 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_PIPELINE_STATS_H_
+#define RIEGELI_CHUNK_ENCODING_PIPELINE_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+// PipelineStats accumulates the time spent and the amount of data processed in
+// stages of writing and reading Riegeli/records files, together with counts of
+// chunks and of transposed buffers and buckets.
+//
+// Statistics are collected by RecordWriter, RecordReader, ChunkEncoder,
+// ChunkDecoder, and ChunkReader which were given a PipelineStats with their
+// set_stats() option. Without it, the only cost is checking a null pointer.
+// With it, the cost is a few clock reads per chunk, and per record in stages
+// which process individual records.
+//
+// PipelineStats is thread-safe. It can be shared by several writers and
+// readers, including their background threads, and snapshot() can be called
+// at any time, e.g. to export statistics periodically.
+class PipelineStats {
+ public:
+  enum class Stage : int {
+    // Serializing proto messages to bytes. If records are not transposed,
+    // messages are serialized directly into the compressor, so this includes
+    // a part of compression.
+    //
+    // bytes_out: size of serialized messages.
+    kSerialize,
+    // Building the transposed representation of records: splitting them into
+    // buffers and constructing the state machine. Compression is excluded.
+    //
+    // bytes_in: size of records, bytes_out: size of transposed chunk data.
+    kTranspose,
+    // Compressing. If records are not transposed, compression is streaming, so
+    // this includes adding records to the compressors.
+    //
+    // bytes_in: uncompressed size, bytes_out: compressed size.
+    kCompress,
+    // Computing the hash of chunk data when writing, or verifying it when
+    // reading.
+    //
+    // bytes_in: size of chunk data.
+    kHash,
+    // Writing chunks with ChunkWriter::WriteChunk().
+    //
+    // bytes_in: size of chunk data, bytes_out: size written, including chunk
+    // and block headers and padding.
+    kWriteChunk,
+    // Reading chunks with ChunkReader::ReadChunk(). Hash verification is
+    // excluded.
+    //
+    // bytes_in: size read, including chunk and block headers and skipped data,
+    // bytes_out: size of chunk data.
+    kReadChunk,
+    // Decompressing. In transposed chunks this covers buckets; the header and
+    // transitions are decompressed incrementally while being parsed, which is
+    // included in kTransposeDecode.
+    //
+    // bytes_in: compressed size, bytes_out: uncompressed size.
+    kDecompress,
+    // Reconstructing records from the transposed representation.
+    // Decompression of buckets is excluded.
+    //
+    // bytes_in: size of transposed chunk data, bytes_out: size of records.
+    kTransposeDecode,
+    // Parsing records to proto messages.
+    //
+    // bytes_in: size of records.
+    kParse,
+    kNumStages,
+  };
+
+  static constexpr int kNumStages = static_cast<int>(Stage::kNumStages);
+
+  // Returns a short lowercase name of the stage, suitable as a metric label.
+  static const char* StageName(Stage stage);
+
+  // Types of buffers records are split into in transposed chunks.
+  enum class BufferType : int {
+    kVarint,
+    kFixed32,
+    kFixed64,
+    kString,
+    kNonProto,
+    kNumBufferTypes,
+  };
+
+  static constexpr int kNumBufferTypes =
+      static_cast<int>(BufferType::kNumBufferTypes);
+
+  // Returns a short lowercase name of the buffer type, suitable as a metric
+  // label.
+  static const char* BufferTypeName(BufferType buffer_type);
+
+  struct StageStats {
+    // Returns bytes_out / bytes_in, e.g. the compression ratio for
+    // kCompress, or 0.0 if bytes_in == 0.
+    double ratio() const;
+
+    // Cumulative wall time spent in the stage, excluding nested stages.
+    uint64_t nanos = 0;
+    // Number of times the stage was entered.
+    uint64_t calls = 0;
+    // Amount of data entering and leaving the stage; see Stage for their
+    // meaning for each stage.
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+  };
+
+  struct BufferTypeStats {
+    // Number of buckets which contain buffers of this type. If compression is
+    // disabled, all buffers share one bucket.
+    uint64_t buckets = 0;
+    // Number of buffers of this type.
+    uint64_t buffers = 0;
+    // Uncompressed size of buffers of this type.
+    uint64_t bytes = 0;
+  };
+
+  // A consistent-enough copy of statistics: each counter is read atomically,
+  // but counters updated together may be observed from different moments.
+  struct Snapshot {
+    const StageStats& stage(Stage stage) const {
+      return stages[static_cast<int>(stage)];
+    }
+    const BufferTypeStats& buffer_type(BufferType buffer_type) const {
+      return buffer_types[static_cast<int>(buffer_type)];
+    }
+
+    StageStats stages[kNumStages];
+    BufferTypeStats buffer_types[kNumBufferTypes];
+    // Number of chunks and records encoded by ChunkEncoder.
+    uint64_t chunks_encoded = 0;
+    uint64_t records_encoded = 0;
+    // Number of chunks and records successfully decoded by ChunkDecoder.
+    uint64_t chunks_decoded = 0;
+    uint64_t records_decoded = 0;
+  };
+
+  // Measures a stage from construction to destruction, excluding stages
+  // measured by Timers nested in the same thread. If stats is nullptr, Timer
+  // does nothing.
+  class Timer;
+
+  PipelineStats() noexcept {}
+
+  PipelineStats(const PipelineStats&) = delete;
+  PipelineStats& operator=(const PipelineStats&) = delete;
+
+  // Returns the current statistics.
+  Snapshot snapshot() const;
+
+  // Sets all statistics to zero. Updates concurrent with Reset() may be lost.
+  void Reset();
+
+  void AddStage(Stage stage, uint64_t nanos, uint64_t bytes_in,
+                uint64_t bytes_out);
+  void AddEncodedChunk(uint64_t num_records);
+  void AddDecodedChunk(uint64_t num_records);
+  void AddBuffers(BufferType buffer_type, uint64_t buckets, uint64_t buffers,
+                  uint64_t bytes);
+
+ private:
+  struct AtomicStageStats {
+    std::atomic<uint64_t> nanos{0};
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+  };
+
+  struct AtomicBufferTypeStats {
+    std::atomic<uint64_t> buckets{0};
+    std::atomic<uint64_t> buffers{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+
+  AtomicStageStats stages_[kNumStages];
+  AtomicBufferTypeStats buffer_types_[kNumBufferTypes];
+  std::atomic<uint64_t> chunks_encoded_{0};
+  std::atomic<uint64_t> records_encoded_{0};
+  std::atomic<uint64_t> chunks_decoded_{0};
+  std::atomic<uint64_t> records_decoded_{0};
+};
+
+class PipelineStats::Timer {
+ public:
+  Timer(PipelineStats* stats, Stage stage) : stats_(stats), stage_(stage) {
+    if (RIEGELI_UNLIKELY(stats_ != nullptr)) Start();
+  }
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  ~Timer() {
+    if (RIEGELI_UNLIKELY(stats_ != nullptr)) Stop();
+  }
+
+  // Sets the amount of data entering and leaving the stage, to be added when
+  // the Timer is destroyed.
+  void set_bytes(uint64_t bytes_in, uint64_t bytes_out) {
+    bytes_in_ = bytes_in;
+    bytes_out_ = bytes_out;
+  }
+
+ private:
+  void Start();
+  void Stop();
+
+  PipelineStats* stats_;
+  Stage stage_;
+  uint64_t bytes_in_ = 0;
+  uint64_t bytes_out_ = 0;
+  // The following members are valid if stats_ != nullptr.
+  Timer* parent_;
+  std::chrono::steady_clock::time_point start_;
+  // Time measured by nested Timers, to be excluded from this Timer.
+  uint64_t nested_nanos_;
+};
+
+// Implementation details follow.
+
+inline void PipelineStats::AddStage(Stage stage, uint64_t nanos,
+                                    uint64_t bytes_in, uint64_t bytes_out) {
+  AtomicStageStats& stats = stages_[static_cast<int>(stage)];
+  stats.nanos.fetch_add(nanos, std::memory_order_relaxed);
+  stats.calls.fetch_add(1, std::memory_order_relaxed);
+  stats.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+  stats.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+}
+
+inline void PipelineStats::AddEncodedChunk(uint64_t num_records) {
+  chunks_encoded_.fetch_add(1, std::memory_order_relaxed);
+  records_encoded_.fetch_add(num_records, std::memory_order_relaxed);
+}
+
+inline void PipelineStats::AddDecodedChunk(uint64_t num_records) {
+  chunks_decoded_.fetch_add(1, std::memory_order_relaxed);
+  records_decoded_.fetch_add(num_records, std::memory_order_relaxed);
+}
+
+inline void PipelineStats::AddBuffers(BufferType buffer_type, uint64_t buckets,
+                                      uint64_t buffers, uint64_t bytes) {
+  AtomicBufferTypeStats& stats = buffer_types_[static_cast<int>(buffer_type)];
+  stats.buckets.fetch_add(buckets, std::memory_order_relaxed);
+  stats.buffers.fetch_add(buffers, std::memory_order_relaxed);
+  stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_PIPELINE_STATS_H_
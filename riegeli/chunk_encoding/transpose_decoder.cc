@@ -16,7 +16,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <string>
@@ -26,17 +29,26 @@
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/base/memory.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/brotli_reader.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/lz4_reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_reader.h"
 #include "riegeli/bytes/writer_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/bytes/zstd_reader.h"
+#include "riegeli/chunk_encoding/column.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/chunk_encoding/flat_decompression.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
@@ -55,11 +67,20 @@ ChainReader* kEmptyChainReader() {
   return kStaticEmptyChainReader.get();
 }
 
+// zstd_dictionary is used if compression_type is
+// internal::CompressionType::kZstdWithDictionary.
+//
+// If src is owned, internal::SupportsFlatDecompression(compression_type), and
+// the decompressed size is at most max_flat_size and plausible for the
+// compressed size, Initialize() decompresses all data at once, and reader()
+// reads them from memory.
 class Decompressor {
  public:
   bool Initialize(ChainReader src, internal::CompressionType compression_type,
-                  std::string* error_message);
+                  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+                  uint64_t max_flat_size, std::string* error_message);
   bool Initialize(Reader* src, internal::CompressionType compression_type,
+                  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
                   std::string* error_message);
 
   Reader* reader() const { return reader_; }
@@ -68,7 +89,8 @@ class Decompressor {
 
  private:
   bool Initialize(internal::CompressionType compression_type,
-                  std::string* error_message);
+                  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+                  uint64_t max_flat_size, std::string* error_message);
 
   ChainReader owned_src_;
   Reader* src_;
@@ -76,30 +98,78 @@ class Decompressor {
   Reader* reader_;
 };
 
-bool Decompressor::Initialize(ChainReader src,
-                              internal::CompressionType compression_type,
-                              std::string* error_message) {
+// The decompressed size is read from the data before decompressing them, so it
+// is trusted only up to this multiple of the compressed size. A larger
+// decompressed size, which is possible but rare, is handled by a Reader, which
+// fails without allocating memory if the data are corrupted.
+constexpr uint64_t kMaxFlatCompressionRatio = 1024;
+
+// Returns true if decompressed_size of the remaining data of src permits
+// allocating it at once.
+bool FlatSizePlausible(const ChainReader& src, uint64_t decompressed_size,
+                       uint64_t max_flat_size) {
+  if (decompressed_size > UnsignedMin(max_flat_size,
+                                      std::numeric_limits<size_t>::max())) {
+    return false;
+  }
+  Position src_size;
+  if (!src.Size(&src_size)) RIEGELI_ASSERT_UNREACHABLE();
+  return decompressed_size / kMaxFlatCompressionRatio <=
+         src_size - src.pos();
+}
+
+bool Decompressor::Initialize(
+    ChainReader src, internal::CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    uint64_t max_flat_size, std::string* error_message) {
   owned_src_ = std::move(src);
   src_ = &owned_src_;
-  return Initialize(compression_type, error_message);
+  return Initialize(compression_type, zstd_dictionary, max_flat_size,
+                    error_message);
 }
 
-bool Decompressor::Initialize(Reader* src,
-                              internal::CompressionType compression_type,
-                              std::string* error_message) {
+bool Decompressor::Initialize(
+    Reader* src, internal::CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    std::string* error_message) {
   owned_src_ = ChainReader();
   src_ = RIEGELI_ASSERT_NOTNULL(src);
-  return Initialize(compression_type, error_message);
+  // Data from a Reader are not decompressed at once.
+  return Initialize(compression_type, zstd_dictionary, 0, error_message);
 }
 
-bool Decompressor::Initialize(internal::CompressionType compression_type,
-                              std::string* error_message) {
+bool Decompressor::Initialize(
+    internal::CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    uint64_t max_flat_size, std::string* error_message) {
   if (compression_type == internal::CompressionType::kNone) {
     reader_ = src_;
     return true;
   }
+  if (compression_type == internal::CompressionType::kZstdWithDictionary &&
+      RIEGELI_UNLIKELY(zstd_dictionary == nullptr)) {
+    *error_message = "Missing Zstd dictionary";
+    return false;
+  }
   uint64_t uncompressed_size;
   RETURN_FALSE_IF(!ReadVarint64(src_, &uncompressed_size));
+  if (src_ == &owned_src_ &&
+      internal::SupportsFlatDecompression(compression_type) &&
+      FlatSizePlausible(owned_src_, uncompressed_size, max_flat_size)) {
+    // The whole compressed stream is available and its decompressed size is
+    // known, so it is decompressed at once to a single block of a Chain,
+    // which is then read without copying.
+    const size_t size = IntCast<size_t>(uncompressed_size);
+    Chain decompressed;
+    const Chain::Buffer buffer = decompressed.MakeAppendBuffer(size, size);
+    RETURN_FALSE_IF(!internal::DecompressFlat(&owned_src_, compression_type,
+                                              zstd_dictionary, buffer.data(),
+                                              size));
+    decompressed.RemoveSuffix(buffer.size() - size);
+    owned_reader_ = riegeli::make_unique<ChainReader>(std::move(decompressed));
+    reader_ = owned_reader_.get();
+    return true;
+  }
   switch (compression_type) {
     case internal::CompressionType::kNone:
       RIEGELI_ASSERT_UNREACHABLE();
@@ -111,6 +181,19 @@ bool Decompressor::Initialize(internal::CompressionType compression_type,
       owned_reader_ = riegeli::make_unique<ZstdReader>(src_);
       reader_ = owned_reader_.get();
       return true;
+    case internal::CompressionType::kZstdWithDictionary:
+      owned_reader_ = riegeli::make_unique<ZstdReader>(
+          src_, ZstdReader::Options().set_dictionary(zstd_dictionary));
+      reader_ = owned_reader_.get();
+      return true;
+    case internal::CompressionType::kLz4:
+      owned_reader_ = riegeli::make_unique<Lz4Reader>(src_);
+      reader_ = owned_reader_.get();
+      return true;
+    case internal::CompressionType::kSnappy:
+      owned_reader_ = riegeli::make_unique<SnappyReader>(src_);
+      reader_ = owned_reader_.get();
+      return true;
   }
   *error_message = "Unknown compression type: " +
                    std::to_string(static_cast<int>(compression_type));
@@ -305,6 +388,82 @@ struct DataBucket {
   bool decompressed = false;
 };
 
+// Decompresses "compressed_data" and splits it into buffers of "buffer_sizes",
+// appending them to "buffers".
+bool DecompressBucket(
+    internal::CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    uint64_t max_flat_size, const Chain& compressed_data,
+    const std::vector<size_t>& buffer_sizes, PipelineStats* stats,
+    std::vector<ChainReader>* buffers, std::string* message) {
+  PipelineStats::Timer timer(stats, PipelineStats::Stage::kDecompress);
+  Decompressor decompressor;
+  RETURN_FALSE_IF(!decompressor.Initialize(ChainReader(&compressed_data),
+                                           compression_type, zstd_dictionary,
+                                           max_flat_size, message));
+  buffers->reserve(buffers->size() + buffer_sizes.size());
+  uint64_t decompressed_size = 0;
+  for (auto buffer_size : buffer_sizes) {
+    Chain buffer;
+    RETURN_FALSE_IF(!decompressor.reader()->Read(&buffer, buffer_size));
+    buffers->emplace_back(std::move(buffer));
+    decompressed_size += buffer_size;
+  }
+  RETURN_FALSE_IF(!decompressor.VerifyEndAndClose());
+  timer.set_bytes(compressed_data.size(), decompressed_size);
+  return true;
+}
+
+// Buckets being decompressed concurrently, shared by the thread running
+// TransposeDecoder::Initialize() and tasks scheduled on the thread pool, which
+// may start after Initialize() returns.
+struct ParallelBuckets {
+  ParallelBuckets(internal::CompressionType compression_type,
+                  std::shared_ptr<const ZstdDictionary> zstd_dictionary,
+                  uint64_t max_flat_size, PipelineStats* stats)
+      : compression_type(compression_type),
+        zstd_dictionary(std::move(zstd_dictionary)),
+        max_flat_size(max_flat_size),
+        stats(stats) {}
+
+  // Decompresses buckets until all of them are claimed by some thread.
+  void Run();
+
+  internal::CompressionType compression_type;
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary;
+  uint64_t max_flat_size;
+  PipelineStats* stats;
+  // For each bucket: compressed data, sizes of its buffers, index of its first
+  // buffer in the chunk, decompressed buffers, and whether decompression
+  // succeeded.
+  std::vector<Chain> compressed_data;
+  std::vector<std::vector<size_t>> buffer_sizes;
+  std::vector<uint32_t> bucket_start;
+  std::vector<std::vector<ChainReader>> buffers;
+  std::unique_ptr<bool[]> decompressed;
+  // Index of the next bucket to decompress.
+  std::atomic<size_t> next_bucket{0};
+  // Number of buckets processed so far.
+  std::atomic<size_t> num_processed{0};
+  internal::EventCount processed_all;
+};
+
+void ParallelBuckets::Run() {
+  const size_t num_buckets = compressed_data.size();
+  for (;;) {
+    const size_t index = next_bucket.fetch_add(1);
+    if (index >= num_buckets) return;
+    std::string message;
+    decompressed[index] =
+        DecompressBucket(compression_type, zstd_dictionary, max_flat_size,
+                         compressed_data[index], buffer_sizes[index], stats,
+                         &buffers[index], &message);
+    if (num_processed.fetch_add(1) + 1 == num_buckets) {
+      processed_all.NotifyAll();
+    }
+  }
+}
+
 // Return true if "tag" is a valid protocol buffer tag.
 bool ValidTag(uint32_t tag) {
   switch (static_cast<internal::WireType>(tag & 7)) {
@@ -597,12 +756,55 @@ bool ContainsImplicitLoop(std::vector<StateMachineNode>* state_machine_nodes) {
   return false;
 }
 
+// How TransposeDecoder::DecodeColumn() handles a state machine node.
+enum class ColumnAction : uint8_t {
+  // Not determined yet.
+  kUnresolved,
+  // Nothing to do, e.g. the node belongs to a different field.
+  kNone,
+  // Beginning of a record (records are decoded back to front).
+  kRecord,
+  // End of a submessage or group, i.e. entering it back to front.
+  kEnter,
+  // Beginning of a submessage or group, i.e. leaving it back to front.
+  kLeave,
+  // A value of the field, stored in the buffer as a varint of varint_length
+  // bytes without continuation bits.
+  kVarint,
+  // A value of the field, stored inline in inline_value.
+  kInlineVarint,
+  // A value of the field, stored in the buffer as 4 bytes.
+  kFixed32,
+  // A value of the field, stored in the buffer as 8 bytes.
+  kFixed64,
+  // A value of the field, stored in the buffer as a length-delimited string.
+  kString,
+  // Invalid data, or the field is stored in a way which DecodeColumn() does
+  // not support.
+  kFailure,
+};
+
+struct ColumnNode {
+  ColumnAction action = ColumnAction::kUnresolved;
+  uint8_t varint_length = 0;
+  uint8_t inline_value = 0;
+  // Field number of the submessage or group if action == kEnter.
+  uint32_t field = 0;
+  ChainReader* buffer = nullptr;
+};
+
 }  // namespace
 
 struct TransposeDecoder::Context {
   // Precondition filtering_enabled == true.
   ChainReader* GetBuffer(uint32_t bucket_index, uint32_t index_within_bucket);
 
+  // Waits until "parallel_buckets" are decompressed, helping with that in the
+  // current thread, and moves their buffers to "buffers".
+  //
+  // Precondition: parallel_buckets != nullptr
+  bool AwaitParallelBuckets();
+
   // Set callback_type in "node" based on "skipped_submessage_level",
   // "submessage_stack" and "node->node_template".
   bool SetCallbackType(
@@ -610,6 +812,12 @@ struct TransposeDecoder::Context {
       const std::vector<SubmessageStackElement>& submessage_stack,
       StateMachineNode* node);
 
+  // Set "column_node" for "node" based on the field and column type decoded by
+  // DecodeColumn() and "submessage_fields".
+  void ResolveColumnNode(const FieldFilter::Field& field, Column::Type type,
+                         const std::vector<uint32_t>& submessage_fields,
+                         const StateMachineNode& node, ColumnNode* column_node);
+
   // TODO: Expose message, probably by making TransposeDecoder an Object
   // and possibly moving Context contents to TransposeDecoder.
   std::string message;
@@ -626,10 +834,19 @@ struct TransposeDecoder::Context {
   // Buffer containing all the data.
   // Note: Used only when filtering is disabled.
   std::vector<ChainReader> buffers;
+  // Buckets being decompressed concurrently into "buffers", or nullptr.
+  // Note: Used only when filtering is disabled.
+  std::shared_ptr<ParallelBuckets> parallel_buckets;
   // State machine transitions. One byte = one transition.
   Decompressor transitions;
   // Compression type of the input.
   internal::CompressionType compression_type;
+  // Dictionary used if "compression_type" is kZstdWithDictionary, or nullptr.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary;
+  // Statistics of decompression, or nullptr.
+  PipelineStats* stats = nullptr;
+  // Maximum decompressed size of data decompressed at once, without a Reader.
+  uint64_t max_flat_size = 0;
 
   // --- Fields used in filtering. ---
   // We number used fields with indices into "existence_only" vector below.
@@ -655,18 +872,11 @@ inline ChainReader* TransposeDecoder::Context::GetBuffer(
     RIEGELI_ASSERT_LT(index_within_bucket, bucket.buffers.size());
   } else {
     RIEGELI_ASSERT_LT(index_within_bucket, bucket.buffer_sizes.size());
-    Decompressor decompressor;
-    if (!decompressor.Initialize(ChainReader(&bucket.compressed_data),
-                                 compression_type, &message)) {
+    if (!DecompressBucket(compression_type, zstd_dictionary, max_flat_size,
+                          bucket.compressed_data, bucket.buffer_sizes, stats,
+                          &bucket.buffers, &message)) {
       return nullptr;
     }
-    bucket.buffers.reserve(bucket.buffer_sizes.size());
-    for (auto buffer_size : bucket.buffer_sizes) {
-      Chain buffer;
-      if (!decompressor.reader()->Read(&buffer, buffer_size)) return nullptr;
-      bucket.buffers.emplace_back(std::move(buffer));
-    }
-    if (!decompressor.VerifyEndAndClose()) return nullptr;
     // Clear buffer_sizes which are no longer needed.
     bucket.buffer_sizes = std::vector<size_t>();
     bucket.compressed_data = Chain();
@@ -675,6 +885,28 @@ inline ChainReader* TransposeDecoder::Context::GetBuffer(
   return &bucket.buffers[index_within_bucket];
 }
 
+bool TransposeDecoder::Context::AwaitParallelBuckets() {
+  RIEGELI_ASSERT(parallel_buckets != nullptr)
+      << "Failed precondition of "
+         "TransposeDecoder::Context::AwaitParallelBuckets(): "
+         "no buckets being decompressed";
+  ParallelBuckets& state = *parallel_buckets;
+  const size_t num_buckets = state.compressed_data.size();
+  // Decompress buckets in this thread too, so that progress does not depend on
+  // the thread pool having idle threads.
+  state.Run();
+  state.processed_all.Wait(
+      [&] { return state.num_processed.load() == num_buckets; });
+  for (size_t i = 0; i < num_buckets; ++i) {
+    RETURN_FALSE_IF(!state.decompressed[i]);
+    for (size_t j = 0; j < state.buffers[i].size(); ++j) {
+      buffers[state.bucket_start[i] + j] = std::move(state.buffers[i][j]);
+    }
+  }
+  parallel_buckets.reset();
+  return true;
+}
+
 // Do not inline this function. This helps Clang to generate better code for
 // the main loop in Decode().
 RIEGELI_ATTRIBUTE_NOINLINE inline bool
@@ -761,6 +993,95 @@ TransposeDecoder::Context::SetCallbackType(
   return true;
 }
 
+void TransposeDecoder::Context::ResolveColumnNode(
+    const FieldFilter::Field& field, Column::Type type,
+    const std::vector<uint32_t>& submessage_fields,
+    const StateMachineNode& node, ColumnNode* column_node) {
+  column_node->action = ColumnAction::kFailure;
+  switch (static_cast<CallbackType>(
+      static_cast<uint8_t>(node.callback_type) &
+      ~static_cast<uint8_t>(CallbackType::kImplicit))) {
+    case CallbackType::kNoOp:
+      column_node->action = ColumnAction::kNone;
+      return;
+    case CallbackType::kMessageStart:
+    case CallbackType::kNonProto:
+      column_node->action = ColumnAction::kRecord;
+      return;
+    case CallbackType::kSelectCallback:
+      break;
+    default:
+      return;
+  }
+  const StateMachineNodeTemplate& node_template = *node.node_template;
+  if (node_template.tag ==
+      static_cast<uint32_t>(internal::MessageId::kStartOfSubmessage)) {
+    column_node->action = ColumnAction::kLeave;
+    return;
+  }
+  const uint32_t field_number = node_template.tag >> 3;
+  const bool is_column_field =
+      submessage_fields.size() + 1 == field.size() &&
+      std::equal(submessage_fields.begin(), submessage_fields.end(),
+                 field.begin()) &&
+      field_number == field.back();
+  const internal::WireType wire_type =
+      static_cast<internal::WireType>(node_template.tag & 7);
+  if ((wire_type == internal::WireType::kLengthDelimited &&
+       node_template.subtype ==
+           internal::Subtype::kLengthDelimitedEndOfSubmessage) ||
+      wire_type == internal::WireType::kEndGroup) {
+    if (is_column_field) return;
+    column_node->action = ColumnAction::kEnter;
+    column_node->field = field_number;
+    return;
+  }
+  if (wire_type == internal::WireType::kStartGroup) {
+    if (is_column_field) return;
+    column_node->action = ColumnAction::kLeave;
+    return;
+  }
+  if (!is_column_field) {
+    column_node->action = ColumnAction::kNone;
+    return;
+  }
+  if (wire_type != internal::ColumnWireType(type)) return;
+  ColumnAction action;
+  switch (wire_type) {
+    case internal::WireType::kVarint:
+      if (node_template.subtype > internal::Subtype::kVarintInlineMax) return;
+      if (node_template.subtype >= internal::Subtype::kVarintInline0) {
+        column_node->action = ColumnAction::kInlineVarint;
+        column_node->inline_value =
+            node_template.subtype - internal::Subtype::kVarintInline0;
+        return;
+      }
+      action = ColumnAction::kVarint;
+      column_node->varint_length =
+          node_template.subtype - internal::Subtype::kVarint1 + 1;
+      break;
+    case internal::WireType::kFixed32:
+      action = ColumnAction::kFixed32;
+      break;
+    case internal::WireType::kFixed64:
+      action = ColumnAction::kFixed64;
+      break;
+    case internal::WireType::kLengthDelimited:
+      if (node_template.subtype != internal::Subtype::kLengthDelimitedString) {
+        return;
+      }
+      action = ColumnAction::kString;
+      break;
+    default:
+      return;
+  }
+  if (node_template.bucket_index == kInvalidPos) return;
+  column_node->buffer = GetBuffer(node_template.bucket_index,
+                                  node_template.buffer_within_bucket_index);
+  if (column_node->buffer == nullptr) return;
+  column_node->action = action;
+}
+
 TransposeDecoder::TransposeDecoder() = default;
 TransposeDecoder::TransposeDecoder(TransposeDecoder&&) noexcept = default;
 TransposeDecoder& TransposeDecoder::operator=(TransposeDecoder&&) noexcept =
@@ -770,6 +1091,8 @@ TransposeDecoder::~TransposeDecoder() = default;
 bool TransposeDecoder::Initialize(Reader* reader,
                                   const FieldFilter& field_filter) {
   context_ = riegeli::make_unique<Context>();
+  context_->stats = stats_;
+  context_->max_flat_size = max_flat_size_;
   const bool filtering_enabled = !field_filter.include_all();
   if (filtering_enabled) {
     for (const auto& include_field : field_filter.fields()) {
@@ -797,6 +1120,7 @@ bool TransposeDecoder::Initialize(Reader* reader,
   RETURN_FALSE_IF(!ReadByte(reader, &compression_type_byte));
   context_->compression_type =
       static_cast<internal::CompressionType>(compression_type_byte);
+  context_->zstd_dictionary = zstd_dictionary_;
 
   uint64_t header_size;
   RETURN_FALSE_IF(!ReadVarint64(reader, &header_size));
@@ -804,7 +1128,8 @@ bool TransposeDecoder::Initialize(Reader* reader,
   RETURN_FALSE_IF(!reader->Read(&header, header_size));
   Decompressor header_decompressor;
   RETURN_FALSE_IF(!header_decompressor.Initialize(
-      ChainReader(&header), context_->compression_type, &context_->message));
+      ChainReader(&header), context_->compression_type,
+      context_->zstd_dictionary, context_->max_flat_size, &context_->message));
 
   uint32_t num_buffers;
   std::vector<uint32_t> bucket_start;
@@ -830,21 +1155,15 @@ bool TransposeDecoder::Initialize(Reader* reader,
       context_->state_machine_nodes;
   bool has_nonproto_op = false;
   size_t num_subtypes = 0;
-  std::vector<uint32_t> tags;
-  tags.reserve(state_machine_size);
-  for (size_t i = 0; i < state_machine_size; ++i) {
-    uint32_t tag;
-    RETURN_FALSE_IF(!ReadVarint32(header_decompressor.reader(), &tag));
-    tags.push_back(tag);
+  std::vector<uint32_t> tags(state_machine_size);
+  RETURN_FALSE_IF(!ReadVarints32(header_decompressor.reader(), tags.data(),
+                                 state_machine_size));
+  for (const uint32_t tag : tags) {
     if (ValidTag(tag) && internal::HasSubtype(tag)) ++num_subtypes;
   }
-  std::vector<uint32_t> next_node_indices;
-  next_node_indices.reserve(state_machine_size);
-  for (size_t i = 0; i < state_machine_size; ++i) {
-    uint32_t next_node;
-    RETURN_FALSE_IF(!ReadVarint32(header_decompressor.reader(), &next_node));
-    next_node_indices.push_back(next_node);
-  }
+  std::vector<uint32_t> next_node_indices(state_machine_size);
+  RETURN_FALSE_IF(!ReadVarints32(header_decompressor.reader(),
+                                 next_node_indices.data(), state_machine_size));
   std::string subtypes;
   RETURN_FALSE_IF(!header_decompressor.reader()->Read(&subtypes, num_subtypes));
   size_t subtype_index = 0;
@@ -987,9 +1306,14 @@ bool TransposeDecoder::Initialize(Reader* reader,
   RETURN_FALSE_IF(ContainsImplicitLoop(&state_machine_nodes));
 
   RETURN_FALSE_IF(!context_->transitions.Initialize(
-      reader, context_->compression_type, &context_->message));
+      reader, context_->compression_type, context_->zstd_dictionary,
+      &context_->message));
 
   RETURN_FALSE_IF(!header_decompressor.VerifyEndAndClose());
+  if (context_->parallel_buckets != nullptr) {
+    // Buckets were being decompressed while the state machine was parsed.
+    RETURN_FALSE_IF(!context_->AwaitParallelBuckets());
+  }
   return true;
 }
 
@@ -1002,7 +1326,14 @@ bool TransposeDecoder::ParseBuffers(Reader* header_reader, Reader* reader) {
     RETURN_FALSE_IF(num_buffers != 0);
     return true;
   }
+  if (thread_pool_ != nullptr && num_buckets > 1) {
+    return ParseBuffersInParallel(header_reader, reader, num_buffers,
+                                  num_buckets);
+  }
   context_->buffers.reserve(num_buffers);
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kDecompress);
+  uint64_t compressed_size = 0;
+  uint64_t decompressed_size = 0;
   std::vector<Chain> buckets;
   buckets.resize(num_buckets);
   std::vector<Decompressor> bucket_decompressors;
@@ -1011,9 +1342,11 @@ bool TransposeDecoder::ParseBuffers(Reader* header_reader, Reader* reader) {
     uint64_t bucket_length;
     RETURN_FALSE_IF(!ReadVarint64(header_reader, &bucket_length));
     RETURN_FALSE_IF(!reader->Read(&buckets[i], bucket_length));
+    compressed_size += bucket_length;
     bucket_decompressors.emplace_back();
     RETURN_FALSE_IF(!bucket_decompressors.back().Initialize(
         ChainReader(&buckets[i]), context_->compression_type,
+        context_->zstd_dictionary, context_->max_flat_size,
         &context_->message));
   }
 
@@ -1024,6 +1357,7 @@ bool TransposeDecoder::ParseBuffers(Reader* header_reader, Reader* reader) {
     Chain buffer;
     RETURN_FALSE_IF(!bucket_decompressors[bucket_index].reader()->Read(
         &buffer, buffer_length));
+    decompressed_size += buffer_length;
     context_->buffers.emplace_back(std::move(buffer));
     while (!bucket_decompressors[bucket_index].reader()->Pull() &&
            bucket_index + 1 < num_buckets) {
@@ -1033,6 +1367,62 @@ bool TransposeDecoder::ParseBuffers(Reader* header_reader, Reader* reader) {
   }
   RETURN_FALSE_IF(bucket_index + 1 != num_buckets);
   RETURN_FALSE_IF(!bucket_decompressors[bucket_index].VerifyEndAndClose());
+  timer.set_bytes(compressed_size, decompressed_size);
+  return true;
+}
+
+bool TransposeDecoder::ParseBuffersInParallel(Reader* header_reader,
+                                              Reader* reader,
+                                              uint32_t num_buffers,
+                                              uint32_t num_buckets) {
+  const std::shared_ptr<ParallelBuckets> state =
+      std::make_shared<ParallelBuckets>(
+          context_->compression_type, context_->zstd_dictionary,
+          context_->max_flat_size, stats_);
+  state->compressed_data.resize(num_buckets);
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    uint64_t bucket_length;
+    RETURN_FALSE_IF(!ReadVarint64(header_reader, &bucket_length));
+    RETURN_FALSE_IF(!reader->Read(&state->compressed_data[i], bucket_length));
+  }
+
+  // Assign buffers to buckets by their decompressed sizes, which are known
+  // before decompressing them.
+  state->buffer_sizes.resize(num_buckets);
+  state->bucket_start.reserve(num_buckets);
+  state->bucket_start.push_back(0);
+  uint32_t bucket_index = 0;
+  uint64_t remaining_bucket_size;
+  RETURN_FALSE_IF(!DecompressedSize(context_->compression_type,
+                                    state->compressed_data[0],
+                                    &remaining_bucket_size));
+  for (uint32_t i = 0; i < num_buffers; ++i) {
+    uint64_t buffer_length;
+    RETURN_FALSE_IF(!ReadVarint64(header_reader, &buffer_length));
+    RETURN_FALSE_IF(buffer_length > remaining_bucket_size);
+    remaining_bucket_size -= buffer_length;
+    state->buffer_sizes[bucket_index].push_back(buffer_length);
+    while (remaining_bucket_size == 0 && bucket_index + 1 < num_buckets) {
+      ++bucket_index;
+      state->bucket_start.push_back(i + 1);
+      RETURN_FALSE_IF(!DecompressedSize(context_->compression_type,
+                                        state->compressed_data[bucket_index],
+                                        &remaining_bucket_size));
+    }
+  }
+  RETURN_FALSE_IF(bucket_index + 1 != num_buckets);
+  RETURN_FALSE_IF(remaining_bucket_size != 0);
+
+  state->buffers.resize(num_buckets);
+  state->decompressed.reset(new bool[num_buckets]());
+  // Buffers are filled by Context::AwaitParallelBuckets(). State machine nodes
+  // refer to them by address in the meantime.
+  context_->buffers.resize(num_buffers);
+  const std::function<void()> decompress = [state] { state->Run(); };
+  const size_t num_tasks =
+      UnsignedMin(size_t{num_buckets} - 1, thread_pool_->max_threads());
+  for (size_t i = 0; i < num_tasks; ++i) thread_pool_->Schedule(decompress);
+  context_->parallel_buckets = state;
   return true;
 }
 
@@ -1284,6 +1674,153 @@ done:
   return true;
 }
 
+bool TransposeDecoder::DecodeColumn(const FieldFilter::Field& field,
+                                    Column::Type type, Column* column) {
+  RIEGELI_ASSERT(!field.empty())
+      << "Failed precondition of TransposeDecoder::DecodeColumn(): "
+         "empty field";
+  Context* const context = context_.get();
+  std::vector<StateMachineNode>& state_machine_nodes =
+      context->state_machine_nodes;
+  column->Clear();
+
+  // Actions of state machine nodes, determined when a node is first visited.
+  std::vector<ColumnNode> column_nodes(state_machine_nodes.size());
+  // Field numbers of the open submessages and groups.
+  std::vector<uint32_t> submessage_fields;
+  // Values are decoded back to front, like messages in Decode(). They are
+  // appended to column and reversed at the end. record_ends and string_ends
+  // hold the numbers of values decoded before each record beginning and the
+  // ends of strings in column->strings, in the order of decoding.
+  size_t num_values = 0;
+  std::vector<size_t> record_ends;
+  std::vector<size_t> string_ends;
+
+  Reader* const transitions_reader = context->transitions.reader();
+  StateMachineNode* node = state_machine_nodes.data() + context->first_node;
+  // Number of following iteration that go directly to node->next_node without
+  // reading transition byte.
+  int num_iters = 0;
+  if (IsImplicit(node->callback_type)) ++num_iters;
+  for (;;) {
+    ColumnNode& column_node =
+        column_nodes[PtrDistance(state_machine_nodes.data(), node)];
+    if (column_node.action == ColumnAction::kUnresolved) {
+      context->ResolveColumnNode(field, type, submessage_fields, *node,
+                                 &column_node);
+    }
+    switch (column_node.action) {
+      case ColumnAction::kUnresolved:
+        RIEGELI_ASSERT_UNREACHABLE() << "Column node not resolved";
+      case ColumnAction::kNone:
+        break;
+      case ColumnAction::kRecord:
+        RETURN_FALSE_IF(!submessage_fields.empty());
+        record_ends.push_back(num_values);
+        break;
+      case ColumnAction::kEnter:
+        submessage_fields.push_back(column_node.field);
+        break;
+      case ColumnAction::kLeave:
+        RETURN_FALSE_IF(submessage_fields.empty());
+        submessage_fields.pop_back();
+        break;
+      case ColumnAction::kVarint: {
+        char buffer[kMaxLengthVarint64()];
+        const size_t length = column_node.varint_length;
+        RETURN_FALSE_IF(!column_node.buffer->Read(buffer, length));
+        const uint8_t last_byte = static_cast<uint8_t>(buffer[length - 1]);
+        RETURN_FALSE_IF(last_byte >= 0x80);
+        RETURN_FALSE_IF(length == kMaxLengthVarint64() && last_byte > 1);
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; ++i) {
+          value |= uint64_t{static_cast<uint8_t>(buffer[i]) & 0x7fu} << (7 * i);
+        }
+        column->ints.push_back(static_cast<int64_t>(value));
+        ++num_values;
+      } break;
+      case ColumnAction::kInlineVarint:
+        column->ints.push_back(int64_t{column_node.inline_value});
+        ++num_values;
+        break;
+      case ColumnAction::kFixed32: {
+        uint32_t word;
+        RETURN_FALSE_IF(!column_node.buffer->Read(
+            reinterpret_cast<char*>(&word), sizeof(word)));
+        const uint32_t value = ReadLittleEndian32(word);
+        if (type == Column::Type::kFloat) {
+          float float_value;
+          std::memcpy(&float_value, &value, sizeof(float_value));
+          column->doubles.push_back(float_value);
+        } else {
+          column->ints.push_back(int64_t{value});
+        }
+        ++num_values;
+      } break;
+      case ColumnAction::kFixed64: {
+        uint64_t word;
+        RETURN_FALSE_IF(!column_node.buffer->Read(
+            reinterpret_cast<char*>(&word), sizeof(word)));
+        const uint64_t value = ReadLittleEndian64(word);
+        if (type == Column::Type::kDouble) {
+          double double_value;
+          std::memcpy(&double_value, &value, sizeof(double_value));
+          column->doubles.push_back(double_value);
+        } else {
+          column->ints.push_back(static_cast<int64_t>(value));
+        }
+        ++num_values;
+      } break;
+      case ColumnAction::kString: {
+        uint32_t length;
+        RETURN_FALSE_IF(!ReadVarint32(column_node.buffer, &length));
+        RETURN_FALSE_IF(!column_node.buffer->Read(&column->strings, length));
+        string_ends.push_back(column->strings.size());
+        ++num_values;
+      } break;
+      case ColumnAction::kFailure:
+        return false;
+    }
+
+    node = node->next_node;
+    if (num_iters == 0) {
+      uint8_t transition_byte;
+      if (RIEGELI_UNLIKELY(!ReadByte(transitions_reader, &transition_byte))) {
+        break;
+      }
+      node += (transition_byte >> 2);
+      num_iters = transition_byte & 3;
+      if (IsImplicit(node->callback_type)) ++num_iters;
+    } else {
+      if (!IsImplicit(node->callback_type)) --num_iters;
+    }
+  }
+  RETURN_FALSE_IF(!submessage_fields.empty());
+  RETURN_FALSE_IF(num_values != (record_ends.empty() ? 0 : record_ends.back()));
+
+  // Reverse records and values.
+  const size_t num_records = record_ends.size();
+  column->record_offsets.resize(num_records + 1);
+  for (size_t i = 0; i < num_records; ++i) {
+    column->record_offsets[i] = num_values - record_ends[num_records - 1 - i];
+  }
+  column->record_offsets[num_records] = num_values;
+  std::reverse(column->ints.begin(), column->ints.end());
+  std::reverse(column->doubles.begin(), column->doubles.end());
+  if (!string_ends.empty()) {
+    std::string strings;
+    strings.reserve(column->strings.size());
+    column->string_offsets.reserve(string_ends.size() + 1);
+    for (size_t i = string_ends.size(); i > 0; --i) {
+      const size_t begin = i == 1 ? 0 : string_ends[i - 2];
+      strings.append(column->strings, begin, string_ends[i - 1] - begin);
+      column->string_offsets.push_back(strings.size());
+    }
+    column->strings = std::move(strings);
+  }
+  return true;
+}
+
 #undef RETURN_FALSE_IF
 
 }  // namespace riegeli
@@ -18,15 +18,21 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/column.h"
 #include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
 
+class ThreadPool;
+class ZstdDictionary;
+
 class TransposeDecoder {
  public:
   TransposeDecoder();
@@ -34,6 +40,39 @@ class TransposeDecoder {
   TransposeDecoder& operator=(TransposeDecoder&&) noexcept;
   ~TransposeDecoder();
 
+  // Sets the PipelineStats which collect time spent in decompression of
+  // buckets, or nullptr to disable collecting statistics. This must be called
+  // before Initialize().
+  void set_stats(PipelineStats* stats) { stats_ = stats; }
+
+  // Sets the thread pool which decompresses buckets concurrently in
+  // Initialize(), or nullptr to decompress them sequentially in the calling
+  // thread. Buckets are decompressed while the state machine is being parsed.
+  // This is used only if filtering is disabled; with filtering buckets are
+  // decompressed on demand. This must be called before Initialize().
+  //
+  // Initialize() also decompresses buckets itself while waiting for the thread
+  // pool, so it may be called from a worker thread of the same thread pool.
+  void set_thread_pool(ThreadPool* thread_pool) { thread_pool_ = thread_pool; }
+
+  // Sets the dictionary for data compressed with
+  // internal::CompressionType::kZstdWithDictionary, or nullptr if there is
+  // none. This must be called before Initialize().
+  void set_zstd_dictionary(std::shared_ptr<const ZstdDictionary> dictionary) {
+    zstd_dictionary_ = std::move(dictionary);
+  }
+
+  // Sets the maximum decompressed size of the header or a bucket which is
+  // decompressed at once to a single buffer, without copying through the
+  // buffer of a decompressing Reader. Larger data, or data whose decompressed
+  // size is implausible for their compressed size, are decompressed with a
+  // Reader. This must be called before Initialize().
+  //
+  // Default: 16M
+  void set_max_flat_size(uint64_t max_flat_size) {
+    max_flat_size_ = max_flat_size;
+  }
+
   // Initialize using "reader" (this should be the byte-by-byte output of an
   // earlier call to TransposeEncoder::Encode()).
   bool Initialize(Reader* reader,
@@ -50,6 +89,21 @@ class TransposeDecoder {
   // TODO: Merge Initialize() and Decode() into a single call.
   bool Decode(BackwardWriter* writer, std::vector<size_t>* boundaries);
 
+  // Decodes values of a single field to *column (replacing its contents)
+  // without reconstructing the messages. Only buckets with values of the field
+  // are decompressed.
+  //
+  // This fails not only for invalid data, but also when the field is stored in
+  // a way which DecodeColumn() does not support: when its wire type does not
+  // match the column type (e.g. a packed repeated field), or when it is a
+  // string which has been transposed because it looked like a proto message.
+  // The caller should then fall back to Decode().
+  //
+  // Precondition: Initialize() was called with a FieldFilter containing only
+  // field, and Decode() was not called.
+  bool DecodeColumn(const FieldFilter::Field& field, Column::Type type,
+                    Column* column);
+
  private:
   class Context;
 
@@ -58,6 +112,12 @@ class TransposeDecoder {
   // filters are initially decompressed.
   bool ParseBuffers(Reader* header_reader, Reader* reader);
 
+  // Implementation of ParseBuffers() which starts decompressing buckets on
+  // "thread_pool_" and leaves "context_->buffers" to be filled by
+  // Context::AwaitParallelBuckets().
+  bool ParseBuffersInParallel(Reader* header_reader, Reader* reader,
+                              uint32_t num_buffers, uint32_t num_buckets);
+
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->data_buckets". When filtering is enabled, buckets are
   // decompressed on demand. "bucket_indices" contains bucket index for each
@@ -69,6 +129,10 @@ class TransposeDecoder {
   // Decode context containing decode information preprocessed by one of the
   // "Initialize" calls.
   std::unique_ptr<Context> context_;
+  PipelineStats* stats_ = nullptr;
+  ThreadPool* thread_pool_ = nullptr;
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+  uint64_t max_flat_size_ = uint64_t{16} << 20;
 };
 
 }  // namespace riegeli
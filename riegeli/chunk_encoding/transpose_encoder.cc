@@ -17,16 +17,22 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <string>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/flat_hash_map.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
@@ -34,14 +40,16 @@
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/chain_writer.h"
-#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_writer.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/writer_utils.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
@@ -113,6 +121,7 @@ TransposeEncoder::EncodedTagInfo::EncodedTagInfo(EncodedTag tag)
 TransposeEncoder::BufferWithMetadata::BufferWithMetadata(
     internal::MessageId message_id, uint32_t field)
     : buffer(riegeli::make_unique<Chain>()),
+      writer(buffer.get()),
       message_id(message_id),
       field(field) {}
 
@@ -126,6 +135,7 @@ void TransposeEncoder::Reset() {
   encoded_tag_pos_.clear();
   for (auto& buffers : data_) buffers.clear();
   group_stack_.clear();
+  submessages_.clear();
   message_nodes_.clear();
   nonproto_lengths_->Clear();
   nonproto_lengths_writer_ = ChainBackwardWriter(nonproto_lengths_.get());
@@ -137,9 +147,40 @@ static_assert(std::is_move_constructible<TransposeEncoder>::value,
 
 namespace {
 
-// Returns true if "message" is a valid protocol buffer message in the canonical
-// encoding. The purpose of this method is to distinguish string from a
-// submessage in the proto wire format and to perform validity checks that are
+// Reads a varint from [*cursor, limit), like ReadVarint32(const char**) and
+// ReadVarint64(const char**) but without requiring the maximum varint length to
+// be available.
+template <typename T, size_t kMaxLength, bool (*ReadVarint)(const char**, T*)>
+bool ReadVarintInRange(const char** cursor, const char* limit, T* data) {
+  const size_t available = PtrDistance(*cursor, limit);
+  if (RIEGELI_LIKELY(available >= kMaxLength)) return ReadVarint(cursor, data);
+  // A zero byte after the available data terminates the varint with an overlong
+  // representation, or is not reached.
+  char buffer[kMaxLength] = {};
+  std::memcpy(buffer, *cursor, available);
+  const char* buffer_cursor = buffer;
+  RETURN_FALSE_IF(!ReadVarint(&buffer_cursor, data));
+  const size_t length = PtrDistance(buffer, buffer_cursor);
+  RETURN_FALSE_IF(length > available);
+  *cursor += length;
+  return true;
+}
+
+bool ReadVarint32InRange(const char** cursor, const char* limit,
+                         uint32_t* data) {
+  return ReadVarintInRange<uint32_t, kMaxLengthVarint32(), ReadVarint32>(
+      cursor, limit, data);
+}
+
+bool ReadVarint64InRange(const char** cursor, const char* limit,
+                         uint64_t* data) {
+  return ReadVarintInRange<uint64_t, kMaxLengthVarint64(), ReadVarint64>(
+      cursor, limit, data);
+}
+
+// Returns true if [cursor, limit) is a valid protocol buffer message in the
+// canonical encoding. The purpose of this method is to distinguish string from
+// a submessage in the proto wire format and to perform validity checks that are
 // asserted later (such as that double proto field is followed by at least 8
 // bytes of data).
 // Note: Protocol buffer with suboptimal varint encoded tags and values (such as
@@ -147,29 +188,51 @@ namespace {
 // parser. This can happen for binary strings in proto. However, we need to
 // produce exactly the same bytes in the output so we reject message encoded
 // in non-canonical way.
-bool IsProtoMessage(Reader* message) {
+//
+// Length-delimited fields are validated recursively in the same pass, so that
+// each byte is parsed once instead of once per nesting level. For each
+// non-empty length-delimited field which is not nested too deeply, in the order
+// of their occurrence, whether it is a submessage is appended to
+// "submessages"; decisions about fields of a value which turns out to not be a
+// submessage are rolled back. "depth" is the recursion depth.
+bool IsProtoMessage(const char* cursor, const char* limit, int depth,
+                    std::vector<bool>* submessages) {
   // We validate that all started proto groups are closed with endgroup tag.
   std::vector<uint32_t> started_groups;
-  while (message->Pull()) {
+  while (cursor != limit) {
     uint32_t tag;
-    RETURN_FALSE_IF(!ReadVarint32(message, &tag));
+    RETURN_FALSE_IF(!ReadVarint32InRange(&cursor, limit, &tag));
     const uint32_t field = tag >> 3;
     RETURN_FALSE_IF(field == 0);
     switch (static_cast<internal::WireType>(tag & 7)) {
       case internal::WireType::kVarint: {
         uint64_t value;
-        RETURN_FALSE_IF(!ReadVarint64(message, &value));
+        RETURN_FALSE_IF(!ReadVarint64InRange(&cursor, limit, &value));
       } break;
       case internal::WireType::kFixed32:
-        RETURN_FALSE_IF(!message->Skip(sizeof(uint32_t)));
+        RETURN_FALSE_IF(PtrDistance(cursor, limit) < sizeof(uint32_t));
+        cursor += sizeof(uint32_t);
         break;
       case internal::WireType::kFixed64:
-        RETURN_FALSE_IF(!message->Skip(sizeof(uint64_t)));
+        RETURN_FALSE_IF(PtrDistance(cursor, limit) < sizeof(uint64_t));
+        cursor += sizeof(uint64_t);
         break;
       case internal::WireType::kLengthDelimited: {
         uint32_t length;
-        RETURN_FALSE_IF(!ReadVarint32(message, &length));
-        RETURN_FALSE_IF(!message->Skip(length));
+        RETURN_FALSE_IF(!ReadVarint32InRange(&cursor, limit, &length));
+        RETURN_FALSE_IF(PtrDistance(cursor, limit) < length);
+        const int value_depth = depth + IntCast<int>(started_groups.size());
+        if (value_depth < kMaxRecursionDepth && length != 0) {
+          const size_t submessage_index = submessages->size();
+          submessages->push_back(false);
+          if (IsProtoMessage(cursor, cursor + length, value_depth + 1,
+                             submessages)) {
+            (*submessages)[submessage_index] = true;
+          } else {
+            submessages->resize(submessage_index + 1);
+          }
+        }
+        cursor += length;
       } break;
       case internal::WireType::kStartGroup:
         started_groups.push_back(field);
@@ -183,7 +246,7 @@ bool IsProtoMessage(Reader* message) {
         return false;
     }
   }
-  return message->healthy() && started_groups.empty();
+  return started_groups.empty();
 }
 
 }  // namespace
@@ -226,15 +289,23 @@ void TransposeEncoder::AddMessageInternal(Reader* message) {
   RIEGELI_ASSERT_EQ(message->pos(), 0u);
   Position size;
   if (!message->Size(&size)) RIEGELI_ASSERT_UNREACHABLE();
-  const bool is_proto = IsProtoMessage(message);
-  if (!message->Seek(0)) RIEGELI_ASSERT_UNREACHABLE();
+  string_view data;
+  std::string scratch;
+  if (!ReadAll(message, &data, &scratch)) RIEGELI_ASSERT_UNREACHABLE();
+  submessages_.clear();
+  const bool is_proto =
+      IsProtoMessage(data.data(), data.data() + data.size(), 0, &submessages_);
   if (is_proto) {
     encoded_tags_.push_back(GetPosInTagsList(EncodedTag(
         internal::MessageId::kStartOfMessage, 0, internal::Subtype::kTrivial)));
-    AddMessageInternal(message, internal::MessageId::kRoot, 0);
+    next_submessage_ = 0;
+    AddMessageInternal(data, internal::MessageId::kRoot, 0);
+    RIEGELI_ASSERT_EQ(next_submessage_, submessages_.size())
+        << "Not all submessages were transposed";
   } else {
     encoded_tags_.push_back(GetPosInTagsList(EncodedTag(
         internal::MessageId::kNonProto, 0, internal::Subtype::kTrivial)));
+    if (!message->Seek(0)) RIEGELI_ASSERT_UNREACHABLE();
     if (!message->CopyTo(
             GetBuffer(internal::MessageId::kNonProto, 0, BufferType::kNonProto),
             IntCast<size_t>(size))) {
@@ -246,58 +317,70 @@ void TransposeEncoder::AddMessageInternal(Reader* message) {
 
 ChainBackwardWriter* TransposeEncoder::GetBuffer(
     internal::MessageId parent_message_id, uint32_t field, BufferType type) {
-  auto insert_result = message_nodes_.emplace(NodeId(parent_message_id, field),
-                                              MessageNode(next_message_id_));
+  auto insert_result = message_nodes_.try_emplace(
+      NodeId(parent_message_id, field), next_message_id_);
   if (insert_result.second) {
     // New node was added.
     ++next_message_id_;
   }
   MessageNode& node = insert_result.first->second;
-  if (node.writer == nullptr) {
+  if (node.buffer_type == BufferType::kNumBufferTypes) {
     auto& data = data_[static_cast<uint32_t>(type)];
+    node.buffer_type = type;
+    node.buffer_index = IntCast<uint32_t>(data.size());
     data.emplace_back(parent_message_id, field);
-    node.writer =
-        riegeli::make_unique<ChainBackwardWriter>(data.back().buffer.get());
   }
-  return node.writer.get();
+  return &data_[static_cast<uint32_t>(node.buffer_type)][node.buffer_index]
+              .writer;
 }
 
 uint32_t TransposeEncoder::GetPosInTagsList(EncodedTag etag) {
-  const auto insert_result = encoded_tag_pos_.emplace(etag, tags_list_.size());
+  const auto insert_result =
+      encoded_tag_pos_.try_emplace(etag, IntCast<uint32_t>(tags_list_.size()));
   if (insert_result.second) {
     tags_list_.emplace_back(etag);
   }
   return insert_result.first->second;
 }
 
-// Precondition: IsProtoMessage returns true for this message.
+// Precondition: IsProtoMessage returns true for this message, and
+// "submessages_" starting from "next_submessage_" tell which length-delimited
+// fields of this message and its submessages are submessages.
 // Note: EncodedTags are appended into "encoded_tags_" but data is prepended
 // into respective buffers. "encoded_tags_" will be reversed later in
 // WriteToBuffer call.
-void TransposeEncoder::AddMessageInternal(Reader* message,
+void TransposeEncoder::AddMessageInternal(string_view message,
                                           internal::MessageId parent_message_id,
                                           int depth) {
-  while (message->Pull()) {
+  const char* cursor = message.data();
+  const char* const limit = message.data() + message.size();
+  while (cursor != limit) {
     uint32_t tag;
-    if (!ReadVarint32(message, &tag)) RIEGELI_ASSERT_UNREACHABLE();
+    if (!ReadVarint32InRange(&cursor, limit, &tag)) {
+      RIEGELI_ASSERT_UNREACHABLE();
+    }
     const uint32_t field = tag >> 3;
     switch (static_cast<internal::WireType>(tag & 7)) {
       case internal::WireType::kVarint: {
-        char value[kMaxLengthVarint64()];
-        char* const value_end = CopyVarint64(message, value);
-        if (value_end == nullptr) RIEGELI_ASSERT_UNREACHABLE();
-        const size_t value_length = PtrDistance(value, value_end);
+        const char* const value_begin = cursor;
+        uint64_t unused_value;
+        if (!ReadVarint64InRange(&cursor, limit, &unused_value)) {
+          RIEGELI_ASSERT_UNREACHABLE();
+        }
+        const size_t value_length = PtrDistance(value_begin, cursor);
         RIEGELI_ASSERT_GT(value_length, 0u);
-        if (static_cast<uint8_t>(value[0]) <= kMaxVarintInline) {
-          encoded_tags_.push_back(
-              GetPosInTagsList(EncodedTag(parent_message_id, tag,
-                                          internal::Subtype::kVarintInline0 +
-                                              static_cast<uint8_t>(value[0]))));
+        if (static_cast<uint8_t>(value_begin[0]) <= kMaxVarintInline) {
+          encoded_tags_.push_back(GetPosInTagsList(
+              EncodedTag(parent_message_id, tag,
+                         internal::Subtype::kVarintInline0 +
+                             static_cast<uint8_t>(value_begin[0]))));
         } else {
           encoded_tags_.push_back(GetPosInTagsList(
               EncodedTag(parent_message_id, tag,
                          internal::Subtype::kVarint1 +
                              IntCast<uint8_t>(value_length - 1))));
+          char value[kMaxLengthVarint64()];
+          std::memcpy(value, value_begin, value_length);
           // TODO: Consider processing the whole sizeof(value) instead.
           for (size_t i = 0; i < value_length - 1; ++i) value[i] &= ~0x80;
           GetBuffer(parent_message_id, field, BufferType::kVarint)
@@ -307,64 +390,56 @@ void TransposeEncoder::AddMessageInternal(Reader* message,
       case internal::WireType::kFixed32:
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
-        if (!message->CopyTo(
-                GetBuffer(parent_message_id, field, BufferType::kFixed32),
-                sizeof(uint32_t))) {
-          RIEGELI_ASSERT_UNREACHABLE();
-        }
+        GetBuffer(parent_message_id, field, BufferType::kFixed32)
+            ->Write(string_view(cursor, sizeof(uint32_t)));
+        cursor += sizeof(uint32_t);
         break;
       case internal::WireType::kFixed64:
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
-        if (!message->CopyTo(
-                GetBuffer(parent_message_id, field, BufferType::kFixed64),
-                sizeof(uint64_t))) {
-          RIEGELI_ASSERT_UNREACHABLE();
-        }
+        GetBuffer(parent_message_id, field, BufferType::kFixed64)
+            ->Write(string_view(cursor, sizeof(uint64_t)));
+        cursor += sizeof(uint64_t);
         break;
       case internal::WireType::kLengthDelimited: {
+        const char* const length_begin = cursor;
         uint32_t length;
-        const Position length_pos = message->pos();
-        if (!ReadVarint32(message, &length)) RIEGELI_ASSERT_UNREACHABLE();
-        const Position value_pos = message->pos();
-        LimitingReader value(message, value_pos + length);
+        if (!ReadVarint32InRange(&cursor, limit, &length)) {
+          RIEGELI_ASSERT_UNREACHABLE();
+        }
         // Non-toplevel empty strings are treated as strings, not messages.
         // They have a simpler encoding this way (one node instead of two).
         if (depth < kMaxRecursionDepth && length != 0 &&
-            IsProtoMessage(&value)) {
+            submessages_[next_submessage_++]) {
           encoded_tags_.push_back(GetPosInTagsList(EncodedTag(
               parent_message_id, tag,
               internal::Subtype::kLengthDelimitedStartOfSubmessage)));
-          auto insert_result = message_nodes_.emplace(
-              NodeId(parent_message_id, field), MessageNode(next_message_id_));
+          auto insert_result = message_nodes_.try_emplace(
+              NodeId(parent_message_id, field), next_message_id_);
           if (insert_result.second) {
             // New node was added.
             ++next_message_id_;
           }
-          if (!value.Seek(value_pos)) RIEGELI_ASSERT_UNREACHABLE();
-          AddMessageInternal(&value, insert_result.first->second.message_id,
-                             depth + 1);
+          AddMessageInternal(string_view(cursor, length),
+                             insert_result.first->second.message_id, depth + 1);
           encoded_tags_.push_back(GetPosInTagsList(
               EncodedTag(parent_message_id, tag,
                          internal::Subtype::kLengthDelimitedEndOfSubmessage)));
-          if (!value.Close()) RIEGELI_ASSERT_UNREACHABLE();
         } else {
           encoded_tags_.push_back(GetPosInTagsList(
               EncodedTag(parent_message_id, tag,
                          internal::Subtype::kLengthDelimitedString)));
-          if (!message->Seek(length_pos)) RIEGELI_ASSERT_UNREACHABLE();
-          if (!message->CopyTo(
-                  GetBuffer(parent_message_id, field, BufferType::kString),
-                  IntCast<size_t>(value_pos - length_pos) + length)) {
-            RIEGELI_ASSERT_UNREACHABLE();
-          }
+          GetBuffer(parent_message_id, field, BufferType::kString)
+              ->Write(string_view(length_begin,
+                                  PtrDistance(length_begin, cursor) + length));
         }
+        cursor += length;
       } break;
       case internal::WireType::kStartGroup: {
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
-        auto insert_result = message_nodes_.emplace(
-            NodeId(parent_message_id, field), MessageNode(next_message_id_));
+        auto insert_result = message_nodes_.try_emplace(
+            NodeId(parent_message_id, field), next_message_id_);
         if (insert_result.second) {
           // New node was added.
           ++next_message_id_;
@@ -384,7 +459,6 @@ void TransposeEncoder::AddMessageInternal(Reader* message,
         RIEGELI_ASSERT_UNREACHABLE() << "Bug in IsProtoMessage()?";
     }
   }
-  RIEGELI_ASSERT(message->healthy());
 }
 
 struct TransposeEncoder::BufferWithMetadataSizeComparator {
@@ -401,53 +475,74 @@ struct TransposeEncoder::BufferWithMetadataSizeComparator {
   }
 };
 
+namespace {
+
+// Compresses input with CompressingWriter and appends it to dest, preceded by
+// its decompressed size, and if prepend_compressed_size is true, by the size of
+// the rest.
+template <typename CompressingWriter>
+void AppendCompressed(bool prepend_compressed_size, const Chain& input,
+                      typename CompressingWriter::Options options,
+                      PipelineStats::Timer* timer, Writer* dest) {
+  Chain compressed;
+  ChainWriter compressed_writer(&compressed);
+  CompressingWriter compressor(&compressed_writer, std::move(options));
+  compressor.Write(input);
+  // TODO: Expose compressor failures by TransposeEncoder.
+  if (!compressor.Close()) RIEGELI_ASSERT_UNREACHABLE();
+  if (!compressed_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+  if (prepend_compressed_size) {
+    WriteVarint64(dest, LengthVarint64(input.size()) + compressed.size());
+  }
+  WriteVarint64(dest, input.size());
+  timer->set_bytes(input.size(), compressed.size());
+  dest->Write(std::move(compressed));
+}
+
+}  // namespace
+
 // TODO: Consider reducing indirections (writing directly to the
 // compressor, and/or letting the compressor write directly to dest if
 // prepend_compressed_size is false).
 void TransposeEncoder::AppendCompressedBuffer(bool prepend_compressed_size,
                                               const Chain& input,
                                               Writer* dest) const {
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kCompress);
   switch (compression_type_) {
     case internal::CompressionType::kNone:
       if (prepend_compressed_size) WriteVarint64(dest, input.size());
       dest->Write(input);
+      timer.set_bytes(input.size(), input.size());
       return;
-    case internal::CompressionType::kBrotli: {
-      Chain compressed;
-      ChainWriter compressed_writer(&compressed);
-      BrotliWriter compressor(&compressed_writer,
-                              BrotliWriter::Options()
-                                  .set_compression_level(compression_level_)
-                                  .set_size_hint(input.size()));
-      compressor.Write(input);
-      // TODO: Expose compressor failures by TransposeEncoder.
-      if (!compressor.Close()) RIEGELI_ASSERT_UNREACHABLE();
-      if (!compressed_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
-      if (prepend_compressed_size) {
-        WriteVarint64(dest, LengthVarint64(input.size()) + compressed.size());
-      }
-      WriteVarint64(dest, input.size());
-      dest->Write(std::move(compressed));
+    case internal::CompressionType::kBrotli:
+      AppendCompressed<BrotliWriter>(
+          prepend_compressed_size, input,
+          BrotliWriter::Options()
+              .set_compression_level(compression_level_)
+              .set_size_hint(input.size()),
+          &timer, dest);
       return;
-    }
-    case internal::CompressionType::kZstd: {
-      Chain compressed;
-      ChainWriter compressed_writer(&compressed);
-      ZstdWriter compressor(&compressed_writer,
-                            ZstdWriter::Options()
-                                .set_compression_level(compression_level_)
-                                .set_size_hint(input.size()));
-      compressor.Write(input);
-      // TODO: Expose compressor failures by TransposeEncoder.
-      if (!compressor.Close()) RIEGELI_ASSERT_UNREACHABLE();
-      if (!compressed_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
-      if (prepend_compressed_size) {
-        WriteVarint64(dest, LengthVarint64(input.size()) + compressed.size());
-      }
-      WriteVarint64(dest, input.size());
-      dest->Write(std::move(compressed));
+    case internal::CompressionType::kZstd:
+    case internal::CompressionType::kZstdWithDictionary:
+      AppendCompressed<ZstdWriter>(
+          prepend_compressed_size, input,
+          ZstdWriter::Options()
+              .set_compression_level(compression_level_)
+              .set_size_hint(input.size())
+              .set_dictionary(zstd_dictionary_),
+          &timer, dest);
+      return;
+    case internal::CompressionType::kLz4:
+      AppendCompressed<Lz4Writer>(
+          prepend_compressed_size, input,
+          Lz4Writer::Options().set_compression_level(compression_level_),
+          &timer, dest);
+      return;
+    case internal::CompressionType::kSnappy:
+      AppendCompressed<SnappyWriter>(
+          prepend_compressed_size, input,
+          SnappyWriter::Options().set_size_hint(input.size()), &timer, dest);
       return;
-    }
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown compression type: " << static_cast<int>(compression_type_);
@@ -457,6 +552,7 @@ void TransposeEncoder::AddBuffer(bool force_new_bucket, const Chain& next_chunk,
                                  Chain* bucket_buffer,
                                  ChainWriter* bucket_writer,
                                  ChainWriter* data_writer,
+                                 std::vector<Chain>* buckets,
                                  std::vector<size_t>* bucket_lengths,
                                  std::vector<size_t>* buffer_lengths) {
   buffer_lengths->push_back(next_chunk.size());
@@ -466,19 +562,100 @@ void TransposeEncoder::AddBuffer(bool force_new_bucket, const Chain& next_chunk,
        IntCast<size_t>(bucket_writer->pos()) + next_chunk.size() >
            desired_bucket_size_)) {
     if (!bucket_writer->Close()) RIEGELI_ASSERT_UNREACHABLE();
-    const Position pos_before = data_writer->pos();
-    AppendCompressedBuffer(/*prepend_compressed_size=*/false, *bucket_buffer,
-                           data_writer);
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before);
-    bucket_lengths->push_back(IntCast<size_t>(data_writer->pos() - pos_before));
-    bucket_buffer->Clear();
+    CloseBucket(bucket_buffer, data_writer, buckets, bucket_lengths);
     *bucket_writer = ChainWriter(bucket_buffer);
   }
   bucket_writer->Write(next_chunk);
 }
 
-std::unordered_map<TransposeEncoder::NodeId, uint32_t,
-                   TransposeEncoder::NodeIdHasher>
+void TransposeEncoder::CloseBucket(Chain* bucket_buffer,
+                                   ChainWriter* data_writer,
+                                   std::vector<Chain>* buckets,
+                                   std::vector<size_t>* bucket_lengths) const {
+  if (thread_pool_ != nullptr) {
+    buckets->push_back(std::move(*bucket_buffer));
+    bucket_buffer->Clear();
+    return;
+  }
+  const Position pos_before = data_writer->pos();
+  AppendCompressedBuffer(/*prepend_compressed_size=*/false, *bucket_buffer,
+                         data_writer);
+  RIEGELI_ASSERT_GE(data_writer->pos(), pos_before);
+  bucket_lengths->push_back(IntCast<size_t>(data_writer->pos() - pos_before));
+  bucket_buffer->Clear();
+}
+
+namespace {
+
+// State of compressing buckets concurrently, shared by the thread calling
+// TransposeEncoder::WriteBuckets() and tasks scheduled on the thread pool,
+// which may start after WriteBuckets() returns.
+struct BucketCompression {
+  explicit BucketCompression(std::vector<Chain>&& buckets)
+      : buckets(std::move(buckets)), compressed(this->buckets.size()) {}
+
+  std::vector<Chain> buckets;
+  std::vector<Chain> compressed;
+  // Index of the next bucket to compress.
+  std::atomic<size_t> next_bucket{0};
+  // Number of buckets compressed so far.
+  std::atomic<size_t> num_compressed{0};
+  internal::EventCount compressed_all;
+};
+
+}  // namespace
+
+void TransposeEncoder::WriteBuckets(std::vector<Chain>* buckets,
+                                    ChainWriter* data_writer,
+                                    std::vector<size_t>* bucket_lengths) const {
+  if (thread_pool_ == nullptr || buckets->size() < 2) {
+    for (const Chain& bucket : *buckets) {
+      const Position pos_before = data_writer->pos();
+      AppendCompressedBuffer(/*prepend_compressed_size=*/false, bucket,
+                             data_writer);
+      RIEGELI_ASSERT_GE(data_writer->pos(), pos_before);
+      bucket_lengths->push_back(
+          IntCast<size_t>(data_writer->pos() - pos_before));
+    }
+    return;
+  }
+  const size_t num_buckets = buckets->size();
+  const std::shared_ptr<BucketCompression> state =
+      std::make_shared<BucketCompression>(std::move(*buckets));
+  const TransposeEncoder* const encoder = this;
+  // Each bucket is claimed by exactly one thread. Tasks which start after all
+  // buckets are claimed return immediately without touching "encoder", which
+  // may be gone by then.
+  const std::function<void()> compress = [state, encoder, num_buckets] {
+    for (;;) {
+      const size_t index = state->next_bucket.fetch_add(1);
+      if (index >= num_buckets) return;
+      ChainWriter compressed_writer(&state->compressed[index]);
+      encoder->AppendCompressedBuffer(/*prepend_compressed_size=*/false,
+                                      state->buckets[index],
+                                      &compressed_writer);
+      if (!compressed_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+      if (state->num_compressed.fetch_add(1) + 1 == num_buckets) {
+        state->compressed_all.NotifyAll();
+      }
+    }
+  };
+  const size_t num_tasks =
+      UnsignedMin(num_buckets - 1, thread_pool_->max_threads());
+  for (size_t i = 0; i < num_tasks; ++i) thread_pool_->Schedule(compress);
+  // Compress buckets in this thread too, so that progress does not depend on
+  // the thread pool having idle threads.
+  compress();
+  state->compressed_all.Wait(
+      [&] { return state->num_compressed.load() == num_buckets; });
+  for (Chain& compressed : state->compressed) {
+    bucket_lengths->push_back(compressed.size());
+    data_writer->Write(std::move(compressed));
+  }
+}
+
+internal::FlatHashMap<TransposeEncoder::NodeId, uint32_t,
+                      TransposeEncoder::NodeIdHasher>
 TransposeEncoder::WriteBuffers(ChainWriter* header_writer,
                                ChainWriter* data_writer) {
   size_t num_buffers = 0;
@@ -496,32 +673,58 @@ TransposeEncoder::WriteBuffers(ChainWriter* header_writer,
 
   Chain bucket_buffer;
   ChainWriter bucket_writer(&bucket_buffer);
-  std::unordered_map<NodeId, uint32_t, NodeIdHasher> buffer_pos;
+  // Uncompressed buckets if "thread_pool_" is set, compressed by
+  // WriteBuckets() at the end. Otherwise buckets are compressed as they are
+  // closed, and only "bucket_lengths" grows.
+  std::vector<Chain> buckets;
+  internal::FlatHashMap<NodeId, uint32_t, NodeIdHasher> buffer_pos;
+  buffer_pos.reserve(num_buffers);
   // Write all buffer lengths to the header and data to "bucket_buffer".
   for (size_t i = 0; i < kNumBufferTypes; ++i) {
+    // The index of the current bucket, which is not closed yet, is the number
+    // of closed buckets.
+    size_t first_bucket = buckets.size() + bucket_lengths.size();
     for (size_t j = 0; j < data_[i].size(); ++j) {
       const auto& x = data_[i][j];
       AddBuffer(j == 0, *x.buffer, &bucket_buffer, &bucket_writer, data_writer,
-                &bucket_lengths, &buffer_lengths);
+                &buckets, &bucket_lengths, &buffer_lengths);
+      if (j == 0) first_bucket = buckets.size() + bucket_lengths.size();
       const uint32_t pos = IntCast<uint32_t>(buffer_pos.size());
       buffer_pos[NodeId(x.message_id, x.field)] = pos;
     }
+    static_assert(PipelineStats::kNumBufferTypes == kNumBufferTypes,
+                  "PipelineStats::BufferType does not match "
+                  "TransposeEncoder::BufferType");
+    if (stats_ != nullptr && !data_[i].empty()) {
+      uint64_t bytes = 0;
+      for (const auto& x : data_[i]) bytes += x.buffer->size();
+      stats_->AddBuffers(static_cast<PipelineStats::BufferType>(i),
+                         buckets.size() + bucket_lengths.size() + 1 -
+                             first_bucket,
+                         data_[i].size(), bytes);
+    }
   }
   if (!nonproto_lengths_->empty()) {
     // nonproto_lengths_ is the last buffer if non-empty.
     AddBuffer(/*force_new_bucket=*/true, *nonproto_lengths_, &bucket_buffer,
-              &bucket_writer, data_writer, &bucket_lengths, &buffer_lengths);
+              &bucket_writer, data_writer, &buckets, &bucket_lengths,
+              &buffer_lengths);
     // Note: nonproto_lengths_ needs no buffer_pos.
+    if (stats_ != nullptr) {
+      // Without compression there is a single bucket, already counted.
+      stats_->AddBuffers(
+          PipelineStats::BufferType::kNonProto,
+          compression_type_ != internal::CompressionType::kNone ? 1 : 0, 1,
+          nonproto_lengths_->size());
+    }
   }
 
   if (bucket_writer.pos() > 0) {
     // Last bucket.
     if (!bucket_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
-    const Position pos_before = data_writer->pos();
-    AppendCompressedBuffer(/*prepend_compressed_size=*/false, bucket_buffer,
-                           data_writer);
-    bucket_lengths.push_back(IntCast<size_t>(data_writer->pos() - pos_before));
+    CloseBucket(&bucket_buffer, data_writer, &buckets, &bucket_lengths);
   }
+  WriteBuckets(&buckets, data_writer, &bucket_lengths);
 
   RIEGELI_ASSERT_EQ(num_buffers, buffer_lengths.size());
   WriteVarint64(header_writer, num_buffers);
@@ -550,7 +753,7 @@ void TransposeEncoder::WriteStatesAndData(
     dest_info[first_key + 1];
     RIEGELI_ASSERT_NE(tags_list_[encoded_tags_[0]].dest_info.size(), 1u);
   }
-  const std::unordered_map<NodeId, uint32_t, NodeIdHasher> buffer_pos =
+  const internal::FlatHashMap<NodeId, uint32_t, NodeIdHasher> buffer_pos =
       WriteBuffers(header_writer, data_writer);
 
   std::string subtype_to_write;
@@ -1177,9 +1380,9 @@ std::vector<TransposeEncoder::StateInfo> TransposeEncoder::CreateStateMachine(
 bool TransposeEncoder::EncodeInternal(uint32_t max_transition,
                                       uint32_t min_count_for_state,
                                       Writer* writer) {
-  for (const auto& entry : message_nodes_) {
-    if (entry.second.writer != nullptr && !entry.second.writer->Close()) {
-      RIEGELI_ASSERT_UNREACHABLE();
+  for (auto& buffers : data_) {
+    for (auto& x : buffers) {
+      if (!x.writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
     }
   }
   if (!nonproto_lengths_writer_.Close()) RIEGELI_ASSERT_UNREACHABLE();
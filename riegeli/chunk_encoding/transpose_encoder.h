@@ -19,15 +19,17 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "riegeli/base/chain.h"
+#include "riegeli/base/flat_hash_map.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 // The layout of the format looks is as follows (values are varint encoded
@@ -58,19 +60,21 @@ namespace riegeli {
 
 class ChainWriter;
 class Reader;
+class ThreadPool;
 
 class TransposeEncoder {
  public:
   TransposeEncoder();
-  // Not noexcept because unordered_map::unordered_map(unordered_map&&) is not
-  // noexcept, and unordered_map::operator=(unordered_map&&) is noexcept since
-  // C++17.
-  //
-  // Also, vector::vector(vector&&) and vector::operator=(vector&&) are noexcept
-  // since C++17.
+  // Not noexcept because vector::vector(vector&&) and
+  // vector::operator=(vector&&) are noexcept since C++17.
   TransposeEncoder(TransposeEncoder&&) = default;
   TransposeEncoder& operator=(TransposeEncoder&&) = default;
 
+  void DisableCompression() {
+    compression_type_ = internal::CompressionType::kNone;
+    compression_level_ = 0;
+  }
+
   void EnableBrotliCompression(int level) {
     compression_type_ = internal::CompressionType::kBrotli;
     compression_level_ = level;
@@ -79,6 +83,30 @@ class TransposeEncoder {
   void EnableZstdCompression(int level) {
     compression_type_ = internal::CompressionType::kZstd;
     compression_level_ = level;
+    zstd_dictionary_.reset();
+  }
+
+  // Like EnableZstdCompression(level), but compresses with a dictionary which
+  // must be available to the decoder as well.
+  void EnableZstdCompression(int level,
+                             std::shared_ptr<const ZstdDictionary> dictionary) {
+    RIEGELI_ASSERT(dictionary != nullptr)
+        << "Failed precondition of TransposeEncoder::EnableZstdCompression(): "
+           "null dictionary";
+    compression_type_ = internal::CompressionType::kZstdWithDictionary;
+    compression_level_ = level;
+    zstd_dictionary_ = std::move(dictionary);
+  }
+
+  // Level must be between 0 and 12; levels from 3 select LZ4-HC.
+  void EnableLz4Compression(int level) {
+    compression_type_ = internal::CompressionType::kLz4;
+    compression_level_ = level;
+  }
+
+  void EnableSnappyCompression() {
+    compression_type_ = internal::CompressionType::kSnappy;
+    compression_level_ = 0;
   }
 
   // Set the compression bucket size hint. Lower values help filtering
@@ -87,8 +115,23 @@ class TransposeEncoder {
     desired_bucket_size_ = desired_bucket_size;
   }
 
+  // Sets the PipelineStats which collect time spent in compression and counts
+  // of buffers and buckets, or nullptr to disable collecting statistics.
+  void set_stats(PipelineStats* stats) { stats_ = stats; }
+
+  // Sets the thread pool which compresses buckets concurrently in Encode(), or
+  // nullptr to compress them sequentially in the calling thread. The output is
+  // the same either way. The thread pool must be kept alive while Encode() is
+  // called.
+  //
+  // Encode() also compresses buckets itself while waiting for the thread pool,
+  // so it may be called from a worker thread of the same thread pool.
+  void set_thread_pool(ThreadPool* thread_pool) { thread_pool_ = thread_pool; }
+
   // Resets the object, to reuse it for the next batch of messages.
-  // Compression and bucketing settings are kept unchanged.
+  // Compression and bucketing settings are kept unchanged. Allocated capacity
+  // of internal tables is kept, so that encoding similar batches repeatedly
+  // does not allocate them again.
   void Reset();
 
   // "message" should be a protocol message in binary format. Transpose works
@@ -143,8 +186,11 @@ class TransposeEncoder {
   struct MessageNode {
     explicit MessageNode(internal::MessageId message_id);
     // Some nodes (such as STARTGROUP) contain no data. Buffer is assigned in
-    // the first GetBuffer call when we have data to write.
-    std::unique_ptr<ChainBackwardWriter> writer;
+    // the first GetBuffer call when we have data to write, as the element
+    // "data_[buffer_type][buffer_index]". BufferType::kNumBufferTypes if no
+    // buffer is assigned yet.
+    BufferType buffer_type = BufferType::kNumBufferTypes;
+    uint32_t buffer_index = 0;
     // Unique ID for every instance of this class within Encoder.
     internal::MessageId message_id;
   };
@@ -175,13 +221,13 @@ class TransposeEncoder {
   // Precondition: "message" is a valid proto message, i.e. IsProtoMessage on
   // this message returns true.
   // "depth" is the recursion depth.
-  void AddMessageInternal(Reader* message,
+  void AddMessageInternal(string_view message,
                           internal::MessageId parent_message_id, int depth);
 
   // Write all data buffers in "data_" to "data_buffer" (possibly compressed)
   // and buffer lengths into "header_buffer".
   // Return map with the sequential position of each buffer written.
-  std::unordered_map<NodeId, uint32_t, NodeIdHasher> WriteBuffers(
+  internal::FlatHashMap<NodeId, uint32_t, NodeIdHasher> WriteBuffers(
       ChainWriter* header_writer, ChainWriter* data_writer);
 
   // One state of the state machine created in encoder.
@@ -203,12 +249,28 @@ class TransposeEncoder {
 
   // Add "next_chunk" to "bucket_buffer". If compression is enabled and either
   // the current bucket would become too large or "force_new_bucket" is true,
-  // flush the bucket to "data_buffer" first and create a new bucket.
+  // close the bucket with CloseBucket() first and create a new bucket.
   void AddBuffer(bool force_new_bucket, const Chain& next_chunk,
                  Chain* bucket_buffer, ChainWriter* bucket_writer,
-                 ChainWriter* data_writer, std::vector<size_t>* bucket_lengths,
+                 ChainWriter* data_writer, std::vector<Chain>* buckets,
+                 std::vector<size_t>* bucket_lengths,
                  std::vector<size_t>* buffer_lengths);
 
+  // If "thread_pool_" is set, move "bucket_buffer" to "buckets", to be
+  // compressed by WriteBuckets() together with other buckets. Otherwise
+  // compress it and append it to "data_writer" right away, so that only one
+  // uncompressed bucket is kept at a time, and append its compressed length to
+  // "bucket_lengths".
+  void CloseBucket(Chain* bucket_buffer, ChainWriter* data_writer,
+                   std::vector<Chain>* buckets,
+                   std::vector<size_t>* bucket_lengths) const;
+
+  // Compress "buckets" and append them to "data_writer" in order, using
+  // "thread_pool_" if set. Compressed lengths are appended to
+  // "bucket_lengths".
+  void WriteBuckets(std::vector<Chain>* buckets, ChainWriter* data_writer,
+                    std::vector<size_t>* bucket_lengths) const;
+
   // Compute base indices for states in "state_machine" that don't have one yet.
   // "public_list_base" is the index of the start of the public list.
   // "public_list_noops" is the list of NoOp states that don't have a base set
@@ -280,7 +342,7 @@ class TransposeEncoder {
     explicit EncodedTagInfo(EncodedTag tag);
     EncodedTag tag;
     // Maps all destinations reachable from this encoded tag to DestInfo.
-    std::unordered_map<uint32_t, DestInfo, Uint32Hasher> dest_info;
+    internal::FlatHashMap<uint32_t, DestInfo, Uint32Hasher> dest_info;
     // Number of incoming tranitions into this state.
     size_t num_incoming_transitions = 0;
     // Index of this state in the state machine.
@@ -302,6 +364,8 @@ class TransposeEncoder {
     // Buffer itself, wrapped in unique_ptr so that its address remains constant
     // when additional buffers are added.
     std::unique_ptr<Chain> buffer;
+    // Writer to "buffer", open until EncodeInternal().
+    ChainBackwardWriter writer;
     // Message ID and tag of the node in "message_nodes_" that this buffer
     // belongs to.
     internal::MessageId message_id;
@@ -317,14 +381,20 @@ class TransposeEncoder {
   // Sequence of tags on input as indices into "tags_list_".
   std::vector<uint32_t> encoded_tags_;
   // Position of encoded tag in "tags_list_".
-  std::unordered_map<EncodedTag, uint32_t, EncodedTagHasher> encoded_tag_pos_;
+  internal::FlatHashMap<EncodedTag, uint32_t, EncodedTagHasher>
+      encoded_tag_pos_;
   // Data buffers in separate vectors per buffer type.
   std::vector<BufferWithMetadata> data_[kNumBufferTypes];
   // Every group creates a new message ID. We keep track of open groups in this
   // vector.
   std::vector<internal::MessageId> group_stack_;
+  // For each non-empty length-delimited field of the message being added,
+  // whether it is a submessage, as computed by IsProtoMessage().
+  std::vector<bool> submessages_;
+  // Index of the next length-delimited field in "submessages_".
+  size_t next_submessage_ = 0;
   // Tree of message nodes.
-  std::unordered_map<NodeId, MessageNode, NodeIdHasher> message_nodes_;
+  internal::FlatHashMap<NodeId, MessageNode, NodeIdHasher> message_nodes_;
   // Lengths of non-proto messages, wrapped in unique_ptr so that its address
   // remains constant when TransposeEncoder is moved.
   std::unique_ptr<Chain> nonproto_lengths_;
@@ -334,10 +404,14 @@ class TransposeEncoder {
   internal::CompressionType compression_type_ =
       internal::CompressionType::kNone;
   int compression_level_ = 0;
+  // Used if compression_type_ is kZstdWithDictionary.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
   // The default approximate bucket size, used if compression is enabled.
   // Finer bucket granularity (i.e. smaller size) worsens compression density
   // but makes field filtering more effective.
   size_t desired_bucket_size_ = 1 << 20;  // 1MB
+  PipelineStats* stats_ = nullptr;
+  ThreadPool* thread_pool_ = nullptr;
 };
 
 }  // namespace riegeli
@@ -19,6 +19,7 @@
 
 #include "riegeli/base/base.h"
 #include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/column.h"
 
 namespace riegeli {
 namespace internal {
@@ -133,6 +134,25 @@ inline bool HasSubtype(uint32_t tag) {
   }
 }
 
+// Returns the wire type of values of a Column of the given type, not counting
+// packed repeated fields.
+inline WireType ColumnWireType(Column::Type type) {
+  switch (type) {
+    case Column::Type::kVarint:
+      return WireType::kVarint;
+    case Column::Type::kFixed32:
+    case Column::Type::kFloat:
+      return WireType::kFixed32;
+    case Column::Type::kFixed64:
+    case Column::Type::kDouble:
+      return WireType::kFixed64;
+    case Column::Type::kString:
+      return WireType::kLengthDelimited;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown column type: " << static_cast<int>(type);
+}
+
 // Murmur3 final mix variant:
 // http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
 inline uint64_t Murmur3_64(uint64_t x) {
@@ -422,6 +422,42 @@ void Benchmarks::RunAll() {
            return ReadRiegeli(filename, riegeli::RecordReader::Options(),
                               records);
          });
+  RunOne("riegeli_notrans_lz4",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableLz4Compression()
+                            .set_transpose(false),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename, riegeli::RecordReader::Options(),
+                              records);
+         });
+  RunOne("riegeli_notrans_lz4hc9",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableLz4Compression(9)
+                            .set_transpose(false),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename, riegeli::RecordReader::Options(),
+                              records);
+         });
+  RunOne("riegeli_notrans_snappy",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableSnappyCompression()
+                            .set_transpose(false),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename, riegeli::RecordReader::Options(),
+                              records);
+         });
   RunOne(
       "riegeli_trans_uncompressed",
       [&](const std::string& filename, const std::vector<std::string>& records) {
@@ -467,6 +503,46 @@ void Benchmarks::RunAll() {
       [&](const std::string& filename, std::vector<std::string>* records) {
         return ReadRiegeli(filename, riegeli::RecordReader::Options(), records);
       });
+  RunOne("riegeli_trans_zstd9_chunk8m",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableZstdCompression(9)
+                            .set_desired_chunk_size(size_t{8} << 20),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename, riegeli::RecordReader::Options(),
+                              records);
+         });
+  RunOne("riegeli_trans_zstd9_chunk8m_hugepages",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableZstdCompression(9)
+                            .set_desired_chunk_size(size_t{8} << 20),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename,
+                              riegeli::RecordReader::Options().set_huge_pages(
+                                  true),
+                              records);
+         });
+  RunOne("riegeli_trans_zstd19_adaptive100m_par10",
+         [&](const std::string& filename, const std::vector<std::string>& records) {
+           WriteRiegeli(filename,
+                        riegeli::RecordWriter::Options()
+                            .EnableZstdCompression(19)
+                            .set_parallelism(10)
+                            .set_adaptive_compression_target(100e6)
+                            .set_adaptive_compression_max_queue_fill(0.8f),
+                        records);
+         },
+         [&](const std::string& filename, std::vector<std::string>* records) {
+           return ReadRiegeli(filename, riegeli::RecordReader::Options(),
+                              records);
+         });
 }
 
 const char kUsage[] =
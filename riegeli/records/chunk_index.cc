@@ -0,0 +1,174 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "riegeli/records/chunk_index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// Follows the padding chunk type, distinguishing an index from other padding.
+constexpr char kSignature[] = "riegidx1";
+constexpr size_t kSignatureSize = sizeof(kSignature) - 1;
+
+}  // namespace
+
+RecordPosition ChunkIndex::PositionOfRecord(uint64_t record_index) const {
+  RIEGELI_ASSERT_LE(record_index, num_records_)
+      << "Failed precondition of ChunkIndex::PositionOfRecord(): "
+         "record index out of range";
+  if (record_index == num_records_) return RecordPosition(end_pos_, 0);
+  // The last chunk with first_record <= record_index. Chunks without records
+  // share first_record with the next chunk, which is the one to choose.
+  const std::vector<Entry>::const_iterator next = std::upper_bound(
+      entries_.begin(), entries_.end(), record_index,
+      [](uint64_t value, const Entry& entry) {
+        return value < entry.first_record;
+      });
+  RIEGELI_ASSERT(next != entries_.begin())
+      << "The first chunk does not begin with the first record";
+  const Entry& entry = *(next - 1);
+  return RecordPosition(entry.chunk_begin, record_index - entry.first_record);
+}
+
+bool ChunkIndex::Locate(Position pos, RecordPosition* record_pos) const {
+  if (RIEGELI_UNLIKELY(pos > end_pos_)) return false;
+  const size_t index = FindChunk(pos);
+  if (index == entries_.size()) {
+    // Before the first chunk.
+    *record_pos = RecordPosition(
+        entries_.empty() ? end_pos_ : entries_.front().chunk_begin, 0);
+    return true;
+  }
+  const Entry& entry = entries_[index];
+  const uint64_t num_records =
+      (index + 1 < entries_.size() ? entries_[index + 1].first_record
+                                   : num_records_) -
+      entry.first_record;
+  if (pos - entry.chunk_begin < num_records) {
+    *record_pos = RecordPosition(entry.chunk_begin, pos - entry.chunk_begin);
+    return true;
+  }
+  // After the last record of the chunk.
+  *record_pos = RecordPosition(index + 1 < entries_.size()
+                                   ? entries_[index + 1].chunk_begin
+                                   : end_pos_,
+                               0);
+  return true;
+}
+
+inline size_t ChunkIndex::FindChunk(Position pos) const {
+  const std::vector<Entry>::const_iterator next = std::upper_bound(
+      entries_.begin(), entries_.end(), pos,
+      [](Position value, const Entry& entry) {
+        return value < entry.chunk_begin;
+      });
+  if (next == entries_.begin()) return entries_.size();
+  return IntCast<size_t>(next - entries_.begin()) - 1;
+}
+
+void ChunkIndex::Encode(Chunk* chunk) const {
+  chunk->data.Clear();
+  ChainWriter data_writer(&chunk->data);
+  WriteByte(&data_writer, static_cast<uint8_t>(ChunkType::kPadding));
+  data_writer.Write(string_view(kSignature, kSignatureSize));
+  WriteVarint64(&data_writer, entries_.size());
+  Position previous_chunk_begin = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& entry = entries_[i];
+    const uint64_t num_records =
+        (i + 1 < entries_.size() ? entries_[i + 1].first_record
+                                 : num_records_) -
+        entry.first_record;
+    WriteVarint64(&data_writer, entry.chunk_begin - previous_chunk_begin);
+    WriteVarint64(&data_writer, num_records);
+    WriteVarint64(&data_writer, entry.decoded_data_size);
+    previous_chunk_begin = entry.chunk_begin;
+  }
+  if (!data_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+  chunk->header = ChunkHeader(chunk->data, 0, 0);
+}
+
+bool ChunkIndex::Decode(const Chunk& chunk, Position chunk_begin) {
+  if (chunk.header.num_records() != 0 ||
+      chunk.header.decoded_data_size() != 0) {
+    return false;
+  }
+  ChainReader data_reader(&chunk.data);
+  uint8_t chunk_type;
+  if (!ReadByte(&data_reader, &chunk_type) ||
+      chunk_type != static_cast<uint8_t>(ChunkType::kPadding)) {
+    return false;
+  }
+  char signature[kSignatureSize];
+  if (!data_reader.Read(signature, kSignatureSize) ||
+      std::memcmp(signature, kSignature, kSignatureSize) != 0) {
+    return false;
+  }
+  uint64_t num_chunks;
+  if (RIEGELI_UNLIKELY(!ReadVarint64(&data_reader, &num_chunks))) return false;
+  // Each entry takes at least 3 bytes, which bounds the allocation if the
+  // index is invalid.
+  if (RIEGELI_UNLIKELY(num_chunks > chunk.data.size() / 3)) return false;
+  std::vector<Entry> entries;
+  entries.reserve(IntCast<size_t>(num_chunks));
+  Position previous_chunk_begin = 0;
+  uint64_t num_records = 0;
+  for (uint64_t i = 0; i < num_chunks; ++i) {
+    uint64_t chunk_begin_delta, chunk_num_records, decoded_data_size;
+    if (RIEGELI_UNLIKELY(!ReadVarint64(&data_reader, &chunk_begin_delta) ||
+                         !ReadVarint64(&data_reader, &chunk_num_records) ||
+                         !ReadVarint64(&data_reader, &decoded_data_size))) {
+      return false;
+    }
+    if (RIEGELI_UNLIKELY(chunk_begin_delta == 0 ||
+                         chunk_begin_delta >=
+                             chunk_begin - previous_chunk_begin ||
+                         chunk_num_records >
+                             std::numeric_limits<uint64_t>::max() -
+                                 num_records)) {
+      return false;
+    }
+    previous_chunk_begin += chunk_begin_delta;
+    entries.push_back(Entry{previous_chunk_begin, num_records,
+                            decoded_data_size});
+    num_records += chunk_num_records;
+  }
+  if (RIEGELI_UNLIKELY(!data_reader.VerifyEndAndClose())) return false;
+  entries_ = std::move(entries);
+  num_records_ = num_records;
+  end_pos_ = chunk_begin;
+  return true;
+}
+
+}  // namespace internal
+}  // namespace riegeli
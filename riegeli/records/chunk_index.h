@@ -0,0 +1,121 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef RIEGELI_RECORDS_CHUNK_INDEX_H_
+#define RIEGELI_RECORDS_CHUNK_INDEX_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+namespace internal {
+
+// Index of the chunks of a Riegeli/records file, listing for each chunk its
+// position, number of preceding records, and decoded size.
+//
+// RecordWriter can write the index at the end of the file as a padding chunk
+// with a signature, so that readers which do not know about the index skip it.
+// See "Chunk index" in doc/riegeli_records_file_format.md.
+class ChunkIndex {
+ public:
+  struct Entry {
+    // Position of the beginning of the chunk.
+    Position chunk_begin;
+    // The number of records in preceding chunks.
+    uint64_t first_record;
+    uint64_t decoded_data_size;
+  };
+
+  ChunkIndex() noexcept {}
+
+  ChunkIndex(ChunkIndex&& src) noexcept;
+  ChunkIndex& operator=(ChunkIndex&& src) noexcept;
+
+  // Adds a chunk after the chunks added so far.
+  //
+  // Precondition: chunk_begin > entries().back().chunk_begin (if any)
+  void AddChunk(Position chunk_begin, uint64_t num_records,
+                uint64_t decoded_data_size);
+
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  // Returns the total number of records in the indexed chunks.
+  uint64_t num_records() const { return num_records_; }
+
+  // Returns the position after the last indexed chunk, i.e. the beginning of
+  // the index chunk. This is known only after Decode().
+  Position end_pos() const { return end_pos_; }
+
+  // Returns the position of the record with the given index, or
+  // RecordPosition(end_pos(), 0) if record_index == num_records().
+  //
+  // Precondition: record_index <= num_records()
+  RecordPosition PositionOfRecord(uint64_t record_index) const;
+
+  // Converts a numeric position between 0 and end_pos() to the position of
+  // the record which RecordReader::Seek(Position) should go to: the record at
+  // that position, or the next one if it points between records.
+  //
+  // Returns false if pos > end_pos().
+  bool Locate(Position pos, RecordPosition* record_pos) const;
+
+  // Encodes the index as a chunk, which should be written after the indexed
+  // chunks.
+  void Encode(Chunk* chunk) const;
+
+  // Decodes the index from a chunk which begins at chunk_begin.
+  //
+  // Returns false if the chunk is not a valid index of the preceding chunks.
+  bool Decode(const Chunk& chunk, Position chunk_begin);
+
+ private:
+  // Returns the index in entries_ of the last chunk which begins at or before
+  // pos, or entries_.size() if none.
+  size_t FindChunk(Position pos) const;
+
+  std::vector<Entry> entries_;
+  uint64_t num_records_ = 0;
+  Position end_pos_ = 0;
+};
+
+// Implementation details follow.
+
+inline ChunkIndex::ChunkIndex(ChunkIndex&& src) noexcept
+    : entries_(riegeli::exchange(src.entries_, std::vector<Entry>())),
+      num_records_(riegeli::exchange(src.num_records_, 0)),
+      end_pos_(riegeli::exchange(src.end_pos_, 0)) {}
+
+inline ChunkIndex& ChunkIndex::operator=(ChunkIndex&& src) noexcept {
+  entries_ = riegeli::exchange(src.entries_, std::vector<Entry>());
+  num_records_ = riegeli::exchange(src.num_records_, 0);
+  end_pos_ = riegeli::exchange(src.end_pos_, 0);
+  return *this;
+}
+
+inline void ChunkIndex::AddChunk(Position chunk_begin, uint64_t num_records,
+                                 uint64_t decoded_data_size) {
+  RIEGELI_ASSERT(entries_.empty() || chunk_begin > entries_.back().chunk_begin)
+      << "Failed precondition of ChunkIndex::AddChunk(): "
+         "chunks not in the order of positions";
+  entries_.push_back(Entry{chunk_begin, num_records_, decoded_data_size});
+  num_records_ += num_records;
+}
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CHUNK_INDEX_H_
@@ -15,6 +15,7 @@
 #include "riegeli/records/chunk_reader.h"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <memory>
 #include <new>
 #include <utility>
@@ -24,6 +25,7 @@
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
 #include "riegeli/records/block.h"
 
 namespace riegeli {
@@ -48,6 +50,7 @@ ChunkReader::ChunkReader(Reader* byte_reader, Options options)
     : Object(State::kOpen),
       byte_reader_(RIEGELI_ASSERT_NOTNULL(byte_reader)),
       skip_corruption_(options.skip_corruption_),
+      stats_(options.stats_),
       pos_(byte_reader_->pos()),
       is_recovering_(internal::IsBlockBoundary(pos_)) {
   if (is_recovering_) {
@@ -83,6 +86,7 @@ void ChunkReader::Done() {
   }
   byte_reader_ = nullptr;
   skip_corruption_ = false;
+  stats_ = nullptr;
   pos_ = 0;
   is_truncated_ = false;
 }
@@ -126,6 +130,8 @@ again:
 
 bool ChunkReader::ReadChunk(Chunk* chunk, Position* chunk_begin) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kReadChunk);
+  const Position pos_before = pos_;
   if (is_recovering_ && !Recover()) return false;
 again:
   RIEGELI_ASSERT(!is_recovering_)
@@ -136,6 +142,11 @@ again:
       if (is_recovering_ && Recover()) goto again;
       return false;
     }
+    // Let the source fetch the rest of the chunk, together with the header of
+    // the next chunk which might be preceded by a block header.
+    byte_reader_->ReadHint(internal::ChunkEnd(reading_.chunk.header, pos_) +
+                           ChunkHeader::size() + internal::BlockHeader::size() -
+                           byte_reader_->pos());
   }
 
   while (reading_.chunk.data.size() < reading_.chunk.header.data_size()) {
@@ -155,8 +166,13 @@ again:
   const Position chunk_end = internal::ChunkEnd(reading_.chunk.header, pos_);
   if (RIEGELI_UNLIKELY(!byte_reader_->Seek(chunk_end))) return ReadingFailed();
 
-  if (RIEGELI_UNLIKELY(internal::Hash(reading_.chunk.data) !=
-                       reading_.chunk.header.data_hash())) {
+  uint64_t data_hash;
+  {
+    PipelineStats::Timer hash_timer(stats_, PipelineStats::Stage::kHash);
+    hash_timer.set_bytes(reading_.chunk.data.size(), 0);
+    data_hash = internal::Hash(reading_.chunk.data);
+  }
+  if (RIEGELI_UNLIKELY(data_hash != reading_.chunk.header.data_hash())) {
     pos_ = chunk_end;
     is_truncated_ = false;
     // Reading, not Recovering, because only chunk data were corrupted; chunk
@@ -172,6 +188,7 @@ again:
   pos_ = chunk_end;
   is_truncated_ = false;
   PrepareForReading();
+  timer.set_bytes(pos_ - pos_before, chunk->data.size());
   return true;
 }
 
@@ -345,14 +362,30 @@ bool ChunkReader::Seek(Position new_pos) {
 }
 
 bool ChunkReader::SeekToChunkContaining(Position new_pos) {
-  return SeekToChunk(new_pos, true);
+  return SeekToChunk(new_pos, SeekMode::kContaining);
 }
 
 bool ChunkReader::SeekToChunkAfter(Position new_pos) {
-  return SeekToChunk(new_pos, false);
+  return SeekToChunk(new_pos, SeekMode::kAfter);
+}
+
+bool ChunkReader::SeekToChunkBefore(Position new_pos) {
+  return SeekToChunk(new_pos, SeekMode::kBefore);
 }
 
-inline bool ChunkReader::SeekToChunk(Position new_pos, bool containing) {
+inline bool ChunkReader::ChunkMatches(Position new_pos, SeekMode mode) const {
+  switch (mode) {
+    case SeekMode::kContaining:
+      return pos_ + reading_.chunk.header.num_records() > new_pos;
+    case SeekMode::kAfter:
+      return false;
+    case SeekMode::kBefore:
+      return internal::ChunkEnd(reading_.chunk.header, pos_) > new_pos;
+  }
+  RIEGELI_ASSERT_UNREACHABLE() << "Unknown seek mode";
+}
+
+inline bool ChunkReader::SeekToChunk(Position new_pos, SeekMode mode) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
   Position block_begin = new_pos;
   if (new_pos % internal::kBlockSize() != 0) {
@@ -384,9 +417,7 @@ inline bool ChunkReader::SeekToChunk(Position new_pos, bool containing) {
       // The current chunk ends too early. Skip to block_begin.
       goto read_block_header;
     }
-    if (containing && pos_ + reading_.chunk.header.num_records() > new_pos) {
-      return true;
-    }
+    if (ChunkMatches(new_pos, mode)) return true;
     chunk_begin = chunk_end;
   } else {
   read_block_header:
@@ -414,7 +445,7 @@ inline bool ChunkReader::SeekToChunk(Position new_pos, bool containing) {
       goto check_current_chunk;
     }
     chunk_begin = block_begin + block_header_.next_chunk();
-    if (containing && chunk_begin > new_pos) {
+    if (mode != SeekMode::kAfter && chunk_begin > new_pos) {
       // new_pos is inside the chunk which contains this block boundary, so
       // start the search from this chunk instead of the next chunk.
       if (RIEGELI_UNLIKELY(block_header_.previous_chunk() > block_begin)) {
@@ -439,9 +470,7 @@ inline bool ChunkReader::SeekToChunk(Position new_pos, bool containing) {
     if (RIEGELI_UNLIKELY(!ReadChunkHeader())) {
       return is_recovering_ && Recover();
     }
-    if (containing && pos_ + reading_.chunk.header.num_records() > new_pos) {
-      return true;
-    }
+    if (ChunkMatches(new_pos, mode)) return true;
     chunk_begin = internal::ChunkEnd(reading_.chunk.header, pos_);
   }
 }
@@ -27,6 +27,8 @@
 
 namespace riegeli {
 
+class PipelineStats;
+
 // A ChunkReader reads chunks of a Riegeli/records file (rather than individual
 // records, as RecordReader does).
 //
@@ -55,10 +57,26 @@ class ChunkReader final : public Object {
       return std::move(set_skip_corruption(skip_corruption));
     }
 
+    // Sets the PipelineStats which collect statistics of reading chunks and
+    // verifying their hashes. It must be kept alive until closing the
+    // ChunkReader.
+    //
+    // nullptr disables collecting statistics.
+    //
+    // Default: nullptr
+    Options& set_stats(PipelineStats* stats) & {
+      stats_ = stats;
+      return *this;
+    }
+    Options&& set_stats(PipelineStats* stats) && {
+      return std::move(set_stats(stats));
+    }
+
    private:
     friend class ChunkReader;
 
     bool skip_corruption_ = false;
+    PipelineStats* stats_ = nullptr;
   };
 
   // Will read chunks from the byte Reader which is owned by this ChunkReader
@@ -143,6 +161,22 @@ class ChunkReader final : public Object {
   //  * false (when !healthy()) - failure
   bool SeekToChunkAfter(Position new_pos);
 
+  // Seeks to the nearest chunk boundary before or at the given position, i.e.
+  // to the beginning of the chunk which occupies the given position, or to
+  // the given position if it is at the end of the file.
+  //
+  // In contrast to SeekToChunkContaining(), this does not depend on the number
+  // of records in the chunk. E.g. SeekToChunkBefore(size - 1) locates the last
+  // chunk of a file of the given size.
+  //
+  // Return values:
+  //  * true                    - success (position is set to pos)
+  //  * false (when healthy())  - source ends before new_pos (position is set to
+  //                              the end) or seeking backwards is not supported
+  //                              (position is unchanged)
+  //  * false (when !healthy()) - failure
+  bool SeekToChunkBefore(Position new_pos);
+
   // Returns the size of the file, i.e. the position corresponding to its end.
   //
   // Return values:
@@ -204,14 +238,25 @@ class ChunkReader final : public Object {
   // to support random access.
   bool Recover();
 
-  // Shared implementation of SeekToChunkContaining() (containing = true) and
-  // SeekToChunkAfter() (containing = false).
-  bool SeekToChunk(Position new_pos, bool containing);
+  enum class SeekMode {
+    kContaining,  // SeekToChunkContaining()
+    kAfter,       // SeekToChunkAfter()
+    kBefore,      // SeekToChunkBefore()
+  };
+
+  // Shared implementation of SeekToChunkContaining(), SeekToChunkAfter(), and
+  // SeekToChunkBefore().
+  bool SeekToChunk(Position new_pos, SeekMode mode);
+
+  // Returns true if SeekToChunk() with the given mode should stop at the chunk
+  // whose header has been read, beginning at pos_, for the given new_pos.
+  bool ChunkMatches(Position new_pos, SeekMode mode) const;
 
   std::unique_ptr<Reader> owned_byte_reader_;
   // Invariant: if healthy() then byte_reader_ != nullptr
   Reader* byte_reader_;
   bool skip_corruption_;
+  PipelineStats* stats_;
 
   // Current position, excluding data buffered in reading_ or implied by
   // recovering_.
@@ -0,0 +1,148 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/column_reader.h"
+
+#include <memory>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/column.h"
+#include "riegeli/chunk_encoding/column_decoder.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/zstd_dictionary_chunk.h"
+
+namespace riegeli {
+
+ColumnReader::ColumnReader() noexcept : Object(State::kClosed) {}
+
+ColumnReader::ColumnReader(std::unique_ptr<Reader> byte_reader,
+                           FieldFilter::Field field, Column::Type type,
+                           Options options)
+    : ColumnReader(riegeli::make_unique<ChunkReader>(
+                       std::move(byte_reader),
+                       ChunkReader::Options().set_skip_corruption(
+                           options.skip_corruption_)),
+                   std::move(field), type, std::move(options)) {}
+
+ColumnReader::ColumnReader(Reader* byte_reader, FieldFilter::Field field,
+                           Column::Type type, Options options)
+    : ColumnReader(riegeli::make_unique<ChunkReader>(
+                       byte_reader, ChunkReader::Options().set_skip_corruption(
+                                        options.skip_corruption_)),
+                   std::move(field), type, std::move(options)) {}
+
+inline ColumnReader::ColumnReader(std::unique_ptr<ChunkReader> chunk_reader,
+                                  FieldFilter::Field field, Column::Type type,
+                                  Options options)
+    : Object(State::kOpen),
+      chunk_reader_(std::move(chunk_reader)),
+      skip_corruption_(options.skip_corruption_),
+      column_decoder_(
+          riegeli::make_unique<ColumnDecoder>(std::move(field), type)) {}
+
+ColumnReader::ColumnReader(ColumnReader&& src) noexcept
+    : Object(std::move(src)),
+      chunk_reader_(std::move(src.chunk_reader_)),
+      skip_corruption_(riegeli::exchange(src.skip_corruption_, false)),
+      column_decoder_(std::move(src.column_decoder_)),
+      zstd_dictionary_searched_(
+          riegeli::exchange(src.zstd_dictionary_searched_, false)) {}
+
+ColumnReader& ColumnReader::operator=(ColumnReader&& src) noexcept {
+  Object::operator=(std::move(src));
+  chunk_reader_ = std::move(src.chunk_reader_);
+  skip_corruption_ = riegeli::exchange(src.skip_corruption_, false);
+  column_decoder_ = std::move(src.column_decoder_);
+  zstd_dictionary_searched_ =
+      riegeli::exchange(src.zstd_dictionary_searched_, false);
+  return *this;
+}
+
+ColumnReader::~ColumnReader() = default;
+
+void ColumnReader::Done() {
+  if (RIEGELI_LIKELY(healthy())) {
+    if (RIEGELI_UNLIKELY(!chunk_reader_->Close())) {
+      Fail(*chunk_reader_);
+    }
+  }
+  chunk_reader_.reset();
+  skip_corruption_ = false;
+  column_decoder_.reset();
+  zstd_dictionary_searched_ = false;
+}
+
+bool ColumnReader::ReadColumn(Column* column, RecordPosition* key) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  for (;;) {
+    Chunk chunk;
+    Position chunk_begin;
+    if (RIEGELI_UNLIKELY(!chunk_reader_->ReadChunk(&chunk, &chunk_begin))) {
+      if (chunk_reader_->healthy()) return false;
+      return Fail(*chunk_reader_);
+    }
+    if (chunk_begin == 0) {
+      // Verify file signature.
+      if (RIEGELI_UNLIKELY(chunk.header.data_size() != 0 ||
+                           chunk.header.num_records() != 0 ||
+                           chunk.header.decoded_data_size() != 0)) {
+        return Fail("Invalid Riegeli/records file: missing file signature");
+      }
+      continue;
+    }
+    std::shared_ptr<const ZstdDictionary> dictionary;
+    if (internal::DecodeZstdDictionaryChunk(chunk, &dictionary)) {
+      zstd_dictionary_searched_ = true;
+      column_decoder_->set_zstd_dictionary(std::move(dictionary));
+      continue;
+    }
+    // Padding chunks, including the chunk index, have no records.
+    if (chunk.header.num_records() == 0) continue;
+    if (!zstd_dictionary_searched_ && internal::UsesZstdDictionary(chunk)) {
+      // The dictionary chunk has been skipped by seeking. Reading it moves
+      // chunk_reader_, which is restored afterwards.
+      zstd_dictionary_searched_ = true;
+      if (internal::ReadZstdDictionary(chunk_reader_.get(), &dictionary)) {
+        column_decoder_->set_zstd_dictionary(std::move(dictionary));
+      } else if (RIEGELI_UNLIKELY(!chunk_reader_->healthy())) {
+        return Fail(*chunk_reader_);
+      }
+    }
+    if (RIEGELI_UNLIKELY(!column_decoder_->Decode(chunk, column))) {
+      if (skip_corruption_) continue;
+      return Fail(*column_decoder_);
+    }
+    if (key != nullptr) *key = RecordPosition(chunk_begin, 0);
+    return true;
+  }
+}
+
+bool ColumnReader::Seek(Position new_pos) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (RIEGELI_UNLIKELY(!chunk_reader_->SeekToChunkAfter(new_pos))) {
+    if (chunk_reader_->healthy()) return false;
+    return Fail(*chunk_reader_);
+  }
+  return true;
+}
+
+}  // namespace riegeli
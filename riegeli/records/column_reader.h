@@ -0,0 +1,186 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_COLUMN_READER_H_
+#define RIEGELI_RECORDS_COLUMN_READER_H_
+
+#include <memory>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/column.h"
+#include "riegeli/chunk_encoding/column_decoder.h"
+#include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+// ColumnReader reads values of a single field of the records of a
+// Riegeli/records file, one chunk at a time, into a Column of typed arrays.
+//
+// For records written as transposed chunks (with
+// RecordWriter::Options().set_transpose(true)), values are decoded directly
+// from the buckets which store them, without reconstructing the records and
+// without decompressing the buckets of other fields. This makes scanning a few
+// fields of records with many fields much faster than RecordReader, even with
+// a FieldFilter.
+//
+// For reading values sequentially, this kind of loop can be used:
+//
+//   ColumnReader column_reader(std::move(byte_reader), {3, 1},
+//                              Column::Type::kVarint);
+//   Column column;
+//   RecordPosition key;
+//   while (column_reader.ReadColumn(&column, &key)) {
+//     for (size_t i = 0; i < column.num_records(); ++i) {
+//       ... Process values column.ints[column.record_offsets[i]] to
+//       ... column.ints[column.record_offsets[i + 1]] of the record at
+//       ... RecordPosition(key.chunk_begin(), i).
+//     }
+//   }
+//   if (!column_reader.Close()) {
+//     ... Failed with reason: column_reader.Message()
+//   }
+class ColumnReader final : public Object {
+ public:
+  class Options {
+   public:
+    // Not defaulted because of a C++ defect:
+    // https://stackoverflow.com/questions/17430377
+    constexpr Options() noexcept {}
+
+    // If true, corrupted regions will be skipped. if false, corrupted regions
+    // will cause reading to fail.
+    //
+    // Default: false
+    Options& set_skip_corruption(bool skip_corruption) & {
+      skip_corruption_ = skip_corruption;
+      return *this;
+    }
+    Options&& set_skip_corruption(bool skip_corruption) && {
+      return std::move(set_skip_corruption(skip_corruption));
+    }
+
+   private:
+    friend class ColumnReader;
+
+    bool skip_corruption_ = false;
+  };
+
+  // Creates a closed ColumnReader.
+  ColumnReader() noexcept;
+
+  // Will read values of field, which is a path of field numbers like in
+  // FieldFilter, represented as specified by type.
+  //
+  // The byte Reader is owned by this ColumnReader and will be closed and
+  // deleted when the ColumnReader is closed.
+  //
+  // Precondition: !field.empty()
+  ColumnReader(std::unique_ptr<Reader> byte_reader, FieldFilter::Field field,
+               Column::Type type, Options options = Options());
+
+  // Will read values of field, which is a path of field numbers like in
+  // FieldFilter, represented as specified by type.
+  //
+  // The byte Reader is not owned by this ColumnReader and must be kept alive
+  // but not accessed until closing the ColumnReader.
+  //
+  // Precondition: !field.empty()
+  ColumnReader(Reader* byte_reader, FieldFilter::Field field, Column::Type type,
+               Options options = Options());
+
+  ColumnReader(ColumnReader&& src) noexcept;
+  ColumnReader& operator=(ColumnReader&& src) noexcept;
+
+  ~ColumnReader();
+
+  // Reads values of the field from the records of the next chunk which has
+  // records, replacing the contents of *column. Values of record i of *column
+  // belong to the record at RecordPosition(key->chunk_begin(), i).
+  //
+  // If key != nullptr, *key is set to the position of the first record of the
+  // chunk on success.
+  //
+  // Return values:
+  //  * true                    - success (*column is set)
+  //  * false (when healthy())  - source ends
+  //  * false (when !healthy()) - failure
+  bool ReadColumn(Column* column, RecordPosition* key = nullptr);
+
+  // Returns true if reading from the current position might succeed, possibly
+  // after some data is appended to the source. Returns false if reading from
+  // the current position will always return false.
+  bool HopeForMore() const;
+
+  // Returns the current position, which is a chunk boundary.
+  Position pos() const;
+
+  // Seeks to the nearest chunk boundary at or after new_pos, so that a file
+  // can be split into shards by byte ranges: a shard [begin, end) consists of
+  // chunks read after Seek(begin) while key.chunk_begin() < end.
+  //
+  // Return values:
+  //  * true                    - success
+  //  * false (when healthy())  - source ends before new_pos (position is set to
+  //                              the end) or seeking backwards is not supported
+  //                              (position is unchanged)
+  //  * false (when !healthy()) - failure
+  bool Seek(Position new_pos);
+
+  // Returns the size of the file, i.e. the position corresponding to its end.
+  //
+  // Return values:
+  //  * true  - success (*size is set, healthy())
+  //  * false - failure (healthy() is unchanged)
+  bool Size(Position* size) const;
+
+ protected:
+  void Done() override;
+
+ private:
+  ColumnReader(std::unique_ptr<ChunkReader> chunk_reader,
+               FieldFilter::Field field, Column::Type type, Options options);
+
+  // Invariant: if healthy() then chunk_reader_ != nullptr
+  std::unique_ptr<ChunkReader> chunk_reader_;
+  bool skip_corruption_ = false;
+  // Invariant: if healthy() then column_decoder_ != nullptr
+  std::unique_ptr<ColumnDecoder> column_decoder_;
+  // True if the Zstd dictionary of the file has been read or looked for.
+  bool zstd_dictionary_searched_ = false;
+};
+
+// Implementation details follow.
+
+inline bool ColumnReader::HopeForMore() const {
+  return healthy() && chunk_reader_->HopeForMore();
+}
+
+inline Position ColumnReader::pos() const {
+  if (RIEGELI_UNLIKELY(chunk_reader_ == nullptr)) return 0;
+  return chunk_reader_->pos();
+}
+
+inline bool ColumnReader::Size(Position* size) const {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  return chunk_reader_->Size(size);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_COLUMN_READER_H_
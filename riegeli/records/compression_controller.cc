@@ -0,0 +1,158 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/compression_controller.h"
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "riegeli/base/base.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// The number of chunks measured at a compression before lowering it, so that a
+// single slow chunk does not lower it.
+constexpr int kChunksBeforeLower = 2;
+
+// Initial and maximum number of chunks measured at a compression before
+// raising it.
+constexpr int kMinChunksBeforeRaise = 8;
+constexpr int kMaxChunksBeforeRaise = 512;
+
+// Weight of the newest measurement in the moving average of throughput.
+constexpr double kThroughputWeight = 0.25;
+
+// Throughput must exceed the target by this factor to raise the level, because
+// a higher level is slower.
+constexpr double kRaiseHeadroom = 1.5;
+
+int MinLevel(CompressionType compression_type, int max_level) {
+  switch (compression_type) {
+    case CompressionType::kBrotli:
+    case CompressionType::kLz4:
+      return 0;
+    case CompressionType::kZstd:
+    case CompressionType::kZstdWithDictionary:
+      return 1;
+    default:
+      // Levels are not applicable.
+      return max_level;
+  }
+}
+
+}  // namespace
+
+CompressionController::CompressionController(CompressionType compression_type,
+                                             int max_level,
+                                             double target_throughput,
+                                             float max_queue_fill,
+                                             bool fallback_to_lz4)
+    : compression_type_(compression_type),
+      min_level_(std::min(MinLevel(compression_type, max_level), max_level)),
+      max_level_(max_level),
+      target_throughput_(target_throughput),
+      max_queue_fill_(max_queue_fill),
+      fallback_to_lz4_(fallback_to_lz4 &&
+                       compression_type != CompressionType::kNone &&
+                       compression_type != CompressionType::kLz4),
+      level_(max_level),
+      chunks_before_raise_(kMinChunksBeforeRaise) {
+  RIEGELI_ASSERT_GE(target_throughput, 0.0)
+      << "Failed precondition of "
+         "CompressionController::CompressionController(): "
+         "negative target throughput";
+  RIEGELI_ASSERT_GE(max_queue_fill, 0.0f)
+      << "Failed precondition of "
+         "CompressionController::CompressionController(): "
+         "negative queue fill";
+}
+
+void CompressionController::ReportChunk(CompressionType compression_type,
+                                        int compression_level,
+                                        uint64_t decoded_data_size,
+                                        uint64_t encode_nanos,
+                                        float queue_fill) {
+  if (compression_type != this->compression_type() ||
+      compression_level != this->compression_level()) {
+    return;
+  }
+  const double throughput = static_cast<double>(decoded_data_size) * 1e9 /
+                            static_cast<double>(std::max(encode_nanos,
+                                                         uint64_t{1}));
+  throughput_ = num_chunks_ == 0 ? throughput
+                                 : throughput_ + kThroughputWeight *
+                                                     (throughput - throughput_);
+  ++num_chunks_;
+  const bool too_slow = target_throughput_ > 0.0 &&
+                        throughput_ < target_throughput_;
+  const bool queue_too_full = queue_fill > max_queue_fill_;
+  if (too_slow || queue_too_full) {
+    if (num_chunks_ >= kChunksBeforeLower || queue_too_full) Lower();
+    return;
+  }
+  const bool fast_enough =
+      target_throughput_ <= 0.0 ||
+      throughput_ >= target_throughput_ * kRaiseHeadroom;
+  const bool queue_short =
+      max_queue_fill_ >= 1.0f || queue_fill <= max_queue_fill_ * 0.5f;
+  if (fast_enough && queue_short && num_chunks_ >= chunks_before_raise_) {
+    Raise();
+  }
+}
+
+inline void CompressionController::Lower() {
+  if (fallback_) return;
+  if (level_ > min_level_) {
+    // Lower by half of the remaining range, so that a level far too high is
+    // left quickly.
+    level_ -= std::max((level_ - min_level_) / 2, 1);
+  } else if (fallback_to_lz4_) {
+    fallback_ = true;
+  } else {
+    return;
+  }
+  if (last_change_was_raise_) {
+    // The last raise did not hold: wait longer before raising again.
+    chunks_before_raise_ =
+        std::min(chunks_before_raise_ * 2, kMaxChunksBeforeRaise);
+  }
+  last_change_was_raise_ = false;
+  StartMeasuring();
+}
+
+inline void CompressionController::Raise() {
+  if (fallback_) {
+    fallback_ = false;
+  } else if (level_ < max_level_) {
+    ++level_;
+  } else {
+    return;
+  }
+  // The previous raise held: the load permits raising sooner again.
+  if (last_change_was_raise_) chunks_before_raise_ = kMinChunksBeforeRaise;
+  last_change_was_raise_ = true;
+  StartMeasuring();
+}
+
+inline void CompressionController::StartMeasuring() {
+  num_chunks_ = 0;
+  throughput_ = 0.0;
+}
+
+}  // namespace internal
+}  // namespace riegeli
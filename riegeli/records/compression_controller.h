@@ -0,0 +1,102 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_COMPRESSION_CONTROLLER_H_
+#define RIEGELI_RECORDS_COMPRESSION_CONTROLLER_H_
+
+#include <stdint.h>
+
+#include "riegeli/chunk_encoding/internal_types.h"
+
+namespace riegeli {
+namespace internal {
+
+// Chooses the compression of each chunk written by RecordWriter, so that
+// encoding keeps up with the rate at which records arrive.
+//
+// The configured compression level is the highest level used. The level is
+// lowered quickly when chunks are encoded more slowly than the target
+// throughput, or when too many chunks wait for encoding, and is raised back one
+// step at a time when there is enough headroom. Raising again right after a
+// raise had to be reverted is delayed exponentially, to avoid oscillating.
+//
+// Decoders are not affected: each chunk records its compression type, and the
+// level is not needed for decompression.
+//
+// CompressionController is not thread-safe.
+class CompressionController {
+ public:
+  // target_throughput is in bytes of decoded data per second per encoding
+  // thread, or 0 to ignore throughput.
+  //
+  // max_queue_fill is the fraction of parallel encoding slots which may be
+  // busy, or 1 to ignore the queue.
+  //
+  // If fallback_to_lz4 is true, LZ4 is used when even the lowest level of
+  // compression_type is too slow.
+  CompressionController(CompressionType compression_type, int max_level,
+                        double target_throughput, float max_queue_fill,
+                        bool fallback_to_lz4);
+
+  CompressionController(const CompressionController&) = delete;
+  CompressionController& operator=(const CompressionController&) = delete;
+
+  // Returns the compression to use for the next chunk.
+  CompressionType compression_type() const {
+    return fallback_ ? CompressionType::kLz4 : compression_type_;
+  }
+  int compression_level() const { return fallback_ ? 0 : level_; }
+
+  // Reports that a chunk with decoded_data_size bytes compressed with the given
+  // compression was encoded in encode_nanos, while queue_fill (between 0 and 1)
+  // of parallel encoding slots were busy.
+  //
+  // Reports about a compression other than the current one are ignored: they
+  // come from chunks encoded before the last change.
+  void ReportChunk(CompressionType compression_type, int compression_level,
+                   uint64_t decoded_data_size, uint64_t encode_nanos,
+                   float queue_fill);
+
+ private:
+  void Lower();
+  void Raise();
+  // Forgets measurements after changing the compression.
+  void StartMeasuring();
+
+  CompressionType compression_type_;
+  int min_level_;
+  int max_level_;
+  double target_throughput_;
+  float max_queue_fill_;
+  bool fallback_to_lz4_;
+
+  int level_;
+  // If true, LZ4 is used instead of compression_type_ at min_level_.
+  bool fallback_ = false;
+  // True if the last change of the compression was a raise.
+  bool last_change_was_raise_ = false;
+  // The number of chunks to observe at the current compression before raising
+  // it.
+  int chunks_before_raise_;
+  // The number of chunks observed at the current compression.
+  int num_chunks_ = 0;
+  // Moving average of encoding throughput at the current compression, in bytes
+  // per second, valid if num_chunks_ > 0.
+  double throughput_ = 0.0;
+};
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_COMPRESSION_CONTROLLER_H_
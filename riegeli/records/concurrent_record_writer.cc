@@ -0,0 +1,378 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/concurrent_record_writer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/zstd_dictionary_chunk.h"
+
+namespace riegeli {
+
+namespace {
+
+// Source of ConcurrentRecordWriter::id_. 0 is never used, so that it never
+// matches an empty cache.
+std::atomic<uint64_t> next_writer_id{1};
+
+}  // namespace
+
+struct ConcurrentRecordWriter::Producer {
+  explicit Producer(std::thread::id thread_id) : thread_id(thread_id) {}
+
+  const std::thread::id thread_id;
+  // Guards the members below. It is taken by the thread filling the chunk for
+  // each record, and by other threads only in Flush() and Close().
+  std::mutex mutex;
+  // The encoder of the open chunk, created lazily.
+  std::unique_ptr<ChunkEncoder> chunk_encoder;
+  // The size of records in the open chunk, as counted by RecordWriter.
+  size_t chunk_size = 0;
+};
+
+thread_local uint64_t ConcurrentRecordWriter::cached_writer_id_ = 0;
+thread_local ConcurrentRecordWriter::Producer*
+    ConcurrentRecordWriter::cached_producer_ = nullptr;
+
+ConcurrentRecordWriter::ConcurrentRecordWriter(
+    std::unique_ptr<Writer> byte_writer, Options options)
+    : ConcurrentRecordWriter(
+          riegeli::make_unique<DefaultChunkWriter>(std::move(byte_writer)),
+          std::move(options)) {}
+
+ConcurrentRecordWriter::ConcurrentRecordWriter(Writer* byte_writer,
+                                               Options options)
+    : ConcurrentRecordWriter(
+          riegeli::make_unique<DefaultChunkWriter>(byte_writer),
+          std::move(options)) {}
+
+ConcurrentRecordWriter::ConcurrentRecordWriter(
+    std::unique_ptr<ChunkWriter> chunk_writer, Options options)
+    : ConcurrentRecordWriter(chunk_writer.get(), std::move(options)) {
+  owned_chunk_writer_ = std::move(chunk_writer);
+}
+
+ConcurrentRecordWriter::ConcurrentRecordWriter(ChunkWriter* chunk_writer,
+                                               Options options)
+    : Object(State::kOpen),
+      id_(next_writer_id.fetch_add(1, std::memory_order_relaxed)),
+      options_(std::move(options)),
+      chunk_writer_(RIEGELI_ASSERT_NOTNULL(chunk_writer)) {
+  options_.zstd_dictionary_training_records_ = 0;
+  options_.adaptive_compression_target_ = 0.0;
+  options_.adaptive_compression_max_queue_fill_ = 1.0f;
+  if (options_.parallelism_ > 0) {
+    thread_pool_ = options_.thread_pool_ != nullptr
+                       ? options_.thread_pool_
+                       : &internal::DefaultThreadPool();
+  }
+  const bool writing_from_beginning = chunk_writer_->pos() == 0;
+  if (writing_from_beginning) {
+    // Write file signature.
+    Chunk signature;
+    signature.header = ChunkHeader(signature.data, 0, 0);
+    if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(signature))) {
+      RIEGELI_ASSERT(!chunk_writer_->healthy());
+      Fail(*chunk_writer_);
+      return;
+    }
+  }
+  // A dictionary can be stored only at the beginning of the file.
+  if (options_.compression_type_ == internal::CompressionType::kZstd &&
+      options_.zstd_dictionary_ != nullptr && writing_from_beginning) {
+    Chunk chunk;
+    internal::EncodeZstdDictionaryChunk(*options_.zstd_dictionary_, &chunk);
+    if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(chunk))) {
+      RIEGELI_ASSERT(!chunk_writer_->healthy());
+      Fail(*chunk_writer_);
+      return;
+    }
+    options_.compression_type_ =
+        internal::CompressionType::kZstdWithDictionary;
+  } else {
+    options_.zstd_dictionary_.reset();
+  }
+  if (options_.index_ && writing_from_beginning) {
+    chunk_index_ = riegeli::make_unique<internal::ChunkIndex>();
+  }
+}
+
+ConcurrentRecordWriter::~ConcurrentRecordWriter() {
+  if (RIEGELI_UNLIKELY(!closed())) {
+    // Ask background encoding to skip writing.
+    Fail("Cancelled");
+    Done();
+  }
+}
+
+void ConcurrentRecordWriter::Done() {
+  if (RIEGELI_LIKELY(healthy())) {
+    CloseAllChunks();
+  } else {
+    // Wait for background encoding, which refers to this object.
+    std::unique_lock<std::mutex> lock(mutex_);
+    chunk_written_.wait(lock, [this] { return num_encoding_ == 0; });
+  }
+  if (chunk_index_ != nullptr && RIEGELI_LIKELY(healthy())) {
+    Chunk chunk;
+    chunk_index_->Encode(&chunk);
+    if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(chunk))) {
+      RIEGELI_ASSERT(!chunk_writer_->healthy());
+      Fail(*chunk_writer_);
+    }
+  }
+  chunk_index_.reset();
+  // Producers are kept until destruction, because GetProducer() in any thread
+  // may return a cached Producer until then. Only their memory is released.
+  for (const std::unique_ptr<Producer>& producer : producers_) {
+    producer->chunk_encoder.reset();
+  }
+  free_chunk_encoders_.clear();
+  if (owned_chunk_writer_ != nullptr) {
+    if (RIEGELI_LIKELY(healthy())) {
+      if (RIEGELI_UNLIKELY(!owned_chunk_writer_->Close())) {
+        Fail(*owned_chunk_writer_);
+      }
+    }
+    owned_chunk_writer_.reset();
+  }
+}
+
+inline ConcurrentRecordWriter::Producer*
+ConcurrentRecordWriter::GetProducer() {
+  if (RIEGELI_LIKELY(cached_writer_id_ == id_)) return cached_producer_;
+  return GetProducerSlow();
+}
+
+ConcurrentRecordWriter::Producer* ConcurrentRecordWriter::GetProducerSlow() {
+  const std::thread::id thread_id = std::this_thread::get_id();
+  Producer* producer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<Producer>& other : producers_) {
+      if (other->thread_id == thread_id) {
+        producer = other.get();
+        break;
+      }
+    }
+    if (producer == nullptr) {
+      producers_.push_back(riegeli::make_unique<Producer>(thread_id));
+      producer = producers_.back().get();
+    }
+  }
+  cached_writer_id_ = id_;
+  cached_producer_ = producer;
+  return producer;
+}
+
+bool ConcurrentRecordWriter::WriteRecord(
+    const google::protobuf::MessageLite& record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  const size_t size = record.ByteSizeLong();
+  if (RIEGELI_UNLIKELY(size > std::numeric_limits<int>::max())) {
+    return Fail("Failed to serialize message of type " + record.GetTypeName() +
+                " (exceeded maximum protobuf size of 2GB: " +
+                std::to_string(size) + ")");
+  }
+  Producer* const producer = GetProducer();
+  std::lock_guard<std::mutex> lock(producer->mutex);
+  if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(producer, size))) return false;
+  producer->chunk_encoder->AddRecord(record);
+  return true;
+}
+
+bool ConcurrentRecordWriter::WriteRecord(string_view record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  Producer* const producer = GetProducer();
+  std::lock_guard<std::mutex> lock(producer->mutex);
+  if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(producer, record.size()))) {
+    return false;
+  }
+  producer->chunk_encoder->AddRecord(record);
+  return true;
+}
+
+bool ConcurrentRecordWriter::WriteRecord(std::string&& record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  Producer* const producer = GetProducer();
+  std::lock_guard<std::mutex> lock(producer->mutex);
+  if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(producer, record.size()))) {
+    return false;
+  }
+  producer->chunk_encoder->AddRecord(std::move(record));
+  return true;
+}
+
+bool ConcurrentRecordWriter::WriteRecord(const Chain& record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  Producer* const producer = GetProducer();
+  std::lock_guard<std::mutex> lock(producer->mutex);
+  if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(producer, record.size()))) {
+    return false;
+  }
+  producer->chunk_encoder->AddRecord(record);
+  return true;
+}
+
+bool ConcurrentRecordWriter::WriteRecord(Chain&& record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  Producer* const producer = GetProducer();
+  std::lock_guard<std::mutex> lock(producer->mutex);
+  if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(producer, record.size()))) {
+    return false;
+  }
+  producer->chunk_encoder->AddRecord(std::move(record));
+  return true;
+}
+
+inline bool ConcurrentRecordWriter::EnsureRoomForRecord(Producer* producer,
+                                                        size_t record_size) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  // See RecordWriter::EnsureRoomForRecord().
+  const size_t kAssumedPointerSize = 8;
+  if (producer->chunk_size + record_size + kAssumedPointerSize >
+          options_.desired_chunk_size_ &&
+      producer->chunk_size != 0) {
+    if (RIEGELI_UNLIKELY(!CloseChunk(producer))) return false;
+  }
+  if (producer->chunk_encoder == nullptr) {
+    producer->chunk_encoder = RecordWriter::MakeChunkEncoder(options_);
+  }
+  producer->chunk_size += record_size + kAssumedPointerSize;
+  return true;
+}
+
+bool ConcurrentRecordWriter::CloseChunk(Producer* producer) {
+  producer->chunk_size = 0;
+  if (thread_pool_ == nullptr) {
+    Chunk chunk;
+    if (RIEGELI_UNLIKELY(!producer->chunk_encoder->Encode(&chunk))) {
+      return Fail("Failed to encode chunk");
+    }
+    producer->chunk_encoder->Reset();
+    std::lock_guard<std::mutex> lock(mutex_);
+    WriteChunk(chunk);
+    return healthy();
+  }
+  std::unique_ptr<ChunkEncoder> chunk_encoder;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    chunk_written_.wait(
+        lock, [this] { return num_encoding_ < options_.parallelism_; });
+    ++num_encoding_;
+    if (!free_chunk_encoders_.empty()) {
+      chunk_encoder = std::move(free_chunk_encoders_.back());
+      free_chunk_encoders_.pop_back();
+    }
+  }
+  // The encoder of the closed chunk is replaced with a reset encoder, created
+  // lazily if none is free.
+  chunk_encoder.swap(producer->chunk_encoder);
+  // std::function requires a copyable function, hence the raw pointer.
+  ChunkEncoder* const chunk_encoder_ptr = chunk_encoder.release();
+  thread_pool_->Schedule([this, chunk_encoder_ptr] {
+    EncodeAndWriteChunk(std::unique_ptr<ChunkEncoder>(chunk_encoder_ptr));
+  });
+  return healthy();
+}
+
+void ConcurrentRecordWriter::EncodeAndWriteChunk(
+    std::unique_ptr<ChunkEncoder> chunk_encoder) {
+  Chunk chunk;
+  const bool encoded = chunk_encoder->Encode(&chunk);
+  chunk_encoder->Reset();
+  if (RIEGELI_UNLIKELY(!encoded)) Fail("Failed to encode chunk");
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (RIEGELI_LIKELY(encoded)) WriteChunk(chunk);
+  free_chunk_encoders_.push_back(std::move(chunk_encoder));
+  --num_encoding_;
+  // Notified under the lock because Done() may destroy chunk_written_ as soon
+  // as it observes num_encoding_ == 0.
+  chunk_written_.notify_all();
+}
+
+inline void ConcurrentRecordWriter::WriteChunk(const Chunk& chunk) {
+  if (RIEGELI_UNLIKELY(!healthy())) return;
+  PipelineStats::Timer timer(options_.stats_,
+                             PipelineStats::Stage::kWriteChunk);
+  const Position pos_before = chunk_writer_->pos();
+  if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(chunk))) {
+    RIEGELI_ASSERT(!chunk_writer_->healthy());
+    Fail(*chunk_writer_);
+    return;
+  }
+  timer.set_bytes(chunk.data.size(), chunk_writer_->pos() - pos_before);
+  if (chunk_index_ != nullptr) {
+    chunk_index_->AddChunk(pos_before, chunk.header.num_records(),
+                           chunk.header.decoded_data_size());
+  }
+}
+
+void ConcurrentRecordWriter::CloseAllChunks() {
+  std::vector<Producer*> producers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    producers.reserve(producers_.size());
+    for (const std::unique_ptr<Producer>& producer : producers_) {
+      producers.push_back(producer.get());
+    }
+  }
+  for (Producer* const producer : producers) {
+    std::lock_guard<std::mutex> lock(producer->mutex);
+    if (producer->chunk_size != 0) {
+      if (RIEGELI_UNLIKELY(!CloseChunk(producer))) break;
+    }
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  chunk_written_.wait(lock, [this] { return num_encoding_ == 0; });
+}
+
+bool ConcurrentRecordWriter::Flush(FlushType flush_type) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  CloseAllChunks();
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (RIEGELI_UNLIKELY(!chunk_writer_->Flush(flush_type))) {
+    if (chunk_writer_->healthy()) return false;
+    return Fail(*chunk_writer_);
+  }
+  return true;
+}
+
+}  // namespace riegeli
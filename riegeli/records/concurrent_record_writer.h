@@ -0,0 +1,197 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_CONCURRENT_RECORD_WRITER_H_
+#define RIEGELI_RECORDS_CONCURRENT_RECORD_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/string_view.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/record_writer.h"
+
+namespace google {
+namespace protobuf {
+class MessageLite;
+}  // namespace protobuf
+}  // namespace google
+
+namespace riegeli {
+
+class ChunkEncoder;
+class ChunkWriter;
+class ThreadPool;
+struct Chunk;
+
+namespace internal {
+class ChunkIndex;
+}  // namespace internal
+
+// ConcurrentRecordWriter writes records to a Riegeli/records file, like
+// RecordWriter, but WriteRecord() and Flush() may be called concurrently from
+// multiple threads without external synchronization.
+//
+// Each thread fills its own chunk, so records written by one thread keep their
+// order, and records written by different threads are interleaved at the
+// granularity of chunks. Chunks are written in the order they are completed.
+//
+// Adding a record to a chunk takes a lock which only the thread filling the
+// chunk uses, except during Flush(). A lock shared by all threads is taken
+// once per chunk, to write it.
+//
+// A thread which stops writing records keeps its chunk open until Flush() or
+// Close().
+class ConcurrentRecordWriter final : public Object {
+ public:
+  // The options have the same meaning as for RecordWriter, with these
+  // differences:
+  //
+  //  * set_parallelism() limits the number of chunks being encoded in
+  //    background. If parallelism == 0, a chunk is encoded by the thread which
+  //    fills it.
+  //
+  //  * set_zstd_dictionary_training(), adaptive compression, and
+  //    set_memory_budget() are not supported and are ignored.
+  using Options = RecordWriter::Options;
+
+  // Will write records to the byte Writer which is owned by this
+  // ConcurrentRecordWriter and will be closed and deleted when the
+  // ConcurrentRecordWriter is closed.
+  explicit ConcurrentRecordWriter(std::unique_ptr<Writer> byte_writer,
+                                  Options options = Options());
+
+  // Will write records to the byte Writer which is not owned by this
+  // ConcurrentRecordWriter and must be kept alive but not accessed until
+  // closing the ConcurrentRecordWriter.
+  explicit ConcurrentRecordWriter(Writer* byte_writer,
+                                  Options options = Options());
+
+  // Will write records to the ChunkWriter which is owned by this
+  // ConcurrentRecordWriter and will be closed and deleted when the
+  // ConcurrentRecordWriter is closed.
+  explicit ConcurrentRecordWriter(std::unique_ptr<ChunkWriter> chunk_writer,
+                                  Options options = Options());
+
+  // Will write records to the ChunkWriter which is not owned by this
+  // ConcurrentRecordWriter and must be kept alive but not accessed until
+  // closing the ConcurrentRecordWriter.
+  explicit ConcurrentRecordWriter(ChunkWriter* chunk_writer,
+                                  Options options = Options());
+
+  ~ConcurrentRecordWriter();
+
+  // Writes the next record of the calling thread. This may be called
+  // concurrently.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool WriteRecord(const google::protobuf::MessageLite& record);
+  bool WriteRecord(string_view record);
+  bool WriteRecord(std::string&& record);
+  bool WriteRecord(const char* record);
+  bool WriteRecord(const Chain& record);
+  bool WriteRecord(Chain&& record);
+
+  // Finalizes open chunks of all threads, waits for background encoding, and
+  // pushes buffered data to the Writer. This may be called concurrently.
+  //
+  // Records written concurrently with Flush() may or may not be flushed.
+  //
+  // Return values are the same as for RecordWriter::Flush().
+  bool Flush(FlushType flush_type);
+
+ protected:
+  // Precondition: no concurrent WriteRecord() nor Flush().
+  void Done() override;
+
+ private:
+  struct Producer;
+
+  // Returns the Producer of the calling thread, creating it if needed.
+  Producer* GetProducer();
+  Producer* GetProducerSlow();
+
+  // Closes the chunk of the producer if the record does not fit, counting the
+  // record in the chunk.
+  //
+  // Precondition: producer->mutex is held.
+  bool EnsureRoomForRecord(Producer* producer, size_t record_size);
+
+  // Encodes and writes the chunk of the producer, or schedules that in
+  // background if parallelism > 0.
+  //
+  // Preconditions:
+  //   producer->mutex is held
+  //   the chunk is not empty
+  bool CloseChunk(Producer* producer);
+
+  // Encodes the chunk, and then writes it and returns the chunk encoder for
+  // reuse.
+  void EncodeAndWriteChunk(std::unique_ptr<ChunkEncoder> chunk_encoder);
+
+  // Writes the chunk with chunk_writer_, collecting the index.
+  //
+  // Precondition: mutex_ is held.
+  void WriteChunk(const Chunk& chunk);
+
+  // Closes open chunks of all producers and waits for background encoding.
+  void CloseAllChunks();
+
+  // Identifies this ConcurrentRecordWriter in cached_writer_id_, unique among
+  // all instances in the process.
+  const uint64_t id_;
+  // The cache of GetProducer() for the calling thread: the id_ of the
+  // ConcurrentRecordWriter last used in this thread, and its Producer.
+  static thread_local uint64_t cached_writer_id_;
+  static thread_local Producer* cached_producer_;
+
+  Options options_;
+  std::unique_ptr<ChunkWriter> owned_chunk_writer_;
+  ChunkWriter* chunk_writer_;
+  ThreadPool* thread_pool_ = nullptr;
+
+  // Guards the members below, and writing to chunk_writer_.
+  std::mutex mutex_;
+  // Producers of all threads which wrote records, kept until destruction
+  // because cached_producer_ may point to them.
+  std::vector<std::unique_ptr<Producer>> producers_;
+  // Chunk encoders which have been reset and can be reused.
+  std::vector<std::unique_ptr<ChunkEncoder>> free_chunk_encoders_;
+  // The number of chunks being encoded in background.
+  int num_encoding_ = 0;
+  // Notified when a chunk encoded in background is written.
+  std::condition_variable chunk_written_;
+  // The index of chunks written, or nullptr if the index is not enabled.
+  std::unique_ptr<internal::ChunkIndex> chunk_index_;
+};
+
+// Implementation details follow.
+
+inline bool ConcurrentRecordWriter::WriteRecord(const char* record) {
+  return WriteRecord(string_view(record));
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CONCURRENT_RECORD_WRITER_H_
@@ -14,21 +14,30 @@
 
 #include "riegeli/records/record_reader.h"
 
+#include <stddef.h>
+#include <stdint.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_budget.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/record_position.h"
+#include "riegeli/records/zstd_dictionary_chunk.h"
 
 namespace riegeli {
 
@@ -37,14 +46,17 @@ RecordReader::RecordReader() noexcept : Object(State::kClosed) {}
 RecordReader::RecordReader(std::unique_ptr<Reader> byte_reader, Options options)
     : RecordReader(riegeli::make_unique<ChunkReader>(
                        std::move(byte_reader),
-                       ChunkReader::Options().set_skip_corruption(
-                           options.skip_corruption_)),
+                       ChunkReader::Options()
+                           .set_skip_corruption(options.skip_corruption_)
+                           .set_stats(options.stats_)),
                    std::move(options)) {}
 
 RecordReader::RecordReader(Reader* byte_reader, Options options)
     : RecordReader(riegeli::make_unique<ChunkReader>(
-                       byte_reader, ChunkReader::Options().set_skip_corruption(
-                                        options.skip_corruption_)),
+                       byte_reader,
+                       ChunkReader::Options()
+                           .set_skip_corruption(options.skip_corruption_)
+                           .set_stats(options.stats_)),
                    std::move(options)) {}
 
 inline RecordReader::RecordReader(std::unique_ptr<ChunkReader> chunk_reader,
@@ -52,10 +64,27 @@ inline RecordReader::RecordReader(std::unique_ptr<ChunkReader> chunk_reader,
     : Object(State::kOpen),
       chunk_reader_(std::move(chunk_reader)),
       skip_corruption_(options.skip_corruption_),
+      parallelism_(options.parallelism_),
+      thread_pool_(options.thread_pool_ != nullptr
+                       ? options.thread_pool_
+                       : &internal::DefaultThreadPool()),
+      memory_budget_(options.memory_budget_),
+      chunk_decoder_options_(
+          ChunkDecoder::Options()
+              .set_skip_corruption(options.skip_corruption_)
+              .set_field_filter(std::move(options.field_filter_))
+              .set_stats(options.stats_)
+              .set_thread_pool(options.parallel_buckets_ ? thread_pool_
+                                                         : nullptr)
+              .set_max_flat_chunk_size(options.max_flat_chunk_size_)
+              .set_huge_pages(options.huge_pages_)
+              .set_memory_budget(options.memory_budget_)),
       chunk_begin_(chunk_reader_->pos()),
-      chunk_decoder_(ChunkDecoder::Options()
-                         .set_skip_corruption(options.skip_corruption_)
-                         .set_field_filter(std::move(options.field_filter_))) {
+      chunk_decoder_(chunk_decoder_options_) {
+  if (parallelism_ > 0) {
+    read_ahead_ = riegeli::make_unique<ReadAheadRing>(
+        IntCast<size_t>(parallelism_) + 1, chunk_decoder_options_);
+  }
   if (chunk_begin_ == 0 && !skip_corruption_) {
     // Verify file signature before any records are read, done proactively here
     // in case the caller calls Seek() before ReadRecord(). This is not done if
@@ -70,21 +99,44 @@ RecordReader::RecordReader(RecordReader&& src) noexcept
     : Object(std::move(src)),
       chunk_reader_(std::move(src.chunk_reader_)),
       skip_corruption_(riegeli::exchange(src.skip_corruption_, false)),
+      parallelism_(riegeli::exchange(src.parallelism_, 0)),
+      thread_pool_(riegeli::exchange(src.thread_pool_, nullptr)),
+      memory_budget_(riegeli::exchange(src.memory_budget_, nullptr)),
+      chunk_decoder_options_(std::move(src.chunk_decoder_options_)),
       chunk_begin_(riegeli::exchange(src.chunk_begin_, 0)),
-      chunk_decoder_(std::move(src.chunk_decoder_)) {}
+      chunk_decoder_(std::move(src.chunk_decoder_)),
+      read_ahead_(std::move(src.read_ahead_)),
+      index_searched_(riegeli::exchange(src.index_searched_, false)),
+      chunk_index_(std::move(src.chunk_index_)),
+      zstd_dictionary_searched_(
+          riegeli::exchange(src.zstd_dictionary_searched_, false)),
+      zstd_dictionary_(std::move(src.zstd_dictionary_)) {}
 
 RecordReader& RecordReader::operator=(RecordReader&& src) noexcept {
   Object::operator=(std::move(src));
   chunk_reader_ = std::move(src.chunk_reader_);
   skip_corruption_ = riegeli::exchange(src.skip_corruption_, false);
+  parallelism_ = riegeli::exchange(src.parallelism_, 0);
+  thread_pool_ = riegeli::exchange(src.thread_pool_, nullptr);
+  memory_budget_ = riegeli::exchange(src.memory_budget_, nullptr);
+  chunk_decoder_options_ = std::move(src.chunk_decoder_options_);
   chunk_begin_ = riegeli::exchange(src.chunk_begin_, 0);
   chunk_decoder_ = std::move(src.chunk_decoder_);
+  read_ahead_ = std::move(src.read_ahead_);
+  index_searched_ = riegeli::exchange(src.index_searched_, false);
+  chunk_index_ = std::move(src.chunk_index_);
+  zstd_dictionary_searched_ =
+      riegeli::exchange(src.zstd_dictionary_searched_, false);
+  zstd_dictionary_ = std::move(src.zstd_dictionary_);
   return *this;
 }
 
 RecordReader::~RecordReader() = default;
 
 void RecordReader::Done() {
+  // Chunks being decoded in background are not needed. Decoding them refers to
+  // read_ahead_, which waits for them when destroyed.
+  read_ahead_.reset();
   if (RIEGELI_LIKELY(healthy())) {
     if (RIEGELI_UNLIKELY(!chunk_reader_->Close())) {
       Fail(*chunk_reader_);
@@ -92,8 +144,15 @@ void RecordReader::Done() {
   }
   chunk_reader_.reset();
   skip_corruption_ = false;
+  parallelism_ = 0;
+  thread_pool_ = nullptr;
+  memory_budget_ = nullptr;
   chunk_begin_ = 0;
   chunk_decoder_.Clear();
+  index_searched_ = false;
+  chunk_index_.reset();
+  zstd_dictionary_searched_ = false;
+  zstd_dictionary_.reset();
 }
 
 bool RecordReader::ReadRecord(google::protobuf::MessageLite* record,
@@ -133,6 +192,32 @@ template bool RecordReader::ReadRecordSlow(string_view* record,
 template bool RecordReader::ReadRecordSlow(std::string* record, RecordPosition* key);
 template bool RecordReader::ReadRecordSlow(Chain* record, RecordPosition* key);
 
+bool RecordReader::ReadRecords(std::vector<string_view>* records,
+                               size_t max_num_records,
+                               std::vector<RecordPosition>* keys) {
+  RIEGELI_ASSERT_GT(max_num_records, 0u)
+      << "Failed precondition of RecordReader::ReadRecords(): "
+         "no records requested";
+  for (;;) {
+    const uint64_t first_index = chunk_decoder_.index();
+    const size_t num_records =
+        chunk_decoder_.ReadRecords(records, max_num_records);
+    if (RIEGELI_LIKELY(num_records > 0)) {
+      if (keys != nullptr) {
+        keys->clear();
+        keys->reserve(num_records);
+        for (size_t i = 0; i < num_records; ++i) {
+          keys->emplace_back(chunk_begin_, first_index + i);
+        }
+      }
+      return true;
+    }
+    if (RIEGELI_UNLIKELY(!healthy())) return false;
+    RIEGELI_ASSERT(chunk_decoder_.healthy());
+    if (RIEGELI_UNLIKELY(!ReadChunk())) return false;
+  }
+}
+
 bool RecordReader::Seek(RecordPosition new_pos) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
   if (new_pos.chunk_begin() == chunk_begin_) {
@@ -144,6 +229,31 @@ bool RecordReader::Seek(RecordPosition new_pos) {
       return true;
     }
   } else {
+    // Chunks read ahead before the new position will not be needed.
+    while (!ReadAheadEmpty() &&
+           read_ahead_->front()->chunk_begin < new_pos.chunk_begin()) {
+      read_ahead_->pop_front();
+    }
+    if (!ReadAheadEmpty() &&
+        read_ahead_->front()->chunk_begin == new_pos.chunk_begin()) {
+      // The chunk has been read ahead, there is no need to seek chunk_reader_.
+      if (new_pos.record_index() == 0) {
+        // Seeking to the beginning of a chunk does not need pulling the chunk,
+        // which is important because it may be corrupted. The chunk is still
+        // used, so its slot is modified only after it is decoded.
+        ReadAheadSlot* const slot = read_ahead_->front();
+        read_ahead_->WaitForSlot(slot);
+        chunk_begin_ = new_pos.chunk_begin();
+        chunk_decoder_.Clear();
+        slot->chunk_reader_pos = new_pos.chunk_begin();
+        return true;
+      }
+      if (RIEGELI_UNLIKELY(!ReadChunk())) return false;
+      RIEGELI_ASSERT_EQ(new_pos.chunk_begin(), chunk_begin_);
+      chunk_decoder_.SetIndex(new_pos.record_index());
+      return true;
+    }
+    ClearReadAhead();
     if (RIEGELI_UNLIKELY(!chunk_reader_->Seek(new_pos.chunk_begin()))) {
       chunk_begin_ = chunk_reader_->pos();
       chunk_decoder_.Clear();
@@ -167,11 +277,16 @@ bool RecordReader::Seek(RecordPosition new_pos) {
 
 bool RecordReader::Seek(Position new_pos) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
-  if (new_pos >= chunk_begin_ && new_pos <= chunk_reader_->pos()) {
+  RecordPosition record_pos;
+  if (chunk_index_ != nullptr && chunk_index_->Locate(new_pos, &record_pos)) {
+    return Seek(record_pos);
+  }
+  if (new_pos >= chunk_begin_ && new_pos <= chunk_reader_pos()) {
     // Seeking inside or just after the current chunk which has been pulled,
     // or to the beginning of the current chunk which has been located,
     // or to the end of file which has been reached.
   } else {
+    ClearReadAhead();
     if (RIEGELI_UNLIKELY(!chunk_reader_->SeekToChunkContaining(new_pos))) {
       chunk_begin_ = chunk_reader_->pos();
       chunk_decoder_.Clear();
@@ -193,7 +308,90 @@ bool RecordReader::Seek(Position new_pos) {
   return true;
 }
 
+bool RecordReader::NumRecords(uint64_t* num_records) {
+  if (RIEGELI_UNLIKELY(!ReadIndex())) return false;
+  *num_records = chunk_index_->num_records();
+  return true;
+}
+
+bool RecordReader::SeekToRecord(uint64_t record_index) {
+  if (RIEGELI_UNLIKELY(!ReadIndex())) return false;
+  if (RIEGELI_UNLIKELY(record_index > chunk_index_->num_records())) {
+    Seek(RecordPosition(chunk_index_->end_pos(), 0));
+    return false;
+  }
+  return Seek(chunk_index_->PositionOfRecord(record_index));
+}
+
+bool RecordReader::Split(uint64_t num_shards,
+                         std::vector<RecordPosition>* boundaries) {
+  RIEGELI_ASSERT_GT(num_shards, 0u)
+      << "Failed precondition of RecordReader::Split(): no shards";
+  if (RIEGELI_UNLIKELY(!ReadIndex())) return false;
+  const uint64_t num_records = chunk_index_->num_records();
+  boundaries->clear();
+  boundaries->reserve(IntCast<size_t>(num_shards) + 1);
+  // record_index is i * num_records / num_shards, computed incrementally
+  // without overflow. fraction is num_records % num_shards * i % num_shards,
+  // which is always below num_shards.
+  const uint64_t quotient = num_records / num_shards;
+  const uint64_t remainder = num_records % num_shards;
+  uint64_t record_index = 0;
+  uint64_t fraction = 0;
+  for (uint64_t i = 0; i <= num_shards; ++i) {
+    boundaries->push_back(chunk_index_->PositionOfRecord(record_index));
+    record_index += quotient;
+    if (fraction >= num_shards - remainder) {
+      fraction -= num_shards - remainder;
+      ++record_index;
+    } else {
+      fraction += remainder;
+    }
+  }
+  return true;
+}
+
+bool RecordReader::ReadIndex() {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (index_searched_) return chunk_index_ != nullptr;
+  Position size;
+  if (!chunk_reader_->Size(&size)) return false;
+  index_searched_ = true;
+  if (size == 0) return false;
+  // The index is the last chunk. Reading it moves chunk_reader_, which is
+  // restored afterwards, so that the current chunk remains valid while chunks
+  // read ahead are discarded.
+  const Position chunk_reader_pos_before = chunk_reader_pos();
+  ClearReadAhead();
+  if (chunk_reader_->SeekToChunkBefore(size - 1)) {
+    Chunk chunk;
+    Position chunk_begin;
+    if (chunk_reader_->ReadChunk(&chunk, &chunk_begin)) {
+      std::unique_ptr<internal::ChunkIndex> chunk_index =
+          riegeli::make_unique<internal::ChunkIndex>();
+      if (chunk_index->Decode(chunk, chunk_begin)) {
+        chunk_index_ = std::move(chunk_index);
+      }
+    }
+  }
+  if (RIEGELI_UNLIKELY(!chunk_reader_->healthy())) {
+    chunk_index_.reset();
+    chunk_decoder_.Clear();
+    return Fail(*chunk_reader_);
+  }
+  if (RIEGELI_UNLIKELY(!chunk_reader_->Seek(chunk_reader_pos_before))) {
+    chunk_index_.reset();
+    chunk_decoder_.Clear();
+    if (chunk_reader_->healthy()) {
+      return Fail("Failed to seek back after reading the chunk index");
+    }
+    return Fail(*chunk_reader_);
+  }
+  return chunk_index_ != nullptr;
+}
+
 inline bool RecordReader::ReadChunk() {
+  if (parallelism_ > 0) return ReadPendingChunk();
 again:
   Chunk chunk;
   if (RIEGELI_UNLIKELY(!chunk_reader_->ReadChunk(&chunk, &chunk_begin_))) {
@@ -213,6 +411,10 @@ again:
     // Decoding this chunk will yield no records and ReadChunk() will be called
     // again if needed.
   }
+  if (RIEGELI_UNLIKELY(!PrepareZstdDictionary(chunk))) {
+    chunk_decoder_.Clear();
+    return Fail(*chunk_reader_);
+  }
   if (RIEGELI_UNLIKELY(!chunk_decoder_.Reset(chunk))) {
     if (skip_corruption_) {
       chunk_decoder_.Clear();
@@ -225,4 +427,164 @@ again:
   return true;
 }
 
+bool RecordReader::ReadPendingChunk() {
+again:
+  // Release memory of the previous chunk before deciding how many chunks to
+  // read ahead.
+  if (memory_budget_ != nullptr) chunk_decoder_.Clear();
+  if (read_ahead_->empty()) {
+    ReadAhead();
+    if (RIEGELI_UNLIKELY(read_ahead_->empty())) {
+      chunk_begin_ = chunk_reader_->pos();
+      chunk_decoder_.Clear();
+      if (chunk_reader_->healthy()) return false;
+      return Fail(*chunk_reader_);
+    }
+  }
+  ReadAheadSlot* const slot = read_ahead_->front();
+  read_ahead_->pop_front();
+  // Keep parallelism_ chunks being decoded while this chunk is being waited
+  // for and its records are being read. The ring has a spare slot, so this
+  // does not reuse the slot of this chunk.
+  ReadAhead();
+  chunk_begin_ = slot->chunk_begin;
+  if (chunk_begin_ == 0) {
+    // Verify file signature.
+    if (RIEGELI_UNLIKELY(slot->header.data_size() != 0 ||
+                         slot->header.num_records() != 0 ||
+                         slot->header.decoded_data_size() != 0)) {
+      chunk_decoder_.Clear();
+      return Fail("Invalid Riegeli/records file: missing file signature");
+    }
+    // Decoding this chunk will yield no records and ReadChunk() will be called
+    // again if needed.
+  }
+  read_ahead_->WaitForSlot(slot);
+  // Exchange the decoders, so that the slot reuses the memory of the previous
+  // one.
+  std::swap(chunk_decoder_, slot->chunk_decoder);
+  slot->chunk_decoder.Clear();
+  if (RIEGELI_UNLIKELY(!chunk_decoder_.healthy())) {
+    if (skip_corruption_) {
+      chunk_decoder_.Clear();
+      goto again;
+    }
+    const std::string message = chunk_decoder_.Message();
+    chunk_decoder_.Clear();
+    return Fail(message);
+  }
+  return true;
+}
+
+void RecordReader::ReadAhead() {
+  while (read_ahead_->size() < IntCast<size_t>(parallelism_)) {
+    // Memory of chunks being decoded is reserved when they are decoded, so
+    // the budget can be exceeded by up to parallelism_ chunks.
+    if (memory_budget_ != nullptr && !read_ahead_->empty() &&
+        memory_budget_->Exhausted()) {
+      return;
+    }
+    ReadAheadSlot* const slot = read_ahead_->WaitForBack();
+    const Position chunk_reader_pos = chunk_reader_->pos();
+    Position chunk_begin;
+    if (!chunk_reader_->ReadChunk(&slot->chunk, &chunk_begin)) return;
+    // The failure will be reported when ReadPendingChunk() reaches it.
+    if (RIEGELI_UNLIKELY(!PrepareZstdDictionary(slot->chunk))) return;
+    slot->chunk_reader_pos = chunk_reader_pos;
+    slot->chunk_begin = chunk_begin;
+    slot->header = slot->chunk.header;
+    slot->chunk_decoder.set_zstd_dictionary(zstd_dictionary_);
+    read_ahead_->PushBackAndDecode(thread_pool_);
+  }
+}
+
+void RecordReader::ClearReadAhead() {
+  if (read_ahead_ != nullptr) read_ahead_->clear();
+}
+
+bool RecordReader::PrepareZstdDictionary(const Chunk& chunk) {
+  std::shared_ptr<const ZstdDictionary> dictionary;
+  if (!internal::DecodeZstdDictionaryChunk(chunk, &dictionary)) {
+    if (zstd_dictionary_searched_ || !internal::UsesZstdDictionary(chunk)) {
+      return true;
+    }
+    // The dictionary chunk has been skipped. Reading it moves chunk_reader_,
+    // which is restored afterwards.
+    zstd_dictionary_searched_ = true;
+    if (!internal::ReadZstdDictionary(chunk_reader_.get(), &dictionary)) {
+      return chunk_reader_->healthy();
+    }
+  }
+  zstd_dictionary_searched_ = true;
+  chunk_decoder_options_.set_zstd_dictionary(dictionary);
+  zstd_dictionary_ = dictionary;
+  chunk_decoder_.set_zstd_dictionary(std::move(dictionary));
+  return true;
+}
+
+RecordReader::ReadAheadRing::ReadAheadRing(size_t num_slots,
+                                           const ChunkDecoder::Options& options)
+    : num_slots_(num_slots), slots_(new ReadAheadSlot[num_slots]) {
+  for (size_t i = 0; i < num_slots_; ++i) {
+    slots_[i].chunk_decoder = ChunkDecoder(options);
+  }
+}
+
+RecordReader::ReadAheadRing::~ReadAheadRing() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < num_slots_; ++i) {
+    ReadAheadSlot* const slot = &slots_[i];
+    slot_decoded_.wait(lock, [slot] { return !slot->decoding; });
+  }
+}
+
+RecordReader::ReadAheadSlot* RecordReader::ReadAheadRing::WaitForBack() {
+  RIEGELI_ASSERT_LT(size_, num_slots_ - 1)
+      << "Failed precondition of ReadAheadRing::WaitForBack(): "
+         "no free slot";
+  ReadAheadSlot* const slot = &slots_[(begin_ + size_) % num_slots_];
+  WaitForSlot(slot);
+  return slot;
+}
+
+void RecordReader::ReadAheadRing::PushBackAndDecode(ThreadPool* thread_pool) {
+  ReadAheadSlot* const slot = &slots_[(begin_ + size_) % num_slots_];
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->decoding = true;
+  }
+  ++size_;
+  thread_pool->Schedule([this, slot] { Decode(slot); });
+}
+
+void RecordReader::ReadAheadRing::pop_front() {
+  RIEGELI_ASSERT_GT(size_, 0u)
+      << "Failed precondition of ReadAheadRing::pop_front(): empty";
+  begin_ = (begin_ + 1) % num_slots_;
+  --size_;
+}
+
+void RecordReader::ReadAheadRing::clear() {
+  // Slots of discarded chunks are waited for when they are reused.
+  begin_ = 0;
+  size_ = 0;
+}
+
+void RecordReader::ReadAheadRing::WaitForSlot(ReadAheadSlot* slot) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  slot_decoded_.wait(lock, [slot] { return !slot->decoding; });
+}
+
+void RecordReader::ReadAheadRing::Decode(ReadAheadSlot* slot) {
+  // A failure is reported by !chunk_decoder.healthy() and handled in
+  // ReadPendingChunk().
+  slot->chunk_decoder.Reset(slot->chunk);
+  slot->chunk.Reset();
+  // Releasing mutex_ is the last access to *this: the destructor cannot return
+  // before it acquires mutex_ after that.
+  std::lock_guard<std::mutex> lock(mutex_);
+  slot->decoding = false;
+  slot_decoded_.notify_all();
+}
+
 }  // namespace riegeli
@@ -15,18 +15,24 @@
 #ifndef RIEGELI_RECORDS_RECORD_READER_H_
 #define RIEGELI_RECORDS_RECORD_READER_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/string_view.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
 #include "riegeli/chunk_encoding/field_filter.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/record_position.h"
 
@@ -38,6 +44,11 @@ class MessageLite;
 
 namespace riegeli {
 
+class MemoryBudget;
+class PipelineStats;
+class ThreadPool;
+class ZstdDictionary;
+
 // RecordReader reads records of a Riegeli/records file. A record is
 // conceptually a binary string; usually it is a serialized proto message.
 //
@@ -92,11 +103,130 @@ class RecordReader final : public Object {
       return std::move(set_field_filter(std::move(field_filter)));
     }
 
+    // Sets the maximum number of chunks being read ahead and decoded in
+    // parallel in background. Larger parallelism can increase throughput, up
+    // to a point where it no longer matters; smaller parallelism reduces memory
+    // usage.
+    //
+    // If parallelism > 0, chunks are read from the byte Reader ahead of the
+    // records being returned, and seeking outside of the chunks read ahead may
+    // need the byte Reader to seek backwards.
+    //
+    // Default: 0
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0);
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+
+    // Sets the thread pool which decodes chunks in background if
+    // parallelism > 0, and decompresses buckets if parallel_buckets is true. It
+    // must be kept alive until closing the RecordReader.
+    //
+    // nullptr means a thread pool shared by default by all RecordWriters and
+    // RecordReaders in the process.
+    //
+    // Default: nullptr
+    Options& set_thread_pool(ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+
+    // If true, buckets of a transposed chunk are decompressed concurrently on
+    // the thread pool, which reduces the latency of decoding a single large
+    // chunk. This is used only if the field filter includes all fields.
+    //
+    // Default: false
+    Options& set_parallel_buckets(bool parallel_buckets) & {
+      parallel_buckets_ = parallel_buckets;
+      return *this;
+    }
+    Options&& set_parallel_buckets(bool parallel_buckets) && {
+      return std::move(set_parallel_buckets(parallel_buckets));
+    }
+
+    // Sets the PipelineStats which collect time spent and amount of data
+    // processed in stages of reading, decoding, and parsing chunks. It must be
+    // kept alive until closing the RecordReader and until chunks being decoded
+    // in background are done, and may be read at any time.
+    //
+    // nullptr disables collecting statistics.
+    //
+    // Default: nullptr
+    Options& set_stats(PipelineStats* stats) & {
+      stats_ = stats;
+      return *this;
+    }
+    Options&& set_stats(PipelineStats* stats) && {
+      return std::move(set_stats(stats));
+    }
+
+    // Sets the maximum decoded size of a chunk which is decompressed into a
+    // single buffer, so that ReadRecord(string_view*) and ReadRecords() never
+    // copy its records. See ChunkDecoder::Options::set_max_flat_chunk_size().
+    //
+    // 0 disables decoding into a single buffer.
+    //
+    // Default: 16M
+    Options& set_max_flat_chunk_size(uint64_t max_flat_chunk_size) & {
+      max_flat_chunk_size_ = max_flat_chunk_size;
+      return *this;
+    }
+    Options&& set_max_flat_chunk_size(uint64_t max_flat_chunk_size) && {
+      return std::move(set_max_flat_chunk_size(max_flat_chunk_size));
+    }
+
+    // If true, chunks decoded into a single buffer of at least 2M are backed by
+    // huge pages if the system supports them. See
+    // ChunkDecoder::Options::set_huge_pages().
+    //
+    // Default: false
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
+    // Sets the MemoryBudget which memory of decoded chunks is reserved from. It
+    // may be shared with other RecordReaders and RecordWriters, and must be
+    // kept alive until closing the RecordReader and until chunks being decoded
+    // in background are done.
+    //
+    // When the budget is exhausted, fewer chunks are read ahead if
+    // parallelism > 0, down to one. Memory reserved by others is never waited
+    // for.
+    //
+    // nullptr means no limit.
+    //
+    // Default: nullptr
+    Options& set_memory_budget(MemoryBudget* memory_budget) & {
+      memory_budget_ = memory_budget;
+      return *this;
+    }
+    Options&& set_memory_budget(MemoryBudget* memory_budget) && {
+      return std::move(set_memory_budget(memory_budget));
+    }
+
    private:
     friend class RecordReader;
 
     bool skip_corruption_ = false;
     FieldFilter field_filter_ = FieldFilter::All();
+    int parallelism_ = 0;
+    ThreadPool* thread_pool_ = nullptr;
+    bool parallel_buckets_ = false;
+    PipelineStats* stats_ = nullptr;
+    uint64_t max_flat_chunk_size_ = uint64_t{16} << 20;
+    bool huge_pages_ = false;
+    MemoryBudget* memory_budget_ = nullptr;
   };
 
   // Creates a closed RecordReader.
@@ -124,6 +254,11 @@ class RecordReader final : public Object {
   // string_view is valid until the next non-const operation on this
   // RecordReader.
   //
+  // Reading uncompressed records with ReadRecord(string_view*) from an
+  // FdMMapReader does not copy them, except for the rare records split by a
+  // block header, so FdMMapReader::Options().set_sequential(true) is the
+  // fastest way to read a file which is likely cached.
+  //
   // If key != nullptr, *key is set to the canonical record position on success.
   //
   // Return values:
@@ -135,6 +270,23 @@ class RecordReader final : public Object {
   bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
   bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
 
+  // Reads the next records, up to max_num_records and up to the end of the
+  // current chunk, replacing *records with them, with less overhead per record
+  // than ReadRecord(). The string_views are valid until the next non-const
+  // operation on this RecordReader.
+  //
+  // If keys != nullptr, *keys is replaced with canonical record positions of
+  // the records.
+  //
+  // Return values:
+  //  * true                    - success (at least one record is read)
+  //  * false (when healthy())  - source ends
+  //  * false (when !healthy()) - failure
+  //
+  // Precondition: max_num_records > 0
+  bool ReadRecords(std::vector<string_view>* records, size_t max_num_records,
+                   std::vector<RecordPosition>* keys = nullptr);
+
   // Returns true if reading from the current position might succeed, possibly
   // after some data is appended to the source. Returns false if reading from
   // the current position will always return false.
@@ -151,7 +303,9 @@ class RecordReader final : public Object {
   // the same file.
   //
   // In Seek(Position) the position can be any integer between 0 and file size.
-  // If it points between records, it is interpreted as the next record.
+  // If it points between records, it is interpreted as the next record. If the
+  // chunk index has been read by one of the functions below, it is used to
+  // locate the chunk instead of scanning the file.
   //
   // Return values:
   //  * true                    - success (position is set to pos)
@@ -169,6 +323,42 @@ class RecordReader final : public Object {
   //  * false - failure (healthy() is unchanged)
   bool Size(Position* size) const;
 
+  // The following functions use the index of chunks which RecordWriter writes
+  // at the end of the file with Options::set_index(). The index is read when
+  // one of them is called for the first time, which requires the byte Reader
+  // to support random access, and costs a seek to the last block of the file.
+  // Later calls do not read anything for the index.
+  //
+  // Return values:
+  //  * true                    - success
+  //  * false (when healthy())  - the file has no index (or random access is
+  //                              not supported); the position is unchanged
+  //  * false (when !healthy()) - failure
+
+  // Sets *num_records to the number of records in the file.
+  bool NumRecords(uint64_t* num_records);
+
+  // Seeks to the record with the given index, counted from 0 in the whole
+  // file. record_index == number of records seeks to the end. A larger
+  // record_index seeks to the end too, but returns false.
+  bool SeekToRecord(uint64_t record_index);
+
+  // Splits the file into num_shards shards with numbers of records differing
+  // by at most 1, and sets *boundaries to num_shards + 1 positions:
+  // shard i consists of records from (*boundaries)[i] inclusive to
+  // (*boundaries)[i + 1] exclusive.
+  //
+  // A shard can be read with:
+  //
+  //   record_reader_.Seek(boundaries[i]);
+  //   while (record_reader_.pos() < boundaries[i + 1] &&
+  //          record_reader_.ReadRecord(&record)) {
+  //     ... Process record.
+  //   }
+  //
+  // Precondition: num_shards > 0
+  bool Split(uint64_t num_shards, std::vector<RecordPosition>* boundaries);
+
 #if 0
   // Searches the region between the current position and end of file for a
   // desired record. What is desired is specified by a function, which should
@@ -195,13 +385,125 @@ class RecordReader final : public Object {
   template <typename String>
   bool ReadRecordSlow(String* record, RecordPosition* key);
 
+  // A chunk which has been read ahead from chunk_reader_ and is being decoded
+  // in background. Slots are reused for subsequent chunks, together with the
+  // memory of their chunk and decoder.
+  struct ReadAheadSlot {
+    // Position of chunk_reader_ before reading this chunk.
+    Position chunk_reader_pos = 0;
+    // Position of the beginning of this chunk.
+    Position chunk_begin = 0;
+    ChunkHeader header;
+    Chunk chunk;
+    ChunkDecoder chunk_decoder;
+    // True if a background task is decoding chunk into chunk_decoder. Guarded
+    // by ReadAheadRing::mutex.
+    bool decoding = false;
+  };
+
+  // Chunks following the current chunk, in the order of the file, stored in a
+  // fixed ring of slots. It is allocated once, so that background tasks can
+  // refer to it while the RecordReader is moved.
+  //
+  // Slots outside of the chunks read ahead may still be decoding discarded
+  // chunks. The destructor waits for them.
+  class ReadAheadRing {
+   public:
+    ReadAheadRing(size_t num_slots, const ChunkDecoder::Options& options);
+
+    ReadAheadRing(const ReadAheadRing&) = delete;
+    ReadAheadRing& operator=(const ReadAheadRing&) = delete;
+
+    ~ReadAheadRing();
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    ReadAheadSlot* front() { return &slots_[begin_]; }
+    const ReadAheadSlot* front() const { return &slots_[begin_]; }
+    // Returns the slot after the chunks read ahead, waiting until it is not
+    // decoding a discarded chunk.
+    //
+    // Precondition: size() < num_slots - 1, so that this is not the slot
+    // removed by the last pop_front()
+    ReadAheadSlot* WaitForBack();
+    // Adds back() to the chunks read ahead and decodes it in background.
+    void PushBackAndDecode(ThreadPool* thread_pool);
+    // Removes front() from the chunks read ahead. Its contents remain valid
+    // until the next pop_front().
+    void pop_front();
+    // Discards all chunks read ahead.
+    void clear();
+
+    // Waits until slot is decoded.
+    void WaitForSlot(ReadAheadSlot* slot);
+
+   private:
+    void Decode(ReadAheadSlot* slot);
+
+    size_t num_slots_;
+    std::unique_ptr<ReadAheadSlot[]> slots_;
+    // The chunks read ahead are slots_[(begin_ + i) % num_slots_] for i in
+    // [0, size_).
+    size_t begin_ = 0;
+    size_t size_ = 0;
+    // Guards ReadAheadSlot::decoding.
+    std::mutex mutex_;
+    // Notified when a slot is decoded.
+    std::condition_variable slot_decoded_;
+  };
+
   // Reads the next chunk from chunk_reader_ and decodes it into chunk_decoder_,
   // chunk_begin_, and chunk_end_. On failure clears chunk_decoder_.
   bool ReadChunk();
 
+  // Implementation of ReadChunk() if parallelism_ > 0: takes the next chunk
+  // from read_ahead_, reading it first if read_ahead_ is empty.
+  bool ReadPendingChunk();
+
+  // Reads chunks from chunk_reader_ and schedules decoding them until
+  // read_ahead_ has parallelism_ chunks, the memory budget is exhausted (if
+  // read_ahead_ is not empty), or chunk_reader_ fails to read a chunk (the
+  // failure will be reported when ReadPendingChunk() reaches it).
+  void ReadAhead();
+
+  // Returns true if no chunks are read ahead.
+  bool ReadAheadEmpty() const;
+
+  // Discards chunks read ahead.
+  void ClearReadAhead();
+
+  // Returns the position of chunk_reader_, not counting chunks read ahead.
+  Position chunk_reader_pos() const;
+
+  // Reads the index of chunks if this has not been done yet.
+  //
+  // Return values:
+  //  * true                    - success (chunk_index_ != nullptr)
+  //  * false (when healthy())  - the file has no index
+  //  * false (when !healthy()) - failure
+  bool ReadIndex();
+
+  // Makes the Zstd dictionary of the file known before decoding chunk: takes
+  // it from chunk if this is the dictionary chunk, or reads it from the
+  // beginning of the file if chunk is compressed with it and it is not known
+  // yet, e.g. after seeking.
+  //
+  // Returns false on failure of chunk_reader_. A missing dictionary is not a
+  // failure here; it is reported when decoding a chunk which needs it.
+  bool PrepareZstdDictionary(const Chunk& chunk);
+
   // Invariant: if healthy() then chunk_reader_ != nullptr
   std::unique_ptr<ChunkReader> chunk_reader_;
   bool skip_corruption_ = false;
+  int parallelism_ = 0;
+  // Thread pool for decoding chunks in background if parallelism_ > 0, and for
+  // decompressing buckets if Options::set_parallel_buckets() was used.
+  ThreadPool* thread_pool_ = nullptr;
+  // The budget which memory of decoded chunks is reserved from, or nullptr if
+  // memory is not limited.
+  MemoryBudget* memory_budget_ = nullptr;
+  // Options for decoding chunks in background if parallelism_ > 0.
+  ChunkDecoder::Options chunk_decoder_options_;
   // Position of the beginning of the current chunk or end of file, except when
   // Seek(Position) failed to locate the chunk containing the position, in which
   // case this is that position.
@@ -211,6 +513,22 @@ class RecordReader final : public Object {
   // Invariant:
   //   if !healthy() then chunk_decoder_.index() == chunk_decoder_.num_records()
   ChunkDecoder chunk_decoder_;
+  // Chunks following the current chunk if parallelism_ > 0, otherwise nullptr.
+  // It has parallelism_ + 1 slots: one for the chunk taken from it by
+  // ReadPendingChunk(), which is being waited for.
+  //
+  // Invariant:
+  //   if read_ahead_ != nullptr then read_ahead_->size() <= parallelism_
+  std::unique_ptr<ReadAheadRing> read_ahead_;
+  // True if ReadIndex() has looked for the index.
+  bool index_searched_ = false;
+  // The index of chunks, or nullptr if it has not been read or is absent.
+  std::unique_ptr<internal::ChunkIndex> chunk_index_;
+  // True if the Zstd dictionary of the file has been read or looked for.
+  bool zstd_dictionary_searched_ = false;
+  // The Zstd dictionary of the file for chunks decoded in background, or
+  // nullptr if it is not known yet.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
 };
 
 // Implementation details follow.
@@ -244,14 +562,14 @@ inline bool RecordReader::ReadRecord(Chain* record, RecordPosition* key) {
 
 inline bool RecordReader::HopeForMore() const {
   return chunk_decoder_.index() < chunk_decoder_.num_records() ||
-         (healthy() && chunk_reader_->HopeForMore());
+         !ReadAheadEmpty() || (healthy() && chunk_reader_->HopeForMore());
 }
 
 inline RecordPosition RecordReader::pos() const {
   if (RIEGELI_LIKELY(chunk_decoder_.index() < chunk_decoder_.num_records())) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
-  return RecordPosition(chunk_reader_->pos(), 0);
+  return RecordPosition(chunk_reader_pos(), 0);
 }
 
 inline bool RecordReader::Size(Position* size) const {
@@ -259,6 +577,15 @@ inline bool RecordReader::Size(Position* size) const {
   return chunk_reader_->Size(size);
 }
 
+inline Position RecordReader::chunk_reader_pos() const {
+  if (!ReadAheadEmpty()) return read_ahead_->front()->chunk_reader_pos;
+  return chunk_reader_->pos();
+}
+
+inline bool RecordReader::ReadAheadEmpty() const {
+  return read_ahead_ == nullptr || read_ahead_->empty();
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_RECORDS_RECORD_READER_H_
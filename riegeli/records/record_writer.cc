@@ -15,33 +15,66 @@
 #include "riegeli/records/record_writer.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <deque>
-#include <future>
 #include <limits>
 #include <memory>
 #include <mutex>
-#include <new>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_budget.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/parallelism.h"
 #include "riegeli/base/string_view.h"
+#include "riegeli/bytes/message_serialize.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/chunk_encoding/pipeline_stats.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/compression_controller.h"
+#include "riegeli/records/zstd_dictionary_chunk.h"
 
 namespace riegeli {
 
+namespace {
+
+// Decoding a chunk allocates records in one array, and pointers to them in
+// another array. We limit the size of both arrays (restricting only the first
+// array might force accumulating an unbounded number of empty records). Since
+// the decoder architecture is not known, and for deterministic output, the
+// pointer size is conservatively assumed to be 8 bytes.
+constexpr size_t kAssumedPointerSize = 8;
+
+// Memory of the open chunk is reserved from a MemoryBudget in steps of at least
+// this size, so that the budget is not locked for every record.
+constexpr size_t kChunkMemoryStep = size_t{64} << 10;
+
+uint64_t NanosSince(std::chrono::steady_clock::time_point start) {
+  return std::max(
+      IntCast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count()),
+      uint64_t{1});
+}
+
+}  // namespace
+
 inline std::unique_ptr<ChunkEncoder> RecordWriter::MakeChunkEncoder(
     const Options& options) {
+  std::unique_ptr<ChunkEncoder> chunk_encoder;
   if (options.transpose_) {
     const float desired_bucket_size_as_float =
         static_cast<float>(options.desired_chunk_size_) *
@@ -53,27 +86,40 @@ inline std::unique_ptr<ChunkEncoder> RecordWriter::MakeChunkEncoder(
             : desired_bucket_size_as_float >= 1.0f
                   ? static_cast<size_t>(desired_bucket_size_as_float)
                   : size_t{1};
+    ThreadPool* const bucket_thread_pool =
+        !options.parallel_buckets_
+            ? nullptr
+            : options.thread_pool_ != nullptr ? options.thread_pool_
+                                              : &internal::DefaultThreadPool();
     if (options.parallelism_ == 0) {
-      return riegeli::make_unique<EagerTransposedChunkEncoder>(
-          options.compression_type_, options.compression_level_,
-          desired_bucket_size);
+      auto eager_chunk_encoder =
+          riegeli::make_unique<EagerTransposedChunkEncoder>(
+              options.compression_type_, options.compression_level_,
+              desired_bucket_size, options.zstd_dictionary_);
+      eager_chunk_encoder->set_thread_pool(bucket_thread_pool);
+      chunk_encoder = std::move(eager_chunk_encoder);
     } else {
-      return riegeli::make_unique<DeferredTransposedChunkEncoder>(
-          options.compression_type_, options.compression_level_,
-          desired_bucket_size);
+      auto deferred_chunk_encoder =
+          riegeli::make_unique<DeferredTransposedChunkEncoder>(
+              options.compression_type_, options.compression_level_,
+              desired_bucket_size, options.zstd_dictionary_);
+      deferred_chunk_encoder->set_thread_pool(bucket_thread_pool);
+      chunk_encoder = std::move(deferred_chunk_encoder);
     }
   } else {
-    return riegeli::make_unique<SimpleChunkEncoder>(options.compression_type_,
-                                                    options.compression_level_);
+    chunk_encoder = riegeli::make_unique<SimpleChunkEncoder>(
+        options.compression_type_, options.compression_level_,
+        options.zstd_dictionary_);
   }
+  chunk_encoder->set_stats(options.stats_);
+  return chunk_encoder;
 }
 
 class RecordWriter::Impl : public Object {
  public:
-  Impl() : Object(State::kOpen) {}
+  explicit Impl(const Options& options);
 
-  explicit Impl(std::unique_ptr<ChunkEncoder> chunk_encoder)
-      : Object(State::kOpen), chunk_encoder_(std::move(chunk_encoder)) {}
+  Impl(std::unique_ptr<ChunkEncoder> chunk_encoder, const Options& options);
 
   ~Impl();
 
@@ -103,6 +149,16 @@ class RecordWriter::Impl : public Object {
     chunk_encoder_->AddRecord(std::move(record));
   }
 
+  // Precondition: chunk is open.
+  void AddRecords(const string_view* records, size_t num_records) {
+    chunk_encoder_->AddRecords(records, num_records);
+  }
+
+  // Precondition: chunk is open.
+  void AddRecords(const Chain* records, size_t num_records) {
+    chunk_encoder_->AddRecords(records, num_records);
+  }
+
   // Precondition: chunk is open.
   //
   // If the result is false then !healthy().
@@ -111,23 +167,185 @@ class RecordWriter::Impl : public Object {
   // Precondition: chunk is not open.
   virtual bool Flush(FlushType flush_type) = 0;
 
+  // Reserves memory from the memory budget, if any, for the open chunk to
+  // grow to chunk_size bytes, without waiting.
+  //
+  // Return values:
+  //  * true  - memory is reserved, or there is no memory budget
+  //  * false - the memory budget is exhausted
+  bool TryReserveChunkMemory(size_t chunk_size) {
+    if (memory_budget_ == nullptr || chunk_size <= chunk_memory_) return true;
+    return TryReserveChunkMemorySlow(chunk_size);
+  }
+
+  // Reserves memory from the memory budget for the open chunk to grow to
+  // chunk_size bytes even if the budget is exhausted, after waiting until
+  // chunks being encoded in background are written, which releases their
+  // memory.
+  //
+  // Preconditions:
+  //   there is a memory budget
+  //   the open chunk is empty
+  void ReserveChunkMemory(size_t chunk_size);
+
+  // Collects the index of chunks written, to be written when closing.
+  void EnableIndex() {
+    chunk_index_ = riegeli::make_unique<internal::ChunkIndex>();
+  }
+
  protected:
+  // Sets the compression of the open chunk to the one chosen by the
+  // compression controller, if it is enabled.
+  void AdaptCompression();
+
+  // Writes the chunk with chunk_writer, collecting statistics and the index.
+  bool WriteChunk(ChunkWriter* chunk_writer, const Chunk& chunk);
+
+  // Writes the index of chunks with chunk_writer if it is enabled.
+  void WriteIndex(ChunkWriter* chunk_writer);
+
+  // Waits until chunks being encoded in background, if any, are written.
+  virtual void WaitForPendingChunks() {}
+
+  // Returns memory reserved for the open chunk, which is being closed. The
+  // caller becomes responsible for releasing it.
+  size_t TakeChunkMemory() { return riegeli::exchange(chunk_memory_, 0); }
+
+  // Reserves memory of an encoded chunk from the memory budget, if any.
+  // Returns the amount reserved, to be released with ReleaseMemory().
+  size_t ReserveEncodedMemory(const Chunk& chunk);
+
+  // Releases memory reserved from the memory budget, if any.
+  void ReleaseMemory(size_t memory) {
+    if (memory_budget_ != nullptr) memory_budget_->Release(memory);
+  }
+
   std::unique_ptr<ChunkEncoder> chunk_encoder_;
+  PipelineStats* stats_;
+  // The budget which memory of chunks is reserved from, or nullptr if memory
+  // is not limited.
+  MemoryBudget* memory_budget_;
+  // The index of chunks written, or nullptr if the index is not enabled.
+  std::unique_ptr<internal::ChunkIndex> chunk_index_;
+  // Adapts the compression level to the load, or nullptr if the level is
+  // fixed.
+  std::unique_ptr<internal::CompressionController> compression_controller_;
+  // The compression of the open chunk, set if compression_controller_ !=
+  // nullptr.
+  internal::CompressionType chunk_compression_type_ =
+      internal::CompressionType::kNone;
+  int chunk_compression_level_ = 0;
+
+ private:
+  bool TryReserveChunkMemorySlow(size_t chunk_size);
+
+  // Memory reserved from memory_budget_ for the open chunk.
+  size_t chunk_memory_ = 0;
 };
 
-RecordWriter::Impl::~Impl() = default;
+inline RecordWriter::Impl::Impl(const Options& options)
+    : Object(State::kOpen),
+      stats_(options.stats_),
+      memory_budget_(options.memory_budget_) {
+  if (options.adaptive_compression_target_ > 0.0 ||
+      (options.parallelism_ > 0 &&
+       options.adaptive_compression_max_queue_fill_ < 1.0f)) {
+    compression_controller_ =
+        riegeli::make_unique<internal::CompressionController>(
+            options.compression_type_, options.compression_level_,
+            options.adaptive_compression_target_,
+            options.adaptive_compression_max_queue_fill_,
+            options.adaptive_compression_fallback_to_lz4_);
+  }
+}
+
+inline RecordWriter::Impl::Impl(std::unique_ptr<ChunkEncoder> chunk_encoder,
+                                const Options& options)
+    : Impl(options) {
+  chunk_encoder_ = std::move(chunk_encoder);
+}
+
+RecordWriter::Impl::~Impl() { ReleaseMemory(chunk_memory_); }
+
+bool RecordWriter::Impl::TryReserveChunkMemorySlow(size_t chunk_size) {
+  const size_t needed = chunk_size - chunk_memory_;
+  const size_t step = std::max(needed, kChunkMemoryStep);
+  if (RIEGELI_UNLIKELY(!memory_budget_->TryReserve(step))) {
+    if (step == needed || !memory_budget_->TryReserve(needed)) return false;
+    chunk_memory_ = chunk_size;
+    return true;
+  }
+  chunk_memory_ += step;
+  return true;
+}
+
+void RecordWriter::Impl::ReserveChunkMemory(size_t chunk_size) {
+  RIEGELI_ASSERT(memory_budget_ != nullptr)
+      << "Failed precondition of RecordWriter::Impl::ReserveChunkMemory(): "
+         "no memory budget";
+  RIEGELI_ASSERT_EQ(chunk_memory_, 0u)
+      << "Failed precondition of RecordWriter::Impl::ReserveChunkMemory(): "
+         "chunk not empty";
+  WaitForPendingChunks();
+  memory_budget_->ReserveUnconditionally(chunk_size);
+  chunk_memory_ = chunk_size;
+}
+
+inline size_t RecordWriter::Impl::ReserveEncodedMemory(const Chunk& chunk) {
+  if (memory_budget_ == nullptr) return 0;
+  // The encoded chunk is already allocated, so this does not wait.
+  const size_t memory = chunk.data.EstimateMemory();
+  memory_budget_->ReserveUnconditionally(memory);
+  return memory;
+}
+
+inline void RecordWriter::Impl::AdaptCompression() {
+  if (compression_controller_ == nullptr) return;
+  chunk_compression_type_ = compression_controller_->compression_type();
+  chunk_compression_level_ = compression_controller_->compression_level();
+  chunk_encoder_->SetCompression(chunk_compression_type_,
+                                 chunk_compression_level_);
+}
+
+inline bool RecordWriter::Impl::WriteChunk(ChunkWriter* chunk_writer,
+                                           const Chunk& chunk) {
+  PipelineStats::Timer timer(stats_, PipelineStats::Stage::kWriteChunk);
+  const Position pos_before = chunk_writer->pos();
+  if (RIEGELI_UNLIKELY(!chunk_writer->WriteChunk(chunk))) return false;
+  timer.set_bytes(chunk.data.size(), chunk_writer->pos() - pos_before);
+  if (chunk_index_ != nullptr) {
+    chunk_index_->AddChunk(pos_before, chunk.header.num_records(),
+                           chunk.header.decoded_data_size());
+  }
+  return true;
+}
+
+void RecordWriter::Impl::WriteIndex(ChunkWriter* chunk_writer) {
+  if (chunk_index_ == nullptr || RIEGELI_UNLIKELY(!healthy())) return;
+  Chunk chunk;
+  chunk_index_->Encode(&chunk);
+  chunk_index_.reset();
+  if (RIEGELI_UNLIKELY(!chunk_writer->WriteChunk(chunk))) {
+    RIEGELI_ASSERT(!chunk_writer->healthy());
+    Fail(*chunk_writer);
+  }
+}
 
 class RecordWriter::SerialImpl final : public Impl {
  public:
   SerialImpl(ChunkWriter* chunk_writer, const Options& options)
-      : Impl(MakeChunkEncoder(options)), chunk_writer_(chunk_writer) {}
+      : Impl(MakeChunkEncoder(options), options),
+        chunk_writer_(chunk_writer) {}
 
-  void OpenChunk() override { chunk_encoder_->Reset(); }
+  void OpenChunk() override {
+    chunk_encoder_->Reset();
+    AdaptCompression();
+  }
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
 
  protected:
-  void Done() override {}
+  void Done() override { WriteIndex(chunk_writer_); }
 
  private:
   ChunkWriter* chunk_writer_;
@@ -135,11 +353,27 @@ class RecordWriter::SerialImpl final : public Impl {
 
 bool RecordWriter::SerialImpl::CloseChunk() {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
+  // Memory of records stays reserved until the chunk is written, because the
+  // chunk encoder holds it until then.
+  const size_t chunk_memory = TakeChunkMemory();
   Chunk chunk;
+  const std::chrono::steady_clock::time_point encode_start =
+      compression_controller_ != nullptr
+          ? std::chrono::steady_clock::now()
+          : std::chrono::steady_clock::time_point();
   if (RIEGELI_UNLIKELY(!chunk_encoder_->Encode(&chunk))) {
+    ReleaseMemory(chunk_memory);
     return Fail("Failed to encode chunk");
   }
-  if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(chunk))) {
+  if (compression_controller_ != nullptr) {
+    compression_controller_->ReportChunk(
+        chunk_compression_type_, chunk_compression_level_,
+        chunk.header.decoded_data_size(), NanosSince(encode_start), 0.0f);
+  }
+  const size_t encoded_memory = ReserveEncodedMemory(chunk);
+  const bool written = WriteChunk(chunk_writer_, chunk);
+  ReleaseMemory(chunk_memory + encoded_memory);
+  if (RIEGELI_UNLIKELY(!written)) {
     RIEGELI_ASSERT(!chunk_writer_->healthy());
     return Fail(*chunk_writer_);
   }
@@ -157,13 +391,19 @@ bool RecordWriter::SerialImpl::Flush(FlushType flush_type) {
 
 // ParallelImpl uses parallelism internally, but the class is still only
 // thread-compatible, not thread-safe.
+//
+// Chunks are encoded in a ring of options.parallelism_ slots. CloseChunk()
+// fills the next slot and schedules encoding it. Encoding tasks finish in any
+// order, and the task which finds the chunk at next_to_write_ encoded writes it
+// and any following encoded chunks. Progress is tracked with atomic variables,
+// so there is no locking nor allocation per chunk.
 class RecordWriter::ParallelImpl final : public Impl {
  public:
   ParallelImpl(ChunkWriter* chunk_writer, const Options& options);
 
   ~ParallelImpl();
 
-  void OpenChunk() override { chunk_encoder_ = MakeChunkEncoder(options_); }
+  void OpenChunk() override;
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
 
@@ -171,218 +411,235 @@ class RecordWriter::ParallelImpl final : public Impl {
   void Done() override;
 
  private:
-  // A request to the chunk writer thread.
-  enum class RequestType {
-    kWriteChunkRequest,
-    kFlushRequest,
-    kDoneRequest,
-  };
-  struct WriteChunkRequest {
-    std::future<Chunk> chunk;
+  enum class SlotState {
+    kFree,
+    kEncoding,
+    kEncoded,
   };
-  struct FlushRequest {
-    FlushType flush_type;
-    std::promise<bool> done;
-  };
-  struct DoneRequest {
-    std::promise<void> done;
-  };
-  struct ChunkWriterRequest {
-    explicit ChunkWriterRequest(WriteChunkRequest write_chunk_request);
-    explicit ChunkWriterRequest(FlushRequest flush_request);
-    explicit ChunkWriterRequest(DoneRequest done_request);
-
-    ChunkWriterRequest(ChunkWriterRequest&& src) noexcept;
-    ChunkWriterRequest& operator=(ChunkWriterRequest&& src) noexcept;
-
-    ~ChunkWriterRequest();
-
-    RequestType request_type;
-    union {
-      WriteChunkRequest write_chunk_request;
-      FlushRequest flush_request;
-      DoneRequest done_request;
-    };
+
+  struct Slot {
+    std::atomic<SlotState> state{SlotState::kFree};
+    // The encoder of the chunk if state != kFree, otherwise an encoder which
+    // has been reset and can be reused, or nullptr.
+    std::unique_ptr<ChunkEncoder> chunk_encoder;
+    // The encoded chunk if state == kEncoded.
+    Chunk chunk;
+    // The compression of the last chunk encoded in the slot, and its encoding
+    // time, or 0 if it has been reported to compression_controller_. This is
+    // used only if compression_controller_ != nullptr.
+    internal::CompressionType compression_type =
+        internal::CompressionType::kNone;
+    int compression_level = 0;
+    uint64_t decoded_data_size = 0;
+    uint64_t encode_nanos = 0;
+    // Memory reserved from memory_budget_ for the chunk, released when it is
+    // written.
+    size_t memory = 0;
   };
 
-  Options options_;
-  ChunkWriter* chunk_writer_;
-  std::mutex mutex_;
-  // All variables below are guarded by mutex_.
-  std::deque<ChunkWriterRequest> chunk_writer_requests_;
-  std::condition_variable has_chunk_writer_request_;
-  std::condition_variable has_space_for_chunk_;
-};
+  // Encodes the chunk in the slot, and then writes encoded chunks if the chunk
+  // is next to be written.
+  void EncodeChunk(Slot* slot);
 
-inline RecordWriter::ParallelImpl::ChunkWriterRequest::ChunkWriterRequest(
-    WriteChunkRequest write_chunk_request)
-    : request_type(RequestType::kWriteChunkRequest),
-      write_chunk_request(std::move(write_chunk_request)) {}
-
-inline RecordWriter::ParallelImpl::ChunkWriterRequest::ChunkWriterRequest(
-    FlushRequest flush_request)
-    : request_type(RequestType::kFlushRequest),
-      flush_request(std::move(flush_request)) {}
-
-inline RecordWriter::ParallelImpl::ChunkWriterRequest::ChunkWriterRequest(
-    DoneRequest done_request)
-    : request_type(RequestType::kDoneRequest),
-      done_request(std::move(done_request)) {}
-
-inline RecordWriter::ParallelImpl::ChunkWriterRequest::~ChunkWriterRequest() {
-  switch (request_type) {
-    case RequestType::kWriteChunkRequest:
-      write_chunk_request.~WriteChunkRequest();
-      return;
-    case RequestType::kFlushRequest:
-      flush_request.~FlushRequest();
-      return;
-    case RequestType::kDoneRequest:
-      done_request.~DoneRequest();
-      return;
-  }
-  RIEGELI_ASSERT_UNREACHABLE()
-      << "Unknown request type: " << static_cast<int>(request_type);
-}
+  // Writes encoded chunks from consecutive slots starting from next_to_write_,
+  // unless another thread is already doing that.
+  void WriteEncodedChunks();
 
-inline RecordWriter::ParallelImpl::ChunkWriterRequest::ChunkWriterRequest(
-    ChunkWriterRequest&& src) noexcept
-    : request_type(src.request_type) {
-  switch (request_type) {
-    case RequestType::kWriteChunkRequest:
-      new (&write_chunk_request)
-          WriteChunkRequest(std::move(src.write_chunk_request));
-      return;
-    case RequestType::kFlushRequest:
-      new (&flush_request) FlushRequest(std::move(src.flush_request));
-      return;
-    case RequestType::kDoneRequest:
-      new (&done_request) DoneRequest(std::move(src.done_request));
-      return;
-  }
-  RIEGELI_ASSERT_UNREACHABLE()
-      << "Unknown request type: " << static_cast<int>(request_type);
-}
+  void WaitForPendingChunks() override;
 
-inline RecordWriter::ParallelImpl::ChunkWriterRequest&
-RecordWriter::ParallelImpl::ChunkWriterRequest::operator=(
-    ChunkWriterRequest&& src) noexcept {
-  if (&src != this) {
-    this->~ChunkWriterRequest();
-    new (this) ChunkWriterRequest(std::move(src));
-  }
-  return *this;
-}
+  // Waits until all chunks are written and no background task refers to this
+  // ParallelImpl.
+  void WaitForBackgroundWork();
+
+  Options options_;
+  ChunkWriter* chunk_writer_;
+  ThreadPool* thread_pool_;
+  size_t num_slots_;
+  // The chunk with sequence number i uses slots_[i % num_slots_].
+  std::unique_ptr<Slot[]> slots_;
+  // Sequence number of the next chunk to encode. This is used only by the
+  // thread calling CloseChunk().
+  uint64_t next_to_encode_ = 0;
+  // Sequence number of the next chunk to write. This is modified only by the
+  // thread which set writing_ to true.
+  std::atomic<uint64_t> next_to_write_{0};
+  // True if some thread is writing encoded chunks.
+  std::atomic<bool> writing_{false};
+  // The number of encoding tasks which have been scheduled but not finished.
+  // It is decremented to 0 only under tasks_mutex_.
+  std::atomic<size_t> num_running_tasks_{0};
+  // Guards decrementing num_running_tasks_ to 0.
+  std::mutex tasks_mutex_;
+  // Notified when num_running_tasks_ drops to 0.
+  std::condition_variable tasks_finished_;
+  // Notified when a chunk is written.
+  internal::EventCount chunk_written_;
+};
 
 inline RecordWriter::ParallelImpl::ParallelImpl(ChunkWriter* chunk_writer,
                                                 const Options& options)
-    : options_(options), chunk_writer_(chunk_writer) {
-  internal::DefaultThreadPool().Schedule([this] {
-    for (;;) {
-      std::unique_lock<std::mutex> lock(mutex_);
-      while (chunk_writer_requests_.empty()) {
-        has_chunk_writer_request_.wait(lock);
-      }
-      ChunkWriterRequest request = std::move(chunk_writer_requests_.front());
-      chunk_writer_requests_.pop_front();
-      has_space_for_chunk_.notify_one();
-      lock.unlock();
-      switch (request.request_type) {
-        case RequestType::kWriteChunkRequest: {
-          // If !healthy(), the chunk must still be waited for, to ensure that
-          // the chunk encoder thread exits before the chunk writer thread
-          // responds to DoneRequest.
-          const Chunk chunk = request.write_chunk_request.chunk.get();
-          if (RIEGELI_UNLIKELY(!healthy())) continue;
-          if (RIEGELI_UNLIKELY(!chunk_writer_->WriteChunk(chunk))) {
-            RIEGELI_ASSERT(!chunk_writer_->healthy());
-            Fail(*chunk_writer_);
-          }
-          continue;
-        }
-        case RequestType::kFlushRequest: {
-          if (RIEGELI_UNLIKELY(!healthy())) {
-            request.flush_request.done.set_value(false);
-            continue;
-          }
-          if (RIEGELI_UNLIKELY(
-                  !chunk_writer_->Flush(request.flush_request.flush_type))) {
-            if (!chunk_writer_->healthy()) Fail(*chunk_writer_);
-            request.flush_request.done.set_value(false);
-            continue;
-          }
-          request.flush_request.done.set_value(true);
-          continue;
-        }
-        case RequestType::kDoneRequest: {
-          request.done_request.done.set_value();
-          return;
-        }
-      }
-      RIEGELI_ASSERT_UNREACHABLE()
-          << "Unknown request type: " << static_cast<int>(request.request_type);
-    }
-  });
-}
+    : Impl(options),
+      options_(options),
+      chunk_writer_(chunk_writer),
+      thread_pool_(options.thread_pool_ != nullptr
+                       ? options.thread_pool_
+                       : &internal::DefaultThreadPool()),
+      num_slots_(IntCast<size_t>(options.parallelism_)),
+      slots_(new Slot[num_slots_]) {}
 
 RecordWriter::ParallelImpl::~ParallelImpl() {
   if (RIEGELI_UNLIKELY(!closed())) {
-    // Ask the chunk writer thread to stop working and exit.
+    // Ask the encoding tasks to skip writing.
     Fail("Cancelled");
     Done();
   }
 }
 
 void RecordWriter::ParallelImpl::Done() {
-  std::promise<void> done_promise;
-  std::future<void> done_future = done_promise.get_future();
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    chunk_writer_requests_.emplace_back(DoneRequest{std::move(done_promise)});
-    has_chunk_writer_request_.notify_one();
-  }
-  done_future.get();
+  WaitForBackgroundWork();
+  WriteIndex(chunk_writer_);
+}
+
+void RecordWriter::ParallelImpl::OpenChunk() {
+  if (chunk_encoder_ == nullptr) chunk_encoder_ = MakeChunkEncoder(options_);
+  AdaptCompression();
 }
 
 bool RecordWriter::ParallelImpl::CloseChunk() {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
-  ChunkEncoder* const chunk_encoder = chunk_encoder_.release();
-  std::promise<Chunk>* const chunk_promise =
-      new std::promise<Chunk>();
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (chunk_writer_requests_.size() >=
-           IntCast<size_t>(options_.parallelism_)) {
-      has_space_for_chunk_.wait(lock);
+  Slot* const slot = &slots_[next_to_encode_ % num_slots_];
+  // The fraction of slots with chunks not written yet.
+  const float queue_fill =
+      static_cast<float>(next_to_encode_ - next_to_write_.load()) /
+      static_cast<float>(num_slots_);
+  // Wait until the chunk which used the slot before has been written.
+  chunk_written_.Wait(
+      [slot] { return slot->state.load() == SlotState::kFree; });
+  if (compression_controller_ != nullptr) {
+    // Measurements of the chunk which used the slot before are reported late,
+    // to avoid synchronizing with encoding tasks.
+    if (slot->encode_nanos > 0) {
+      compression_controller_->ReportChunk(
+          slot->compression_type, slot->compression_level,
+          slot->decoded_data_size, slot->encode_nanos, queue_fill);
+      slot->encode_nanos = 0;
     }
-    chunk_writer_requests_.emplace_back(
-        WriteChunkRequest{chunk_promise->get_future()});
-    has_chunk_writer_request_.notify_one();
+    slot->compression_type = chunk_compression_type_;
+    slot->compression_level = chunk_compression_level_;
   }
-  internal::DefaultThreadPool().Schedule([this, chunk_encoder, chunk_promise] {
-    Chunk chunk;
-    if (RIEGELI_UNLIKELY(!chunk_encoder->Encode(&chunk))) {
-      Fail("Failed to encode chunk");
-    }
-    delete chunk_encoder;
-    chunk_promise->set_value(std::move(chunk));
-    delete chunk_promise;
-  });
+  slot->chunk_encoder.swap(chunk_encoder_);
+  slot->memory = TakeChunkMemory();
+  slot->state.store(SlotState::kEncoding);
+  ++next_to_encode_;
+  num_running_tasks_.fetch_add(1);
+  thread_pool_->Schedule([this, slot] { EncodeChunk(slot); });
   return true;
 }
 
 bool RecordWriter::ParallelImpl::Flush(FlushType flush_type) {
-  std::promise<bool> done_promise;
-  std::future<bool> done_future = done_promise.get_future();
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    chunk_writer_requests_.emplace_back(
-        FlushRequest{flush_type, std::move(done_promise)});
-    has_chunk_writer_request_.notify_one();
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  chunk_written_.Wait(
+      [this] { return next_to_write_.load() == next_to_encode_; });
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (RIEGELI_UNLIKELY(!chunk_writer_->Flush(flush_type))) {
+    if (chunk_writer_->healthy()) return false;
+    return Fail(*chunk_writer_);
+  }
+  return true;
+}
+
+void RecordWriter::ParallelImpl::EncodeChunk(Slot* slot) {
+  const std::chrono::steady_clock::time_point encode_start =
+      compression_controller_ != nullptr
+          ? std::chrono::steady_clock::now()
+          : std::chrono::steady_clock::time_point();
+  if (RIEGELI_UNLIKELY(!slot->chunk_encoder->Encode(&slot->chunk))) {
+    Fail("Failed to encode chunk");
+  }
+  if (compression_controller_ != nullptr) {
+    slot->decoded_data_size = slot->chunk.header.decoded_data_size();
+    slot->encode_nanos = NanosSince(encode_start);
+  }
+  slot->chunk_encoder->Reset();
+  if (memory_budget_ != nullptr) {
+    // Memory of records has been freed, memory of the encoded chunk remains.
+    const size_t encoded_memory = ReserveEncodedMemory(slot->chunk);
+    ReleaseMemory(riegeli::exchange(slot->memory, encoded_memory));
+  }
+  slot->state.store(SlotState::kEncoded);
+  WriteEncodedChunks();
+  // While other tasks are running, WaitForBackgroundWork() cannot return, so
+  // decrementing num_running_tasks_ is the last access to *this.
+  size_t num_running_tasks = num_running_tasks_.load();
+  while (num_running_tasks > 1) {
+    if (num_running_tasks_.compare_exchange_weak(num_running_tasks,
+                                                 num_running_tasks - 1)) {
+      return;
+    }
+  }
+  // This might be the last task. Releasing tasks_mutex_ is the last access to
+  // *this: WaitForBackgroundWork() cannot return before it acquires
+  // tasks_mutex_ after that.
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  if (num_running_tasks_.fetch_sub(1) == 1) tasks_finished_.notify_all();
+}
+
+void RecordWriter::ParallelImpl::WriteEncodedChunks() {
+  for (;;) {
+    if (writing_.exchange(true)) {
+      // Another thread is writing. It will notice that this chunk is encoded,
+      // either in its loop or when checking after setting writing_ to false.
+      return;
+    }
+    for (;;) {
+      Slot* const slot = &slots_[next_to_write_.load() % num_slots_];
+      if (slot->state.load() != SlotState::kEncoded) break;
+      // If !healthy(), chunks are still marked as written, to let
+      // CloseChunk() and WaitForBackgroundWork() proceed.
+      if (RIEGELI_LIKELY(healthy())) {
+        if (RIEGELI_UNLIKELY(!WriteChunk(chunk_writer_, slot->chunk))) {
+          RIEGELI_ASSERT(!chunk_writer_->healthy());
+          Fail(*chunk_writer_);
+        }
+      }
+      slot->chunk.Reset();
+      ReleaseMemory(riegeli::exchange(slot->memory, 0));
+      next_to_write_.fetch_add(1);
+      slot->state.store(SlotState::kFree);
+      chunk_written_.NotifyAll();
+    }
+    writing_.store(false);
+    // A chunk could have become encoded after checking its state above, while
+    // its encoding task saw writing_ set to true.
+    if (slots_[next_to_write_.load() % num_slots_].state.load() !=
+        SlotState::kEncoded) {
+      return;
+    }
   }
-  return done_future.get();
 }
 
+void RecordWriter::ParallelImpl::WaitForPendingChunks() {
+  chunk_written_.Wait(
+      [this] { return next_to_write_.load() == next_to_encode_; });
+}
+
+void RecordWriter::ParallelImpl::WaitForBackgroundWork() {
+  WaitForPendingChunks();
+  // The remaining tasks have finished their work, but might still be about to
+  // return from EncodeChunk().
+  std::unique_lock<std::mutex> lock(tasks_mutex_);
+  tasks_finished_.wait(lock,
+                       [this] { return num_running_tasks_.load() == 0; });
+}
+
+struct RecordWriter::ZstdDictionaryTraining {
+  // Options for starting impl_ after training.
+  Options options;
+  ChunkWriter* chunk_writer;
+  // Records to train the dictionary from, to be written afterwards.
+  std::vector<Chain> records;
+};
+
 RecordWriter::RecordWriter() noexcept : Object(State::kClosed) {}
 
 RecordWriter::RecordWriter(std::unique_ptr<Writer> chunk_writer,
@@ -402,9 +659,12 @@ RecordWriter::RecordWriter(std::unique_ptr<ChunkWriter> chunk_writer,
 }
 
 RecordWriter::RecordWriter(ChunkWriter* chunk_writer, Options options)
-    : Object(State::kOpen), desired_chunk_size_(options.desired_chunk_size_) {
+    : Object(State::kOpen),
+      desired_chunk_size_(options.desired_chunk_size_),
+      memory_budget_(options.memory_budget_) {
   RIEGELI_ASSERT_NOTNULL(chunk_writer);
-  if (chunk_writer->pos() == 0) {
+  const bool writing_from_beginning = chunk_writer->pos() == 0;
+  if (writing_from_beginning) {
     // Write file signature.
     Chunk signature;
     signature.header = ChunkHeader(signature.data, 0, 0);
@@ -414,35 +674,119 @@ RecordWriter::RecordWriter(ChunkWriter* chunk_writer, Options options)
       return;
     }
   }
+  // A dictionary can be stored only at the beginning of the file.
+  if (options.compression_type_ == internal::CompressionType::kZstd &&
+      writing_from_beginning) {
+    if (options.zstd_dictionary_ != nullptr) {
+      std::shared_ptr<const ZstdDictionary> dictionary =
+          std::move(options.zstd_dictionary_);
+      if (RIEGELI_UNLIKELY(!WriteZstdDictionary(
+              chunk_writer, std::move(dictionary), &options))) {
+        return;
+      }
+    } else if (options.zstd_dictionary_training_records_ > 0) {
+      zstd_dictionary_training_ =
+          riegeli::make_unique<ZstdDictionaryTraining>();
+      zstd_dictionary_training_->options = std::move(options);
+      zstd_dictionary_training_->chunk_writer = chunk_writer;
+      return;
+    }
+  } else {
+    // Chunks are compressed with a dictionary only if it is stored in the
+    // file.
+    options.zstd_dictionary_.reset();
+  }
+  StartImpl(chunk_writer, options, writing_from_beginning);
+}
+
+inline void RecordWriter::StartImpl(ChunkWriter* chunk_writer,
+                                    const Options& options,
+                                    bool writing_from_beginning) {
   if (options.parallelism_ == 0) {
     impl_ = riegeli::make_unique<SerialImpl>(chunk_writer, options);
   } else {
     impl_ = riegeli::make_unique<ParallelImpl>(chunk_writer, options);
   }
+  if (options.index_ && writing_from_beginning) impl_->EnableIndex();
   impl_->OpenChunk();
 }
 
+bool RecordWriter::WriteZstdDictionary(
+    ChunkWriter* chunk_writer, std::shared_ptr<const ZstdDictionary> dictionary,
+    Options* options) {
+  Chunk chunk;
+  internal::EncodeZstdDictionaryChunk(*dictionary, &chunk);
+  if (RIEGELI_UNLIKELY(!chunk_writer->WriteChunk(chunk))) {
+    RIEGELI_ASSERT(!chunk_writer->healthy());
+    return Fail(*chunk_writer);
+  }
+  options->compression_type_ = internal::CompressionType::kZstdWithDictionary;
+  options->zstd_dictionary_ = std::move(dictionary);
+  return true;
+}
+
+bool RecordWriter::AddZstdDictionarySample(Chain&& record) {
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  zstd_dictionary_training_->records.push_back(std::move(record));
+  if (zstd_dictionary_training_->records.size() >=
+      zstd_dictionary_training_->options.zstd_dictionary_training_records_) {
+    return FinishZstdDictionaryTraining();
+  }
+  return true;
+}
+
+bool RecordWriter::FinishZstdDictionaryTraining() {
+  const std::unique_ptr<ZstdDictionaryTraining> training =
+      std::move(zstd_dictionary_training_);
+  std::shared_ptr<const ZstdDictionary> dictionary;
+  if (!training->records.empty()) {
+    dictionary = ZstdDictionary::Train(
+        training->records, training->options.zstd_dictionary_max_size_);
+  }
+  if (dictionary != nullptr) {
+    if (RIEGELI_UNLIKELY(!WriteZstdDictionary(training->chunk_writer,
+                                              std::move(dictionary),
+                                              &training->options))) {
+      return false;
+    }
+  }
+  // Training happens only when writing from the beginning of the file.
+  StartImpl(training->chunk_writer, training->options, true);
+  for (Chain& record : training->records) {
+    if (RIEGELI_UNLIKELY(!WriteRecord(std::move(record)))) return false;
+  }
+  return true;
+}
+
 RecordWriter::RecordWriter(RecordWriter&& src) noexcept
     : Object(std::move(src)),
       desired_chunk_size_(riegeli::exchange(src.desired_chunk_size_, 0)),
       chunk_size_(riegeli::exchange(src.chunk_size_, 0)),
+      memory_budget_(riegeli::exchange(src.memory_budget_, nullptr)),
       owned_chunk_writer_(std::move(src.owned_chunk_writer_)),
-      impl_(std::move(src.impl_)) {}
+      impl_(std::move(src.impl_)),
+      zstd_dictionary_training_(std::move(src.zstd_dictionary_training_)) {}
 
 RecordWriter& RecordWriter::operator=(RecordWriter&& src) noexcept {
   Object::operator=(std::move(src));
   desired_chunk_size_ = riegeli::exchange(src.desired_chunk_size_, 0);
   chunk_size_ = riegeli::exchange(src.chunk_size_, 0);
+  memory_budget_ = riegeli::exchange(src.memory_budget_, nullptr);
   // impl_ must be assigned before owned_chunk_writer_ because background work
   // of impl_ may need owned_chunk_writer_.
   impl_ = std::move(src.impl_);
   owned_chunk_writer_ = std::move(src.owned_chunk_writer_);
+  zstd_dictionary_training_ = std::move(src.zstd_dictionary_training_);
   return *this;
 }
 
 RecordWriter::~RecordWriter() = default;
 
 void RecordWriter::Done() {
+  if (RIEGELI_LIKELY(healthy()) && zstd_dictionary_training_ != nullptr) {
+    FinishZstdDictionaryTraining();
+  }
+  zstd_dictionary_training_.reset();
   if (RIEGELI_LIKELY(healthy()) && chunk_size_ != 0) {
     if (RIEGELI_UNLIKELY(!impl_->CloseChunk())) Fail(*impl_);
   }
@@ -462,6 +806,7 @@ void RecordWriter::Done() {
   }
   desired_chunk_size_ = 0;
   chunk_size_ = 0;
+  memory_budget_ = nullptr;
 }
 
 bool RecordWriter::WriteRecord(const google::protobuf::MessageLite& record) {
@@ -475,55 +820,133 @@ bool RecordWriter::WriteRecord(const google::protobuf::MessageLite& record) {
   // when the stream itself reports failure, which should not happen because
   // ChunkEncoder writes to a Chain or string, hence we do not need to propagate
   // potential failures from AddRecord() here.
+  if (RIEGELI_UNLIKELY(zstd_dictionary_training_ != nullptr)) {
+    if (RIEGELI_UNLIKELY(!record.IsInitialized())) {
+      return Fail("Failed to serialize message of type " +
+                  record.GetTypeName() +
+                  " because it is missing required fields: " +
+                  record.InitializationErrorString());
+    }
+    return AddZstdDictionarySample(SerializePartialAsChain(record));
+  }
   if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(size))) return false;
   impl_->AddRecord(record);
   return true;
 }
 
 bool RecordWriter::WriteRecord(string_view record) {
+  if (RIEGELI_UNLIKELY(zstd_dictionary_training_ != nullptr)) {
+    return AddZstdDictionarySample(Chain(record));
+  }
   if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(record.size()))) return false;
   impl_->AddRecord(record);
   return true;
 }
 
 bool RecordWriter::WriteRecord(std::string&& record) {
+  if (RIEGELI_UNLIKELY(zstd_dictionary_training_ != nullptr)) {
+    return AddZstdDictionarySample(Chain(std::move(record)));
+  }
   if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(record.size()))) return false;
   impl_->AddRecord(std::move(record));
   return true;
 }
 
 bool RecordWriter::WriteRecord(const Chain& record) {
+  if (RIEGELI_UNLIKELY(zstd_dictionary_training_ != nullptr)) {
+    return AddZstdDictionarySample(Chain(record));
+  }
   if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(record.size()))) return false;
   impl_->AddRecord(record);
   return true;
 }
 
 bool RecordWriter::WriteRecord(Chain&& record) {
+  if (RIEGELI_UNLIKELY(zstd_dictionary_training_ != nullptr)) {
+    return AddZstdDictionarySample(std::move(record));
+  }
   if (RIEGELI_UNLIKELY(!EnsureRoomForRecord(record.size()))) return false;
   impl_->AddRecord(std::move(record));
   return true;
 }
 
+bool RecordWriter::WriteRecords(const string_view* records,
+                                size_t num_records) {
+  return WriteRecordsImpl(records, num_records);
+}
+
+bool RecordWriter::WriteRecords(const Chain* records, size_t num_records) {
+  return WriteRecordsImpl(records, num_records);
+}
+
+template <typename Record>
+inline bool RecordWriter::WriteRecordsImpl(const Record* records,
+                                           size_t num_records) {
+  // Records buffered for training a dictionary are written one by one, until
+  // the training finishes. With a memory budget, records are written one by
+  // one, so that memory is reserved for each record.
+  while (num_records > 0 && (zstd_dictionary_training_ != nullptr ||
+                             memory_budget_ != nullptr)) {
+    if (RIEGELI_UNLIKELY(!WriteRecord(*records))) return false;
+    ++records;
+    --num_records;
+  }
+  if (RIEGELI_UNLIKELY(!healthy())) return false;
+  while (num_records > 0) {
+    // Find how many records fit in the current chunk, like
+    // EnsureRoomForRecord() does for one record.
+    size_t num_fitting = 0;
+    while (num_fitting < num_records) {
+      const size_t record_size =
+          records[num_fitting].size() + kAssumedPointerSize;
+      if (chunk_size_ + record_size > desired_chunk_size_ &&
+          chunk_size_ != 0) {
+        break;
+      }
+      chunk_size_ += record_size;
+      ++num_fitting;
+    }
+    impl_->AddRecords(records, num_fitting);
+    records += num_fitting;
+    num_records -= num_fitting;
+    if (num_records > 0) {
+      if (RIEGELI_UNLIKELY(!impl_->CloseChunk())) return Fail(*impl_);
+      impl_->OpenChunk();
+      chunk_size_ = 0;
+    }
+  }
+  return true;
+}
+
 inline bool RecordWriter::EnsureRoomForRecord(size_t record_size) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
-  // Decoding a chunk allocates records in one array, and pointers to them in
-  // another array. We limit the size of both arrays (restricting only the first
-  // array might force accumulating an unbounded number of empty records).
-  // Since the decoder architecture is not known, and for deterministic output,
-  // the pointer size is conservatively assumed to be 8 bytes.
-  const size_t kAssumedPointerSize = 8;
   if (chunk_size_ + record_size + kAssumedPointerSize > desired_chunk_size_ &&
       chunk_size_ != 0) {
     if (RIEGELI_UNLIKELY(!impl_->CloseChunk())) return Fail(*impl_);
     impl_->OpenChunk();
     chunk_size_ = 0;
   }
+  if (RIEGELI_UNLIKELY(!impl_->TryReserveChunkMemory(
+          chunk_size_ + record_size + kAssumedPointerSize))) {
+    // The memory budget is exhausted. Close the chunk early, so that its memory
+    // is released when it is written, and reserve memory for the record in a
+    // new chunk.
+    if (chunk_size_ != 0) {
+      if (RIEGELI_UNLIKELY(!impl_->CloseChunk())) return Fail(*impl_);
+      impl_->OpenChunk();
+      chunk_size_ = 0;
+    }
+    impl_->ReserveChunkMemory(record_size + kAssumedPointerSize);
+  }
   chunk_size_ += record_size + kAssumedPointerSize;
   return true;
 }
 
 bool RecordWriter::Flush(FlushType flush_type) {
   if (RIEGELI_UNLIKELY(!healthy())) return false;
+  if (zstd_dictionary_training_ != nullptr) {
+    if (RIEGELI_UNLIKELY(!FinishZstdDictionaryTraining())) return false;
+  }
   if (chunk_size_ != 0) {
     if (RIEGELI_UNLIKELY(!impl_->CloseChunk())) return Fail(*impl_);
   }
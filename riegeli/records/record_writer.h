@@ -37,6 +37,10 @@ namespace riegeli {
 
 class ChunkEncoder;
 class ChunkWriter;
+class MemoryBudget;
+class PipelineStats;
+class ThreadPool;
+class ZstdDictionary;
 
 // RecordWriter writes records to a Riegeli/records file. A record is
 // conceptually a binary string; usually it is a serialized proto message.
@@ -60,7 +64,7 @@ class RecordWriter final : public Object {
    public:
     // Not defaulted because of a C++ defect:
     // https://stackoverflow.com/questions/17430377
-    constexpr Options() noexcept {}
+    Options() noexcept {}
 
     // If true, records should be serialized proto messages (but nothing will
     // break if they are not). A chunk of records will be processed in a way
@@ -121,6 +125,33 @@ class RecordWriter final : public Object {
       return std::move(EnableZstdCompression(level));
     }
 
+    // Changes compression algorithm to LZ4, which compresses less densely than
+    // Brotli or Zstd but decompresses much faster.
+    //
+    // Level must be between 0 and 12. Levels from 3 select LZ4-HC, which
+    // compresses more slowly but more densely, and decompresses as fast.
+    Options& EnableLz4Compression(int level = 0) & {
+      RIEGELI_ASSERT_GE(level, 0);
+      RIEGELI_ASSERT_LE(level, 12);
+      compression_type_ = internal::CompressionType::kLz4;
+      compression_level_ = level;
+      return *this;
+    }
+    Options&& EnableLz4Compression(int level = 0) && {
+      return std::move(EnableLz4Compression(level));
+    }
+
+    // Changes compression algorithm to Snappy, which compresses less densely
+    // than Brotli or Zstd but decompresses much faster.
+    Options& EnableSnappyCompression() & {
+      compression_type_ = internal::CompressionType::kSnappy;
+      compression_level_ = 0;
+      return *this;
+    }
+    Options&& EnableSnappyCompression() && {
+      return std::move(EnableSnappyCompression());
+    }
+
     // Sets the desired uncompressed size of a chunk which groups messages to be
     // transposed, compressed, and written together.
     //
@@ -176,7 +207,207 @@ class RecordWriter final : public Object {
       return std::move(set_parallelism(parallelism));
     }
 
+    // Sets the thread pool which encodes chunks in background if
+    // parallelism > 0, and compresses buckets if parallel_buckets is true. It
+    // must be kept alive until closing the RecordWriter.
+    //
+    // nullptr means a thread pool shared by default by all RecordWriters and
+    // RecordReaders in the process.
+    //
+    // Default: nullptr
+    Options& set_thread_pool(ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+
+    // If true, buckets of a transposed chunk are compressed concurrently on
+    // the thread pool, which reduces the latency of encoding a single chunk,
+    // e.g. in Flush() or if parallelism == 0. The output does not change.
+    //
+    // This is meaningful if transpose and compression are enabled and a chunk
+    // has several buckets, see set_desired_bucket_fraction().
+    //
+    // Default: false
+    Options& set_parallel_buckets(bool parallel_buckets) & {
+      parallel_buckets_ = parallel_buckets;
+      return *this;
+    }
+    Options&& set_parallel_buckets(bool parallel_buckets) && {
+      return std::move(set_parallel_buckets(parallel_buckets));
+    }
+
+    // If bytes_per_second > 0, the compression level is adapted per chunk: it
+    // is lowered when chunks are encoded more slowly than bytes_per_second of
+    // decoded data per encoding thread, and raised back when there is enough
+    // headroom. The level set by Enable*Compression() is the highest level
+    // used.
+    //
+    // This does not change the format: readers do not depend on the level.
+    //
+    // Default: 0 (no target)
+    Options& set_adaptive_compression_target(double bytes_per_second) & {
+      RIEGELI_ASSERT_GE(bytes_per_second, 0.0)
+          << "Failed precondition of "
+             "RecordWriter::Options::set_adaptive_compression_target(): "
+             "negative throughput";
+      adaptive_compression_target_ = bytes_per_second;
+      return *this;
+    }
+    Options&& set_adaptive_compression_target(double bytes_per_second) && {
+      return std::move(set_adaptive_compression_target(bytes_per_second));
+    }
+
+    // If fill < 1 and parallelism > 0, the compression level is adapted per
+    // chunk also to the queue of chunks being encoded: it is lowered when more
+    // than this fraction of set_parallelism() chunks are being encoded, and
+    // raised back when at most half of that are. This works together with
+    // set_adaptive_compression_target().
+    //
+    // Default: 1 (no limit)
+    Options& set_adaptive_compression_max_queue_fill(float fill) & {
+      RIEGELI_ASSERT_GE(fill, 0.0f)
+          << "Failed precondition of "
+             "RecordWriter::Options::"
+             "set_adaptive_compression_max_queue_fill(): "
+             "negative fill";
+      RIEGELI_ASSERT_LE(fill, 1.0f)
+          << "Failed precondition of "
+             "RecordWriter::Options::"
+             "set_adaptive_compression_max_queue_fill(): "
+             "fill greater than 1";
+      adaptive_compression_max_queue_fill_ = fill;
+      return *this;
+    }
+    Options&& set_adaptive_compression_max_queue_fill(float fill) && {
+      return std::move(set_adaptive_compression_max_queue_fill(fill));
+    }
+
+    // If true and the compression level is adapted, chunks are compressed with
+    // LZ4 when even the lowest level of the configured algorithm is too slow.
+    //
+    // Default: false
+    Options& set_adaptive_compression_fallback_to_lz4(bool fallback) & {
+      adaptive_compression_fallback_to_lz4_ = fallback;
+      return *this;
+    }
+    Options&& set_adaptive_compression_fallback_to_lz4(bool fallback) && {
+      return std::move(set_adaptive_compression_fallback_to_lz4(fallback));
+    }
+
+    // Sets the PipelineStats which collect time spent and amount of data
+    // processed in stages of serializing, encoding, and writing chunks. It must
+    // be kept alive until closing the RecordWriter, and may be read at any
+    // time.
+    //
+    // nullptr disables collecting statistics.
+    //
+    // Default: nullptr
+    Options& set_stats(PipelineStats* stats) & {
+      stats_ = stats;
+      return *this;
+    }
+    Options&& set_stats(PipelineStats* stats) && {
+      return std::move(set_stats(stats));
+    }
+
+    // Sets the MemoryBudget which memory of chunks being filled, encoded, and
+    // written is reserved from. It may be shared with other RecordWriters and
+    // RecordReaders, and must be kept alive until closing the RecordWriter.
+    //
+    // When the budget is exhausted, the open chunk is closed early, so that its
+    // memory is released sooner, and if parallelism > 0, writing the next
+    // record waits until chunks being encoded by this RecordWriter are
+    // written. Memory reserved by others is never waited for.
+    //
+    // nullptr means no limit.
+    //
+    // Default: nullptr
+    Options& set_memory_budget(MemoryBudget* memory_budget) & {
+      memory_budget_ = memory_budget;
+      return *this;
+    }
+    Options&& set_memory_budget(MemoryBudget* memory_budget) && {
+      return std::move(set_memory_budget(memory_budget));
+    }
+
+    // If true, Close() writes an index of chunks at the end of the file, which
+    // lets RecordReader::NumRecords(), SeekToRecord(), and Split() work
+    // without scanning the file. Readers which do not know about the index
+    // skip it as padding.
+    //
+    // The index is written only if the RecordWriter begins writing at the
+    // beginning of the file, because it must cover all chunks.
+    //
+    // Default: false
+    Options& set_index(bool index) & {
+      index_ = index;
+      return *this;
+    }
+    Options&& set_index(bool index) && { return std::move(set_index(index)); }
+
+    // Sets a Zstd dictionary which chunks are compressed with. A dictionary
+    // improves compression density of small chunks whose records share
+    // content. It is stored in the file once, after the file signature.
+    //
+    // This is used only with EnableZstdCompression(), and only if the
+    // RecordWriter begins writing at the beginning of the file, otherwise
+    // chunks are compressed without a dictionary.
+    //
+    // nullptr means no dictionary, unless set_zstd_dictionary_training() is
+    // used.
+    //
+    // Default: nullptr
+    Options& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) & {
+      zstd_dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(dictionary)));
+    }
+
+    // If num_records > 0 and set_zstd_dictionary() is not used, a Zstd
+    // dictionary is trained from the first num_records records, which are
+    // buffered until then, or until Flush() or Close(). If training fails, e.g.
+    // if there are too few records, chunks are compressed without a
+    // dictionary.
+    //
+    // The dictionary is trained on whole records, so it helps simple chunks
+    // more than transposed chunks, whose buckets hold individual fields.
+    //
+    // This is used under the same conditions as set_zstd_dictionary().
+    //
+    // Default: 0 (no training)
+    Options& set_zstd_dictionary_training(size_t num_records) & {
+      zstd_dictionary_training_records_ = num_records;
+      return *this;
+    }
+    Options&& set_zstd_dictionary_training(size_t num_records) && {
+      return std::move(set_zstd_dictionary_training(num_records));
+    }
+
+    // Sets the maximum size of a Zstd dictionary trained with
+    // set_zstd_dictionary_training().
+    //
+    // Default: 110 << 10
+    Options& set_zstd_dictionary_max_size(size_t max_size) & {
+      RIEGELI_ASSERT_GT(max_size, 0u)
+          << "Failed precondition of "
+             "RecordWriter::Options::set_zstd_dictionary_max_size(): "
+             "zero dictionary size";
+      zstd_dictionary_max_size_ = max_size;
+      return *this;
+    }
+    Options&& set_zstd_dictionary_max_size(size_t max_size) && {
+      return std::move(set_zstd_dictionary_max_size(max_size));
+    }
+
    private:
+    friend class ConcurrentRecordWriter;
     friend class RecordWriter;
 
     bool transpose_ = true;
@@ -186,6 +417,17 @@ class RecordWriter final : public Object {
     size_t desired_chunk_size_ = size_t{1} << 20;
     float desired_bucket_fraction_ = 1.0f;
     int parallelism_ = 0;
+    ThreadPool* thread_pool_ = nullptr;
+    bool parallel_buckets_ = false;
+    double adaptive_compression_target_ = 0.0;
+    float adaptive_compression_max_queue_fill_ = 1.0f;
+    bool adaptive_compression_fallback_to_lz4_ = false;
+    PipelineStats* stats_ = nullptr;
+    MemoryBudget* memory_budget_ = nullptr;
+    bool index_ = false;
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+    size_t zstd_dictionary_training_records_ = 0;
+    size_t zstd_dictionary_max_size_ = size_t{110} << 10;
   };
 
   // Creates a closed RecordWriter.
@@ -239,6 +481,16 @@ class RecordWriter final : public Object {
   bool WriteRecord(const Chain& record);
   bool WriteRecord(Chain&& record);
 
+  // Writes num_records records, like WriteRecord() called for each of them,
+  // with less overhead per record: the batch is split at chunk boundaries in
+  // one pass, and each part is passed to the chunk encoder at once.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool WriteRecords(const string_view* records, size_t num_records);
+  bool WriteRecords(const Chain* records, size_t num_records);
+
   // Finalizes any open chunk and pushes buffered data to the Writer.
   // If Options::set_parallelism() was used, waits for any background writing to
   // complete.
@@ -260,24 +512,52 @@ class RecordWriter final : public Object {
   void Done() override;
 
  private:
+  friend class ConcurrentRecordWriter;
+
   class Impl;
   class SerialImpl;
   class ParallelImpl;
   class DummyImpl;
+  struct ZstdDictionaryTraining;
 
   static std::unique_ptr<ChunkEncoder> MakeChunkEncoder(const Options& options);
 
+  // Creates impl_ and opens the first chunk.
+  void StartImpl(ChunkWriter* chunk_writer, const Options& options,
+                 bool writing_from_beginning);
+
+  // Writes the dictionary chunk and changes *options to compress with the
+  // dictionary.
+  bool WriteZstdDictionary(ChunkWriter* chunk_writer,
+                           std::shared_ptr<const ZstdDictionary> dictionary,
+                           Options* options);
+
+  // Buffers a record to train a Zstd dictionary from, and finishes training
+  // when enough records are buffered.
+  bool AddZstdDictionarySample(Chain&& record);
+
+  // Trains the Zstd dictionary, starts impl_, and writes buffered records.
+  bool FinishZstdDictionaryTraining();
+
   bool EnsureRoomForRecord(size_t record_size);
 
+  template <typename Record>
+  bool WriteRecordsImpl(const Record* records, size_t num_records);
+
   size_t desired_chunk_size_ = 0;
   size_t chunk_size_ = 0;
+  MemoryBudget* memory_budget_ = nullptr;
   std::unique_ptr<ChunkWriter> owned_chunk_writer_;
   // impl_ must be defined after owned_chunk_writer_ so that it is destroyed
   // before owned_chunk_writer_, because background work of impl_ may need
   // owned_chunk_writer_
   //
-  // Invariant: if healthy() them impl_ != nullptr
+  // Invariant: if healthy() then impl_ != nullptr, unless
+  //            zstd_dictionary_training_ != nullptr
   std::unique_ptr<Impl> impl_;
+  // Records buffered until a Zstd dictionary is trained from them, or nullptr
+  // if training is not pending.
+  std::unique_ptr<ZstdDictionaryTraining> zstd_dictionary_training_;
 };
 
 // Implementation details follow.
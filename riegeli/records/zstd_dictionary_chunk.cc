@@ -0,0 +1,95 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/zstd_dictionary_chunk.h"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/writer_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/internal_types.h"
+#include "riegeli/records/chunk_reader.h"
+
+namespace riegeli {
+namespace internal {
+
+void EncodeZstdDictionaryChunk(const ZstdDictionary& dictionary, Chunk* chunk) {
+  chunk->data.Clear();
+  ChainWriter data_writer(&chunk->data,
+                          ChainWriter::Options().set_size_hint(
+                              1 + dictionary.data().size()));
+  WriteByte(&data_writer, static_cast<uint8_t>(ChunkType::kZstdDictionary));
+  data_writer.Write(dictionary.data());
+  if (!data_writer.Close()) RIEGELI_ASSERT_UNREACHABLE();
+  chunk->header = ChunkHeader(chunk->data, 0, 0);
+}
+
+bool DecodeZstdDictionaryChunk(
+    const Chunk& chunk, std::shared_ptr<const ZstdDictionary>* dictionary) {
+  if (chunk.header.num_records() != 0) return false;
+  ChainReader data_reader(&chunk.data);
+  uint8_t chunk_type;
+  if (!ReadByte(&data_reader, &chunk_type) ||
+      chunk_type != static_cast<uint8_t>(ChunkType::kZstdDictionary)) {
+    return false;
+  }
+  std::string data;
+  if (!data_reader.Read(&data, chunk.data.size() - 1)) {
+    RIEGELI_ASSERT_UNREACHABLE();
+  }
+  *dictionary = std::make_shared<const ZstdDictionary>(std::move(data));
+  return true;
+}
+
+bool UsesZstdDictionary(const Chunk& chunk) {
+  if (chunk.data.size() < 2) return false;
+  ChainReader data_reader(&chunk.data);
+  uint8_t chunk_type, compression_type;
+  if (!ReadByte(&data_reader, &chunk_type) ||
+      !ReadByte(&data_reader, &compression_type)) {
+    RIEGELI_ASSERT_UNREACHABLE();
+  }
+  return (chunk_type == static_cast<uint8_t>(ChunkType::kSimple) ||
+          chunk_type == static_cast<uint8_t>(ChunkType::kTransposed)) &&
+         compression_type ==
+             static_cast<uint8_t>(CompressionType::kZstdWithDictionary);
+}
+
+bool ReadZstdDictionary(ChunkReader* chunk_reader,
+                        std::shared_ptr<const ZstdDictionary>* dictionary) {
+  const Position pos_before = chunk_reader->pos();
+  if (RIEGELI_UNLIKELY(!chunk_reader->Seek(0))) return false;
+  bool found = false;
+  Chunk chunk;
+  Position chunk_begin;
+  // Skip the file signature.
+  if (chunk_reader->ReadChunk(&chunk, &chunk_begin) && chunk_begin == 0 &&
+      chunk_reader->ReadChunk(&chunk, &chunk_begin)) {
+    found = DecodeZstdDictionaryChunk(chunk, dictionary);
+  }
+  if (RIEGELI_UNLIKELY(!chunk_reader->healthy())) return false;
+  if (RIEGELI_UNLIKELY(!chunk_reader->Seek(pos_before))) return false;
+  return found;
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,58 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_ZSTD_DICTIONARY_CHUNK_H_
+#define RIEGELI_RECORDS_ZSTD_DICTIONARY_CHUNK_H_
+
+#include <memory>
+
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/chunk_reader.h"
+
+namespace riegeli {
+namespace internal {
+
+// A Riegeli/records file whose chunks are compressed with a Zstd dictionary
+// stores the dictionary once, in a ChunkType::kZstdDictionary chunk right
+// after the file signature. Chunks using it have
+// CompressionType::kZstdWithDictionary. See "Zstd dictionary chunk" in
+// doc/riegeli_records_file_format.md.
+
+// Encodes dictionary as a ChunkType::kZstdDictionary chunk.
+void EncodeZstdDictionaryChunk(const ZstdDictionary& dictionary, Chunk* chunk);
+
+// Returns true if chunk is a ChunkType::kZstdDictionary chunk, setting
+// *dictionary to its contents.
+bool DecodeZstdDictionaryChunk(
+    const Chunk& chunk, std::shared_ptr<const ZstdDictionary>* dictionary);
+
+// Returns true if chunk is compressed with the dictionary of the file.
+bool UsesZstdDictionary(const Chunk& chunk);
+
+// Reads the dictionary of the file, for reading a chunk compressed with it when
+// the ChunkType::kZstdDictionary chunk has been skipped, e.g. by seeking.
+// chunk_reader is moved to the beginning of the file and back.
+//
+// Return values:
+//  * true                                  - success (*dictionary is set)
+//  * false (when chunk_reader->healthy())  - the file has no dictionary
+//  * false (when !chunk_reader->healthy()) - failure
+bool ReadZstdDictionary(ChunkReader* chunk_reader,
+                        std::shared_ptr<const ZstdDictionary>* dictionary);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_ZSTD_DICTIONARY_CHUNK_H_